@@ -0,0 +1,283 @@
+#include "DistanceVolume.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+using namespace TKA::REGISTRATION;
+
+namespace
+{
+    const int BRICK_SAMPLES = DistanceVolume::BRICK_SIZE * DistanceVolume::BRICK_SIZE * DistanceVolume::BRICK_SIZE;
+    const double SQRT3 = 1.7320508075688772;
+}
+
+DistanceVolume::DistanceVolume()
+{
+    origin = Eigen::Vector3d::Zero();
+    spacing = 0;
+    bandWidth = 0;
+    maxSpread = 0;
+
+    for (int i = 0; i < 3; i++)
+    {
+        size[i] = 0;
+        bricks[i] = 0;
+    }
+}
+
+void DistanceVolume::Build(const SurfaceBVH& bvh, double pSpacing, double pBandWidth)
+{
+    spacing = pSpacing;
+    bandWidth = std::max(0.0, pBandWidth);
+    brickIndex = SharedArray<int>();
+    samples = SharedArray<Sample>();
+
+    for (int i = 0; i < 3; i++)
+    {
+        size[i] = 0;
+        bricks[i] = 0;
+    }
+
+    if (bvh.Empty() == true || spacing <= 0)
+    {
+        return;
+    }
+
+    Eigen::Vector3d lower, upper;
+    bvh.GetBounds(lower, upper);
+
+    // One more cell on every side, so points at the edge of the band still have their eight samples.
+    double margin = bandWidth + spacing;
+    origin = lower - Eigen::Vector3d::Constant(margin);
+
+    for (int i = 0; i < 3; i++)
+    {
+        size[i] = int(std::ceil((upper(i) - lower(i) + 2.0 * margin) / spacing)) + 1;
+        bricks[i] = (size[i] + BRICK_SIZE - 1) / BRICK_SIZE;
+    }
+
+    // On a plane the closest points of the corners of a cell are at most a cell diagonal apart. Twice that
+    // still accepts curved surfaces and rejects cells whose corners project on different sides of a thin part.
+    maxSpread = 2.0 * SQRT3 * spacing;
+
+    int brickCount = bricks[0] * bricks[1] * bricks[2];
+    std::vector<int> buildIndex(brickCount, -1);
+
+    // A sample is needed when it is a corner of a cell holding a point of the band, so it is at most one cell
+    // diagonal further than the band. A brick is kept when its center is close enough for any of its samples.
+    double brickRadius = 0.5 * (BRICK_SIZE - 1) * SQRT3 * spacing;
+    double reach = bandWidth + SQRT3 * spacing + brickRadius;
+    // Distance from the center of every kept brick to the surface, negative for the other bricks.
+    std::vector<double> centerDistance(brickCount, -1.0);
+
+    cv::parallel_for_(cv::Range(0, brickCount), [&](const cv::Range& range)
+    {
+        for (int b = range.start; b < range.end; b++)
+        {
+            int bx = b % bricks[0];
+            int by = (b / bricks[0]) % bricks[1];
+            int bz = b / (bricks[0] * bricks[1]);
+
+            Eigen::Vector3d center = origin + spacing * (Eigen::Vector3d(bx, by, bz) * BRICK_SIZE + Eigen::Vector3d::Constant(0.5 * (BRICK_SIZE - 1)));
+            SurfaceHit hit = bvh.ClosestPoint(cv::Point3d(center(0), center(1), center(2)), reach * reach);
+
+            if (hit.triangle >= 0)
+            {
+                centerDistance[b] = std::sqrt(hit.squaredDistance);
+            }
+        }
+    });
+
+    // Numbered in brick order so the layout does not depend on the threads.
+    std::vector<int> kept;
+
+    for (int b = 0; b < brickCount; b++)
+    {
+        if (centerDistance[b] >= 0)
+        {
+            buildIndex[b] = int(kept.size()) * BRICK_SAMPLES;
+            kept.push_back(b);
+        }
+    }
+
+    std::vector<Sample> buildSamples(kept.size() * BRICK_SAMPLES);
+
+    cv::parallel_for_(cv::Range(0, int(kept.size())), [&](const cv::Range& range)
+    {
+        for (int k = range.start; k < range.end; k++)
+        {
+            int b = kept[k];
+            int bx = b % bricks[0];
+            int by = (b / bricks[0]) % bricks[1];
+            int bz = b / (bricks[0] * bricks[1]);
+            Sample* brick = &buildSamples[buildIndex[b]];
+
+            // No sample of the brick is further from the surface than its center plus the brick radius, so the
+            // traversal can skip the nodes beyond that.
+            double bound = centerDistance[b] + brickRadius + spacing;
+
+            for (int z = 0; z < BRICK_SIZE; z++)
+            {
+                for (int y = 0; y < BRICK_SIZE; y++)
+                {
+                    for (int x = 0; x < BRICK_SIZE; x++)
+                    {
+                        Eigen::Vector3d position = origin + spacing * Eigen::Vector3d(bx * BRICK_SIZE + x, by * BRICK_SIZE + y, bz * BRICK_SIZE + z);
+                        SurfaceHit hit = bvh.ClosestPoint(cv::Point3d(position(0), position(1), position(2)), bound * bound);
+
+                        Sample& sample = brick[x + BRICK_SIZE * (y + BRICK_SIZE * z)];
+                        sample.offset[0] = float(hit.point.x - position(0));
+                        sample.offset[1] = float(hit.point.y - position(1));
+                        sample.offset[2] = float(hit.point.z - position(2));
+                        sample.distance = float(std::sqrt(hit.squaredDistance));
+                    }
+                }
+            }
+        }
+    });
+
+    brickIndex = SharedArray<int>(std::move(buildIndex));
+    samples = SharedArray<Sample>(std::move(buildSamples));
+}
+
+const DistanceVolume::Sample* DistanceVolume::GetSample(int x, int y, int z) const
+{
+    int brick = brickIndex[(x / BRICK_SIZE) + bricks[0] * ((y / BRICK_SIZE) + bricks[1] * (z / BRICK_SIZE))];
+
+    if (brick < 0)
+    {
+        return NULL;
+    }
+
+    return &samples[brick + (x % BRICK_SIZE) + BRICK_SIZE * ((y % BRICK_SIZE) + BRICK_SIZE * (z % BRICK_SIZE))];
+}
+
+bool DistanceVolume::ClosestPoint(const cv::Point3d& point, cv::Point3d& closest) const
+{
+    if (samples.empty() == true)
+    {
+        return false;
+    }
+
+    Eigen::Vector3d position = (Eigen::Vector3d(point.x, point.y, point.z) - origin) / spacing;
+    int cell[3];
+    double t[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        // Written so that NaN coordinates are rejected too.
+        if ((position(i) >= 0) == false)
+        {
+            return false;
+        }
+
+        cell[i] = int(position(i));
+
+        if (cell[i] >= size[i] - 1)
+        {
+            return false;
+        }
+
+        t[i] = position(i) - cell[i];
+    }
+
+    Eigen::Vector3d result = Eigen::Vector3d::Zero();
+    Eigen::Vector3d lower = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+    Eigen::Vector3d upper = -lower;
+    double distance = 0;
+
+    for (int k = 0; k < 8; k++)
+    {
+        int dx = k & 1;
+        int dy = (k >> 1) & 1;
+        int dz = k >> 2;
+
+        const Sample* sample = GetSample(cell[0] + dx, cell[1] + dy, cell[2] + dz);
+
+        if (sample == NULL)
+        {
+            return false;
+        }
+
+        double weight = (dx ? t[0] : 1.0 - t[0]) * (dy ? t[1] : 1.0 - t[1]) * (dz ? t[2] : 1.0 - t[2]);
+        Eigen::Vector3d corner = origin + spacing * Eigen::Vector3d(cell[0] + dx, cell[1] + dy, cell[2] + dz);
+        Eigen::Vector3d cornerClosest = corner + Eigen::Vector3d(sample->offset[0], sample->offset[1], sample->offset[2]);
+
+        lower = lower.cwiseMin(cornerClosest);
+        upper = upper.cwiseMax(cornerClosest);
+        result += weight * cornerClosest;
+        distance += weight * sample->distance;
+    }
+
+    if (distance > bandWidth || (upper - lower).norm() > maxSpread)
+    {
+        return false;
+    }
+
+    closest = cv::Point3d(result(0), result(1), result(2));
+    return true;
+}
+
+bool DistanceVolume::Empty() const
+{
+    return samples.empty();
+}
+
+double DistanceVolume::GetSpacing() const
+{
+    return spacing;
+}
+
+double DistanceVolume::GetBandWidth() const
+{
+    return bandWidth;
+}
+
+int DistanceVolume::GetNumberOfBricks() const
+{
+    return int(samples.size() / BRICK_SAMPLES);
+}
+
+size_t DistanceVolume::GetMemorySize() const
+{
+    return samples.size() * sizeof(Sample) + brickIndex.size() * sizeof(int);
+}
+
+bool DistanceVolume::IsConsistent() const
+{
+    int64_t brickCount = 1;
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (size[i] < 0 || bricks[i] < 0 || int64_t(bricks[i]) * BRICK_SIZE < size[i])
+        {
+            return false;
+        }
+
+        brickCount *= bricks[i];
+    }
+
+    if (uint64_t(brickCount) != brickIndex.size())
+    {
+        return false;
+    }
+
+    // Written so that a NaN spacing is rejected too.
+    if (samples.empty() == false && (spacing > 0) == false)
+    {
+        return false;
+    }
+
+    for (size_t b = 0; b < brickIndex.size(); b++)
+    {
+        int brick = brickIndex[b];
+
+        if (brick != -1 && (brick < 0 || samples.size() < size_t(BRICK_SAMPLES) || size_t(brick) > samples.size() - BRICK_SAMPLES))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
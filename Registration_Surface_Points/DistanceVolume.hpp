@@ -0,0 +1,78 @@
+#ifndef REGISTRATION_DISTANCE_VOLUME_H
+#define REGISTRATION_DISTANCE_VOLUME_H
+
+#include <opencv2/core.hpp>
+#include <Eigen/Dense>
+#include <vector>
+#include "SurfaceBVH.hpp"
+
+namespace TKA
+{
+	namespace REGISTRATION
+	{
+		class SurfaceIndex;
+
+		/*
+		* Closest surface points sampled on a regular grid around a surface, so a correspondence is a trilinear
+		* lookup instead of a tree traversal. Only a narrow band of the grid is stored: the grid is cut in bricks
+		* of 8x8x8 samples and a brick is kept when it can hold a sample closer than the band to the surface.
+		* Every sample keeps the offset to its closest point and the distance to it in single precision.
+		*/
+		class DistanceVolume
+		{
+		public:
+			static const int BRICK_SIZE = 8;
+
+			struct Sample
+			{
+				float offset[3];
+				float distance;
+			};
+
+			DistanceVolume();
+
+			// spacing is the distance between samples and bandWidth the largest distance to the surface that is
+			// answered by the volume, both in surface units. Nothing is built for an empty tree or a spacing <= 0.
+			void Build(const SurfaceBVH& bvh, double spacing, double bandWidth);
+
+			// Closest surface point interpolated from the eight samples around point. False when point is
+			// outside the band, or when the closest points of the samples are too far apart to be interpolated
+			// (close to the medial axis of the surface); the caller then falls back to an exact query.
+			bool ClosestPoint(const cv::Point3d& point, cv::Point3d& closest) const;
+
+			bool Empty() const;
+
+			double GetSpacing() const;
+
+			double GetBandWidth() const;
+
+			int GetNumberOfBricks() const;
+
+			// Bytes held by the samples and the brick table.
+			size_t GetMemorySize() const;
+
+		private:
+			// Saved and loaded by SurfaceIndex.
+			friend class SurfaceIndex;
+
+			Eigen::Vector3d origin;
+			double spacing;
+			double bandWidth;
+			// Largest distance between the closest points of two samples of a cell that is still interpolated.
+			double maxSpread;
+			// Samples per axis and bricks per axis.
+			int size[3];
+			int bricks[3];
+			// Position of every brick in samples (BRICK_SIZE^3 samples each), -1 for bricks out of the band.
+			SharedArray<int> brickIndex;
+			SharedArray<Sample> samples;
+
+			const Sample* GetSample(int x, int y, int z) const;
+
+			// Whether the brick table matches the grid and points inside the samples, see SurfaceBVH::IsConsistent.
+			bool IsConsistent() const;
+		};
+	}
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include "LeastSquaresICP.hpp"
+#include "TransformKernel.hpp"
 #include <Eigen/Dense>
+#include <opencv2/core/eigen.hpp>
 #include <vtkActor.h>
 #include <vtkProperty.h>
 #include <vtkRenderWindow.h>
@@ -11,9 +13,23 @@
 #include <vtkPolyDataMapper.h>
 #include <algorithm>
 #include <random>
+#include <stdexcept>
+#include <string>
 
 using namespace TKA::REGISTRATION;
 
+// Smaller point sets are not worth waking up the thread pool for.
+static const int MIN_POINTS_PER_STRIPE = 64;
+
+// A default or loaded-but-empty index has no tree to search.
+static void CheckIndex(const SurfaceIndex& index, const char* method)
+{
+    if (index.Empty() == true)
+    {
+        throw std::runtime_error(std::string("LeastSquaresICP::") + method + ": the surface index is empty");
+    }
+}
+
 vtkSmartPointer<vtkPolyData> CreateSphereTest(const cv::Point3d& pPoint)
 {
     double pnt[3];
@@ -165,29 +181,26 @@ void showProcess(vtkSmartPointer<vtkPolyData> poly, const std::vector<cv::Point3
 
 LeastSquaresICP::LeastSquaresICP(const std::vector<PointTypeITK>& sourcePoints)
 {
-    aveSource = cv::Point3d(0, 0, 0);
+    std::vector<cv::Point3d> points;
     for (int i = 0; i < sourcePoints.size(); i++)
     {
-        source.push_back(cv::Point3d(sourcePoints[i][0], sourcePoints[i][1], sourcePoints[i][2]));
-        aveSource = aveSource + source[i];
+        points.push_back(cv::Point3d(sourcePoints[i][0], sourcePoints[i][1], sourcePoints[i][2]));
     }
 
-    if (source.size() > 0)
-    {
-        aveSource = aveSource / double(source.size());
+    Initialize(points, std::vector<cv::Point3d>());
+}
 
-        for (int i = 0; i < source.size(); i++)
-        {
-            cv::Point3d temp = source[i] - aveSource;
-            centerSource.push_back(temp);
-        }
-    }
+LeastSquaresICP::LeastSquaresICP(const std::vector<cv::Point3d>& sourcePoints)
+{
+    Initialize(sourcePoints, std::vector<cv::Point3d>());
+}
 
-    chi2 = 0.75;
-    maxError = 0.3;
+LeastSquaresICP::LeastSquaresICP(const std::vector<cv::Point3d>& sourcePoints, const std::vector<cv::Point3d>& pSourceNormals)
+{
+    Initialize(sourcePoints, pSourceNormals);
 }
 
-LeastSquaresICP::LeastSquaresICP(const std::vector<cv::Point3d>& sourcePoints)
+void LeastSquaresICP::Initialize(const std::vector<cv::Point3d>& sourcePoints, const std::vector<cv::Point3d>& pSourceNormals)
 {
     aveSource = cv::Point3d(0, 0, 0);
     for (int i = 0; i < sourcePoints.size(); i++)
@@ -207,8 +220,21 @@ LeastSquaresICP::LeastSquaresICP(const std::vector<cv::Point3d>& sourcePoints)
         }
     }
 
+    // Normals that do not match the points are ignored.
+    if (pSourceNormals.size() == source.size())
+    {
+        sourceNormals = pSourceNormals;
+        centerSourceNormals = pSourceNormals;
+    }
+
     chi2 = 0.75;
     maxError = 0.3;
+    search = SEARCH_BVH;
+    residual = RESIDUAL_POINT_TO_POINT;
+    solver = SOLVER_LEVENBERG_MARQUARDT;
+    parallel = true;
+    coarseLevel = false;
+    converged = false;
 }
 
 void LeastSquaresICP::setChi2(double pChi2)
@@ -231,16 +257,78 @@ double LeastSquaresICP::getMaxError() const
     return maxError;
 }
 
+void LeastSquaresICP::setCorrespondenceSearch(CorrespondenceSearch pSearch)
+{
+    search = pSearch;
+}
+
+CorrespondenceSearch LeastSquaresICP::getCorrespondenceSearch() const
+{
+    return search;
+}
+
+void LeastSquaresICP::setResidualMode(ResidualMode pResidual)
+{
+    residual = pResidual;
+}
+
+ResidualMode LeastSquaresICP::getResidualMode() const
+{
+    return residual;
+}
+
+void LeastSquaresICP::setSolver(ICPSolver pSolver)
+{
+    solver = pSolver;
+}
+
+ICPSolver LeastSquaresICP::getSolver() const
+{
+    return solver;
+}
+
+void LeastSquaresICP::setParallel(bool pParallel)
+{
+    parallel = pParallel;
+}
+
+bool LeastSquaresICP::getParallel() const
+{
+    return parallel;
+}
+
 void LeastSquaresICP::shuffleSource()
 {
     auto rng = std::default_random_engine{};
     std::shuffle(source.begin(), source.end(), rng);
+
+    // An engine in the same state gives the same permutation, which keeps the normals with their points.
+    if (sourceNormals.empty() == false)
+    {
+        auto normalRng = std::default_random_engine{};
+        std::shuffle(sourceNormals.begin(), sourceNormals.end(), normalRng);
+    }
 }
 
 void LeastSquaresICP::shuffleCenterSource()
 {
     auto rng = std::default_random_engine{};
     std::shuffle(centerSource.begin(), centerSource.end(), rng);
+
+    if (centerSourceNormals.empty() == false)
+    {
+        auto normalRng = std::default_random_engine{};
+        std::shuffle(centerSourceNormals.begin(), centerSourceNormals.end(), normalRng);
+    }
+}
+
+void LeastSquaresICP::shuffleCache(CorrespondenceCache& cache)
+{
+    auto positionRng = std::default_random_engine{};
+    std::shuffle(cache.position.begin(), cache.position.end(), positionRng);
+
+    auto triangleRng = std::default_random_engine{};
+    std::shuffle(cache.triangle.begin(), cache.triangle.end(), triangleRng);
 }
 
 cv::Mat LeastSquaresICP::Rx(double angle)
@@ -297,60 +385,6 @@ cv::Mat LeastSquaresICP::Rz(double angle)
     return matrix;
 }
 
-cv::Mat LeastSquaresICP::DRx(double angle)
-{
-    cv::Mat matrix = cv::Mat::zeros(3, 3, CV_64F);
-
-    matrix.at<double>(0, 0) = 0;
-    matrix.at<double>(0, 1) = 0;
-    matrix.at<double>(0, 2) = 0;
-
-    matrix.at<double>(1, 0) = 0;
-    matrix.at<double>(1, 1) = -sin(angle);
-    matrix.at<double>(1, 2) = -cos(angle);
-
-    matrix.at<double>(2, 0) = 0;
-    matrix.at<double>(2, 1) = cos(angle);
-    matrix.at<double>(2, 2) = -sin(angle);
-    return matrix;
-}
-
-cv::Mat LeastSquaresICP::DRy(double angle)
-{
-    cv::Mat matrix = cv::Mat::zeros(3, 3, CV_64F);
-
-    matrix.at<double>(0, 0) = -sin(angle);
-    matrix.at<double>(0, 1) = 0;
-    matrix.at<double>(0, 2) = cos(angle);
-
-    matrix.at<double>(1, 0) = 0;
-    matrix.at<double>(1, 1) = 0;
-    matrix.at<double>(1, 2) = 0;
-
-    matrix.at<double>(2, 0) = -cos(angle);
-    matrix.at<double>(2, 1) = 0;
-    matrix.at<double>(2, 2) = -sin(angle);
-    return matrix;
-}
-
-cv::Mat LeastSquaresICP::DRz(double angle)
-{
-    cv::Mat matrix = cv::Mat::zeros(3, 3, CV_64F);
-
-    matrix.at<double>(0, 0) = -sin(angle);
-    matrix.at<double>(0, 1) = -cos(angle);
-    matrix.at<double>(0, 2) = 0;
-
-    matrix.at<double>(1, 0) = cos(angle);
-    matrix.at<double>(1, 1) = -sin(angle);
-    matrix.at<double>(1, 2) = 0;
-
-    matrix.at<double>(2, 0) = 0;
-    matrix.at<double>(2, 1) = 0;
-    matrix.at<double>(2, 2) = 0;
-    return matrix;
-}
-
 cv::Mat LeastSquaresICP::CreatePoint(double x, double y, double z)
 {
     cv::Mat trans(3, 1, CV_64F);
@@ -369,105 +403,9 @@ cv::Mat LeastSquaresICP::CreatePoint(cv::Point3d Point)
     return trans;
 }
 
-cv::Mat LeastSquaresICP::DF_Rx(double angleX, double angleY, double angleZ, const cv::Mat& Point)
-{
-    cv::Mat result = (DRx(angleX) * Ry(angleY) * Rz(angleZ)) * Point;
-    return result;
-}
-
-cv::Mat LeastSquaresICP::DF_Ry(double angleX, double angleY, double angleZ, const cv::Mat& Point)
-{
-    cv::Mat result = (Rx(angleX) * DRy(angleY) * Rz(angleZ)) * Point;
-    return result;
-}
-
-cv::Mat LeastSquaresICP::DF_Rz(double angleX, double angleY, double angleZ, const cv::Mat& Point)
-{
-    cv::Mat result = (Rx(angleX) * Ry(angleY) * DRz(angleZ)) * Point;
-    return result;
-}
-
-cv::Mat LeastSquaresICP::Jacobian(const cv::Mat& data, const cv::Mat& Point)
-{
-    double angleX = data.at<double>(3, 0);
-    double angleY = data.at<double>(4, 0);
-    double angleZ = data.at<double>(5, 0);
-
-    cv::Mat H1, H2, J;
-    cv::Mat translation = cv::Mat::eye(3, 3, CV_64F);
-    cv::Mat alphaX = DF_Rx(angleX, angleY, angleZ, Point);
-    cv::Mat alphaY = DF_Ry(angleX, angleY, angleZ, Point);
-    cv::Mat alphaZ = DF_Rz(angleX, angleY, angleZ, Point);
-
-    cv::hconcat(translation, alphaX, H1);
-    cv::hconcat(H1, alphaY, H2);
-    cv::hconcat(H2, alphaZ, J);
-
-    return J;
-}
-
-cv::Mat LeastSquaresICP::JacobianScale(const cv::Mat& data, const cv::Mat& Point)
-{
-    double angleX = data.at<double>(3, 0);
-    double angleY = data.at<double>(4, 0);
-    double angleZ = data.at<double>(5, 0);
-
-    double scale = data.at<double>(6, 0);
-
-    cv::Mat H1, H2, J;
-    cv::Mat translationDf = (cv::Mat::eye(3, 3, CV_64F));
-
-    cv::Mat alphaX = scale * DF_Rx(angleX, angleY, angleZ, Point);
-    cv::Mat alphaY = scale * DF_Ry(angleX, angleY, angleZ, Point);
-    cv::Mat alphaZ = scale * DF_Rz(angleX, angleY, angleZ, Point);
-
-    cv::hconcat(translationDf, alphaX, H1);
-    cv::hconcat(H1, alphaY, H2);
-    cv::hconcat(H2, alphaZ, J);
-
-    return J;
-}
-
-cv::Mat LeastSquaresICP::SquareError(const cv::Mat& data, const cv::Mat& source, const cv::Mat& target)
-{
-    cv::Mat translation(3, 1, CV_64F);
-    translation.at<double>(0, 0) = data.at<double>(0, 0);
-    translation.at<double>(1, 0) = data.at<double>(1, 0);
-    translation.at<double>(2, 0) = data.at<double>(2, 0);
-
-    cv::Mat result = (Rx(data.at<double>(3, 0)) * Ry(data.at<double>(4, 0)) * Rz(data.at<double>(5, 0))) * source + translation;
-    cv::Mat error = result - target;
-    return error;
-}
-
-cv::Mat LeastSquaresICP::SquareErrorScale(const cv::Mat& data, const cv::Mat& source, const cv::Mat& target)
-{
-    cv::Mat translation(3, 1, CV_64F);
-
-    translation.at<double>(0, 0) = data.at<double>(0, 0);
-    translation.at<double>(1, 0) = data.at<double>(1, 0);
-    translation.at<double>(2, 0) = data.at<double>(2, 0);
-
-    double scale = data.at<double>(6, 0);
-
-    cv::Mat rotation = Rx(data.at<double>(3, 0)) * Ry(data.at<double>(4, 0)) * Rz(data.at<double>(5, 0));
-
-    cv::Mat result = scale * (rotation * source) + translation;
-    cv::Mat error = result - target;
-    return error;
-}
-
 void LeastSquaresICP::GetScale(const std::vector<cv::Point3d>& target, cv::Mat& data)
 {
-    cv::Mat rotation;
-    rotation = Rx(data.at<double>(3, 0)) * Ry(data.at<double>(4, 0)) * Rz(data.at<double>(5, 0));
-
-    cv::Mat translation(3, 1, CV_64F);
-    translation.at<double>(0, 0) = data.at<double>(0, 0);
-    translation.at<double>(1, 0) = data.at<double>(1, 0);
-    translation.at<double>(2, 0) = data.at<double>(2, 0);
-
-    double scale = data.at<double>(6, 0);
+    TransformKernel kernel(data, true);
 
     int tSize = centerSource.size();
 
@@ -476,43 +414,50 @@ void LeastSquaresICP::GetScale(const std::vector<cv::Point3d>& target, cv::Mat&
 
     for (int i = 0; i < tSize; i++)
     {
-        cv::Mat movePointRotation = scale * (rotation * CreatePoint(centerSource[i]));
-        cv::Mat movePointTarget = translation - CreatePoint(target[i]);
+        Eigen::Vector3d movePointRotation = kernel.Scale() * (kernel.Rotation() * TransformKernel::ToEigen(centerSource[i]));
+        Eigen::Vector3d movePointTarget = kernel.Translation() - TransformKernel::ToEigen(target[i]);
+
+        add1 = add1 + movePointRotation.dot(movePointTarget);
+        add2 = add2 + movePointTarget.dot(movePointTarget);
+    }
+
+    data.at<double>(6, 0) = kernel.Scale() * (-(add2 / add1));
+}
 
-        cv::Mat varA = movePointRotation.t() * movePointTarget;
-        cv::Mat varB = movePointTarget.t() * movePointTarget;
+LeastSquaresICP::GaussNewton LeastSquaresICP::GetSystem(const TransformKernel::Matrix66& A, const TransformKernel::Vector6& B, double chi, double localError, double lambda)
+{
+    // Summing lambda * diag(J^T J) per point is the same as damping the diagonal of the sum once.
+    TransformKernel::Matrix66 damped = A;
+    damped.diagonal() *= (1.0 + lambda);
 
-        add1 = add1 + varA.at<double>(0, 0);
-        add2 = add2 + varB.at<double>(0, 0);
+    // A plane leaves the point-to-plane system without any term along its own directions, a tiny ridge keeps
+    // it solvable. The point-to-point system always has the translations and is left as it is.
+    if (residual != RESIDUAL_POINT_TO_POINT)
+    {
+        damped.diagonal().array() += 1e-12 * std::max(1.0, A.diagonal().maxCoeff());
     }
 
-    data.at<double>(6, 0) = scale * (-(add2 / add1));
+    cv::Mat matA, matB;
+    cv::eigen2cv(damped, matA);
+    cv::eigen2cv(TransformKernel::Vector6(-B), matB);
+
+    return GaussNewton(matA, matB, chi, sqrt(localError));
 }
 
 LeastSquaresICP::GaussNewton LeastSquaresICP::GetSystem(const std::vector<PointTypeITK>& target, const cv::Mat& data, int posBegin, int posEnd, double lambda)
 {
-    cv::Mat A = cv::Mat::zeros(6, 6, CV_64F);
-    cv::Mat B = cv::Mat::zeros(6, 1, CV_64F);
+    TransformKernel kernel(data);
+    TransformKernel::Matrix66 A = TransformKernel::Matrix66::Zero();
+    TransformKernel::Vector6 B = TransformKernel::Vector6::Zero();
     double chi = 0;
     double squareError;
     double localError = -1.0;
-    int tSize = source.size();
 
     for (int i = posBegin; i < posEnd; i++)
     {
-        cv::Mat sourcePoint = CreatePoint(source[i]);
-        cv::Mat targetPoint = CreatePoint(target[i][0], target[i][1], target[i][2]);
-
-        cv::Mat error = SquareError(data, sourcePoint, targetPoint);
-        cv::Mat Jac = Jacobian(data, sourcePoint);
-
-        cv::Mat squareJac = (Jac.t())*Jac;
-        cv::Mat d0 = squareJac.diag(0);
-        cv::Mat diagonal = cv::Mat::diag(d0);
+        Eigen::Vector3d targetPoint(target[i][0], target[i][1], target[i][2]);
 
-        A = A + (squareJac + lambda * diagonal);
-        B = B + (Jac.t())*error;
-        squareError = error.dot(error);
+        squareError = kernel.Accumulate(TransformKernel::ToEigen(source[i]), targetPoint, A, B);
 
         chi = chi + squareError;
         if (squareError > localError)
@@ -520,33 +465,23 @@ LeastSquaresICP::GaussNewton LeastSquaresICP::GetSystem(const std::vector<PointT
             localError = squareError;
         }
     }
-    return GaussNewton(A, -B, chi, sqrt(localError));
+
+    return GetSystem(A, B, chi, localError, lambda);
 }
 
-LeastSquaresICP::GaussNewton LeastSquaresICP::GetSystem(const std::vector<cv::Point3d>& target, const cv::Mat& data, int posBegin, int posEnd, double lambda)
+LeastSquaresICP::GaussNewton LeastSquaresICP::GetSystem(const std::vector<cv::Point3d>& target, const cv::Mat& data, int posBegin, int posEnd, double lambda, const std::vector<cv::Point3d>* normals)
 {
-    cv::Mat A = cv::Mat::zeros(6, 6, CV_64F);
-    cv::Mat B = cv::Mat::zeros(6, 1, CV_64F);
+    TransformKernel kernel(data);
+    TransformKernel::Matrix66 A = TransformKernel::Matrix66::Zero();
+    TransformKernel::Vector6 B = TransformKernel::Vector6::Zero();
     double chi = 0;
     double squareError;
     double localError = -1.0;
-    //int tSize = source.size();
 
     for (int i = posBegin; i < posEnd; i++)
     {
-        cv::Mat sourcePoint = CreatePoint(source[i]);
-        cv::Mat targetPoint = CreatePoint(target[i]);
-
-        cv::Mat error = SquareError(data, sourcePoint, targetPoint);
-        cv::Mat Jac = Jacobian(data, sourcePoint);
+        squareError = AccumulateResidual(kernel, source, sourceNormals, target, normals, i, A, B);
 
-        cv::Mat squareJac = (Jac.t())*Jac;
-        cv::Mat d0 = squareJac.diag(0);
-        cv::Mat diagonal = cv::Mat::diag(d0);
-
-        A = A + (squareJac + lambda * diagonal);
-        B = B + (Jac.t())*error;
-        squareError = error.dot(error);
         chi = chi + squareError;
         if (squareError > localError)
         {
@@ -554,43 +489,66 @@ LeastSquaresICP::GaussNewton LeastSquaresICP::GetSystem(const std::vector<cv::Po
         }
     }
 
-    return GaussNewton(A, -B, chi, sqrt(localError));
+    return GetSystem(A, B, chi, localError, lambda);
 }
 
-LeastSquaresICP::GaussNewton LeastSquaresICP::GetSystemScale(const std::vector<cv::Point3d>& target, const cv::Mat& data, int posBegin, int posEnd, double lambda)
+LeastSquaresICP::GaussNewton LeastSquaresICP::GetSystemScale(const std::vector<cv::Point3d>& target, const cv::Mat& data, int posBegin, int posEnd, double lambda, const std::vector<cv::Point3d>* normals)
 {
-    cv::Mat A = cv::Mat::zeros(6, 6, CV_64F);
-    cv::Mat B = cv::Mat::zeros(6, 1, CV_64F);
+    TransformKernel kernel(data, true);
+    TransformKernel::Matrix66 A = TransformKernel::Matrix66::Zero();
+    TransformKernel::Vector6 B = TransformKernel::Vector6::Zero();
     double chi = 0;
     double squareError;
     double localError = -1.0;
-    int tSize = centerSource.size();
 
     for (int i = posBegin; i < posEnd; i++)
     {
-        cv::Mat sourcePoint = CreatePoint(centerSource[i]);
-        cv::Mat targetPoint = CreatePoint(target[i]);
-
-        cv::Mat error = SquareErrorScale(data, sourcePoint, targetPoint);
-        cv::Mat Jac = JacobianScale(data, sourcePoint);
-
-        cv::Mat squareJac = (Jac.t())*Jac;
-        cv::Mat d0 = squareJac.diag(0);
-        cv::Mat diagonal = cv::Mat::diag(d0);
-
-        A = A + (squareJac + lambda * diagonal);
-        B = B + (Jac.t())*error;
-        squareError = error.dot(error);
+        squareError = AccumulateResidual(kernel, centerSource, centerSourceNormals, target, normals, i, A, B);
 
         chi = chi + squareError;
         if (squareError > localError)
         {
             localError = squareError;
         }
+    }
+
+    return GetSystem(A, B, chi, localError, lambda);
+}
+
+double LeastSquaresICP::AccumulateResidual(const TransformKernel& kernel, const std::vector<cv::Point3d>& points, const std::vector<cv::Point3d>& pointNormals, const std::vector<cv::Point3d>& target, const std::vector<cv::Point3d>* normals, int i, TransformKernel::Matrix66& A, TransformKernel::Vector6& B) const
+{
+    Eigen::Vector3d point = TransformKernel::ToEigen(points[i]);
+    Eigen::Vector3d targetPoint = TransformKernel::ToEigen(target[i]);
 
+    if (normals == NULL)
+    {
+        return kernel.Accumulate(point, targetPoint, A, B);
     }
 
-    return GaussNewton(A, -B, chi, sqrt(localError));
+    Eigen::Vector3d normal = TransformKernel::ToEigen((*normals)[i]);
+
+    if (residual == RESIDUAL_SYMMETRIC && pointNormals.empty() == false && normal.squaredNorm() > 0)
+    {
+        // Triangle normals are not oriented, the surface normal is flipped to agree with the source normal.
+        // The sum is held fixed during the step, as the correspondences are.
+        Eigen::Vector3d rotated = kernel.Rotation() * TransformKernel::ToEigen(pointNormals[i]);
+
+        if (rotated.dot(normal) < 0)
+        {
+            normal = -normal;
+        }
+
+        normal += rotated;
+        double length = normal.norm();
+        normal = (length > 0) ? Eigen::Vector3d(normal / length) : Eigen::Vector3d::Zero();
+    }
+
+    if (normal.squaredNorm() == 0)
+    {
+        return kernel.Accumulate(point, targetPoint, A, B);
+    }
+
+    return kernel.AccumulatePlane(point, targetPoint, normal, A, B);
 }
 
 cv::Point3d LeastSquaresICP::ClosestPoint(const vtkSmartPointer<vtkPolyData>& surface, double point[3])
@@ -603,80 +561,251 @@ cv::Point3d LeastSquaresICP::ClosestPoint(const vtkSmartPointer<vtkPolyData>& su
     return closest;
 }
 
-std::vector<cv::Point3d> LeastSquaresICP::GetCorrespondence(const vtkSmartPointer<vtkImplicitPolyDataDistance> implicitPolyDataDistance, const cv::Mat& data)
+void LeastSquaresICP::FindCorrespondences(const SurfaceQuery& query, const std::vector<cv::Point3d>& points, const TransformKernel& kernel, std::vector<cv::Point3d>& target, bool exact, std::vector<cv::Point3d>* normals, CorrespondenceCache* cache)
 {
-    std::vector<cv::Point3d> result;
+    int count = int(points.size());
+    target.resize(count);
 
-    double angleX = data.at<double>(3, 0);
-    double angleY = data.at<double>(4, 0);
-    double angleZ = data.at<double>(5, 0);
+    if (normals != NULL)
+    {
+        normals->resize(count);
+    }
 
-    cv::Mat translation(3, 1, CV_64F);
-    translation.at<double>(0, 0) = data.at<double>(0, 0);
-    translation.at<double>(1, 0) = data.at<double>(1, 0);
-    translation.at<double>(2, 0) = data.at<double>(2, 0);
+    int stripes = 1;
 
-    for (int i = 0; i < source.size(); i++)
+    if (parallel == true)
     {
-        cv::Mat pointMat = CreatePoint(source[i]);
-        cv::Mat newPointMat = (Rx(angleX) * Ry(angleY) * Rz(angleZ)) * pointMat + translation;
-        cv::Point3d newPoint = cv::Point3d(newPointMat);
-
-        double pnt[3];
-        pnt[0] = newPoint.x;
-        pnt[1] = newPoint.y;
-        pnt[2] = newPoint.z;
+        stripes = std::max(1, std::min(cv::getNumThreads(), count / MIN_POINTS_PER_STRIPE));
+    }
 
-        double myClosest[3];
-        implicitPolyDataDistance->EvaluateFunctionAndGetClosestPoint(pnt, myClosest);
+    bool useTree = query.implicitDistances.empty();
 
-        result.push_back(cv::Point3d(myClosest[0], myClosest[1], myClosest[2]));
+    if (useTree == false)
+    {
+        stripes = std::min(stripes, int(query.implicitDistances.size()));
     }
-    return result;
-}
 
-std::vector<cv::Point3d> LeastSquaresICP::GetCorrespondenceScale(const vtkSmartPointer<vtkImplicitPolyDataDistance> implicitPolyDataDistance, const cv::Mat& data)
-{
-    std::vector<cv::Point3d> result;
+    const SurfaceBVH* bvh = query.index.GetBVH();
+    const DistanceVolume* volume = (exact == false) ? query.index.GetVolume() : NULL;
 
-    double angleX = data.at<double>(3, 0);
-    double angleY = data.at<double>(4, 0);
-    double angleZ = data.at<double>(5, 0);
+    if (useTree == true && bvh == NULL)
+    {
+        throw std::runtime_error("LeastSquaresICP::FindCorrespondences: no surface tree to search");
+    }
 
-    cv::Mat translation(3, 1, CV_64F);
-    translation.at<double>(0, 0) = data.at<double>(0, 0);
-    translation.at<double>(1, 0) = data.at<double>(1, 0);
-    translation.at<double>(2, 0) = data.at<double>(2, 0);
+    if (useTree == false)
+    {
+        cache = NULL;
+    }
+
+    if (cache != NULL && int(cache->triangle.size()) != count)
+    {
+        cache->position.assign(count, cv::Point3d(0, 0, 0));
+        cache->triangle.assign(count, -1);
+    }
 
-    double scale = data.at<double>(6, 0);
+    double skipDistance = incremental.moveThreshold * incremental.moveThreshold;
+    std::vector<CorrespondenceCounts> stripeCounts(stripes);
 
-    for (int i = 0; i < centerSource.size(); i++)
+    // Every point is written by exactly one stripe with the same arithmetic as the serial loop, so the
+    // result does not depend on the number of threads. Stripe k owns locator k.
+    auto findStripes = [&](const cv::Range& range)
     {
-        cv::Mat pointMat = CreatePoint(centerSource[i]);
-        cv::Mat newPointMat = scale * ((Rx(angleX) * Ry(angleY) * Rz(angleZ)) * pointMat) + translation;
-        cv::Point3d newPoint = cv::Point3d(newPointMat);
+        for (int k = range.start; k < range.end; k++)
+        {
+            int begin = int(int64_t(count) * k / stripes);
+            int end = int(int64_t(count) * (k + 1) / stripes);
 
-        double pnt[3];
-        pnt[0] = newPoint.x;
-        pnt[1] = newPoint.y;
-        pnt[2] = newPoint.z;
+            for (int i = begin; i < end; i++)
+            {
+                Eigen::Vector3d newPoint = kernel.Transform(TransformKernel::ToEigen(points[i]));
+
+                if (volume != NULL && volume->ClosestPoint(TransformKernel::ToPoint(newPoint), target[i]) == true)
+                {
+                    if (normals == NULL)
+                    {
+                        stripeCounts[k].volume++;
+                        continue;
+                    }
+
+                    // Off the surface the direction to the closest point is the normal. Points too close to the
+                    // surface for that direction to be reliable ask the tree.
+                    Eigen::Vector3d offset = newPoint - TransformKernel::ToEigen(target[i]);
+                    double length = offset.norm();
+
+                    if (length > 0.1 * volume->GetSpacing())
+                    {
+                        (*normals)[i] = TransformKernel::ToPoint(offset / length);
+                        stripeCounts[k].volume++;
+                        continue;
+                    }
+                }
+
+                if (useTree == true)
+                {
+                    cv::Point3d position = TransformKernel::ToPoint(newPoint);
+                    int cached = (cache != NULL) ? cache->triangle[i] : -1;
+                    bool searched = true;
+                    SurfaceHit hit;
+
+                    // The distance is measured from the last search, not the last projection, so small steps
+                    // cannot add up past the threshold. A triangle the tree does not have is searched again.
+                    if (cached >= 0 && cached < bvh->GetNumberOfTriangles() && (newPoint - TransformKernel::ToEigen(cache->position[i])).squaredNorm() <= skipDistance)
+                    {
+                        hit = bvh->ClosestPointOnTriangle(cached, position);
+                        searched = false;
+                        stripeCounts[k].skipped++;
+                    }
+                    else
+                    {
+                        hit = bvh->ClosestPoint(position);
+                        stripeCounts[k].full++;
+                    }
+
+                    if (cache != NULL && searched == true)
+                    {
+                        cache->position[i] = position;
+                        cache->triangle[i] = hit.index;
+                    }
 
-        double myClosest[3];
-        implicitPolyDataDistance->EvaluateFunctionAndGetClosestPoint(pnt, myClosest);
+                    // An empty tree finds nothing: the point is its own target and has no normal.
+                    if (hit.index < 0)
+                    {
+                        target[i] = position;
+
+                        if (normals != NULL)
+                        {
+                            (*normals)[i] = cv::Point3d(0, 0, 0);
+                        }
+                        continue;
+                    }
+
+                    target[i] = hit.point;
+
+                    if (normals != NULL)
+                    {
+                        (*normals)[i] = TransformKernel::ToPoint(bvh->GetNormal(hit.index));
+                    }
+                    continue;
+                }
 
-        result.push_back(cv::Point3d(myClosest[0], myClosest[1], myClosest[2]));
+                double pnt[3];
+                pnt[0] = newPoint(0);
+                pnt[1] = newPoint(1);
+                pnt[2] = newPoint(2);
+
+                double myClosest[3];
+                query.implicitDistances[k]->EvaluateFunctionAndGetClosestPoint(pnt, myClosest);
+                stripeCounts[k].full++;
+
+                target[i] = cv::Point3d(myClosest[0], myClosest[1], myClosest[2]);
+
+                if (normals != NULL)
+                {
+                    // The gradient of the distance is the normal, it vanishes on the surface.
+                    double gradient[3];
+                    query.implicitDistances[k]->EvaluateGradient(pnt, gradient);
+
+                    Eigen::Vector3d normal(gradient[0], gradient[1], gradient[2]);
+                    double length = normal.norm();
+                    (*normals)[i] = (length > 0) ? TransformKernel::ToPoint(normal / length) : cv::Point3d(0, 0, 0);
+                }
+            }
+        }
+    };
+
+    if (stripes == 1)
+    {
+        findStripes(cv::Range(0, 1));
+    }
+    else
+    {
+        cv::parallel_for_(cv::Range(0, stripes), findStripes);
+    }
+
+    CorrespondenceCounts counts;
+
+    for (int k = 0; k < stripes; k++)
+    {
+        counts.full += stripeCounts[k].full;
+        counts.skipped += stripeCounts[k].skipped;
+        counts.volume += stripeCounts[k].volume;
     }
 
-    return result;
+    correspondenceCounts.push_back(counts);
 }
 
+void LeastSquaresICP::GetCorrespondence(const SurfaceQuery& query, const cv::Mat& data, std::vector<cv::Point3d>& target, bool exact, std::vector<cv::Point3d>* normals, CorrespondenceCache* cache)
+{
+    FindCorrespondences(query, source, TransformKernel(data), target, exact, normals, cache);
+}
+
+void LeastSquaresICP::GetCorrespondenceScale(const SurfaceQuery& query, const cv::Mat& data, std::vector<cv::Point3d>& target, bool exact, std::vector<cv::Point3d>* normals, CorrespondenceCache* cache)
+{
+    FindCorrespondences(query, centerSource, TransformKernel(data, true), target, exact, normals, cache);
+}
+
+LeastSquaresICP::CorrespondenceCache* LeastSquaresICP::GetCache(CorrespondenceCache& cache) const
+{
+    return (incremental.enabled == true) ? &cache : NULL;
+}
+
+void LeastSquaresICP::BuildSurface(const vtkSmartPointer<vtkPolyData>& surface, SurfaceQuery& query, int locators)
+{
+    // The volume is sampled with the tree, which is kept for the points outside the band.
+    if (search == SEARCH_BVH || distanceVolume.enabled == true)
+    {
+        query.index = BuildIndex(surface);
+    }
+
+    if (search == SEARCH_BVH)
+    {
+        return;
+    }
+
+    // Built one after the other: building a locator touches the shared vtkPolyData.
+    if (locators <= 0)
+    {
+        locators = (parallel == true) ? std::max(1, cv::getNumThreads()) : 1;
+    }
+
+    for (int i = 0; i < locators; i++)
+    {
+        vtkSmartPointer<vtkImplicitPolyDataDistance> implicitPolyDataDistance = vtkSmartPointer<vtkImplicitPolyDataDistance>::New();
+        implicitPolyDataDistance->SetInput(surface);
+        query.implicitDistances.push_back(implicitPolyDataDistance);
+    }
+}
 
 double LeastSquaresICP::LeastSquares(const vtkSmartPointer<vtkPolyData>& surface, cv::Mat& data, int iterations)
 {
-    vtkNew<vtkImplicitPolyDataDistance> implicitPolyDataDistance;
-    implicitPolyDataDistance->SetInput(surface);
+    correspondenceCounts.clear();
+
+    SurfaceQuery query;
+    BuildSurface(surface, query);
+
+    return LeastSquares(query, data, iterations);
+}
+
+double LeastSquaresICP::LeastSquares(const SurfaceQuery& query, cv::Mat& data, int iterations, std::atomic<bool>* cancel, bool exact)
+{
+    if (exact == false && sourcePyramid.GetNumberOfLevels() > 0)
+    {
+        return Pyramid(query, data, iterations, cancel, false);
+    }
 
-    std::vector<cv::Point3d> target = GetCorrespondence(implicitPolyDataDistance, data);
+    if (solver == SOLVER_CLOSED_FORM)
+    {
+        return ClosedForm(query, data, iterations, cancel, exact, false);
+    }
+
+    bool refine = Refines(query, exact);
+    converged = false;
+    std::vector<cv::Point3d> target, normals;
+    std::vector<cv::Point3d>* targetNormals = (residual != RESIDUAL_POINT_TO_POINT) ? &normals : NULL;
+    CorrespondenceCache cache;
+    CorrespondenceCache* incrementalCache = GetCache(cache);
+    GetCorrespondence(query, data, target, exact, targetNormals, incrementalCache);
     double angleX, angleY, angleZ;
 
     bool finish = false;
@@ -690,8 +819,9 @@ double LeastSquaresICP::LeastSquares(const vtkSmartPointer<vtkPolyData>& surface
 
     cv::Mat dataTemp(6, 1, CV_64F);
     double bestError = -1;
+    std::vector<double> history;
 
-    for (int i = 0; i < iterations && finish == false; i++)
+    for (int i = 0; i < iterations && finish == false && Cancelled(cancel) == false; i++)
     {
         for (int j = 0; j < batch; j++)
         {
@@ -704,7 +834,7 @@ double LeastSquaresICP::LeastSquares(const vtkSmartPointer<vtkPolyData>& surface
                 posB = source.size();
             }
 
-            GaussNewton resultInfo = GetSystem(target, data, posA, posB, lambda);
+            GaussNewton resultInfo = GetSystem(target, data, posA, posB, lambda, targetNormals);
             currentError = resultInfo.localError;
 
             if (beforeError < 0)
@@ -757,18 +887,30 @@ double LeastSquaresICP::LeastSquares(const vtkSmartPointer<vtkPolyData>& surface
             if (resultInfo.totalError < chi2 && resultInfo.localError < maxError)
             {
                 finish = true;
+                converged = (refine == false);
+
+                if (cancel != NULL && refine == false)
+                {
+                    *cancel = true;
+                }
                 break;
             }
         }
 
-        if (finish == true)
+        if (finish == true || Plateaued(history, bestError) == true)
         {
-            continue;
+            break;
         }
 
         shuffleSource();
-        target.clear();
-        target = GetCorrespondence(implicitPolyDataDistance, data);
+        shuffleCache(cache);
+        GetCorrespondence(query, data, target, exact, targetNormals, incrementalCache);
+    }
+
+    // Cancelled before the first step, data is left as it was.
+    if (bestError < 0)
+    {
+        return bestError;
     }
 
     data.at<double>(0, 0) = dataTemp.at<double>(0, 0);
@@ -778,15 +920,142 @@ double LeastSquaresICP::LeastSquares(const vtkSmartPointer<vtkPolyData>& surface
     data.at<double>(4, 0) = dataTemp.at<double>(4, 0);
     data.at<double>(5, 0) = dataTemp.at<double>(5, 0);
 
+    // The refinement keeps the result of the volume when it is cancelled before its first step.
+    if (refine == true)
+    {
+        double refinedError = LeastSquares(query, data, distanceVolume.refinementIterations, cancel, true);
+        return (refinedError < 0) ? bestError : refinedError;
+    }
+
+    return bestError;
+}
+
+double LeastSquaresICP::ClosedForm(const SurfaceQuery& query, cv::Mat& data, int iterations, std::atomic<bool>* cancel, bool exact, bool useScale)
+{
+    bool refine = Refines(query, exact);
+    converged = false;
+    int count = int(source.size());
+
+    std::vector<cv::Point3d> target;
+    CorrespondenceCache cache;
+    CorrespondenceCache* incrementalCache = GetCache(cache);
+    cv::Mat bestData = data.clone();
+    double bestError = -1;
+    std::vector<double> history;
+    bool finish = false;
+
+    for (int i = 0; i < iterations && finish == false && Cancelled(cancel) == false; i++)
+    {
+        TransformKernel kernel(data, useScale);
+        FindCorrespondences(query, source, kernel, target, exact, NULL, incrementalCache);
+
+        // Error of the current transform and the moments of the pairs in the same pass. The points are taken
+        // relative to the source centroid and its image, which keeps the covariance free of cancellation far
+        // from the origin.
+        Eigen::Vector3d sourceOrigin = TransformKernel::ToEigen(aveSource);
+        Eigen::Vector3d targetOrigin = kernel.Transform(sourceOrigin);
+        Eigen::Vector3d sumSource = Eigen::Vector3d::Zero();
+        Eigen::Vector3d sumTarget = Eigen::Vector3d::Zero();
+        Eigen::Matrix3d sumCross = Eigen::Matrix3d::Zero();
+        double sumSquares = 0;
+        double chi = 0;
+        double localError = 0;
+
+        for (int k = 0; k < count; k++)
+        {
+            Eigen::Vector3d point = TransformKernel::ToEigen(source[k]);
+            Eigen::Vector3d targetPoint = TransformKernel::ToEigen(target[k]);
+
+            double squareError = (kernel.Transform(point) - targetPoint).squaredNorm();
+            chi = chi + squareError;
+            localError = std::max(localError, squareError);
+
+            Eigen::Vector3d p = point - sourceOrigin;
+            Eigen::Vector3d q = targetPoint - targetOrigin;
+            sumSource += p;
+            sumTarget += q;
+            sumCross.noalias() += q * p.transpose();
+            sumSquares += p.squaredNorm();
+        }
+
+        localError = sqrt(localError);
+
+        if (bestError < 0 || localError < bestError)
+        {
+            bestError = localError;
+            data.copyTo(bestData);
+        }
+
+        if (chi < chi2 && localError < maxError)
+        {
+            finish = true;
+            converged = (refine == false);
+
+            if (cancel != NULL && refine == false)
+            {
+                *cancel = true;
+            }
+            break;
+        }
+
+        if (count == 0 || Plateaued(history, bestError) == true)
+        {
+            break;
+        }
+
+        Eigen::Matrix3d rotation;
+        Eigen::Vector3d translation;
+        double scale;
+        TransformKernel::FitMoments(sourceOrigin, targetOrigin, count, sumSource, sumTarget, sumCross, sumSquares, useScale, rotation, scale, translation);
+
+        double angleX, angleY, angleZ;
+        TransformKernel::AnglesXYZ(rotation, angleX, angleY, angleZ);
+
+        data.at<double>(0, 0) = translation(0);
+        data.at<double>(1, 0) = translation(1);
+        data.at<double>(2, 0) = translation(2);
+        data.at<double>(3, 0) = angleX;
+        data.at<double>(4, 0) = angleY;
+        data.at<double>(5, 0) = angleZ;
+
+        if (useScale == true)
+        {
+            data.at<double>(6, 0) = scale;
+        }
+    }
+
+    // Cancelled before the first step, data is left as it was.
+    if (bestError < 0)
+    {
+        return bestError;
+    }
+
+    bestData.copyTo(data);
+
+    // The refinement keeps the result of the volume when it is cancelled before its first step.
+    if (refine == true)
+    {
+        double refinedError = ClosedForm(query, data, distanceVolume.refinementIterations, cancel, true, useScale);
+        return (refinedError < 0) ? bestError : refinedError;
+    }
+
     return bestError;
 }
 
 double LeastSquaresICP::LeastSquaresTest(const vtkSmartPointer<vtkPolyData>& surface, cv::Mat& data, int iterations)
 {
-    vtkNew<vtkImplicitPolyDataDistance> implicitPolyDataDistance;
-    implicitPolyDataDistance->SetInput(surface);
+    correspondenceCounts.clear();
+
+    SurfaceQuery query;
+    BuildSurface(surface, query);
+
+    return LeastSquaresTest(surface, query, data, iterations);
+}
 
-    std::vector<cv::Point3d> target = GetCorrespondence(implicitPolyDataDistance, data);
+double LeastSquaresICP::LeastSquaresTest(const vtkSmartPointer<vtkPolyData>& surface, const SurfaceQuery& query, cv::Mat& data, int iterations)
+{
+    std::vector<cv::Point3d> target;
+    GetCorrespondence(query, data, target);
     double angleX, angleY, angleZ;
 
     bool finish = false;
@@ -880,8 +1149,7 @@ double LeastSquaresICP::LeastSquaresTest(const vtkSmartPointer<vtkPolyData>& sur
         }
 
         shuffleSource();
-        target.clear();
-        target = GetCorrespondence(implicitPolyDataDistance, data);
+        GetCorrespondence(query, data, target);
     }
 
     return currentError;
@@ -889,17 +1157,42 @@ double LeastSquaresICP::LeastSquaresTest(const vtkSmartPointer<vtkPolyData>& sur
 
 double LeastSquaresICP::LeastSquaresScale(const vtkSmartPointer<vtkPolyData>& surface, cv::Mat& data, int iterations)
 {
-    vtkNew<vtkImplicitPolyDataDistance> implicitPolyDataDistance;
-    implicitPolyDataDistance->SetInput(surface);
+    correspondenceCounts.clear();
+
+    SurfaceQuery query;
+    BuildSurface(surface, query);
+
+    return LeastSquaresScale(query, data, iterations);
+}
+
+double LeastSquaresICP::LeastSquaresScale(const SurfaceQuery& query, cv::Mat& data, int iterations, std::atomic<bool>* cancel, bool exact)
+{
+    if (exact == false && sourcePyramid.GetNumberOfLevels() > 0)
+    {
+        return Pyramid(query, data, iterations, cancel, true);
+    }
+
+    if (solver == SOLVER_CLOSED_FORM)
+    {
+        return ClosedForm(query, data, iterations, cancel, exact, true);
+    }
 
+    bool refine = Refines(query, exact);
+    converged = false;
+    // The solver moves centerSource, so the translation it works on is t + s * R * aveSource. The scale is the
+    // one of data, the exit subtracts the same term with the final scale.
     cv::Mat myRotation = Rx(data.at<double>(3, 0)) * Ry(data.at<double>(4, 0)) * Rz(data.at<double>(5, 0));
-    cv::Mat myRest = myRotation * CreatePoint(aveSource);
+    cv::Mat myRest = data.at<double>(6, 0) * (myRotation * CreatePoint(aveSource));
 
     data.at<double>(0, 0) = data.at<double>(0, 0) + myRest.at<double>(0, 0);
     data.at<double>(1, 0) = data.at<double>(1, 0) + myRest.at<double>(1, 0);
     data.at<double>(2, 0) = data.at<double>(2, 0) + myRest.at<double>(2, 0);
 
-    std::vector<cv::Point3d> target = GetCorrespondenceScale(implicitPolyDataDistance, data);
+    std::vector<cv::Point3d> target, normals;
+    std::vector<cv::Point3d>* targetNormals = (residual != RESIDUAL_POINT_TO_POINT) ? &normals : NULL;
+    CorrespondenceCache cache;
+    CorrespondenceCache* incrementalCache = GetCache(cache);
+    GetCorrespondenceScale(query, data, target, exact, targetNormals, incrementalCache);
     double angleX, angleY, angleZ;
 
     bool finish = false;
@@ -933,8 +1226,9 @@ double LeastSquaresICP::LeastSquaresScale(const vtkSmartPointer<vtkPolyData>& su
 
     cv::Mat dataTemp(7, 1, CV_64F);
     double bestError = -1;
+    std::vector<double> history;
 
-    for (int i = 0; i < iterations && finish == false; i++)
+    for (int i = 0; i < iterations && finish == false && Cancelled(cancel) == false; i++)
     {
         for (int j = 0; j < batch; j++)
         {
@@ -947,7 +1241,7 @@ double LeastSquaresICP::LeastSquaresScale(const vtkSmartPointer<vtkPolyData>& su
                 posB = source.size();
             }
 
-            GaussNewton resultInfo = GetSystemScale(target, data, posA, posB, lambda);
+            GaussNewton resultInfo = GetSystemScale(target, data, posA, posB, lambda, targetNormals);
             currentError = resultInfo.localError;
 
             if (beforeError < 0)
@@ -991,8 +1285,7 @@ double LeastSquaresICP::LeastSquaresScale(const vtkSmartPointer<vtkPolyData>& su
             data.at<double>(4, 0) = atan2(sin(angleY), cos(angleY));
             data.at<double>(5, 0) = atan2(sin(angleZ), cos(angleZ));
 
-            target.clear();
-            target = GetCorrespondenceScale(implicitPolyDataDistance, data);
+            GetCorrespondenceScale(query, data, target, exact, targetNormals, incrementalCache);
 
             GetScale(target, data);
 
@@ -1012,18 +1305,33 @@ double LeastSquaresICP::LeastSquaresScale(const vtkSmartPointer<vtkPolyData>& su
             if (resultInfo.totalError < chi2 && resultInfo.localError < maxError)
             {
                 finish = true;
+                converged = (refine == false);
+
+                if (cancel != NULL && refine == false)
+                {
+                    *cancel = true;
+                }
                 break;
             }
         }
 
-        if (finish == true)
+        if (finish == true || Plateaued(history, bestError) == true)
         {
-            continue;
+            break;
         }
 
         shuffleCenterSource();
-        target.clear();
-        target = GetCorrespondenceScale(implicitPolyDataDistance, data);
+        shuffleCache(cache);
+        GetCorrespondenceScale(query, data, target, exact, targetNormals, incrementalCache);
+    }
+
+    // Cancelled before the first step, data is left as it was.
+    if (bestError < 0)
+    {
+        data.at<double>(0, 0) = data.at<double>(0, 0) - myRest.at<double>(0, 0);
+        data.at<double>(1, 0) = data.at<double>(1, 0) - myRest.at<double>(1, 0);
+        data.at<double>(2, 0) = data.at<double>(2, 0) - myRest.at<double>(2, 0);
+        return bestError;
     }
 
     data.at<double>(0, 0) = dataTemp.at<double>(0, 0);
@@ -1061,131 +1369,372 @@ double LeastSquaresICP::LeastSquaresScale(const vtkSmartPointer<vtkPolyData>& su
 
     ///////////////////////////////////////
 
+    // The refinement keeps the result of the volume when it is cancelled before its first step.
+    if (refine == true)
+    {
+        double refinedError = LeastSquaresScale(query, data, distanceVolume.refinementIterations, cancel, true);
+        return (refinedError < 0) ? bestError : refinedError;
+    }
+
     return bestError;
 }
 
 double LeastSquaresICP::LeastSquaresRandomInit(const vtkSmartPointer<vtkPolyData>& surface, cv::Mat& data, int iterations)
 {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<> distr_translation(-1, 1);
-    std::uniform_real_distribution<> distr_rotation(-0.06, 0.06);
+    correspondenceCounts.clear();
 
-    cv::Mat dataTemp(6, 1, CV_64F);
-    cv::Mat dataInit(6, 1, CV_64F);
-    cv::Mat randomValues(6, 1, CV_64F);
+    SurfaceQuery query;
+    BuildSurface(surface, query, 1);
+
+    return RandomRestarts(query, data, iterations, false);
+}
+
+double LeastSquaresICP::LeastSquaresScaleRandomInit(const vtkSmartPointer<vtkPolyData>& surface, cv::Mat& data, int iterations)
+{
+    correspondenceCounts.clear();
+
+    SurfaceQuery query;
+    BuildSurface(surface, query, 1);
+
+    return RandomRestarts(query, data, iterations, true);
+}
+
+double LeastSquaresICP::LeastSquares(const SurfaceIndex& index, cv::Mat& data, int iterations)
+{
+    CheckIndex(index, "LeastSquares");
+    correspondenceCounts.clear();
+
+    SurfaceQuery query;
+    query.index = index;
+
+    return LeastSquares(query, data, iterations);
+}
+
+double LeastSquaresICP::LeastSquaresScale(const SurfaceIndex& index, cv::Mat& data, int iterations)
+{
+    CheckIndex(index, "LeastSquaresScale");
+    correspondenceCounts.clear();
+
+    SurfaceQuery query;
+    query.index = index;
 
-    dataInit.at<double>(0, 0) = data.at<double>(0, 0);
-    dataInit.at<double>(1, 0) = data.at<double>(1, 0);
-    dataInit.at<double>(2, 0) = data.at<double>(2, 0);
-    dataInit.at<double>(3, 0) = data.at<double>(3, 0);
-    dataInit.at<double>(4, 0) = data.at<double>(4, 0);
-    dataInit.at<double>(5, 0) = data.at<double>(5, 0);
+    return LeastSquaresScale(query, data, iterations);
+}
+
+double LeastSquaresICP::LeastSquaresRandomInit(const SurfaceIndex& index, cv::Mat& data, int iterations)
+{
+    CheckIndex(index, "LeastSquaresRandomInit");
+    correspondenceCounts.clear();
+
+    SurfaceQuery query;
+    query.index = index;
+
+    return RandomRestarts(query, data, iterations, false);
+}
+
+double LeastSquaresICP::LeastSquaresScaleRandomInit(const SurfaceIndex& index, cv::Mat& data, int iterations)
+{
+    CheckIndex(index, "LeastSquaresScaleRandomInit");
+    correspondenceCounts.clear();
+
+    SurfaceQuery query;
+    query.index = index;
+
+    return RandomRestarts(query, data, iterations, true);
+}
+
+double LeastSquaresICP::LeastSquaresTest(const vtkSmartPointer<vtkPolyData>& surface, const SurfaceIndex& index, cv::Mat& data, int iterations)
+{
+    CheckIndex(index, "LeastSquaresTest");
+    correspondenceCounts.clear();
+
+    SurfaceQuery query;
+    query.index = index;
+
+    return LeastSquaresTest(surface, query, data, iterations);
+}
 
-    double error = LeastSquares(surface, data, iterations);
+void LeastSquaresICP::GetCorrespondences(const vtkSmartPointer<vtkPolyData>& surface, const cv::Mat& data, std::vector<cv::Point3d>& target)
+{
+    correspondenceCounts.clear();
+
+    SurfaceQuery query;
+    BuildSurface(surface, query);
+
+    FindCorrespondences(query, source, TransformKernel(data, data.rows > 6), target, false, NULL);
+}
 
-    for (int i = 0; i < 10; i++)
+SurfaceIndex LeastSquaresICP::BuildIndex(const vtkSmartPointer<vtkPolyData>& surface) const
+{
+    SurfaceIndex index;
+    index.Build(surface);
+
+    if (distanceVolume.enabled == true)
     {
+        index.BuildVolume(distanceVolume.spacing, distanceVolume.bandWidth);
+    }
+
+    return index;
+}
 
-        dataTemp.at<double>(0, 0) = dataInit.at<double>(0, 0);
-        dataTemp.at<double>(1, 0) = dataInit.at<double>(1, 0);
-        dataTemp.at<double>(2, 0) = dataInit.at<double>(2, 0);
-        dataTemp.at<double>(3, 0) = dataInit.at<double>(3, 0);
-        dataTemp.at<double>(4, 0) = dataInit.at<double>(4, 0);
-        dataTemp.at<double>(5, 0) = dataInit.at<double>(5, 0);
+int LeastSquaresICP::GetNumberOfRuns() const
+{
+    return std::max(0, randomInit.restarts) + 1;
+}
 
-        randomValues.at<double>(0, 0) = distr_translation(gen);
-        randomValues.at<double>(1, 0) = distr_translation(gen);
-        randomValues.at<double>(2, 0) = distr_translation(gen);
+double LeastSquaresICP::RandomRestarts(const SurfaceQuery& query, cv::Mat& data, int iterations, bool useScale)
+{
+    int rows = useScale ? 7 : 6;
+    int runs = GetNumberOfRuns();
 
-        randomValues.at<double>(3, 0) = distr_rotation(gen);
-        randomValues.at<double>(4, 0) = distr_rotation(gen);
-        randomValues.at<double>(5, 0) = distr_rotation(gen);
+    // The starting points are drawn up front and in order, so they only depend on the seed.
+    std::mt19937 gen;
 
-        dataTemp += randomValues;
+    if (randomInit.useSeed == true)
+    {
+        gen.seed(randomInit.seed);
+    }
+    else
+    {
+        std::random_device rd;
+        gen.seed(rd());
+    }
 
-        double errorTemp = LeastSquares(surface, dataTemp, iterations);
+    std::uniform_real_distribution<> distr_translation(-randomInit.translationRange, randomInit.translationRange);
+    std::uniform_real_distribution<> distr_rotation(-randomInit.rotationRange, randomInit.rotationRange);
 
-        if (errorTemp < error)
+    std::vector<cv::Mat> results(runs);
+    std::vector<double> errors(runs, -1.0);
+    std::vector<char> finished(runs, 0);
+    std::vector<std::vector<CorrespondenceCounts>> counts(runs);
+
+    for (int k = 0; k < runs; k++)
+    {
+        results[k] = data.rowRange(0, rows).clone();
+
+        if (k == 0)
+        {
+            continue;
+        }
+
+        for (int j = 0; j < 3; j++)
         {
-            error = errorTemp;
-
-            data.at<double>(0, 0) = dataTemp.at<double>(0, 0);
-            data.at<double>(1, 0) = dataTemp.at<double>(1, 0);
-            data.at<double>(2, 0) = dataTemp.at<double>(2, 0);
-            data.at<double>(3, 0) = dataTemp.at<double>(3, 0);
-            data.at<double>(4, 0) = dataTemp.at<double>(4, 0);
-            data.at<double>(5, 0) = dataTemp.at<double>(5, 0);
+            results[k].at<double>(j, 0) += distr_translation(gen);
         }
 
+        for (int j = 3; j < 6; j++)
+        {
+            results[k].at<double>(j, 0) += distr_rotation(gen);
+        }
     }
 
-    return error;
+    // Every run gets its own copy of the point sets (they are shuffled in place), the index is shared. A
+    // vtkImplicitPolyDataDistance is costly to build and cannot be queried from several threads, so with the
+    // VTK search the runs take the first locator in turn; parallel restarts need the tree.
+    std::atomic<bool> cancel(false);
+    std::atomic<bool>* cancelPointer = (randomInit.cancelOnConvergence == true) ? &cancel : NULL;
+    int stripes = query.implicitDistances.empty() ? runs : 1;
+
+    cv::parallel_for_(cv::Range(0, runs), [&](const cv::Range& range)
+    {
+        for (int k = range.start; k < range.end; k++)
+        {
+            LeastSquaresICP worker(*this);
+            worker.parallel = false;
+            worker.converged = false;
+            worker.correspondenceCounts.clear();
+
+            if (useScale == true)
+            {
+                errors[k] = worker.LeastSquaresScale(query, results[k], iterations, cancelPointer);
+            }
+            else
+            {
+                errors[k] = worker.LeastSquares(query, results[k], iterations, cancelPointer);
+            }
+
+            // A run that did not converge and ends with the flag set may have been stopped part way by another
+            // one. It is left out even if it had reached its last iteration first.
+            finished[k] = (worker.converged == true || Cancelled(cancelPointer) == false);
+            counts[k].swap(worker.correspondenceCounts);
+        }
+    }, stripes);
+
+    // The first run with the smallest error among the runs that converged or ran to the end. Once a run
+    // converges at least one qualifies.
+    int best = -1;
+
+    for (int k = 0; k < runs; k++)
+    {
+        if (finished[k] != 0 && errors[k] >= 0 && (best < 0 || errors[k] < errors[best]))
+        {
+            best = k;
+        }
+    }
+
+    if (best < 0)
+    {
+        return -1.0;
+    }
+
+    results[best].copyTo(data.rowRange(0, rows));
+    correspondenceCounts.insert(correspondenceCounts.end(), counts[best].begin(), counts[best].end());
+    return errors[best];
 }
 
-double LeastSquaresICP::LeastSquaresScaleRandomInit(const vtkSmartPointer<vtkPolyData>& surface, cv::Mat& data, int iterations)
+void LeastSquaresICP::setRandomInitOptions(const RandomInitOptions& pOptions)
 {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<> distr_translation(-1, 1);
-    std::uniform_real_distribution<> distr_rotation(-0.06, 0.06);
+    // The ranges bound uniform distributions, which need lower <= upper. Written so that NaN fails too.
+    if (!(pOptions.translationRange >= 0) || !(pOptions.rotationRange >= 0))
+    {
+        throw std::runtime_error("LeastSquaresICP::setRandomInitOptions: the ranges must not be negative");
+    }
 
-    cv::Mat dataTemp(7, 1, CV_64F);
-    cv::Mat dataInit(7, 1, CV_64F);
-    cv::Mat randomValues(7, 1, CV_64F);
+    randomInit = pOptions;
+}
+
+RandomInitOptions LeastSquaresICP::getRandomInitOptions() const
+{
+    return randomInit;
+}
 
-    dataInit.at<double>(0, 0) = data.at<double>(0, 0);
-    dataInit.at<double>(1, 0) = data.at<double>(1, 0);
-    dataInit.at<double>(2, 0) = data.at<double>(2, 0);
-    dataInit.at<double>(3, 0) = data.at<double>(3, 0);
-    dataInit.at<double>(4, 0) = data.at<double>(4, 0);
-    dataInit.at<double>(5, 0) = data.at<double>(5, 0);
-    dataInit.at<double>(6, 0) = data.at<double>(6, 0);
+void LeastSquaresICP::setDistanceVolume(const DistanceVolumeOptions& pOptions)
+{
+    distanceVolume = pOptions;
+}
+
+DistanceVolumeOptions LeastSquaresICP::getDistanceVolume() const
+{
+    return distanceVolume;
+}
 
-    double error = LeastSquaresScale(surface, data, iterations);
+void LeastSquaresICP::setPyramid(const PyramidOptions& pOptions)
+{
+    pyramid = pOptions;
+    sourcePyramid.Clear();
 
-    for (int i = 0; i < 10; i++)
+    if (pyramid.enabled == true)
     {
+        sourcePyramid.Build(source, sourceNormals, pyramid.voxelSize, pyramid.levels, pyramid.minPoints);
+    }
+}
 
-        dataTemp.at<double>(0, 0) = dataInit.at<double>(0, 0);
-        dataTemp.at<double>(1, 0) = dataInit.at<double>(1, 0);
-        dataTemp.at<double>(2, 0) = dataInit.at<double>(2, 0);
-        dataTemp.at<double>(3, 0) = dataInit.at<double>(3, 0);
-        dataTemp.at<double>(4, 0) = dataInit.at<double>(4, 0);
-        dataTemp.at<double>(5, 0) = dataInit.at<double>(5, 0);
-        dataTemp.at<double>(6, 0) = dataInit.at<double>(6, 0);
+PyramidOptions LeastSquaresICP::getPyramid() const
+{
+    return pyramid;
+}
+
+std::vector<int> LeastSquaresICP::getPyramidLevelSizes() const
+{
+    std::vector<int> sizes;
 
-        randomValues.at<double>(0, 0) = distr_translation(gen);
-        randomValues.at<double>(1, 0) = distr_translation(gen);
-        randomValues.at<double>(2, 0) = distr_translation(gen);
+    for (int level = 0; level < sourcePyramid.GetNumberOfLevels(); level++)
+    {
+        sizes.push_back(int(sourcePyramid.GetPoints(level).size()));
+    }
 
-        randomValues.at<double>(3, 0) = distr_rotation(gen);
-        randomValues.at<double>(4, 0) = distr_rotation(gen);
-        randomValues.at<double>(5, 0) = distr_rotation(gen);
+    sizes.push_back(int(source.size()));
+    return sizes;
+}
 
-        randomValues.at<double>(6, 0) = 0;
+void LeastSquaresICP::setIncremental(const IncrementalOptions& pOptions)
+{
+    incremental = pOptions;
+}
+
+IncrementalOptions LeastSquaresICP::getIncremental() const
+{
+    return incremental;
+}
+
+std::vector<CorrespondenceCounts> LeastSquaresICP::getCorrespondenceCounts() const
+{
+    return correspondenceCounts;
+}
 
-        dataTemp += randomValues;
+double LeastSquaresICP::Pyramid(const SurfaceQuery& query, cv::Mat& data, int iterations, std::atomic<bool>* cancel, bool useScale)
+{
+    int levelIterations = std::min(iterations, pyramid.levelIterations);
 
-        double errorTemp = LeastSquaresScale(surface, dataTemp, iterations);
+    // The coarse levels neither report convergence nor refine on the exact surface, they only move data closer
+    // for the next level. A level that stops before its first step leaves data as it was.
+    for (int level = 0; level < sourcePyramid.GetNumberOfLevels() && Cancelled(cancel) == false; level++)
+    {
+        LeastSquaresICP coarse(*this);
+        coarse.UseLevel(level);
+        coarse.coarseLevel = true;
+        coarse.distanceVolume.refinementIterations = 0;
+        coarse.correspondenceCounts.clear();
 
-        if (errorTemp < error)
+        if (useScale == true)
+        {
+            coarse.LeastSquaresScale(query, data, levelIterations);
+        }
+        else
         {
-            error = errorTemp;
-
-            data.at<double>(0, 0) = dataTemp.at<double>(0, 0);
-            data.at<double>(1, 0) = dataTemp.at<double>(1, 0);
-            data.at<double>(2, 0) = dataTemp.at<double>(2, 0);
-            data.at<double>(3, 0) = dataTemp.at<double>(3, 0);
-            data.at<double>(4, 0) = dataTemp.at<double>(4, 0);
-            data.at<double>(5, 0) = dataTemp.at<double>(5, 0);
-            data.at<double>(6, 0) = dataTemp.at<double>(6, 0);
+            coarse.LeastSquares(query, data, levelIterations);
         }
+
+        correspondenceCounts.insert(correspondenceCounts.end(), coarse.correspondenceCounts.begin(), coarse.correspondenceCounts.end());
     }
 
+    LeastSquaresICP full(*this);
+    full.sourcePyramid.Clear();
+    full.correspondenceCounts.clear();
+
+    double error = (useScale == true) ? full.LeastSquaresScale(query, data, iterations, cancel) : full.LeastSquares(query, data, iterations, cancel);
+
+    correspondenceCounts.insert(correspondenceCounts.end(), full.correspondenceCounts.begin(), full.correspondenceCounts.end());
+    converged = full.converged;
     return error;
 }
 
+void LeastSquaresICP::UseLevel(int level)
+{
+    source = sourcePyramid.GetPoints(level);
+    sourceNormals = sourcePyramid.GetNormals(level);
+    centerSourceNormals = sourceNormals;
+    centerSource.resize(source.size());
+
+    for (size_t i = 0; i < source.size(); i++)
+    {
+        centerSource[i] = source[i] - aveSource;
+    }
+
+    sourcePyramid.Clear();
+}
+
+bool LeastSquaresICP::Plateaued(std::vector<double>& history, double bestError) const
+{
+    if (coarseLevel == false || pyramid.plateauIterations <= 0)
+    {
+        return false;
+    }
+
+    history.push_back(bestError);
+
+    // plateauIterations is positive here.
+    size_t window = size_t(pyramid.plateauIterations);
+
+    if (history.size() <= window)
+    {
+        return false;
+    }
+
+    double before = history[history.size() - 1 - window];
+    return before - bestError <= pyramid.plateauRatio * before;
+}
+
+bool LeastSquaresICP::Refines(const SurfaceQuery& query, bool exact) const
+{
+    return exact == false && query.index.GetVolume() != NULL && distanceVolume.refinementIterations > 0;
+}
+
+bool LeastSquaresICP::Cancelled(const std::atomic<bool>* cancel)
+{
+    return cancel != NULL && cancel->load() == true;
+}
+
 cv::Mat LeastSquaresICP::GetRotationAnglesXYZ(const std::vector<cv::Point3d>& threeVectorsSource, const std::vector<cv::Point3d>& threeVectorstarget, cv::Mat& data)
 {
     std::vector<cv::Point3d> sources = threeVectorsSource;
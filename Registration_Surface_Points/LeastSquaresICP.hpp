@@ -2,15 +2,118 @@
 #define REGISTRATION_ICPLS_H
 
 #include <opencv2/calib3d/calib3d.hpp>
+#include <atomic>
 #include "vtkSmartPointer.h"
 #include "vtkImplicitPolyDataDistance.h"
 #include "vtkPolyData.h"
 #include "Types.hpp"
+#include "TransformKernel.hpp"
+#include "SurfaceIndex.hpp"
+#include "SourcePyramid.hpp"
 
 namespace TKA
 {
 	namespace REGISTRATION
 	{
+		// How the closest surface point of every source point is found. SEARCH_IMPLICIT_DISTANCE is the
+		// vtkImplicitPolyDataDistance cell locator, SEARCH_BVH the SurfaceBVH built once per registration.
+		// Registrations given a SurfaceIndex always search its tree. SEARCH_BVH is the default; the closest points
+		// it finds are exact, so results can differ in the last digits from those of SEARCH_IMPLICIT_DISTANCE,
+		// which earlier versions always used and which reproduces them.
+		enum CorrespondenceSearch
+		{
+			SEARCH_IMPLICIT_DISTANCE,
+			SEARCH_BVH
+		};
+
+		// Residual minimized for every correspondence. RESIDUAL_POINT_TO_PLANE measures the distance along the
+		// normal of the closest triangle, so the source can slide along flat regions of the surface.
+		// RESIDUAL_SYMMETRIC uses the sum of that normal and the rotated source normal, and needs the source
+		// normals given to the constructor (point-to-plane without them). Both are solved with the same LM steps
+		// and still report point distances, so chi2 and maxError keep their meaning. Correspondences without a
+		// normal (on the surface with the VTK search) use the point-to-point residual.
+		enum ResidualMode
+		{
+			RESIDUAL_POINT_TO_POINT,
+			RESIDUAL_POINT_TO_PLANE,
+			RESIDUAL_SYMMETRIC
+		};
+
+		// Step of every ICP iteration. SOLVER_LEVENBERG_MARQUARDT takes damped Gauss-Newton steps on the angles
+		// over three batches of points. SOLVER_CLOSED_FORM solves the best rigid or similarity transform of all
+		// the current correspondences at once (Kabsch / Umeyama: one pass over the points and a 3x3 SVD), so
+		// it only minimizes point-to-point residuals and ignores the ResidualMode. Its chi2 test is on the sum
+		// over all the points instead of one batch.
+		enum ICPSolver
+		{
+			SOLVER_LEVENBERG_MARQUARDT,
+			SOLVER_CLOSED_FORM
+		};
+
+		// Perturbed starting points tried by LeastSquaresRandomInit and LeastSquaresScaleRandomInit, on top of
+		// the given one. Translations are drawn in [-translationRange, translationRange] and angles in
+		// [-rotationRange, rotationRange] radians. The runs share one surface index and run in parallel, except
+		// with SEARCH_IMPLICIT_DISTANCE, whose single locator they take in turn. With
+		// cancelOnConvergence the remaining runs stop as soon as one meets the chi2 and maxError criteria, so the
+		// result is only reproducible with a seed and cancelOnConvergence off.
+		struct RandomInitOptions
+		{
+			int restarts = 10;
+			double translationRange = 1.0;
+			double rotationRange = 0.06;
+			bool useSeed = false;
+			unsigned int seed = 0;
+			bool cancelOnConvergence = true;
+		};
+
+		// Correspondences read from a DistanceVolume built once per surface instead of searched on the mesh.
+		// Points outside the band, or where the volume cannot interpolate, use the selected search. Once the
+		// solver stops on the volume it runs up to refinementIterations more iterations on exact correspondences.
+		// Registrations given a SurfaceIndex use its volume, if it has one, and ignore enabled and the sizes.
+		struct DistanceVolumeOptions
+		{
+			bool enabled = false;
+			double spacing = 0.5;
+			double bandWidth = 2.0;
+			int refinementIterations = 10;
+		};
+
+		// Coarse-to-fine schedule over a SourcePyramid of the source points. The first cells are voxelSize wide
+		// and double on every coarser level; levels stop at minPoints points. Every registration starts on the
+		// coarsest level and moves to the next finer one when the level meets the chi2 and maxError criteria,
+		// after levelIterations iterations, or when the best error improved by less than plateauRatio (relative)
+		// over the last plateauIterations iterations. The full point set only runs the last stage, with the
+		// given iterations and the distance volume refinement.
+		struct PyramidOptions
+		{
+			bool enabled = false;
+			int levels = 3;
+			double voxelSize = 4.0;
+			int minPoints = 30;
+			double plateauRatio = 0.01;
+			int plateauIterations = 3;
+			int levelIterations = 50;
+		};
+
+		// Correspondences reused from the last tree search of every point. A point that moved less than
+		// moveThreshold (surface units) since its last search is projected on the triangle found then instead of
+		// searched again, so its distance is at most 2 * moveThreshold above the exact one. Only the tree search
+		// is incremental; the VTK search and the distance volume answer every point as before.
+		struct IncrementalOptions
+		{
+			bool enabled = false;
+			double moveThreshold = 0.005;
+		};
+
+		// How the correspondences of one pass were found: searches (tree or VTK locator), projections on the
+		// cached triangle, and distance volume lookups.
+		struct CorrespondenceCounts
+		{
+			int full = 0;
+			int skipped = 0;
+			int volume = 0;
+		};
+
 		class LeastSquaresICP
 		{
 		private:
@@ -32,62 +135,148 @@ namespace TKA
 
 			double maxError;
 
-			cv::Mat Rx(double angle);
+			CorrespondenceSearch search;
 
-			cv::Mat Ry(double angle);
+			ResidualMode residual;
 
-			cv::Mat Rz(double angle);
+			ICPSolver solver;
 
-			cv::Mat DRx(double angle);
+			bool parallel;
 
-			cv::Mat DRy(double angle);
+			RandomInitOptions randomInit;
 
-			cv::Mat DRz(double angle);
+			DistanceVolumeOptions distanceVolume;
 
-			cv::Mat CreatePoint(double x, double y, double z);
+			PyramidOptions pyramid;
 
-			cv::Mat CreatePoint(cv::Point3d Point);
+			SourcePyramid sourcePyramid;
 
-			cv::Mat DF_Rx(double angleX, double angleY, double angleZ, const cv::Mat& Point);
+			// Set on the copies running a coarse level, enables the plateau test.
+			bool coarseLevel;
 
-			cv::Mat DF_Ry(double angleX, double angleY, double angleZ, const cv::Mat& Point);
+			// Whether the last solve met the chi2 and maxError criteria in the stage that reports convergence.
+			bool converged;
 
-			cv::Mat DF_Rz(double angleX, double angleY, double angleZ, const cv::Mat& Point);
+			IncrementalOptions incremental;
 
-			cv::Mat Jacobian(const cv::Mat& data, const cv::Mat& Point);
+			// One entry per correspondence pass of the last registration.
+			std::vector<CorrespondenceCounts> correspondenceCounts;
 
-			cv::Mat JacobianScale(const cv::Mat& data, const cv::Mat& Point);
+			cv::Mat Rx(double angle);
 
-			cv::Mat SquareError(const cv::Mat& data, const cv::Mat& source, const cv::Mat& target);
+			cv::Mat Ry(double angle);
 
-			cv::Mat SquareErrorScale(const cv::Mat& data, const cv::Mat& source, const cv::Mat& target);
+			cv::Mat Rz(double angle);
+
+			cv::Mat CreatePoint(double x, double y, double z);
+
+			cv::Mat CreatePoint(cv::Point3d Point);
 
 			void GetScale(const std::vector<cv::Point3d>& target, cv::Mat& data);
 
-			GaussNewton GetSystem(const std::vector<cv::Point3d>& target, const cv::Mat& data, int posBegin, int posEnd, double lambda = 0);
+			// Normal equations from the sums of J^T J and J^T r accumulated by TransformKernel.
+			GaussNewton GetSystem(const TransformKernel::Matrix66& A, const TransformKernel::Vector6& B, double chi, double localError, double lambda);
+
+			// normals are the surface normals at the targets, point-to-point residuals when null.
+			GaussNewton GetSystem(const std::vector<cv::Point3d>& target, const cv::Mat& data, int posBegin, int posEnd, double lambda = 0, const std::vector<cv::Point3d>* normals = NULL);
+
+			GaussNewton GetSystemScale(const std::vector<cv::Point3d>& target, const cv::Mat& data, int posBegin, int posEnd, double lambda = 0, const std::vector<cv::Point3d>* normals = NULL);
 
-			GaussNewton GetSystemScale(const std::vector<cv::Point3d>& target, const cv::Mat& data, int posBegin, int posEnd, double lambda = 0);
+			// Adds the residual of points[i] to the normal equations and returns its squared point distance.
+			double AccumulateResidual(const TransformKernel& kernel, const std::vector<cv::Point3d>& points, const std::vector<cv::Point3d>& pointNormals, const std::vector<cv::Point3d>& target, const std::vector<cv::Point3d>* normals, int i, TransformKernel::Matrix66& A, TransformKernel::Vector6& B) const;
 
 			GaussNewton GetSystem(const std::vector<PointTypeITK>& target, const cv::Mat& data, int posBegin, int posEnd, double lambda = 0);
 
 			cv::Point3d ClosestPoint(const vtkSmartPointer<vtkPolyData>& surface, double point[3]);
 
-			std::vector<cv::Point3d> GetCorrespondence(const vtkSmartPointer<vtkImplicitPolyDataDistance> implicitPolyDataDistance, const cv::Mat& data);
+			// Closest point structures of one surface. The index is shared by the copies handed to parallel runs.
+			// Without locators the index tree is searched.
+			struct SurfaceQuery
+			{
+				SurfaceIndex index;
+				// One locator per stripe, vtkImplicitPolyDataDistance cannot be queried from several threads.
+				std::vector<vtkSmartPointer<vtkImplicitPolyDataDistance>> implicitDistances;
+			};
+
+			// Last tree search of every point, in the order of the points and shuffled with them.
+			struct CorrespondenceCache
+			{
+				std::vector<cv::Point3d> position;
+				std::vector<int> triangle;
+			};
+
+			// Closest surface point of every transformed point, written into target (resized, not reallocated
+			// when the size does not change). exact skips the distance volume. When normals is given it receives
+			// the unit surface normal at every target, zero where there is none. With a cache the tree searches
+			// are incremental, see IncrementalOptions.
+			void FindCorrespondences(const SurfaceQuery& query, const std::vector<cv::Point3d>& points, const TransformKernel& kernel, std::vector<cv::Point3d>& target, bool exact, std::vector<cv::Point3d>* normals, CorrespondenceCache* cache = NULL);
+
+			void GetCorrespondence(const SurfaceQuery& query, const cv::Mat& data, std::vector<cv::Point3d>& target, bool exact = false, std::vector<cv::Point3d>* normals = NULL, CorrespondenceCache* cache = NULL);
+
+			void GetCorrespondenceScale(const SurfaceQuery& query, const cv::Mat& data, std::vector<cv::Point3d>& target, bool exact = false, std::vector<cv::Point3d>* normals = NULL, CorrespondenceCache* cache = NULL);
+
+			// The cache of the solver when incremental correspondences are enabled, null otherwise.
+			CorrespondenceCache* GetCache(CorrespondenceCache& cache) const;
+
+			// Only the structure used by the selected search is built. locators is the number of VTK locators,
+			// one per thread when 0.
+			void BuildSurface(const vtkSmartPointer<vtkPolyData>& surface, SurfaceQuery& query, int locators = 0);
+
+			// The solvers on a built surface. When the criteria are met they set *cancel, and they stop at the
+			// next iteration once it is set by another run. Return -1 without touching data if stopped before
+			// the first step. Solvers running on the distance volume continue with the refinement on exact
+			// correspondences, only that stage reports convergence.
+			double LeastSquares(const SurfaceQuery& query, cv::Mat& data, int iterations, std::atomic<bool>* cancel = NULL, bool exact = false);
+
+			double LeastSquaresScale(const SurfaceQuery& query, cv::Mat& data, int iterations, std::atomic<bool>* cancel = NULL, bool exact = false);
+
+			bool Refines(const SurfaceQuery& query, bool exact) const;
+
+			// SOLVER_CLOSED_FORM iterations, for the rigid (6 rows) and the scaled (7 rows) data vector.
+			double ClosedForm(const SurfaceQuery& query, cv::Mat& data, int iterations, std::atomic<bool>* cancel, bool exact, bool useScale);
+
+			double LeastSquaresTest(const vtkSmartPointer<vtkPolyData>& surface, const SurfaceQuery& query, cv::Mat& data, int iterations);
+
+			// Runs the coarse levels on copies of this object, then the full point set.
+			double Pyramid(const SurfaceQuery& query, cv::Mat& data, int iterations, std::atomic<bool>* cancel, bool useScale);
 
-			std::vector<cv::Point3d> GetCorrespondenceScale(const vtkSmartPointer<vtkImplicitPolyDataDistance> implicitPolyDataDistance, const cv::Mat& data);
+			// Replaces the source with a coarse level. aveSource stays the one of the full set, so the data
+			// vector means the same on every level.
+			void UseLevel(int level);
+
+			// Adds the best error of an iteration to history and tells whether a coarse level stopped improving.
+			bool Plateaued(std::vector<double>& history, double bestError) const;
+
+			// With the VTK search the runs share the first locator and go one after the other.
+			double RandomRestarts(const SurfaceQuery& query, cv::Mat& data, int iterations, bool useScale);
+
+			int GetNumberOfRuns() const;
+
+			static bool Cancelled(const std::atomic<bool>* cancel);
 
 			void shuffleSource();
 
 			void shuffleCenterSource();
 
+			// Same permutation as shuffleSource and shuffleCenterSource.
+			static void shuffleCache(CorrespondenceCache& cache);
+
+			void Initialize(const std::vector<cv::Point3d>& sourcePoints, const std::vector<cv::Point3d>& pSourceNormals);
+
 			std::vector<cv::Point3d> source;
 			std::vector<cv::Point3d> centerSource;
+			// Same order as source and centerSource, shuffled with them. Empty without normals.
+			std::vector<cv::Point3d> sourceNormals;
+			std::vector<cv::Point3d> centerSourceNormals;
 			cv::Point3d aveSource;
 		public:
 			LeastSquaresICP(const std::vector<PointTypeITK>& sourcePoints);
 
 			LeastSquaresICP(const std::vector<cv::Point3d>& sourcePoints);
 
+			// Unit normals of the source points, used by RESIDUAL_SYMMETRIC.
+			LeastSquaresICP(const std::vector<cv::Point3d>& sourcePoints, const std::vector<cv::Point3d>& pSourceNormals);
+
 			double LeastSquares(const vtkSmartPointer<vtkPolyData>& surface, cv::Mat& data, int iterations = 200);
 
 			double LeastSquaresScale(const vtkSmartPointer<vtkPolyData>& surface, cv::Mat& data, int iterations = 200);
@@ -98,6 +287,28 @@ namespace TKA
 
 			double LeastSquaresTest(const vtkSmartPointer<vtkPolyData>& surface, cv::Mat& data, int iterations = 100);
 
+			// Same registrations against a prebuilt index, nothing is built per call. Throw std::runtime_error when
+			// the index is empty (default constructed, or built from a surface without triangles).
+			double LeastSquares(const SurfaceIndex& index, cv::Mat& data, int iterations = 200);
+
+			double LeastSquaresScale(const SurfaceIndex& index, cv::Mat& data, int iterations = 200);
+
+			double LeastSquaresRandomInit(const SurfaceIndex& index, cv::Mat& data, int iterations = 200);
+
+			double LeastSquaresScaleRandomInit(const SurfaceIndex& index, cv::Mat& data, int iterations = 200);
+
+			// The surface is only drawn.
+			double LeastSquaresTest(const vtkSmartPointer<vtkPolyData>& surface, const SurfaceIndex& index, cv::Mat& data, int iterations = 100);
+
+			// Closest surface point of every source point moved by data (6 rows, or 7 with the scale), found as the
+			// registrations find them with the selected search and the distance volume when enabled. In the
+			// current order of the source points, which the registrations shuffle.
+			void GetCorrespondences(const vtkSmartPointer<vtkPolyData>& surface, const cv::Mat& data, std::vector<cv::Point3d>& target);
+
+			// Index of the surface as the vtkPolyData registrations build it: the tree, plus the volume when
+			// enabled in the DistanceVolumeOptions.
+			SurfaceIndex BuildIndex(const vtkSmartPointer<vtkPolyData>& surface) const;
+
 			cv::Mat GetRotationMatrix(double angleX, double angleY, double angleZ);
 
 			void setChi2(double pChi2);
@@ -108,6 +319,50 @@ namespace TKA
 
 			double getMaxError() const;
 
+			void setCorrespondenceSearch(CorrespondenceSearch pSearch);
+
+			CorrespondenceSearch getCorrespondenceSearch() const;
+
+			// LeastSquaresTest always uses point-to-point residuals.
+			void setResidualMode(ResidualMode pResidual);
+
+			ResidualMode getResidualMode() const;
+
+			void setSolver(ICPSolver pSolver);
+
+			ICPSolver getSolver() const;
+
+			// Spreads the correspondence search over cv::getNumThreads() threads. The results are the same as
+			// with a single thread.
+			void setParallel(bool pParallel);
+
+			bool getParallel() const;
+
+			// Throws std::runtime_error, and keeps the options, when a range is negative.
+			void setRandomInitOptions(const RandomInitOptions& pOptions);
+
+			RandomInitOptions getRandomInitOptions() const;
+
+			void setDistanceVolume(const DistanceVolumeOptions& pOptions);
+
+			DistanceVolumeOptions getDistanceVolume() const;
+
+			// Builds the levels from the current source points, so it is called after the constructor.
+			void setPyramid(const PyramidOptions& pOptions);
+
+			PyramidOptions getPyramid() const;
+
+			// Points of every level from the coarsest to the full set, only the full set when disabled.
+			std::vector<int> getPyramidLevelSizes() const;
+
+			void setIncremental(const IncrementalOptions& pOptions);
+
+			IncrementalOptions getIncremental() const;
+
+			// Counts of every correspondence pass of the last registration, in order: the coarse levels first
+			// with the pyramid, and only the chosen run with random restarts.
+			std::vector<CorrespondenceCounts> getCorrespondenceCounts() const;
+
 			static cv::Mat GetRotationAnglesXYZ(const std::vector<cv::Point3d>& threeVectorsSource, const std::vector<cv::Point3d>& threeVectorstarget, cv::Mat& data);
 		};
 	}
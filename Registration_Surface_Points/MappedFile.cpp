@@ -0,0 +1,160 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace TKA::REGISTRATION;
+
+MappedFile::MappedFile()
+{
+    data = NULL;
+    size = 0;
+
+#ifdef _WIN32
+    file = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+#else
+    file = -1;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart <= 0)
+    {
+        Close();
+        return false;
+    }
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (mapping == NULL)
+    {
+        Close();
+        return false;
+    }
+
+    data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+    if (data == NULL)
+    {
+        Close();
+        return false;
+    }
+
+    size = size_t(fileSize.QuadPart);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data != NULL)
+    {
+        UnmapViewOfFile(data);
+        data = NULL;
+    }
+
+    if (mapping != NULL)
+    {
+        CloseHandle(mapping);
+        mapping = NULL;
+    }
+
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+    }
+
+    size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+
+    file = ::open(path.c_str(), O_RDONLY);
+
+    if (file < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+
+    if (fstat(file, &info) != 0 || info.st_size <= 0)
+    {
+        Close();
+        return false;
+    }
+
+    void* view = mmap(NULL, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+
+    if (view == MAP_FAILED)
+    {
+        Close();
+        return false;
+    }
+
+    data = static_cast<const char*>(view);
+    size = size_t(info.st_size);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data != NULL)
+    {
+        munmap(const_cast<char*>(data), size);
+        data = NULL;
+    }
+
+    if (file >= 0)
+    {
+        ::close(file);
+        file = -1;
+    }
+
+    size = 0;
+}
+
+#endif
+
+const char* MappedFile::Data() const
+{
+    return data;
+}
+
+size_t MappedFile::Size() const
+{
+    return size;
+}
@@ -0,0 +1,45 @@
+#ifndef REGISTRATION_MAPPED_FILE_H
+#define REGISTRATION_MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+namespace TKA
+{
+	namespace REGISTRATION
+	{
+		// Read-only memory mapping of a whole file. Pages are loaded on demand and shared with the page cache
+		// and the other processes mapping the same file.
+		class MappedFile
+		{
+		public:
+			MappedFile();
+
+			~MappedFile();
+
+			bool Open(const std::string& path);
+
+			void Close();
+
+			const char* Data() const;
+
+			size_t Size() const;
+
+		private:
+			const char* data;
+			size_t size;
+
+#ifdef _WIN32
+			void* file;
+			void* mapping;
+#else
+			int file;
+#endif
+
+			MappedFile(const MappedFile&);
+			MappedFile& operator=(const MappedFile&);
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef REGISTRATION_SHARED_ARRAY_H
+#define REGISTRATION_SHARED_ARRAY_H
+
+#include <memory>
+#include <vector>
+
+namespace TKA
+{
+	namespace REGISTRATION
+	{
+		/*
+		* Read-only array whose elements are owned by someone else: a vector moved into it, or a memory mapped
+		* file holding them. Copies share the elements, which stay alive as long as one copy does.
+		*/
+		template<typename T>
+		class SharedArray
+		{
+		public:
+			SharedArray() : elements(NULL), count(0)
+			{
+			}
+
+			explicit SharedArray(std::vector<T>&& values)
+			{
+				std::shared_ptr<std::vector<T>> vector = std::make_shared<std::vector<T>>(std::move(values));
+				owner = vector;
+				elements = vector->data();
+				count = vector->size();
+			}
+
+			// pData must outlive pOwner.
+			SharedArray(const T* pData, size_t pCount, const std::shared_ptr<const void>& pOwner) : owner(pOwner), elements(pData), count(pCount)
+			{
+			}
+
+			const T& operator[](size_t index) const
+			{
+				return elements[index];
+			}
+
+			const T* data() const
+			{
+				return elements;
+			}
+
+			size_t size() const
+			{
+				return count;
+			}
+
+			bool empty() const
+			{
+				return count == 0;
+			}
+
+		private:
+			std::shared_ptr<const void> owner;
+			const T* elements;
+			size_t count;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,165 @@
+#include "SourcePyramid.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+using namespace TKA::REGISTRATION;
+
+namespace
+{
+    // Cells are hashed on 21 bits per axis, enough for any bone at any sensible cell size.
+    const int64_t CELL_BITS = 21;
+    const int64_t CELL_MASK = (int64_t(1) << CELL_BITS) - 1;
+
+    // A coarser level is only kept when it drops at least this share of the points of the level below.
+    const double MIN_REDUCTION = 0.1;
+
+    int64_t CellKey(const cv::Point3d& point, double voxelSize)
+    {
+        int64_t x = int64_t(std::floor(point.x / voxelSize)) & CELL_MASK;
+        int64_t y = int64_t(std::floor(point.y / voxelSize)) & CELL_MASK;
+        int64_t z = int64_t(std::floor(point.z / voxelSize)) & CELL_MASK;
+
+        return (x << (2 * CELL_BITS)) | (y << CELL_BITS) | z;
+    }
+
+    struct Cell
+    {
+        cv::Point3d sum;
+        int count;
+        int closest;
+        double closestDistance;
+    };
+}
+
+SourcePyramid::SourcePyramid()
+{
+}
+
+void SourcePyramid::Downsample(const std::vector<cv::Point3d>& points, const std::vector<cv::Point3d>& normals, double voxelSize, std::vector<cv::Point3d>& outPoints, std::vector<cv::Point3d>& outNormals)
+{
+    outPoints.clear();
+    outNormals.clear();
+
+    if (voxelSize <= 0)
+    {
+        outPoints = points;
+        outNormals = normals;
+        return;
+    }
+
+    int count = int(points.size());
+    std::unordered_map<int64_t, int> cellIndex;
+    std::vector<Cell> cells;
+    std::vector<int> pointCell(count);
+    cellIndex.reserve(count);
+
+    // Cells are numbered in the order they are first met, so the output keeps the order of the input.
+    for (int i = 0; i < count; i++)
+    {
+        std::pair<std::unordered_map<int64_t, int>::iterator, bool> found = cellIndex.insert(std::make_pair(CellKey(points[i], voxelSize), int(cells.size())));
+
+        if (found.second == true)
+        {
+            Cell cell;
+            cell.sum = cv::Point3d(0, 0, 0);
+            cell.count = 0;
+            cell.closest = -1;
+            cell.closestDistance = 0;
+            cells.push_back(cell);
+        }
+
+        Cell& cell = cells[found.first->second];
+        cell.sum += points[i];
+        cell.count++;
+        pointCell[i] = found.first->second;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        Cell& cell = cells[pointCell[i]];
+        cv::Point3d diff = points[i] - cell.sum / double(cell.count);
+        double distance = diff.dot(diff);
+
+        if (cell.closest < 0 || distance < cell.closestDistance)
+        {
+            cell.closest = i;
+            cell.closestDistance = distance;
+        }
+    }
+
+    bool hasNormals = normals.size() == points.size();
+    outPoints.reserve(cells.size());
+
+    if (hasNormals == true)
+    {
+        outNormals.reserve(cells.size());
+    }
+
+    for (int c = 0; c < int(cells.size()); c++)
+    {
+        outPoints.push_back(points[cells[c].closest]);
+
+        if (hasNormals == true)
+        {
+            outNormals.push_back(normals[cells[c].closest]);
+        }
+    }
+}
+
+void SourcePyramid::Build(const std::vector<cv::Point3d>& points, const std::vector<cv::Point3d>& normals, double voxelSize, int levels, int minPoints)
+{
+    Clear();
+
+    std::vector<std::vector<cv::Point3d>> finerPoints;
+    std::vector<std::vector<cv::Point3d>> finerNormals;
+    // Reserved so that below keeps pointing at the last level.
+    finerPoints.reserve(std::max(levels, 1));
+    finerNormals.reserve(std::max(levels, 1));
+    const std::vector<cv::Point3d>* below = &points;
+    const std::vector<cv::Point3d>* belowNormals = &normals;
+    double cellSize = voxelSize;
+
+    // Each level is sampled from the one below it, so the whole pyramid costs little more than the first level.
+    for (int level = 1; level < levels && voxelSize > 0; level++)
+    {
+        std::vector<cv::Point3d> levelPoint, levelNormal;
+        Downsample(*below, *belowNormals, cellSize, levelPoint, levelNormal);
+
+        if (int(levelPoint.size()) < minPoints || levelPoint.size() > (1.0 - MIN_REDUCTION) * below->size())
+        {
+            break;
+        }
+
+        finerPoints.push_back(std::move(levelPoint));
+        finerNormals.push_back(std::move(levelNormal));
+        below = &finerPoints.back();
+        belowNormals = &finerNormals.back();
+        cellSize *= 2;
+    }
+
+    levelPoints.assign(finerPoints.rbegin(), finerPoints.rend());
+    levelNormals.assign(finerNormals.rbegin(), finerNormals.rend());
+}
+
+void SourcePyramid::Clear()
+{
+    levelPoints.clear();
+    levelNormals.clear();
+}
+
+int SourcePyramid::GetNumberOfLevels() const
+{
+    return int(levelPoints.size());
+}
+
+const std::vector<cv::Point3d>& SourcePyramid::GetPoints(int level) const
+{
+    return levelPoints[level];
+}
+
+const std::vector<cv::Point3d>& SourcePyramid::GetNormals(int level) const
+{
+    return levelNormals[level];
+}
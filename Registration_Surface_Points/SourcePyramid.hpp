@@ -0,0 +1,48 @@
+#ifndef REGISTRATION_SOURCE_PYRAMID_H
+#define REGISTRATION_SOURCE_PYRAMID_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+namespace TKA
+{
+	namespace REGISTRATION
+	{
+		/*
+		* Coarser copies of a point set for coarse-to-fine registration. Each level keeps one point per cell of a
+		* voxel grid, the one closest to the centroid of the cell, so the levels are real samples of the surface
+		* and keep their normals. The grid cell doubles from one level to the next. Every level is built with one
+		* hashed pass over the previous one.
+		*/
+		class SourcePyramid
+		{
+		public:
+			SourcePyramid();
+
+			// Builds up to levels - 1 coarse levels, the finest with cells of voxelSize. Coarsening stops early when
+			// a level would have fewer than minPoints points or barely fewer than the one below. normals is empty
+			// or matches points.
+			void Build(const std::vector<cv::Point3d>& points, const std::vector<cv::Point3d>& normals, double voxelSize, int levels, int minPoints);
+
+			void Clear();
+
+			// Number of coarse levels, the full point set is not stored.
+			int GetNumberOfLevels() const;
+
+			// Level 0 is the coarsest.
+			const std::vector<cv::Point3d>& GetPoints(int level) const;
+
+			// Empty when built without normals.
+			const std::vector<cv::Point3d>& GetNormals(int level) const;
+
+			// One point per occupied cell of size voxelSize.
+			static void Downsample(const std::vector<cv::Point3d>& points, const std::vector<cv::Point3d>& normals, double voxelSize, std::vector<cv::Point3d>& outPoints, std::vector<cv::Point3d>& outNormals);
+
+		private:
+			std::vector<std::vector<cv::Point3d>> levelPoints;
+			std::vector<std::vector<cv::Point3d>> levelNormals;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,789 @@
+#include "SurfaceBVH.hpp"
+#include "vtkCellType.h"
+#include "vtkIdList.h"
+#include "vtkNew.h"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SURFACE_BVH_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SURFACE_BVH_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SURFACE_BVH_TARGET(isa)
+#endif
+
+using namespace TKA::REGISTRATION;
+
+namespace
+{
+    const int LEAF_SIZE = 4;
+    const int SAH_BINS = 16;
+    // Below this depth the builder stops trusting the heuristic and splits at the median, which bounds the
+    // depth of the tree and therefore the traversal stack.
+    const int MAX_SAH_DEPTH = 48;
+    const int STACK_SIZE = 128;
+
+    double SurfaceArea(const Eigen::Vector3d& lower, const Eigen::Vector3d& upper)
+    {
+        Eigen::Vector3d extent = (upper - lower).cwiseMax(0.0);
+        return 2.0 * (extent(0) * extent(1) + extent(1) * extent(2) + extent(2) * extent(0));
+    }
+
+    double BoxDistance(const SurfaceBVH::Node& node, const Eigen::Vector3d& point)
+    {
+        double distance = 0;
+
+        for (int i = 0; i < 3; i++)
+        {
+            double d = std::max(std::max(node.lower[i] - point(i), 0.0), point(i) - node.upper[i]);
+            distance += d * d;
+        }
+
+        return distance;
+    }
+
+    double Inverse(double value)
+    {
+        return (value > 0) ? 1.0 / value : 0.0;
+    }
+
+    typedef void (*PacketFunction)(const SurfaceBVH::TrianglePacket& packet, const Eigen::Vector3d& point, double* distance, double* u, double* v, double* w);
+
+    // Closest point of every lane: the projection on the plane when it falls inside the triangle, otherwise
+    // the closest of the three edges.
+    void PacketDistancesScalar(const SurfaceBVH::TrianglePacket& packet, const Eigen::Vector3d& point, double* distance, double* u, double* v, double* w)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            double apx = point(0) - packet.ax[lane];
+            double apy = point(1) - packet.ay[lane];
+            double apz = point(2) - packet.az[lane];
+
+            double d20 = apx * packet.abx[lane] + apy * packet.aby[lane] + apz * packet.abz[lane];
+            double d21 = apx * packet.acx[lane] + apy * packet.acy[lane] + apz * packet.acz[lane];
+
+            double bv = (packet.d11[lane] * d20 - packet.d01[lane] * d21) * packet.invDenom[lane];
+            double bw = (packet.d00[lane] * d21 - packet.d01[lane] * d20) * packet.invDenom[lane];
+            double bu = 1.0 - bv - bw;
+
+            double rx = apx - bv * packet.abx[lane] - bw * packet.acx[lane];
+            double ry = apy - bv * packet.aby[lane] - bw * packet.acy[lane];
+            double rz = apz - bv * packet.abz[lane] - bw * packet.acz[lane];
+            double best = (bu >= 0 && bv >= 0 && bw >= 0) ? rx * rx + ry * ry + rz * rz : std::numeric_limits<double>::max();
+
+            double t = std::min(std::max(d20 * packet.invAB[lane], 0.0), 1.0);
+            rx = apx - t * packet.abx[lane];
+            ry = apy - t * packet.aby[lane];
+            rz = apz - t * packet.abz[lane];
+            double d = rx * rx + ry * ry + rz * rz;
+
+            if (d < best)
+            {
+                best = d;
+                bu = 1.0 - t;
+                bv = t;
+                bw = 0;
+            }
+
+            t = std::min(std::max(d21 * packet.invAC[lane], 0.0), 1.0);
+            rx = apx - t * packet.acx[lane];
+            ry = apy - t * packet.acy[lane];
+            rz = apz - t * packet.acz[lane];
+            d = rx * rx + ry * ry + rz * rz;
+
+            if (d < best)
+            {
+                best = d;
+                bu = 1.0 - t;
+                bv = 0;
+                bw = t;
+            }
+
+            double bpx = apx - packet.abx[lane];
+            double bpy = apy - packet.aby[lane];
+            double bpz = apz - packet.abz[lane];
+            double d3 = bpx * packet.bcx[lane] + bpy * packet.bcy[lane] + bpz * packet.bcz[lane];
+
+            t = std::min(std::max(d3 * packet.invBC[lane], 0.0), 1.0);
+            rx = bpx - t * packet.bcx[lane];
+            ry = bpy - t * packet.bcy[lane];
+            rz = bpz - t * packet.bcz[lane];
+            d = rx * rx + ry * ry + rz * rz;
+
+            if (d < best)
+            {
+                best = d;
+                bu = 0;
+                bv = 1.0 - t;
+                bw = t;
+            }
+
+            distance[lane] = best;
+            u[lane] = bu;
+            v[lane] = bv;
+            w[lane] = bw;
+        }
+    }
+
+#ifdef SURFACE_BVH_X86
+    // Same kernel on the four lanes at once: all candidates are evaluated and the smallest kept, without
+    // branches. Compiled for AVX whatever the target of the build, and only called when the CPU has it.
+    SURFACE_BVH_TARGET("avx")
+    void PacketDistancesAVX(const SurfaceBVH::TrianglePacket& packet, const Eigen::Vector3d& point, double* distance, double* u, double* v, double* w)
+    {
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d infinity = _mm256_set1_pd(std::numeric_limits<double>::max());
+
+        __m256d abx = _mm256_loadu_pd(packet.abx), aby = _mm256_loadu_pd(packet.aby), abz = _mm256_loadu_pd(packet.abz);
+        __m256d acx = _mm256_loadu_pd(packet.acx), acy = _mm256_loadu_pd(packet.acy), acz = _mm256_loadu_pd(packet.acz);
+
+        __m256d apx = _mm256_sub_pd(_mm256_set1_pd(point(0)), _mm256_loadu_pd(packet.ax));
+        __m256d apy = _mm256_sub_pd(_mm256_set1_pd(point(1)), _mm256_loadu_pd(packet.ay));
+        __m256d apz = _mm256_sub_pd(_mm256_set1_pd(point(2)), _mm256_loadu_pd(packet.az));
+
+        __m256d d20 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(apx, abx), _mm256_mul_pd(apy, aby)), _mm256_mul_pd(apz, abz));
+        __m256d d21 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(apx, acx), _mm256_mul_pd(apy, acy)), _mm256_mul_pd(apz, acz));
+
+        __m256d d00 = _mm256_loadu_pd(packet.d00), d01 = _mm256_loadu_pd(packet.d01), d11 = _mm256_loadu_pd(packet.d11);
+        __m256d invDenom = _mm256_loadu_pd(packet.invDenom);
+
+        __m256d bv = _mm256_mul_pd(_mm256_sub_pd(_mm256_mul_pd(d11, d20), _mm256_mul_pd(d01, d21)), invDenom);
+        __m256d bw = _mm256_mul_pd(_mm256_sub_pd(_mm256_mul_pd(d00, d21), _mm256_mul_pd(d01, d20)), invDenom);
+        __m256d bu = _mm256_sub_pd(_mm256_sub_pd(one, bv), bw);
+
+        __m256d inside = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(bu, zero, _CMP_GE_OQ), _mm256_cmp_pd(bv, zero, _CMP_GE_OQ)), _mm256_cmp_pd(bw, zero, _CMP_GE_OQ));
+
+        __m256d rx = _mm256_sub_pd(_mm256_sub_pd(apx, _mm256_mul_pd(bv, abx)), _mm256_mul_pd(bw, acx));
+        __m256d ry = _mm256_sub_pd(_mm256_sub_pd(apy, _mm256_mul_pd(bv, aby)), _mm256_mul_pd(bw, acy));
+        __m256d rz = _mm256_sub_pd(_mm256_sub_pd(apz, _mm256_mul_pd(bv, abz)), _mm256_mul_pd(bw, acz));
+        __m256d best = _mm256_blendv_pd(infinity, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(rx, rx), _mm256_mul_pd(ry, ry)), _mm256_mul_pd(rz, rz)), inside);
+
+        // Edge AB, barycentrics (1 - t, t, 0).
+        __m256d t = _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(d20, _mm256_loadu_pd(packet.invAB)), zero), one);
+        rx = _mm256_sub_pd(apx, _mm256_mul_pd(t, abx));
+        ry = _mm256_sub_pd(apy, _mm256_mul_pd(t, aby));
+        rz = _mm256_sub_pd(apz, _mm256_mul_pd(t, abz));
+        __m256d d = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(rx, rx), _mm256_mul_pd(ry, ry)), _mm256_mul_pd(rz, rz));
+        __m256d closer = _mm256_cmp_pd(d, best, _CMP_LT_OQ);
+        best = _mm256_blendv_pd(best, d, closer);
+        bu = _mm256_blendv_pd(bu, _mm256_sub_pd(one, t), closer);
+        bv = _mm256_blendv_pd(bv, t, closer);
+        bw = _mm256_blendv_pd(bw, zero, closer);
+
+        // Edge AC, barycentrics (1 - t, 0, t).
+        t = _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(d21, _mm256_loadu_pd(packet.invAC)), zero), one);
+        rx = _mm256_sub_pd(apx, _mm256_mul_pd(t, acx));
+        ry = _mm256_sub_pd(apy, _mm256_mul_pd(t, acy));
+        rz = _mm256_sub_pd(apz, _mm256_mul_pd(t, acz));
+        d = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(rx, rx), _mm256_mul_pd(ry, ry)), _mm256_mul_pd(rz, rz));
+        closer = _mm256_cmp_pd(d, best, _CMP_LT_OQ);
+        best = _mm256_blendv_pd(best, d, closer);
+        bu = _mm256_blendv_pd(bu, _mm256_sub_pd(one, t), closer);
+        bv = _mm256_blendv_pd(bv, zero, closer);
+        bw = _mm256_blendv_pd(bw, t, closer);
+
+        // Edge BC, barycentrics (0, 1 - t, t).
+        __m256d bcx = _mm256_loadu_pd(packet.bcx), bcy = _mm256_loadu_pd(packet.bcy), bcz = _mm256_loadu_pd(packet.bcz);
+        __m256d bpx = _mm256_sub_pd(apx, abx), bpy = _mm256_sub_pd(apy, aby), bpz = _mm256_sub_pd(apz, abz);
+        __m256d d3 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(bpx, bcx), _mm256_mul_pd(bpy, bcy)), _mm256_mul_pd(bpz, bcz));
+        t = _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(d3, _mm256_loadu_pd(packet.invBC)), zero), one);
+        rx = _mm256_sub_pd(bpx, _mm256_mul_pd(t, bcx));
+        ry = _mm256_sub_pd(bpy, _mm256_mul_pd(t, bcy));
+        rz = _mm256_sub_pd(bpz, _mm256_mul_pd(t, bcz));
+        d = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(rx, rx), _mm256_mul_pd(ry, ry)), _mm256_mul_pd(rz, rz));
+        closer = _mm256_cmp_pd(d, best, _CMP_LT_OQ);
+        best = _mm256_blendv_pd(best, d, closer);
+        bu = _mm256_blendv_pd(bu, zero, closer);
+        bv = _mm256_blendv_pd(bv, _mm256_sub_pd(one, t), closer);
+        bw = _mm256_blendv_pd(bw, t, closer);
+
+        _mm256_storeu_pd(distance, best);
+        _mm256_storeu_pd(u, bu);
+        _mm256_storeu_pd(v, bv);
+        _mm256_storeu_pd(w, bw);
+    }
+#endif
+
+    bool DetectAVX()
+    {
+#ifdef SURFACE_BVH_X86
+        return cv::checkHardwareSupport(CV_CPU_AVX);
+#else
+        return false;
+#endif
+    }
+
+    std::atomic<bool>& AVXChoice()
+    {
+        static std::atomic<bool> avx{ DetectAVX() };
+        return avx;
+    }
+
+    PacketFunction PacketKernel()
+    {
+#ifdef SURFACE_BVH_X86
+        if (AVXChoice().load() == true)
+        {
+            return PacketDistancesAVX;
+        }
+#endif
+        return PacketDistancesScalar;
+    }
+}
+
+SurfaceBVH::SurfaceBVH()
+{
+}
+
+void SurfaceBVH::Build(const vtkSmartPointer<vtkPolyData>& surface)
+{
+    std::vector<Eigen::Vector3d> points(surface->GetNumberOfPoints());
+
+    for (vtkIdType i = 0; i < surface->GetNumberOfPoints(); i++)
+    {
+        double pnt[3];
+        surface->GetPoint(i, pnt);
+        points[i] = Eigen::Vector3d(pnt[0], pnt[1], pnt[2]);
+    }
+
+    std::vector<Eigen::Vector3i> faces;
+    std::vector<int> ids;
+    vtkNew<vtkIdList> cellPoints;
+
+    for (vtkIdType cell = 0; cell < surface->GetNumberOfCells(); cell++)
+    {
+        int type = surface->GetCellType(cell);
+
+        // Vertices and lines, poly-vertices and polylines included, have no area.
+        if (type != VTK_TRIANGLE && type != VTK_QUAD && type != VTK_POLYGON && type != VTK_TRIANGLE_STRIP)
+        {
+            continue;
+        }
+
+        surface->GetCellPoints(cell, cellPoints);
+
+        for (vtkIdType k = 2; k < cellPoints->GetNumberOfIds(); k++)
+        {
+            if (type == VTK_TRIANGLE_STRIP)
+            {
+                // Every other triangle of a strip is flipped to keep the orientation of the first one.
+                vtkIdType first = (k % 2 == 0) ? k - 2 : k - 1;
+                vtkIdType second = (k % 2 == 0) ? k - 1 : k - 2;
+                faces.push_back(Eigen::Vector3i(int(cellPoints->GetId(first)), int(cellPoints->GetId(second)), int(cellPoints->GetId(k))));
+            }
+            else
+            {
+                // Polygons are split in a fan around their first vertex.
+                faces.push_back(Eigen::Vector3i(int(cellPoints->GetId(0)), int(cellPoints->GetId(k - 1)), int(cellPoints->GetId(k))));
+            }
+
+            ids.push_back(int(cell));
+        }
+    }
+
+    Build(points, faces, ids);
+}
+
+void SurfaceBVH::Build(const std::vector<Eigen::Vector3d>& pVertices, const std::vector<Eigen::Vector3i>& pTriangles, const std::vector<int>& pCellIds)
+{
+    std::vector<int> ids = pCellIds;
+
+    if (ids.size() != pTriangles.size())
+    {
+        ids.resize(pTriangles.size());
+
+        for (size_t i = 0; i < pTriangles.size(); i++)
+        {
+            ids[i] = int(i);
+        }
+    }
+
+    vertices = SharedArray<Eigen::Vector3d>(std::vector<Eigen::Vector3d>(pVertices));
+    triangles = SharedArray<Eigen::Vector3i>(std::vector<Eigen::Vector3i>(pTriangles));
+    cellIds = SharedArray<int>(std::move(ids));
+    nodes = SharedArray<Node>();
+    packets = SharedArray<TrianglePacket>();
+
+    if (triangles.empty())
+    {
+        return;
+    }
+
+    std::vector<BuildItem> items(triangles.size());
+
+    for (size_t i = 0; i < triangles.size(); i++)
+    {
+        const Eigen::Vector3d& A = vertices[triangles[i](0)];
+        const Eigen::Vector3d& B = vertices[triangles[i](1)];
+        const Eigen::Vector3d& C = vertices[triangles[i](2)];
+
+        items[i].lower = A.cwiseMin(B).cwiseMin(C);
+        items[i].upper = A.cwiseMax(B).cwiseMax(C);
+        items[i].centroid = (A + B + C) / 3.0;
+        items[i].index = int(i);
+    }
+
+    std::vector<Node> buildNodes;
+    std::vector<TrianglePacket> buildPackets;
+    buildNodes.reserve(2 * (triangles.size() / 2 + 1));
+    buildPackets.reserve(triangles.size() / 2 + 1);
+
+    buildNodes.push_back(Node());
+    BuildNode(buildNodes, buildPackets, 0, items, 0, int(items.size()), 0);
+
+    nodes = SharedArray<Node>(std::move(buildNodes));
+    packets = SharedArray<TrianglePacket>(std::move(buildPackets));
+}
+
+void SurfaceBVH::BuildNode(std::vector<Node>& buildNodes, std::vector<TrianglePacket>& buildPackets, int nodeIndex, std::vector<BuildItem>& items, int first, int count, int depth)
+{
+    Eigen::Vector3d lower = items[first].lower;
+    Eigen::Vector3d upper = items[first].upper;
+    Eigen::Vector3d centroidLower = items[first].centroid;
+    Eigen::Vector3d centroidUpper = items[first].centroid;
+
+    for (int i = first + 1; i < first + count; i++)
+    {
+        lower = lower.cwiseMin(items[i].lower);
+        upper = upper.cwiseMax(items[i].upper);
+        centroidLower = centroidLower.cwiseMin(items[i].centroid);
+        centroidUpper = centroidUpper.cwiseMax(items[i].centroid);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        buildNodes[nodeIndex].lower[i] = lower(i);
+        buildNodes[nodeIndex].upper[i] = upper(i);
+    }
+
+    if (count <= LEAF_SIZE)
+    {
+        AddLeaf(buildNodes[nodeIndex], buildPackets, items, first, count);
+        return;
+    }
+
+    int axis;
+    double extent = (centroidUpper - centroidLower).maxCoeff(&axis);
+    int middle = -1;
+
+    if (extent > 0 && depth < MAX_SAH_DEPTH)
+    {
+        int binCount[SAH_BINS] = { 0 };
+        Eigen::Vector3d binLower[SAH_BINS], binUpper[SAH_BINS];
+        double binScale = SAH_BINS / extent;
+
+        for (int b = 0; b < SAH_BINS; b++)
+        {
+            binLower[b] = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+            binUpper[b] = Eigen::Vector3d::Constant(-std::numeric_limits<double>::max());
+        }
+
+        for (int i = first; i < first + count; i++)
+        {
+            int b = std::min(SAH_BINS - 1, int((items[i].centroid(axis) - centroidLower(axis)) * binScale));
+            binCount[b]++;
+            binLower[b] = binLower[b].cwiseMin(items[i].lower);
+            binUpper[b] = binUpper[b].cwiseMax(items[i].upper);
+        }
+
+        // Cost of splitting after bin b: triangles times box area on each side.
+        double rightCost[SAH_BINS];
+        Eigen::Vector3d sweepLower = binLower[SAH_BINS - 1];
+        Eigen::Vector3d sweepUpper = binUpper[SAH_BINS - 1];
+        int sweepCount = binCount[SAH_BINS - 1];
+
+        for (int b = SAH_BINS - 2; b >= 0; b--)
+        {
+            rightCost[b] = sweepCount * SurfaceArea(sweepLower, sweepUpper);
+            sweepLower = sweepLower.cwiseMin(binLower[b]);
+            sweepUpper = sweepUpper.cwiseMax(binUpper[b]);
+            sweepCount += binCount[b];
+        }
+
+        double bestCost = std::numeric_limits<double>::max();
+        int bestBin = -1;
+        sweepLower = binLower[0];
+        sweepUpper = binUpper[0];
+        sweepCount = 0;
+
+        for (int b = 0; b < SAH_BINS - 1; b++)
+        {
+            sweepLower = sweepLower.cwiseMin(binLower[b]);
+            sweepUpper = sweepUpper.cwiseMax(binUpper[b]);
+            sweepCount += binCount[b];
+
+            double cost = sweepCount * SurfaceArea(sweepLower, sweepUpper) + rightCost[b];
+
+            if (sweepCount > 0 && sweepCount < count && cost < bestCost)
+            {
+                bestCost = cost;
+                bestBin = b;
+            }
+        }
+
+        if (bestBin >= 0)
+        {
+            double split = centroidLower(axis);
+            BuildItem* middleItem = std::partition(&items[first], &items[first] + count, [&](const BuildItem& item)
+            {
+                return std::min(SAH_BINS - 1, int((item.centroid(axis) - split) * binScale)) <= bestBin;
+            });
+
+            middle = int(middleItem - &items[0]);
+        }
+    }
+
+    if (middle <= first || middle >= first + count)
+    {
+        middle = first + count / 2;
+        std::nth_element(&items[first], &items[middle], &items[first] + count, [axis](const BuildItem& a, const BuildItem& b)
+        {
+            return a.centroid(axis) < b.centroid(axis);
+        });
+    }
+
+    // Children are stored next to each other, the reference to the parent is not kept across the push_back.
+    int child = int(buildNodes.size());
+    buildNodes[nodeIndex].first = child;
+    buildNodes[nodeIndex].count = 0;
+    buildNodes.push_back(Node());
+    buildNodes.push_back(Node());
+
+    BuildNode(buildNodes, buildPackets, child, items, first, middle - first, depth + 1);
+    BuildNode(buildNodes, buildPackets, child + 1, items, middle, first + count - middle, depth + 1);
+}
+
+void SurfaceBVH::AddLeaf(Node& node, std::vector<TrianglePacket>& buildPackets, const std::vector<BuildItem>& items, int first, int count)
+{
+    node.first = int(buildPackets.size());
+    node.count = count;
+
+    TrianglePacket packet;
+
+    for (int lane = 0; lane < 4; lane++)
+    {
+        // Unused lanes repeat the first triangle, they can never beat it.
+        SetLane(packet, lane, items[first + ((lane < count) ? lane : 0)].index);
+    }
+
+    buildPackets.push_back(packet);
+}
+
+void SurfaceBVH::SetLane(TrianglePacket& packet, int lane, int index) const
+{
+    const Eigen::Vector3d& A = vertices[triangles[index](0)];
+    const Eigen::Vector3d& B = vertices[triangles[index](1)];
+    const Eigen::Vector3d& C = vertices[triangles[index](2)];
+
+    Eigen::Vector3d ab = B - A;
+    Eigen::Vector3d ac = C - A;
+    Eigen::Vector3d bc = C - B;
+
+    double d00 = ab.dot(ab);
+    double d01 = ab.dot(ac);
+    double d11 = ac.dot(ac);
+    double denom = d00 * d11 - d01 * d01;
+
+    packet.ax[lane] = A(0);
+    packet.ay[lane] = A(1);
+    packet.az[lane] = A(2);
+    packet.abx[lane] = ab(0);
+    packet.aby[lane] = ab(1);
+    packet.abz[lane] = ab(2);
+    packet.acx[lane] = ac(0);
+    packet.acy[lane] = ac(1);
+    packet.acz[lane] = ac(2);
+    packet.bcx[lane] = bc(0);
+    packet.bcy[lane] = bc(1);
+    packet.bcz[lane] = bc(2);
+    packet.d00[lane] = d00;
+    packet.d01[lane] = d01;
+    packet.d11[lane] = d11;
+    // Degenerate triangles project on A, which is on the triangle, and their edges do the rest.
+    packet.invDenom[lane] = (denom > std::numeric_limits<double>::epsilon() * d00 * d11) ? 1.0 / denom : 0.0;
+    packet.invAB[lane] = Inverse(d00);
+    packet.invAC[lane] = Inverse(d11);
+    packet.invBC[lane] = Inverse(bc.dot(bc));
+    packet.index[lane] = index;
+}
+
+void SurfaceBVH::TestPacket(const TrianglePacket& packet, const Eigen::Vector3d& point, double& bestDistance, int& bestIndex, double& bestU, double& bestV, double& bestW) const
+{
+    double distance[4], u[4], v[4], w[4];
+    PacketKernel()(packet, point, distance, u, v, w);
+
+    for (int lane = 0; lane < 4; lane++)
+    {
+        if (distance[lane] < bestDistance)
+        {
+            bestDistance = distance[lane];
+            bestIndex = packet.index[lane];
+            bestU = u[lane];
+            bestV = v[lane];
+            bestW = w[lane];
+        }
+    }
+}
+
+bool SurfaceBVH::IsAVXEnabled()
+{
+    return AVXChoice().load();
+}
+
+bool SurfaceBVH::SetAVX(bool enable)
+{
+    if (enable == true && DetectAVX() == false)
+    {
+        return false;
+    }
+
+    AVXChoice().store(enable);
+    return true;
+}
+
+SurfaceHit SurfaceBVH::ClosestPoint(const cv::Point3d& pPoint, double maxSquaredDistance) const
+{
+    SurfaceHit hit;
+
+    if (nodes.empty())
+    {
+        return hit;
+    }
+
+    Eigen::Vector3d point(pPoint.x, pPoint.y, pPoint.z);
+
+    double bestDistance = maxSquaredDistance;
+    int bestIndex = -1;
+    double bestU = 0, bestV = 0, bestW = 0;
+
+    int stackNode[STACK_SIZE];
+    double stackDistance[STACK_SIZE];
+    int size = 0;
+
+    double rootDistance = BoxDistance(nodes[0], point);
+
+    if (rootDistance < bestDistance)
+    {
+        stackNode[size] = 0;
+        stackDistance[size] = rootDistance;
+        size++;
+    }
+
+    while (size > 0)
+    {
+        size--;
+
+        // The best distance may have shrunk since the node was pushed.
+        if (stackDistance[size] >= bestDistance)
+        {
+            continue;
+        }
+
+        const Node& node = nodes[stackNode[size]];
+
+        if (node.count > 0)
+        {
+            TestPacket(packets[node.first], point, bestDistance, bestIndex, bestU, bestV, bestW);
+            continue;
+        }
+
+        int nearChild = node.first;
+        int farChild = node.first + 1;
+        double nearDistance = BoxDistance(nodes[nearChild], point);
+        double farDistance = BoxDistance(nodes[farChild], point);
+
+        if (farDistance < nearDistance)
+        {
+            std::swap(nearChild, farChild);
+            std::swap(nearDistance, farDistance);
+        }
+
+        // The far child is pushed first so the near one is visited next.
+        if (farDistance < bestDistance)
+        {
+            stackNode[size] = farChild;
+            stackDistance[size] = farDistance;
+            size++;
+        }
+
+        if (nearDistance < bestDistance)
+        {
+            stackNode[size] = nearChild;
+            stackDistance[size] = nearDistance;
+            size++;
+        }
+    }
+
+    if (bestIndex >= 0)
+    {
+        const Eigen::Vector3i& triangle = triangles[bestIndex];
+        Eigen::Vector3d closest = bestU * vertices[triangle(0)] + bestV * vertices[triangle(1)] + bestW * vertices[triangle(2)];
+
+        hit.point = cv::Point3d(closest(0), closest(1), closest(2));
+        hit.triangle = cellIds[bestIndex];
+        hit.index = bestIndex;
+        hit.u = bestU;
+        hit.v = bestV;
+        hit.w = bestW;
+        hit.squaredDistance = bestDistance;
+    }
+
+    return hit;
+}
+
+SurfaceHit SurfaceBVH::ClosestPointOnTriangle(int index, const cv::Point3d& pPoint) const
+{
+    SurfaceHit hit;
+    Eigen::Vector3d point(pPoint.x, pPoint.y, pPoint.z);
+
+    // The packet kernel on four copies of the triangle, so the distance is the one a search would find.
+    TrianglePacket packet;
+
+    for (int lane = 0; lane < 4; lane++)
+    {
+        SetLane(packet, lane, index);
+    }
+
+    double bestDistance = std::numeric_limits<double>::max();
+    int bestIndex = -1;
+    TestPacket(packet, point, bestDistance, bestIndex, hit.u, hit.v, hit.w);
+
+    const Eigen::Vector3i& triangle = triangles[index];
+    Eigen::Vector3d closest = hit.u * vertices[triangle(0)] + hit.v * vertices[triangle(1)] + hit.w * vertices[triangle(2)];
+
+    hit.point = cv::Point3d(closest(0), closest(1), closest(2));
+    hit.triangle = cellIds[index];
+    hit.index = index;
+    hit.squaredDistance = bestDistance;
+
+    return hit;
+}
+
+void SurfaceBVH::ClosestPoints(const std::vector<cv::Point3d>& points, std::vector<SurfaceHit>& hits) const
+{
+    hits.resize(points.size());
+
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        hits[i] = ClosestPoint(points[i]);
+    }
+}
+
+bool SurfaceBVH::Empty() const
+{
+    return nodes.empty();
+}
+
+int SurfaceBVH::GetNumberOfTriangles() const
+{
+    return int(triangles.size());
+}
+
+int SurfaceBVH::GetNumberOfNodes() const
+{
+    return int(nodes.size());
+}
+
+void SurfaceBVH::GetBounds(Eigen::Vector3d& lower, Eigen::Vector3d& upper) const
+{
+    if (nodes.empty() == true)
+    {
+        lower = Eigen::Vector3d::Constant(1.0);
+        upper = Eigen::Vector3d::Constant(-1.0);
+        return;
+    }
+
+    lower = Eigen::Vector3d(nodes[0].lower[0], nodes[0].lower[1], nodes[0].lower[2]);
+    upper = Eigen::Vector3d(nodes[0].upper[0], nodes[0].upper[1], nodes[0].upper[2]);
+}
+
+void SurfaceBVH::GetTriangle(int index, Eigen::Vector3d& A, Eigen::Vector3d& B, Eigen::Vector3d& C) const
+{
+    A = vertices[triangles[index](0)];
+    B = vertices[triangles[index](1)];
+    C = vertices[triangles[index](2)];
+}
+
+Eigen::Vector3d SurfaceBVH::GetNormal(int index) const
+{
+    Eigen::Vector3d A, B, C;
+    GetTriangle(index, A, B, C);
+
+    Eigen::Vector3d normal = (B - A).cross(C - A);
+    double length = normal.norm();
+
+    return (length > 0) ? Eigen::Vector3d(normal / length) : Eigen::Vector3d::Zero();
+}
+
+bool SurfaceBVH::IsConsistent() const
+{
+    const size_t maxIndex = size_t(std::numeric_limits<int>::max());
+
+    if (vertices.size() > maxIndex || triangles.size() > maxIndex || nodes.size() > maxIndex || packets.size() > maxIndex ||
+        cellIds.size() != triangles.size())
+    {
+        return false;
+    }
+
+    int vertexCount = int(vertices.size());
+    int triangleCount = int(triangles.size());
+    int nodeCount = int(nodes.size());
+    int packetCount = int(packets.size());
+
+    for (int i = 0; i < triangleCount; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            if (triangles[i](j) < 0 || triangles[i](j) >= vertexCount)
+            {
+                return false;
+            }
+        }
+    }
+
+    for (int i = 0; i < packetCount; i++)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            if (packets[i].index[lane] < 0 || packets[i].index[lane] >= triangleCount)
+            {
+                return false;
+            }
+        }
+    }
+
+    // The builder stores children after their parent, which also rules out cycles. Nodes are visited in order,
+    // so depth holds the longest path from the root when a node is reached; the stack grows by at most one entry
+    // per level.
+    std::vector<int> depth(nodeCount, 0);
+
+    for (int i = 0; i < nodeCount; i++)
+    {
+        const Node& node = nodes[i];
+
+        if (node.count > 0)
+        {
+            if (node.count > LEAF_SIZE || node.first < 0 || node.first >= packetCount)
+            {
+                return false;
+            }
+            continue;
+        }
+
+        if (node.count < 0 || node.first <= i || node.first >= nodeCount - 1 || depth[i] + 2 >= STACK_SIZE)
+        {
+            return false;
+        }
+
+        depth[node.first] = std::max(depth[node.first], depth[i] + 1);
+        depth[node.first + 1] = std::max(depth[node.first + 1], depth[i] + 1);
+    }
+
+    return true;
+}
@@ -0,0 +1,131 @@
+#ifndef REGISTRATION_SURFACE_BVH_H
+#define REGISTRATION_SURFACE_BVH_H
+
+#include <opencv2/core.hpp>
+#include <Eigen/Dense>
+#include <limits>
+#include <vector>
+#include "vtkSmartPointer.h"
+#include "vtkPolyData.h"
+#include "SharedArray.hpp"
+
+namespace TKA
+{
+	namespace REGISTRATION
+	{
+		// Closest point on the surface. triangle is the vtk cell id (polygons are split in fans, so several
+		// triangles can share a cell) and point = u * A + v * B + w * C on the triangle vertices.
+		struct SurfaceHit
+		{
+			cv::Point3d point;
+			int triangle = -1;
+			int index = -1;
+			double u = 0, v = 0, w = 0;
+			double squaredDistance = std::numeric_limits<double>::max();
+		};
+
+		class SurfaceIndex;
+
+		/*
+		* Bounding volume hierarchy over the triangles of a surface for closest point queries. Built with the
+		* binned surface area heuristic into a flat array of 56-byte nodes, every leaf holds at most four
+		* triangles stored side by side, so one leaf is tested with a single 4-wide point-triangle kernel
+		* (AVX when the CPU has it, chosen at runtime).
+		*/
+		class SurfaceBVH
+		{
+		public:
+			struct Node
+			{
+				double lower[3];
+				double upper[3];
+				// Leaves: index of the triangle packet and number of triangles (1 to 4).
+				// Internal nodes: index of the first child, the second one follows it, and count 0.
+				int first;
+				int count;
+			};
+
+			// Four triangles in structure-of-arrays layout with the terms of the distance kernel precomputed.
+			struct TrianglePacket
+			{
+				double ax[4], ay[4], az[4];
+				double abx[4], aby[4], abz[4];
+				double acx[4], acy[4], acz[4];
+				double bcx[4], bcy[4], bcz[4];
+				double d00[4], d01[4], d11[4];
+				double invDenom[4], invAB[4], invAC[4], invBC[4];
+				int index[4];
+			};
+
+			SurfaceBVH();
+
+			// Triangulates the triangles, quads, polygons and triangle strips of the surface and builds the tree.
+			// Vertices and lines are ignored.
+			void Build(const vtkSmartPointer<vtkPolyData>& surface);
+
+			// cellIds gives the triangle id reported in SurfaceHit, the triangle index when empty.
+			void Build(const std::vector<Eigen::Vector3d>& vertices, const std::vector<Eigen::Vector3i>& triangles, const std::vector<int>& cellIds = std::vector<int>());
+
+			// Only triangles closer than sqrt(maxSquaredDistance) are considered, the hit has triangle -1 if none is.
+			SurfaceHit ClosestPoint(const cv::Point3d& point, double maxSquaredDistance = std::numeric_limits<double>::max()) const;
+
+			// Closest point of a single triangle (SurfaceHit::index), without the tree.
+			SurfaceHit ClosestPointOnTriangle(int index, const cv::Point3d& point) const;
+
+			void ClosestPoints(const std::vector<cv::Point3d>& points, std::vector<SurfaceHit>& hits) const;
+
+			bool Empty() const;
+
+			int GetNumberOfTriangles() const;
+
+			int GetNumberOfNodes() const;
+
+			// Bounding box of all the triangles, empty trees give lower > upper.
+			void GetBounds(Eigen::Vector3d& lower, Eigen::Vector3d& upper) const;
+
+			// Vertices of triangle index (SurfaceHit::index).
+			void GetTriangle(int index, Eigen::Vector3d& A, Eigen::Vector3d& B, Eigen::Vector3d& C) const;
+
+			// Unit normal (B - A) x (C - A) of triangle index, zero for degenerate triangles.
+			Eigen::Vector3d GetNormal(int index) const;
+
+			// Whether leaves are tested with the AVX kernel, detected from the CPU at startup. SetAVX replaces the
+			// choice for every later query, for tests and benchmarks; it returns false, and changes nothing, when
+			// enabling AVX on a CPU without it.
+			static bool IsAVXEnabled();
+
+			static bool SetAVX(bool enable);
+
+		private:
+			// Saved and loaded by SurfaceIndex, the arrays of a loaded tree point into the mapped file.
+			friend class SurfaceIndex;
+
+			struct BuildItem
+			{
+				Eigen::Vector3d lower, upper, centroid;
+				int index;
+			};
+
+			SharedArray<Node> nodes;
+			SharedArray<TrianglePacket> packets;
+			SharedArray<Eigen::Vector3d> vertices;
+			SharedArray<Eigen::Vector3i> triangles;
+			SharedArray<int> cellIds;
+
+			void BuildNode(std::vector<Node>& buildNodes, std::vector<TrianglePacket>& buildPackets, int nodeIndex, std::vector<BuildItem>& items, int first, int count, int depth);
+
+			void AddLeaf(Node& node, std::vector<TrianglePacket>& buildPackets, const std::vector<BuildItem>& items, int first, int count);
+
+			// Copies triangle index and its precomputed terms into one lane of packet.
+			void SetLane(TrianglePacket& packet, int lane, int index) const;
+
+			void TestPacket(const TrianglePacket& packet, const Eigen::Vector3d& point, double& bestDistance, int& bestIndex, double& bestU, double& bestV, double& bestW) const;
+
+			// Whether every index of the arrays is in range and the tree fits the traversal stack, checked on the
+			// arrays of a loaded file before any query reads them.
+			bool IsConsistent() const;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,270 @@
+#include "SurfaceIndex.hpp"
+#include "MappedFile.hpp"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+using namespace TKA::REGISTRATION;
+
+namespace
+{
+    const char FILE_MAGIC[8] = { 'T', 'K', 'A', 'S', 'I', 'D', 'X', '\0' };
+    const uint32_t FILE_VERSION = 1;
+    const uint32_t FILE_BYTE_ORDER = 0x01020304;
+    // Every array starts on a cache line, the mapping itself is page aligned.
+    const uint64_t SECTION_ALIGNMENT = 64;
+
+    enum Section
+    {
+        SECTION_VERTICES,
+        SECTION_TRIANGLES,
+        SECTION_CELL_IDS,
+        SECTION_NODES,
+        SECTION_PACKETS,
+        SECTION_BRICKS,
+        SECTION_SAMPLES,
+        SECTION_COUNT
+    };
+
+    // The arrays are stored as they are in memory, so a file is only read by a build with the same element
+    // sizes and byte order.
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint32_t elementSize[SECTION_COUNT];
+        uint32_t hasVolume;
+        double origin[3];
+        double spacing;
+        double bandWidth;
+        double maxSpread;
+        int32_t size[3];
+        int32_t bricks[3];
+        uint64_t offset[SECTION_COUNT];
+        uint64_t count[SECTION_COUNT];
+    };
+
+    const uint32_t ELEMENT_SIZE[SECTION_COUNT] =
+    {
+        uint32_t(sizeof(Eigen::Vector3d)),
+        uint32_t(sizeof(Eigen::Vector3i)),
+        uint32_t(sizeof(int)),
+        uint32_t(sizeof(SurfaceBVH::Node)),
+        uint32_t(sizeof(SurfaceBVH::TrianglePacket)),
+        uint32_t(sizeof(int)),
+        uint32_t(sizeof(DistanceVolume::Sample))
+    };
+
+    uint64_t Align(uint64_t position)
+    {
+        return (position + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+    }
+
+    template<typename T>
+    void AddSection(FileHeader& header, const char* sections[SECTION_COUNT], Section section, const SharedArray<T>& array)
+    {
+        header.count[section] = array.size();
+        sections[section] = reinterpret_cast<const char*>(array.data());
+    }
+
+    template<typename T>
+    SharedArray<T> MapSection(const MappedFile& file, const FileHeader& header, Section section, const std::shared_ptr<const void>& owner)
+    {
+        return SharedArray<T>(reinterpret_cast<const T*>(file.Data() + header.offset[section]), size_t(header.count[section]), owner);
+    }
+}
+
+SurfaceIndex::SurfaceIndex()
+{
+}
+
+void SurfaceIndex::Build(const vtkSmartPointer<vtkPolyData>& surface)
+{
+    std::shared_ptr<SurfaceBVH> tree = std::make_shared<SurfaceBVH>();
+    tree->Build(surface);
+
+    bvh = tree;
+    volume.reset();
+}
+
+void SurfaceIndex::BuildVolume(double spacing, double bandWidth)
+{
+    std::shared_ptr<DistanceVolume> band = std::make_shared<DistanceVolume>();
+
+    if (bvh != NULL)
+    {
+        band->Build(*bvh, spacing, bandWidth);
+    }
+
+    volume = band;
+}
+
+void SurfaceIndex::Save(const std::string& path) const
+{
+    if (Empty() == true)
+    {
+        throw std::runtime_error("SurfaceIndex::Save: the index is empty");
+    }
+
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.byteOrder = FILE_BYTE_ORDER;
+
+    const char* sections[SECTION_COUNT] = { NULL };
+    AddSection(header, sections, SECTION_VERTICES, bvh->vertices);
+    AddSection(header, sections, SECTION_TRIANGLES, bvh->triangles);
+    AddSection(header, sections, SECTION_CELL_IDS, bvh->cellIds);
+    AddSection(header, sections, SECTION_NODES, bvh->nodes);
+    AddSection(header, sections, SECTION_PACKETS, bvh->packets);
+
+    if (volume != NULL)
+    {
+        header.hasVolume = 1;
+
+        for (int i = 0; i < 3; i++)
+        {
+            header.origin[i] = volume->origin(i);
+            header.size[i] = volume->size[i];
+            header.bricks[i] = volume->bricks[i];
+        }
+
+        header.spacing = volume->spacing;
+        header.bandWidth = volume->bandWidth;
+        header.maxSpread = volume->maxSpread;
+
+        AddSection(header, sections, SECTION_BRICKS, volume->brickIndex);
+        AddSection(header, sections, SECTION_SAMPLES, volume->samples);
+    }
+
+    uint64_t position = Align(sizeof(FileHeader));
+
+    for (int s = 0; s < SECTION_COUNT; s++)
+    {
+        header.elementSize[s] = ELEMENT_SIZE[s];
+        header.offset[s] = position;
+        position = Align(position + header.count[s] * ELEMENT_SIZE[s]);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+    if (!file)
+    {
+        throw std::runtime_error("SurfaceIndex::Save: cannot open " + path);
+    }
+
+    const char padding[SECTION_ALIGNMENT] = { 0 };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    position = sizeof(header);
+
+    for (int s = 0; s < SECTION_COUNT; s++)
+    {
+        file.write(padding, std::streamsize(header.offset[s] - position));
+        file.write(sections[s], std::streamsize(header.count[s] * ELEMENT_SIZE[s]));
+        position = header.offset[s] + header.count[s] * ELEMENT_SIZE[s];
+    }
+
+    // The last array is padded too, so every section of the file ends inside it.
+    file.write(padding, std::streamsize(Align(position) - position));
+
+    if (!file)
+    {
+        throw std::runtime_error("SurfaceIndex::Save: cannot write " + path);
+    }
+}
+
+void SurfaceIndex::Load(const std::string& path)
+{
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+
+    if (file->Open(path) == false)
+    {
+        throw std::runtime_error("SurfaceIndex::Load: cannot map " + path);
+    }
+
+    FileHeader header;
+
+    if (file->Size() < sizeof(header))
+    {
+        throw std::runtime_error("SurfaceIndex::Load: " + path + " is truncated");
+    }
+
+    std::memcpy(&header, file->Data(), sizeof(header));
+
+    if (std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header.version != FILE_VERSION)
+    {
+        throw std::runtime_error("SurfaceIndex::Load: " + path + " is not a surface index");
+    }
+
+    if (header.byteOrder != FILE_BYTE_ORDER || std::memcmp(header.elementSize, ELEMENT_SIZE, sizeof(ELEMENT_SIZE)) != 0)
+    {
+        throw std::runtime_error("SurfaceIndex::Load: " + path + " was written with a different layout");
+    }
+
+    for (int s = 0; s < SECTION_COUNT; s++)
+    {
+        // Written as a division so that huge counts cannot overflow.
+        if (header.offset[s] % SECTION_ALIGNMENT != 0 || header.offset[s] > file->Size() ||
+            header.count[s] > (file->Size() - header.offset[s]) / ELEMENT_SIZE[s])
+        {
+            throw std::runtime_error("SurfaceIndex::Load: " + path + " is truncated");
+        }
+    }
+
+    // Every array keeps the mapping alive, it is closed with the last copy of the index using it.
+    std::shared_ptr<const void> owner = file;
+
+    std::shared_ptr<SurfaceBVH> tree = std::make_shared<SurfaceBVH>();
+    tree->vertices = MapSection<Eigen::Vector3d>(*file, header, SECTION_VERTICES, owner);
+    tree->triangles = MapSection<Eigen::Vector3i>(*file, header, SECTION_TRIANGLES, owner);
+    tree->cellIds = MapSection<int>(*file, header, SECTION_CELL_IDS, owner);
+    tree->nodes = MapSection<SurfaceBVH::Node>(*file, header, SECTION_NODES, owner);
+    tree->packets = MapSection<SurfaceBVH::TrianglePacket>(*file, header, SECTION_PACKETS, owner);
+
+    std::shared_ptr<DistanceVolume> band;
+
+    if (header.hasVolume != 0)
+    {
+        band = std::make_shared<DistanceVolume>();
+
+        for (int i = 0; i < 3; i++)
+        {
+            band->origin(i) = header.origin[i];
+            band->size[i] = header.size[i];
+            band->bricks[i] = header.bricks[i];
+        }
+
+        band->spacing = header.spacing;
+        band->bandWidth = header.bandWidth;
+        band->maxSpread = header.maxSpread;
+        band->brickIndex = MapSection<int>(*file, header, SECTION_BRICKS, owner);
+        band->samples = MapSection<DistanceVolume::Sample>(*file, header, SECTION_SAMPLES, owner);
+    }
+
+    // The queries trust every index stored in the arrays, a corrupt file must not reach them.
+    if (tree->IsConsistent() == false || (band != NULL && band->IsConsistent() == false))
+    {
+        throw std::runtime_error("SurfaceIndex::Load: " + path + " is corrupt");
+    }
+
+    bvh = tree;
+    volume = band;
+}
+
+bool SurfaceIndex::Empty() const
+{
+    return bvh == NULL || bvh->Empty() == true;
+}
+
+const SurfaceBVH* SurfaceIndex::GetBVH() const
+{
+    return bvh.get();
+}
+
+const DistanceVolume* SurfaceIndex::GetVolume() const
+{
+    return volume.get();
+}
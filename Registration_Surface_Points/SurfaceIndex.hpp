@@ -0,0 +1,54 @@
+#ifndef REGISTRATION_SURFACE_INDEX_H
+#define REGISTRATION_SURFACE_INDEX_H
+
+#include <memory>
+#include <string>
+#include "vtkSmartPointer.h"
+#include "vtkPolyData.h"
+#include "SurfaceBVH.hpp"
+#include "DistanceVolume.hpp"
+
+namespace TKA
+{
+	namespace REGISTRATION
+	{
+		/*
+		* Closest point structures of one surface, built once and passed to every registration against it. Copies
+		* share the structures, so one index can serve several LeastSquaresICP objects and threads. An index can
+		* be saved to a binary file and loaded back by mapping the file: the tree and the volume then read the
+		* mapped pages directly and nothing is rebuilt.
+		*/
+		class SurfaceIndex
+		{
+		public:
+			SurfaceIndex();
+
+			// Builds the tree of the surface and drops any volume.
+			void Build(const vtkSmartPointer<vtkPolyData>& surface);
+
+			// Adds a DistanceVolume sampled from the tree, see DistanceVolume::Build.
+			void BuildVolume(double spacing, double bandWidth);
+
+			// Throws std::runtime_error when the index is empty or the file cannot be written.
+			void Save(const std::string& path) const;
+
+			// Maps a file written by Save. Throws std::runtime_error when the file cannot be mapped, is truncated,
+			// holds indices out of range, or was written by a build with a different layout; the index is left
+			// unchanged then.
+			void Load(const std::string& path);
+
+			bool Empty() const;
+
+			// Null when not built.
+			const SurfaceBVH* GetBVH() const;
+
+			const DistanceVolume* GetVolume() const;
+
+		private:
+			std::shared_ptr<const SurfaceBVH> bvh;
+			std::shared_ptr<const DistanceVolume> volume;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "TransformKernel.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace TKA::REGISTRATION;
+
+namespace
+{
+    // Elementary rotations, same convention as LeastSquaresICP::Rx, and their derivatives.
+    void RotationX(double angle, Eigen::Matrix3d& R, Eigen::Matrix3d& D)
+    {
+        double c = cos(angle);
+        double s = sin(angle);
+
+        R << 1, 0, 0,
+             0, c, -s,
+             0, s, c;
+
+        D << 0, 0, 0,
+             0, -s, -c,
+             0, c, -s;
+    }
+
+    void RotationY(double angle, Eigen::Matrix3d& R, Eigen::Matrix3d& D)
+    {
+        double c = cos(angle);
+        double s = sin(angle);
+
+        R << c, 0, s,
+             0, 1, 0,
+             -s, 0, c;
+
+        D << -s, 0, c,
+             0, 0, 0,
+             -c, 0, -s;
+    }
+
+    void RotationZ(double angle, Eigen::Matrix3d& R, Eigen::Matrix3d& D)
+    {
+        double c = cos(angle);
+        double s = sin(angle);
+
+        R << c, -s, 0,
+             s, c, 0,
+             0, 0, 1;
+
+        D << -s, -c, 0,
+             c, -s, 0,
+             0, 0, 0;
+    }
+}
+
+TransformKernel::TransformKernel(const cv::Mat& data, bool useScale)
+{
+    Eigen::Matrix3d Rx, Ry, Rz, DRx, DRy, DRz;
+    RotationX(data.at<double>(3, 0), Rx, DRx);
+    RotationY(data.at<double>(4, 0), Ry, DRy);
+    RotationZ(data.at<double>(5, 0), Rz, DRz);
+
+    Eigen::Matrix3d RyRz = Ry * Rz;
+    Eigen::Matrix3d RxRy = Rx * Ry;
+
+    rotation = Rx * RyRz;
+    rotationDX = DRx * RyRz;
+    rotationDY = Rx * DRy * Rz;
+    rotationDZ = RxRy * DRz;
+
+    translation = Eigen::Vector3d(data.at<double>(0, 0), data.at<double>(1, 0), data.at<double>(2, 0));
+
+    scale = (useScale == true && data.rows > 6) ? data.at<double>(6, 0) : 1.0;
+}
+
+Eigen::Matrix3d TransformKernel::RotationXYZ(double angleX, double angleY, double angleZ)
+{
+    Eigen::Matrix3d Rx, Ry, Rz, D;
+    RotationX(angleX, Rx, D);
+    RotationY(angleY, Ry, D);
+    RotationZ(angleZ, Rz, D);
+    return Rx * Ry * Rz;
+}
+
+void TransformKernel::AnglesXYZ(const Eigen::Matrix3d& R, double& angleX, double& angleY, double& angleZ)
+{
+    // R = Rx * Ry * Rz has R(0, 2) = sin(ay), R(1, 2) = -sin(ax) cos(ay), R(2, 2) = cos(ax) cos(ay),
+    // R(0, 1) = -cos(ay) sin(az) and R(0, 0) = cos(ay) cos(az).
+    angleY = asin(std::max(-1.0, std::min(1.0, R(0, 2))));
+
+    if (std::abs(R(0, 2)) < 1.0 - 1e-12)
+    {
+        angleX = atan2(-R(1, 2), R(2, 2));
+        angleZ = atan2(-R(0, 1), R(0, 0));
+    }
+    else
+    {
+        // Gimbal lock, only ax + az (or ax - az) is defined and az is set to 0.
+        angleX = atan2(R(2, 1), R(1, 1));
+        angleZ = 0;
+    }
+}
+
+void TransformKernel::FitMoments(const Eigen::Vector3d& sourceOrigin, const Eigen::Vector3d& targetOrigin, int count, const Eigen::Vector3d& sumSource, const Eigen::Vector3d& sumTarget, const Eigen::Matrix3d& sumCross, double sumSquares, bool useScale, Eigen::Matrix3d& R, double& scale, Eigen::Vector3d& t)
+{
+    Eigen::Vector3d meanSource = sumSource / count;
+    Eigen::Vector3d meanTarget = sumTarget / count;
+    Eigen::Matrix3d covariance = sumCross / count - meanTarget * meanSource.transpose();
+    double variance = sumSquares / count - meanSource.squaredNorm();
+
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(covariance, Eigen::ComputeFullU | Eigen::ComputeFullV);
+
+    // A reflection is turned into the closest rotation by flipping the smallest singular direction.
+    Eigen::Vector3d sign(1.0, 1.0, (svd.matrixU().determinant() * svd.matrixV().determinant() < 0) ? -1.0 : 1.0);
+    R = svd.matrixU() * sign.asDiagonal() * svd.matrixV().transpose();
+    scale = (useScale == true && variance > 0) ? svd.singularValues().dot(sign) / variance : 1.0;
+    t = (targetOrigin + meanTarget) - scale * R * (sourceOrigin + meanSource);
+}
@@ -0,0 +1,118 @@
+#ifndef REGISTRATION_TRANSFORM_KERNEL_H
+#define REGISTRATION_TRANSFORM_KERNEL_H
+
+#include <opencv2/core.hpp>
+#include <Eigen/Dense>
+
+namespace TKA
+{
+	namespace REGISTRATION
+	{
+		/*
+		* Rotation Rx(ax) * Ry(ay) * Rz(az) of a data vector (tx, ty, tz, ax, ay, az[, scale]), its three
+		* partial derivatives and the translation, evaluated once per solve step. The per point work is then
+		* fixed-size arithmetic with no allocation.
+		*/
+		class TransformKernel
+		{
+		public:
+			using Matrix36 = Eigen::Matrix<double, 3, 6>;
+			using Matrix66 = Eigen::Matrix<double, 6, 6>;
+			using Vector6 = Eigen::Matrix<double, 6, 1>;
+
+			// The scale is read from data when it has 7 rows and useScale is true, otherwise it is 1.
+			TransformKernel(const cv::Mat& data, bool useScale = false);
+
+			// scale * R * point + t
+			Eigen::Vector3d Transform(const Eigen::Vector3d& point) const
+			{
+				return scale * (rotation * point) + translation;
+			}
+
+			// Derivatives of Transform(point) with respect to (tx, ty, tz, ax, ay, az).
+			void Jacobian(const Eigen::Vector3d& point, Matrix36& J) const
+			{
+				J.leftCols<3>().setIdentity();
+				J.col(3).noalias() = scale * (rotationDX * point);
+				J.col(4).noalias() = scale * (rotationDY * point);
+				J.col(5).noalias() = scale * (rotationDZ * point);
+			}
+
+			// Adds the point to the normal equations, A += J^T J and B += J^T r with r = Transform(source) - target,
+			// and returns |r|^2.
+			double Accumulate(const Eigen::Vector3d& source, const Eigen::Vector3d& target, Matrix66& A, Vector6& B) const
+			{
+				Matrix36 J;
+				Jacobian(source, J);
+
+				Eigen::Vector3d error = Transform(source) - target;
+
+				A.noalias() += J.transpose() * J;
+				B.noalias() += J.transpose() * error;
+				return error.squaredNorm();
+			}
+
+			// Point-to-plane term, A += (J^T n)(J^T n)^T and B += (J^T n) r with r = n . (Transform(source) - target).
+			// Returns the squared point distance |Transform(source) - target|^2, not r^2, so errors stay comparable
+			// with Accumulate.
+			double AccumulatePlane(const Eigen::Vector3d& source, const Eigen::Vector3d& target, const Eigen::Vector3d& normal, Matrix66& A, Vector6& B) const
+			{
+				Matrix36 J;
+				Jacobian(source, J);
+
+				Eigen::Vector3d error = Transform(source) - target;
+				Vector6 Jn = J.transpose() * normal;
+				double planeError = normal.dot(error);
+
+				A.noalias() += Jn * Jn.transpose();
+				B.noalias() += Jn * planeError;
+				return error.squaredNorm();
+			}
+
+			const Eigen::Matrix3d& Rotation() const
+			{
+				return rotation;
+			}
+
+			const Eigen::Vector3d& Translation() const
+			{
+				return translation;
+			}
+
+			double Scale() const
+			{
+				return scale;
+			}
+
+			static Eigen::Vector3d ToEigen(const cv::Point3d& point)
+			{
+				return Eigen::Vector3d(point.x, point.y, point.z);
+			}
+
+			static cv::Point3d ToPoint(const Eigen::Vector3d& point)
+			{
+				return cv::Point3d(point(0), point(1), point(2));
+			}
+
+			static Eigen::Matrix3d RotationXYZ(double angleX, double angleY, double angleZ);
+
+			// Inverse of RotationXYZ with angleY in [-pi/2, pi/2] and the other two in [-pi, pi].
+			static void AnglesXYZ(const Eigen::Matrix3d& R, double& angleX, double& angleY, double& angleZ);
+
+			// Closed-form fit of scale * R * p + t to q over count pairs (Kabsch, with the Umeyama scale when useScale
+			// is set, 1 otherwise). The pairs are given by their moments relative to sourceOrigin and targetOrigin:
+			// the sums of p, of q, of q p^T and of |p|^2. A reflection is turned into the closest rotation.
+			static void FitMoments(const Eigen::Vector3d& sourceOrigin, const Eigen::Vector3d& targetOrigin, int count, const Eigen::Vector3d& sumSource, const Eigen::Vector3d& sumTarget, const Eigen::Matrix3d& sumCross, double sumSquares, bool useScale, Eigen::Matrix3d& R, double& scale, Eigen::Vector3d& t);
+
+		private:
+			Eigen::Matrix3d rotation;
+			Eigen::Matrix3d rotationDX;
+			Eigen::Matrix3d rotationDY;
+			Eigen::Matrix3d rotationDZ;
+			Eigen::Vector3d translation;
+			double scale;
+		};
+	}
+}
+
+#endif
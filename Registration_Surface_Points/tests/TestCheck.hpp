@@ -0,0 +1,22 @@
+#ifndef REGISTRATION_TEST_CHECK_H
+#define REGISTRATION_TEST_CHECK_H
+
+#include <iostream>
+
+// Minimal assertion for the test executables: reports the failed condition and counts it, so one run
+// lists every failure. main returns TEST_RESULT, which ctest reads as pass or fail.
+static int gTestFailures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; \
+			gTestFailures++; \
+		} \
+	} while (0)
+
+#define TEST_RESULT (gTestFailures == 0 ? 0 : 1)
+
+#endif
@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <vtkCellArray.h>
+#include <vtkNew.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+#include "SurfaceBVH.hpp"
+#include "TestCheck.hpp"
+
+using namespace TKA::REGISTRATION;
+
+// Closest point of a triangle by its Voronoi regions (Ericson, Real-Time Collision Detection 5.1.5), written
+// independently of the packet kernel of the tree.
+Eigen::Vector3d ReferenceClosestPoint(const Eigen::Vector3d& p, const Eigen::Vector3d& a, const Eigen::Vector3d& b, const Eigen::Vector3d& c)
+{
+    Eigen::Vector3d ab = b - a;
+    Eigen::Vector3d ac = c - a;
+    Eigen::Vector3d ap = p - a;
+
+    double d1 = ab.dot(ap);
+    double d2 = ac.dot(ap);
+
+    if (d1 <= 0 && d2 <= 0)
+    {
+        return a;
+    }
+
+    Eigen::Vector3d bp = p - b;
+    double d3 = ab.dot(bp);
+    double d4 = ac.dot(bp);
+
+    if (d3 >= 0 && d4 <= d3)
+    {
+        return b;
+    }
+
+    double vc = d1 * d4 - d3 * d2;
+
+    if (vc <= 0 && d1 >= 0 && d3 <= 0)
+    {
+        return a + ab * (d1 / (d1 - d3));
+    }
+
+    Eigen::Vector3d cp = p - c;
+    double d5 = ab.dot(cp);
+    double d6 = ac.dot(cp);
+
+    if (d6 >= 0 && d5 <= d6)
+    {
+        return c;
+    }
+
+    double vb = d5 * d2 - d1 * d6;
+
+    if (vb <= 0 && d2 >= 0 && d6 <= 0)
+    {
+        return a + ac * (d2 / (d2 - d6));
+    }
+
+    double va = d3 * d6 - d5 * d4;
+
+    if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+    {
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    }
+
+    double denom = 1.0 / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+double BruteForceSquaredDistance(const std::vector<Eigen::Vector3d>& vertices, const std::vector<Eigen::Vector3i>& triangles, const Eigen::Vector3d& p)
+{
+    double best = std::numeric_limits<double>::max();
+
+    for (size_t t = 0; t < triangles.size(); t++)
+    {
+        Eigen::Vector3d q = ReferenceClosestPoint(p, vertices[triangles[t](0)], vertices[triangles[t](1)], vertices[triangles[t](2)]);
+        best = std::min(best, (q - p).squaredNorm());
+    }
+
+    return best;
+}
+
+Eigen::Vector3d ToEigen(const cv::Point3d& p)
+{
+    return Eigen::Vector3d(p.x, p.y, p.z);
+}
+
+// Closed sphere of radius 40 (long thin triangles near the poles) and a soup of random triangles around it,
+// some of them degenerate.
+void MakeSurface(std::mt19937& random, std::vector<Eigen::Vector3d>& vertices, std::vector<Eigen::Vector3i>& triangles)
+{
+    const int rings = 24;
+    const int sectors = 32;
+    const double pi = 3.14159265358979323846;
+
+    for (int i = 0; i <= rings; i++)
+    {
+        for (int j = 0; j < sectors; j++)
+        {
+            double theta = pi * i / rings;
+            double phi = 2.0 * pi * j / sectors;
+            vertices.push_back(40.0 * Eigen::Vector3d(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta)));
+        }
+    }
+
+    for (int i = 0; i < rings; i++)
+    {
+        for (int j = 0; j < sectors; j++)
+        {
+            int a = i * sectors + j;
+            int b = i * sectors + (j + 1) % sectors;
+            int c = (i + 1) * sectors + j;
+            int d = (i + 1) * sectors + (j + 1) % sectors;
+            triangles.push_back(Eigen::Vector3i(a, b, d));
+            triangles.push_back(Eigen::Vector3i(a, d, c));
+        }
+    }
+
+    std::uniform_real_distribution<double> coordinate(-60.0, 60.0);
+    std::uniform_real_distribution<double> offset(-5.0, 5.0);
+
+    for (int t = 0; t < 200; t++)
+    {
+        Eigen::Vector3d a(coordinate(random), coordinate(random), coordinate(random));
+        Eigen::Vector3d b = a + Eigen::Vector3d(offset(random), offset(random), offset(random));
+        Eigen::Vector3d c = (t % 20 == 0) ? b : a + Eigen::Vector3d(offset(random), offset(random), offset(random));
+
+        int first = int(vertices.size());
+        vertices.push_back(a);
+        vertices.push_back(b);
+        vertices.push_back(c);
+        triangles.push_back(Eigen::Vector3i(first, first + 1, first + 2));
+    }
+}
+
+void TreeMatchesBruteForce()
+{
+    std::mt19937 random(1);
+    std::vector<Eigen::Vector3d> vertices;
+    std::vector<Eigen::Vector3i> triangles;
+    MakeSurface(random, vertices, triangles);
+
+    std::vector<int> cellIds(triangles.size());
+
+    for (size_t t = 0; t < cellIds.size(); t++)
+    {
+        cellIds[t] = int(t / 2);
+    }
+
+    SurfaceBVH bvh;
+    bvh.Build(vertices, triangles, cellIds);
+    CHECK(bvh.Empty() == false);
+    CHECK(bvh.GetNumberOfTriangles() == int(triangles.size()));
+
+    std::uniform_real_distribution<double> coordinate(-80.0, 80.0);
+    std::vector<cv::Point3d> points;
+
+    for (int i = 0; i < 2000; i++)
+    {
+        points.push_back(cv::Point3d(coordinate(random), coordinate(random), coordinate(random)));
+    }
+
+    std::vector<SurfaceHit> hits;
+    bvh.ClosestPoints(points, hits);
+    CHECK(hits.size() == points.size());
+
+    for (size_t i = 0; i < points.size() && i < hits.size(); i++)
+    {
+        Eigen::Vector3d p = ToEigen(points[i]);
+        double expected = BruteForceSquaredDistance(vertices, triangles, p);
+        const SurfaceHit& hit = hits[i];
+
+        CHECK(hit.index >= 0 && hit.index < int(triangles.size()));
+
+        if (hit.index < 0 || hit.index >= int(triangles.size()))
+        {
+            continue;
+        }
+
+        CHECK(std::abs(hit.squaredDistance - expected) <= 1e-9 * (1.0 + expected));
+        CHECK(std::abs((ToEigen(hit.point) - p).squaredNorm() - hit.squaredDistance) <= 1e-9 * (1.0 + expected));
+        CHECK(hit.triangle == cellIds[hit.index]);
+
+        // The point is on the reported triangle, at its barycentric coordinates.
+        Eigen::Vector3d a, b, c;
+        bvh.GetTriangle(hit.index, a, b, c);
+        Eigen::Vector3d onTriangle = hit.u * a + hit.v * b + hit.w * c;
+        CHECK((onTriangle - ToEigen(hit.point)).norm() <= 1e-9 * (1.0 + p.norm()));
+
+        // The single query and the projection on the found triangle agree with the batch.
+        SurfaceHit single = bvh.ClosestPoint(points[i]);
+        CHECK(single.squaredDistance == hit.squaredDistance);
+
+        SurfaceHit projected = bvh.ClosestPointOnTriangle(hit.index, points[i]);
+        CHECK(std::abs(projected.squaredDistance - hit.squaredDistance) <= 1e-9 * (1.0 + expected));
+    }
+}
+
+// The projection on one triangle matches the reference, and the triangle found for a point stays within twice the
+// move of the exact distance for a point moved from it: the bound the incremental correspondences rely on.
+void ProjectionOnCachedTriangle()
+{
+    std::mt19937 random(2);
+    std::vector<Eigen::Vector3d> vertices;
+    std::vector<Eigen::Vector3i> triangles;
+    MakeSurface(random, vertices, triangles);
+
+    SurfaceBVH bvh;
+    bvh.Build(vertices, triangles);
+
+    const double move = 0.5;
+    std::uniform_real_distribution<double> coordinate(-80.0, 80.0);
+    std::uniform_real_distribution<double> step(-1.0, 1.0);
+    std::uniform_int_distribution<int> triangle(0, bvh.GetNumberOfTriangles() - 1);
+
+    for (int i = 0; i < 2000; i++)
+    {
+        cv::Point3d point(coordinate(random), coordinate(random), coordinate(random));
+        Eigen::Vector3d p = ToEigen(point);
+
+        int index = triangle(random);
+        Eigen::Vector3d a, b, c;
+        bvh.GetTriangle(index, a, b, c);
+        SurfaceHit projected = bvh.ClosestPointOnTriangle(index, point);
+        CHECK(projected.index == index);
+
+        // The reference divides by the area, so it is only compared on proper triangles.
+        if ((b - a).cross(c - a).squaredNorm() > 0)
+        {
+            double expected = (ReferenceClosestPoint(p, a, b, c) - p).squaredNorm();
+            CHECK(std::abs(projected.squaredDistance - expected) <= 1e-9 * (1.0 + expected));
+            CHECK(std::abs((ToEigen(projected.point) - p).squaredNorm() - projected.squaredDistance) <= 1e-9 * (1.0 + expected));
+        }
+
+        Eigen::Vector3d direction(step(random), step(random), step(random));
+        Eigen::Vector3d moved = p + move * direction.normalized() * std::abs(step(random));
+        cv::Point3d movedPoint(moved(0), moved(1), moved(2));
+
+        SurfaceHit cached = bvh.ClosestPointOnTriangle(bvh.ClosestPoint(point).index, movedPoint);
+        double exact = std::sqrt(bvh.ClosestPoint(movedPoint).squaredDistance);
+        CHECK(std::sqrt(cached.squaredDistance) <= exact + 2.0 * move + 1e-9);
+    }
+}
+
+void MaximumDistance()
+{
+    std::vector<Eigen::Vector3d> vertices = { Eigen::Vector3d(0, 0, 0), Eigen::Vector3d(1, 0, 0), Eigen::Vector3d(0, 1, 0) };
+    std::vector<Eigen::Vector3i> triangles = { Eigen::Vector3i(0, 1, 2) };
+
+    SurfaceBVH bvh;
+    bvh.Build(vertices, triangles);
+
+    cv::Point3d above(0.25, 0.25, 2.0);
+    SurfaceHit hit = bvh.ClosestPoint(above);
+    CHECK(hit.index == 0 && hit.triangle == 0);
+    CHECK(std::abs(hit.squaredDistance - 4.0) < 1e-12);
+    CHECK((bvh.GetNormal(0) - Eigen::Vector3d(0, 0, 1)).norm() < 1e-12);
+
+    CHECK(bvh.ClosestPoint(above, 3.9).index == -1);
+    CHECK(bvh.ClosestPoint(above, 4.1).index == 0);
+}
+
+void EmptyTree()
+{
+    SurfaceBVH bvh;
+    bvh.Build(std::vector<Eigen::Vector3d>(), std::vector<Eigen::Vector3i>());
+
+    CHECK(bvh.Empty() == true);
+    CHECK(bvh.GetNumberOfTriangles() == 0);
+
+    SurfaceHit hit = bvh.ClosestPoint(cv::Point3d(1, 2, 3));
+    CHECK(hit.index == -1 && hit.triangle == -1);
+}
+
+// Only the cells with an area become triangles: a quad and a strip here, next to a poly-vertex and a polyline.
+void MixedCells()
+{
+    vtkNew<vtkPoints> points;
+    const double coordinates[][3] = {
+        { 100, 0, 0 }, { 100, 1, 0 }, { 100, 2, 0 },
+        { 100, 0, 1 }, { 101, 0, 1 }, { 102, 0, 1 }, { 103, 0, 1 },
+        { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+        { 0, 0, 5 }, { 0, 1, 5 }, { 1, 0, 5 }, { 1, 1, 5 }, { 2, 0, 5 } };
+
+    for (int i = 0; i < 16; i++)
+    {
+        points->InsertNextPoint(coordinates[i][0], coordinates[i][1], coordinates[i][2]);
+    }
+
+    vtkIdType polyVertex[3] = { 0, 1, 2 };
+    vtkIdType polyLine[4] = { 3, 4, 5, 6 };
+    vtkIdType quad[4] = { 7, 8, 9, 10 };
+    vtkIdType strip[5] = { 11, 12, 13, 14, 15 };
+
+    vtkNew<vtkCellArray> verts, lines, polys, strips;
+    verts->InsertNextCell(3, polyVertex);
+    lines->InsertNextCell(4, polyLine);
+    polys->InsertNextCell(4, quad);
+    strips->InsertNextCell(5, strip);
+
+    vtkSmartPointer<vtkPolyData> surface = vtkSmartPointer<vtkPolyData>::New();
+    surface->SetPoints(points);
+    surface->SetVerts(verts);
+    surface->SetLines(lines);
+    surface->SetPolys(polys);
+    surface->SetStrips(strips);
+
+    SurfaceBVH bvh;
+    bvh.Build(surface);
+    CHECK(bvh.GetNumberOfTriangles() == 5);
+
+    if (bvh.GetNumberOfTriangles() != 5)
+    {
+        return;
+    }
+
+    // Cells are numbered verts, lines, polys, strips.
+    SurfaceHit onLine = bvh.ClosestPoint(cv::Point3d(101.5, 0, 1));
+    CHECK(onLine.triangle == 2 || onLine.triangle == 3);
+
+    SurfaceHit onQuad = bvh.ClosestPoint(cv::Point3d(0.8, 0.9, -2));
+    CHECK(onQuad.triangle == 2 && std::abs(onQuad.squaredDistance - 4.0) < 1e-12);
+
+    // The strip covers (0,0)-(2,0)-(1,1)-(0,1) with three triangles facing the same side.
+    SurfaceHit onStrip = bvh.ClosestPoint(cv::Point3d(1.5, 0.3, 6));
+    CHECK(onStrip.triangle == 3 && std::abs(onStrip.squaredDistance - 1.0) < 1e-12);
+
+    Eigen::Vector3d normal = bvh.GetNormal(2);
+    CHECK(std::abs(std::abs(normal(2)) - 1.0) < 1e-12);
+    CHECK((bvh.GetNormal(3) - normal).norm() < 1e-12);
+    CHECK((bvh.GetNormal(4) - normal).norm() < 1e-12);
+}
+
+int main()
+{
+    // Both leaf kernels, the AVX one only where the CPU has it.
+    bool avx = SurfaceBVH::IsAVXEnabled();
+    CHECK(SurfaceBVH::SetAVX(false) == true && SurfaceBVH::IsAVXEnabled() == false);
+    TreeMatchesBruteForce();
+
+    if (SurfaceBVH::SetAVX(true) == true)
+    {
+        CHECK(SurfaceBVH::IsAVXEnabled() == true);
+        TreeMatchesBruteForce();
+    }
+
+    SurfaceBVH::SetAVX(avx);
+    ProjectionOnCachedTriangle();
+    MaximumDistance();
+    EmptyTree();
+    MixedCells();
+
+    return TEST_RESULT;
+}
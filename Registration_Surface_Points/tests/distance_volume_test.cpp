@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "DistanceVolume.hpp"
+#include "TestCheck.hpp"
+
+using namespace TKA::REGISTRATION;
+
+const double RADIUS = 40.0;
+const double SPACING = 0.5;
+const double BAND_WIDTH = 2.0;
+
+// Sphere of radius RADIUS around the origin.
+void MakeSphere(int rings, int sectors, std::vector<Eigen::Vector3d>& vertices, std::vector<Eigen::Vector3i>& triangles)
+{
+    const double pi = 3.14159265358979323846;
+
+    for (int i = 0; i <= rings; i++)
+    {
+        for (int j = 0; j < sectors; j++)
+        {
+            double theta = pi * i / rings;
+            double phi = 2.0 * pi * j / sectors;
+            vertices.push_back(RADIUS * Eigen::Vector3d(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta)));
+        }
+    }
+
+    for (int i = 0; i < rings; i++)
+    {
+        for (int j = 0; j < sectors; j++)
+        {
+            int a = i * sectors + j;
+            int b = i * sectors + (j + 1) % sectors;
+            int c = (i + 1) * sectors + j;
+            int d = (i + 1) * sectors + (j + 1) % sectors;
+            triangles.push_back(Eigen::Vector3i(a, b, d));
+            triangles.push_back(Eigen::Vector3i(a, d, c));
+        }
+    }
+}
+
+double Distance(const cv::Point3d& a, const cv::Point3d& b)
+{
+    cv::Point3d d(a.x - b.x, a.y - b.y, a.z - b.z);
+    return std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z);
+}
+
+// Inside the band the interpolated closest point stays within a quarter of the spacing of the exact one (the
+// facets of the sphere bend the offsets between samples), and nearly every point is answered by the volume.
+void VolumeMatchesTree()
+{
+    std::vector<Eigen::Vector3d> vertices;
+    std::vector<Eigen::Vector3i> triangles;
+    MakeSphere(120, 120, vertices, triangles);
+
+    SurfaceBVH bvh;
+    bvh.Build(vertices, triangles);
+
+    DistanceVolume volume;
+    volume.Build(bvh, SPACING, BAND_WIDTH);
+    CHECK(volume.Empty() == false);
+    CHECK(volume.GetSpacing() == SPACING);
+    CHECK(volume.GetBandWidth() == BAND_WIDTH);
+    CHECK(volume.GetNumberOfBricks() > 0);
+
+    std::mt19937 random(2);
+    std::normal_distribution<double> direction(0.0, 1.0);
+    std::uniform_real_distribution<double> offset(-0.75 * BAND_WIDTH, 0.75 * BAND_WIDTH);
+
+    int answered = 0;
+    int total = 20000;
+    double maxError = 0;
+
+    for (int i = 0; i < total; i++)
+    {
+        Eigen::Vector3d p(direction(random), direction(random), direction(random));
+        p = p.normalized() * (RADIUS + offset(random));
+        cv::Point3d point(p(0), p(1), p(2));
+
+        cv::Point3d closest;
+
+        if (volume.ClosestPoint(point, closest) == true)
+        {
+            answered++;
+            maxError = std::max(maxError, Distance(closest, bvh.ClosestPoint(point).point));
+        }
+    }
+
+    CHECK(answered > 0.99 * total);
+    CHECK(maxError < 0.25 * SPACING);
+}
+
+// Points out of the band and points where closest points of neighbouring samples are far apart (the centre of
+// the sphere) are left to the tree.
+void OutsideTheBand()
+{
+    std::vector<Eigen::Vector3d> vertices;
+    std::vector<Eigen::Vector3i> triangles;
+    MakeSphere(40, 40, vertices, triangles);
+
+    SurfaceBVH bvh;
+    bvh.Build(vertices, triangles);
+
+    DistanceVolume volume;
+    volume.Build(bvh, SPACING, BAND_WIDTH);
+
+    cv::Point3d closest;
+    CHECK(volume.ClosestPoint(cv::Point3d(0, 0, 0), closest) == false);
+    CHECK(volume.ClosestPoint(cv::Point3d(RADIUS + 3 * BAND_WIDTH, 0, 0), closest) == false);
+    CHECK(volume.ClosestPoint(cv::Point3d(RADIUS - 3 * BAND_WIDTH, 0, 0), closest) == false);
+    CHECK(volume.ClosestPoint(cv::Point3d(1000, 1000, 1000), closest) == false);
+}
+
+void EmptyVolume()
+{
+    SurfaceBVH empty;
+    empty.Build(std::vector<Eigen::Vector3d>(), std::vector<Eigen::Vector3i>());
+
+    DistanceVolume volume;
+    volume.Build(empty, SPACING, BAND_WIDTH);
+    CHECK(volume.Empty() == true);
+
+    cv::Point3d closest;
+    CHECK(volume.ClosestPoint(cv::Point3d(0, 0, 0), closest) == false);
+
+    std::vector<Eigen::Vector3d> vertices;
+    std::vector<Eigen::Vector3i> triangles;
+    MakeSphere(8, 8, vertices, triangles);
+
+    SurfaceBVH bvh;
+    bvh.Build(vertices, triangles);
+
+    DistanceVolume unsampled;
+    unsampled.Build(bvh, 0.0, BAND_WIDTH);
+    CHECK(unsampled.Empty() == true);
+}
+
+int main()
+{
+    VolumeMatchesTree();
+    OutsideTheBand();
+    EmptyVolume();
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,439 @@
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <vtkCellArray.h>
+#include <vtkNew.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+#include <vtkSphereSource.h>
+#include "LeastSquaresICP.hpp"
+#include "TestCheck.hpp"
+
+using namespace TKA::REGISTRATION;
+
+const double PI = 3.14159265358979323846;
+
+// Ellipsoid with three different axes, away from the origin as the bones are in scanner coordinates, so that a
+// translation error of the scaled solver shows up as (scale - 1) * 270 mm.
+const Eigen::Vector3d CENTER(150.0, -80.0, 200.0);
+const Eigen::Vector3d AXES(40.0, 30.0, 20.0);
+
+const int RINGS = 60;
+const int SECTORS = 80;
+
+// Vertices and triangles of the ellipsoid, poles included as degenerate rings.
+void MakeMesh(std::vector<Eigen::Vector3d>& vertices, std::vector<Eigen::Vector3i>& triangles)
+{
+    for (int i = 0; i <= RINGS; i++)
+    {
+        for (int j = 0; j < SECTORS; j++)
+        {
+            double theta = PI * i / RINGS;
+            double phi = 2.0 * PI * j / SECTORS;
+            vertices.push_back(CENTER + Eigen::Vector3d(AXES(0) * std::sin(theta) * std::cos(phi), AXES(1) * std::sin(theta) * std::sin(phi), AXES(2) * std::cos(theta)));
+        }
+    }
+
+    for (int i = 0; i < RINGS; i++)
+    {
+        for (int j = 0; j < SECTORS; j++)
+        {
+            int a = i * SECTORS + j;
+            int b = i * SECTORS + (j + 1) % SECTORS;
+            int c = (i + 1) * SECTORS + j;
+            int d = (i + 1) * SECTORS + (j + 1) % SECTORS;
+            triangles.push_back(Eigen::Vector3i(a, b, d));
+            triangles.push_back(Eigen::Vector3i(a, d, c));
+        }
+    }
+}
+
+vtkSmartPointer<vtkPolyData> MakeSurface()
+{
+    std::vector<Eigen::Vector3d> vertices;
+    std::vector<Eigen::Vector3i> triangles;
+    MakeMesh(vertices, triangles);
+
+    vtkNew<vtkPoints> points;
+
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        points->InsertNextPoint(vertices[i](0), vertices[i](1), vertices[i](2));
+    }
+
+    vtkNew<vtkCellArray> polys;
+
+    for (size_t t = 0; t < triangles.size(); t++)
+    {
+        vtkIdType ids[3] = { triangles[t](0), triangles[t](1), triangles[t](2) };
+        polys->InsertNextCell(3, ids);
+    }
+
+    vtkSmartPointer<vtkPolyData> surface = vtkSmartPointer<vtkPolyData>::New();
+    surface->SetPoints(points);
+    surface->SetPolys(polys);
+    return surface;
+}
+
+// data of the pose the source points are registered to: translation, XYZ angles and scale.
+cv::Mat MakePose(double scale)
+{
+    cv::Mat data(7, 1, CV_64F);
+    data.at<double>(0, 0) = 6.0;
+    data.at<double>(1, 0) = -4.0;
+    data.at<double>(2, 0) = 3.0;
+    data.at<double>(3, 0) = 0.05;
+    data.at<double>(4, 0) = -0.03;
+    data.at<double>(5, 0) = 0.04;
+    data.at<double>(6, 0) = scale;
+    return data;
+}
+
+Eigen::Matrix3d Rotation(const cv::Mat& data)
+{
+    return TransformKernel::RotationXYZ(data.at<double>(3, 0), data.at<double>(4, 0), data.at<double>(5, 0));
+}
+
+Eigen::Vector3d Translation(const cv::Mat& data)
+{
+    return Eigen::Vector3d(data.at<double>(0, 0), data.at<double>(1, 0), data.at<double>(2, 0));
+}
+
+// Points inside every third triangle of the mesh, so that the pose fits them exactly, taken back through the pose
+// so that scale * R * p + t puts them on the surface.
+std::vector<cv::Point3d> MakeSource(const cv::Mat& pose)
+{
+    std::vector<Eigen::Vector3d> vertices;
+    std::vector<Eigen::Vector3i> triangles;
+    MakeMesh(vertices, triangles);
+
+    Eigen::Matrix3d R = Rotation(pose);
+    Eigen::Vector3d t = Translation(pose);
+    double scale = pose.at<double>(6, 0);
+    std::vector<cv::Point3d> source;
+
+    for (size_t k = 0; k < triangles.size(); k += 3)
+    {
+        Eigen::Vector3d q = 0.2 * vertices[triangles[k](0)] + 0.3 * vertices[triangles[k](1)] + 0.5 * vertices[triangles[k](2)];
+        Eigen::Vector3d p = R.transpose() * (q - t) / scale;
+        source.push_back(cv::Point3d(p(0), p(1), p(2)));
+    }
+
+    return source;
+}
+
+bool SamePose(const cv::Mat& data, const cv::Mat& expected, double translationTolerance, double angleTolerance, double scaleTolerance)
+{
+    return (Translation(data) - Translation(expected)).norm() < translationTolerance &&
+        (Rotation(data) - Rotation(expected)).norm() < angleTolerance &&
+        std::abs(data.at<double>(6, 0) - expected.at<double>(6, 0)) < scaleTolerance;
+}
+
+// The coarse levels hand a scaled data vector to the next level, which must not move the pose when it starts.
+void ScaledPyramidRecoversPose()
+{
+    vtkSmartPointer<vtkPolyData> surface = MakeSurface();
+    cv::Mat pose = MakePose(1.05);
+
+    LeastSquaresICP icp(MakeSource(pose));
+    icp.setChi2(1e-8);
+    icp.setMaxError(1e-8);
+
+    PyramidOptions pyramid;
+    pyramid.enabled = true;
+    icp.setPyramid(pyramid);
+    CHECK(icp.getPyramidLevelSizes().size() > 1);
+
+    cv::Mat data = MakePose(1.0);
+    data.at<double>(0, 0) += 1.5;
+    data.at<double>(1, 0) -= 1.0;
+    data.at<double>(4, 0) += 0.02;
+
+    double error = icp.LeastSquaresScale(surface, data, 60);
+    CHECK(error >= 0);
+    CHECK(SamePose(data, pose, 0.01, 1e-4, 1e-4));
+}
+
+// Started on the pose, a few iterations keep it.
+void ScaledPoseIsFixedPoint()
+{
+    vtkSmartPointer<vtkPolyData> surface = MakeSurface();
+    cv::Mat pose = MakePose(1.05);
+
+    LeastSquaresICP icp(MakeSource(pose));
+    icp.setChi2(1e-8);
+    icp.setMaxError(1e-8);
+
+    cv::Mat data = pose.clone();
+    double error = icp.LeastSquaresScale(surface, data, 2);
+    CHECK(error >= 0 && error < 1e-6);
+    CHECK(SamePose(data, pose, 1e-6, 1e-9, 1e-9));
+}
+
+// The refinement on exact correspondences starts again from the scaled pose the volume stage left.
+void ScaledVolumeRecoversPose()
+{
+    vtkSmartPointer<vtkPolyData> surface = MakeSurface();
+    cv::Mat pose = MakePose(1.05);
+
+    LeastSquaresICP icp(MakeSource(pose));
+    icp.setChi2(1e-8);
+    icp.setMaxError(1e-8);
+
+    DistanceVolumeOptions volume;
+    volume.enabled = true;
+    icp.setDistanceVolume(volume);
+
+    cv::Mat data = MakePose(1.0);
+    data.at<double>(0, 0) += 0.5;
+    data.at<double>(5, 0) -= 0.01;
+
+    double error = icp.LeastSquaresScale(surface, data, 60);
+    CHECK(error >= 0);
+    CHECK(SamePose(data, pose, 0.01, 1e-4, 1e-4));
+
+    // Both stages ran: the volume answered correspondences, the refinement searched all of them.
+    std::vector<CorrespondenceCounts> counts = icp.getCorrespondenceCounts();
+    CHECK(counts.empty() == false && counts.front().volume > 0);
+    CHECK(counts.empty() == false && counts.back().volume == 0);
+}
+
+vtkSmartPointer<vtkPolyData> MakeSphere(double radius, int resolution)
+{
+    vtkNew<vtkSphereSource> sphere;
+    sphere->SetRadius(radius);
+    sphere->SetThetaResolution(resolution);
+    sphere->SetPhiResolution(resolution);
+    sphere->Update();
+    return sphere->GetOutput();
+}
+
+bool SameData(const cv::Mat& a, const cv::Mat& b)
+{
+    for (int i = 0; i < a.rows; i++)
+    {
+        if (a.at<double>(i, 0) != b.at<double>(i, 0))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool SamePoints(const std::vector<cv::Point3d>& a, const std::vector<cv::Point3d>& b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].x != b[i].x || a[i].y != b[i].y || a[i].z != b[i].z)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The parallel correspondence search gives the same bits as the serial one, for both searches and solvers.
+void ParallelMatchesSerial()
+{
+    vtkSmartPointer<vtkPolyData> surface = MakeSphere(40.0, 24);
+    vtkSmartPointer<vtkPolyData> points = MakeSphere(37.0, 30);
+    std::vector<cv::Point3d> source;
+
+    for (vtkIdType i = 0; i < points->GetNumberOfPoints(); i++)
+    {
+        double p[3];
+        points->GetPoint(i, p);
+        source.push_back(cv::Point3d(p[0] + 1.0, p[1] + 2.0, p[2] - 1.5));
+    }
+
+    int threads = cv::getNumThreads();
+    cv::setNumThreads(4);
+
+    for (int search = SEARCH_IMPLICIT_DISTANCE; search <= SEARCH_BVH; search++)
+    {
+        for (int scaled = 0; scaled < 2; scaled++)
+        {
+            cv::Mat data[2];
+            std::vector<cv::Point3d> target[2];
+
+            for (int parallel = 0; parallel < 2; parallel++)
+            {
+                LeastSquaresICP icp(source);
+                icp.setCorrespondenceSearch(CorrespondenceSearch(search));
+                icp.setParallel(parallel == 1);
+
+                data[parallel] = cv::Mat::zeros(scaled == 1 ? 7 : 6, 1, CV_64F);
+                data[parallel].at<double>(3, 0) = 0.02;
+
+                if (scaled == 1)
+                {
+                    data[parallel].at<double>(6, 0) = 1.0;
+                    icp.LeastSquaresScale(surface, data[parallel], 20);
+                }
+                else
+                {
+                    icp.LeastSquares(surface, data[parallel], 20);
+                }
+
+                icp.GetCorrespondences(surface, data[parallel], target[parallel]);
+            }
+
+            CHECK(SameData(data[0], data[1]));
+            CHECK(target[0].size() == source.size());
+            CHECK(SamePoints(target[0], target[1]));
+        }
+    }
+
+    cv::setNumThreads(threads);
+}
+
+// With a seed and without cancellation every run goes to the end, so the result depends neither on the run nor
+// on the number of threads.
+void SeededRestartsAreReproducible()
+{
+    vtkSmartPointer<vtkPolyData> surface = MakeSurface();
+    cv::Mat pose = MakePose(1.0);
+    std::vector<cv::Point3d> source = MakeSource(pose);
+
+    RandomInitOptions options;
+    options.restarts = 6;
+    options.translationRange = 3.0;
+    options.useSeed = true;
+    options.seed = 11;
+    options.cancelOnConvergence = false;
+
+    int threads = cv::getNumThreads();
+    cv::Mat results[3];
+
+    for (int run = 0; run < 3; run++)
+    {
+        cv::setNumThreads(run == 2 ? 1 : 4);
+
+        LeastSquaresICP icp(source);
+        icp.setRandomInitOptions(options);
+
+        results[run] = cv::Mat::zeros(6, 1, CV_64F);
+        CHECK(icp.LeastSquaresRandomInit(surface, results[run], 20) >= 0);
+    }
+
+    cv::setNumThreads(threads);
+
+    CHECK(SameData(results[0], results[1]));
+    CHECK(SameData(results[0], results[2]));
+}
+
+void NegativeRangesRejected()
+{
+    LeastSquaresICP icp(std::vector<cv::Point3d>(10, cv::Point3d(1, 2, 3)));
+
+    for (int i = 0; i < 3; i++)
+    {
+        RandomInitOptions options;
+        options.restarts = 3;
+        options.translationRange = (i == 0) ? -1.0 : 1.0;
+        options.rotationRange = (i == 1) ? -0.1 : (i == 2) ? std::nan("") : 0.1;
+        bool thrown = false;
+
+        try
+        {
+            icp.setRandomInitOptions(options);
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+
+        CHECK(thrown == true);
+        CHECK(icp.getRandomInitOptions().restarts == RandomInitOptions().restarts);
+    }
+}
+
+// Every pass answers each point of its level once, either searched, projected on the cached triangle, or from the
+// distance volume. The first pass of a registration has nothing cached.
+void IncrementalCountsAddUp()
+{
+    vtkSmartPointer<vtkPolyData> surface = MakeSurface();
+    cv::Mat pose = MakePose(1.0);
+    std::vector<cv::Point3d> source = MakeSource(pose);
+
+    for (int mode = 0; mode < 3; mode++)
+    {
+        LeastSquaresICP icp(source);
+        icp.setChi2(1e-8);
+        icp.setMaxError(1e-8);
+
+        IncrementalOptions incremental;
+        incremental.enabled = true;
+        incremental.moveThreshold = 0.01;
+        icp.setIncremental(incremental);
+
+        if (mode == 1)
+        {
+            PyramidOptions pyramid;
+            pyramid.enabled = true;
+            icp.setPyramid(pyramid);
+        }
+        else if (mode == 2)
+        {
+            DistanceVolumeOptions volume;
+            volume.enabled = true;
+            icp.setDistanceVolume(volume);
+        }
+
+        cv::Mat data = pose.rowRange(0, 6).clone();
+        data.at<double>(0, 0) += 1.0;
+        data.at<double>(4, 0) -= 0.01;
+
+        // The skipped points are off by up to twice the threshold, the pose by about as much.
+        CHECK(icp.LeastSquares(surface, data, 60) >= 0);
+        CHECK((Translation(data) - Translation(pose)).norm() < 0.1);
+        CHECK((Rotation(data) - Rotation(pose)).norm() < 1e-3);
+
+        std::vector<int> sizes = icp.getPyramidLevelSizes();
+        std::vector<CorrespondenceCounts> counts = icp.getCorrespondenceCounts();
+        CHECK(counts.empty() == false);
+        CHECK(counts.empty() == false && counts.front().skipped == 0);
+
+        size_t level = 0;
+        int skipped = 0;
+
+        for (size_t k = 0; k < counts.size(); k++)
+        {
+            int total = counts[k].full + counts[k].skipped + counts[k].volume;
+
+            // The levels come from the coarsest to the full set.
+            while (level < sizes.size() && sizes[level] != total)
+            {
+                level++;
+            }
+
+            CHECK(level < sizes.size());
+            skipped += counts[k].skipped;
+        }
+
+        CHECK(sizes.back() == int(source.size()));
+        CHECK(mode == 2 || skipped > 0);
+        CHECK(mode != 2 || counts.front().volume > 0);
+    }
+}
+
+int main()
+{
+    ScaledPyramidRecoversPose();
+    ScaledPoseIsFixedPoint();
+    ScaledVolumeRecoversPose();
+    ParallelMatchesSerial();
+    SeededRestartsAreReproducible();
+    NegativeRangesRejected();
+    IncrementalCountsAddUp();
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,224 @@
+#include <cmath>
+#include <random>
+#include <vector>
+#include "TransformKernel.hpp"
+#include "TestCheck.hpp"
+
+using namespace TKA::REGISTRATION;
+
+struct Fit
+{
+    Eigen::Matrix3d rotation;
+    Eigen::Vector3d translation;
+    double scale;
+};
+
+// Moments of the pairs relative to the two origins, as LeastSquaresICP::ClosedForm accumulates them.
+Fit FitPairs(const std::vector<Eigen::Vector3d>& source, const std::vector<Eigen::Vector3d>& target, const Eigen::Vector3d& sourceOrigin, const Eigen::Vector3d& targetOrigin, bool useScale)
+{
+    Eigen::Vector3d sumSource = Eigen::Vector3d::Zero();
+    Eigen::Vector3d sumTarget = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d sumCross = Eigen::Matrix3d::Zero();
+    double sumSquares = 0;
+
+    for (size_t k = 0; k < source.size(); k++)
+    {
+        Eigen::Vector3d p = source[k] - sourceOrigin;
+        Eigen::Vector3d q = target[k] - targetOrigin;
+        sumSource += p;
+        sumTarget += q;
+        sumCross += q * p.transpose();
+        sumSquares += p.squaredNorm();
+    }
+
+    Fit fit;
+    TransformKernel::FitMoments(sourceOrigin, targetOrigin, int(source.size()), sumSource, sumTarget, sumCross, sumSquares, useScale, fit.rotation, fit.scale, fit.translation);
+    return fit;
+}
+
+// Points about 250 mm from the origin, as the bones are in scanner coordinates. With planar set the points lie in
+// one plane, where the covariance has rank 2 and the third direction comes from the reflection test alone.
+std::vector<Eigen::Vector3d> MakePoints(std::mt19937& random, bool planar)
+{
+    std::uniform_real_distribution<double> coordinate(-30.0, 30.0);
+    Eigen::Vector3d center(150.0, -80.0, 200.0);
+    std::vector<Eigen::Vector3d> points;
+
+    for (int i = 0; i < 200; i++)
+    {
+        points.push_back(center + Eigen::Vector3d(coordinate(random), coordinate(random), planar ? 0.0 : coordinate(random)));
+    }
+
+    return points;
+}
+
+std::vector<Eigen::Vector3d> Apply(const std::vector<Eigen::Vector3d>& points, const Eigen::Matrix3d& M, double scale, const Eigen::Vector3d& t)
+{
+    std::vector<Eigen::Vector3d> result;
+
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        result.push_back(scale * (M * points[i]) + t);
+    }
+
+    return result;
+}
+
+void KnownTransforms()
+{
+    std::mt19937 random(6);
+    Eigen::Matrix3d R = TransformKernel::RotationXYZ(0.3, -0.7, 1.1);
+    Eigen::Vector3d t(12.0, -5.0, 40.0);
+    Eigen::Vector3d sourceOrigin(150.0, -80.0, 200.0);
+    Eigen::Vector3d targetOrigin(160.0, -70.0, 230.0);
+
+    for (int planar = 0; planar < 2; planar++)
+    {
+        std::vector<Eigen::Vector3d> source = MakePoints(random, planar != 0);
+
+        Fit rigid = FitPairs(source, Apply(source, R, 1.0, t), sourceOrigin, targetOrigin, false);
+        CHECK((rigid.rotation - R).norm() < 1e-12);
+        CHECK((rigid.translation - t).norm() < 1e-9);
+        CHECK(rigid.scale == 1.0);
+
+        Fit scaled = FitPairs(source, Apply(source, R, 1.04, t), sourceOrigin, targetOrigin, true);
+        CHECK((scaled.rotation - R).norm() < 1e-12);
+        CHECK((scaled.translation - t).norm() < 1e-9);
+        CHECK(std::abs(scaled.scale - 1.04) < 1e-12);
+
+        // Without the scale the rotation is the same, only the translation absorbs the size difference.
+        Fit unscaled = FitPairs(source, Apply(source, R, 1.04, t), sourceOrigin, targetOrigin, false);
+        CHECK((unscaled.rotation - R).norm() < 1e-12);
+        CHECK(unscaled.scale == 1.0);
+
+        // The fit does not depend on the origins the moments are taken from.
+        Fit origins = FitPairs(source, Apply(source, R, 1.0, t), Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero(), false);
+        CHECK((origins.rotation - R).norm() < 1e-10);
+        CHECK((origins.translation - t).norm() < 1e-7);
+    }
+}
+
+// A mirrored target still gives a proper rotation.
+void Reflection()
+{
+    std::mt19937 random(7);
+    std::vector<Eigen::Vector3d> source = MakePoints(random, false);
+    Eigen::Matrix3d mirror = Eigen::Vector3d(1.0, 1.0, -1.0).asDiagonal();
+    Eigen::Matrix3d M = mirror * TransformKernel::RotationXYZ(0.2, 0.1, -0.4);
+
+    Fit fit = FitPairs(source, Apply(source, M, 1.0, Eigen::Vector3d(1.0, 2.0, 3.0)), source[0], source[0], true);
+    CHECK(std::abs(fit.rotation.determinant() - 1.0) < 1e-12);
+    CHECK((fit.rotation * fit.rotation.transpose() - Eigen::Matrix3d::Identity()).norm() < 1e-12);
+    CHECK(fit.scale > 0 && fit.scale < 1.0);
+}
+
+// The data vector written by the solver reproduces the fitted rotation.
+void AnglesRoundTrip()
+{
+    std::mt19937 random(8);
+    std::uniform_real_distribution<double> angle(-3.0, 3.0);
+
+    for (int i = 0; i < 100; i++)
+    {
+        Eigen::Matrix3d R = TransformKernel::RotationXYZ(angle(random), 0.5 * angle(random), angle(random));
+
+        double angleX, angleY, angleZ;
+        TransformKernel::AnglesXYZ(R, angleX, angleY, angleZ);
+        CHECK((TransformKernel::RotationXYZ(angleX, angleY, angleZ) - R).norm() < 1e-12);
+    }
+
+    // Gimbal lock.
+    Eigen::Matrix3d locked = TransformKernel::RotationXYZ(0.4, 1.5707963267948966, -0.3);
+    double angleX, angleY, angleZ;
+    TransformKernel::AnglesXYZ(locked, angleX, angleY, angleZ);
+    CHECK((TransformKernel::RotationXYZ(angleX, angleY, angleZ) - locked).norm() < 1e-12);
+}
+
+// Transform of data after moving parameter k by step.
+Eigen::Vector3d Moved(const cv::Mat& data, bool useScale, int k, double step, const Eigen::Vector3d& point)
+{
+    cv::Mat moved = data.clone();
+    moved.at<double>(k, 0) += step;
+    return TransformKernel(moved, useScale).Transform(point);
+}
+
+// The analytic Jacobian and the normal equations built from it agree with central differences of Transform, with
+// and without the scale.
+void JacobianMatchesDifferences()
+{
+    std::mt19937 random(9);
+    std::uniform_real_distribution<double> angle(-1.0, 1.0);
+    std::uniform_real_distribution<double> offset(-5.0, 5.0);
+    std::vector<Eigen::Vector3d> points = MakePoints(random, false);
+    const double step = 1e-6;
+
+    for (int useScale = 0; useScale < 2; useScale++)
+    {
+        cv::Mat data(7, 1, CV_64F);
+        data.at<double>(0, 0) = 12.0;
+        data.at<double>(1, 0) = -5.0;
+        data.at<double>(2, 0) = 40.0;
+        data.at<double>(3, 0) = angle(random);
+        data.at<double>(4, 0) = angle(random);
+        data.at<double>(5, 0) = angle(random);
+        data.at<double>(6, 0) = 1.07;
+
+        TransformKernel kernel(data, useScale != 0);
+        CHECK(kernel.Scale() == (useScale != 0 ? 1.07 : 1.0));
+
+        TransformKernel::Matrix66 A = TransformKernel::Matrix66::Zero();
+        TransformKernel::Vector6 B = TransformKernel::Vector6::Zero();
+        TransformKernel::Matrix66 planeA = TransformKernel::Matrix66::Zero();
+        TransformKernel::Vector6 planeB = TransformKernel::Vector6::Zero();
+        TransformKernel::Matrix66 expectedA = TransformKernel::Matrix66::Zero();
+        TransformKernel::Vector6 expectedB = TransformKernel::Vector6::Zero();
+        TransformKernel::Matrix66 expectedPlaneA = TransformKernel::Matrix66::Zero();
+        TransformKernel::Vector6 expectedPlaneB = TransformKernel::Vector6::Zero();
+
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            TransformKernel::Matrix36 J;
+            kernel.Jacobian(points[i], J);
+
+            TransformKernel::Matrix36 numeric;
+
+            for (int k = 0; k < 6; k++)
+            {
+                numeric.col(k) = (Moved(data, useScale != 0, k, step, points[i]) - Moved(data, useScale != 0, k, -step, points[i])) / (2.0 * step);
+            }
+
+            // The points are about 250 from the origin, so the rounding of the differences is about 1e-7.
+            CHECK((J - numeric).norm() < 1e-5);
+
+            Eigen::Vector3d target = kernel.Transform(points[i]) + Eigen::Vector3d(offset(random), offset(random), offset(random));
+            Eigen::Vector3d normal = Eigen::Vector3d(offset(random), offset(random), offset(random)).normalized();
+            Eigen::Vector3d error = kernel.Transform(points[i]) - target;
+
+            double squared = kernel.Accumulate(points[i], target, A, B);
+            CHECK(std::abs(squared - error.squaredNorm()) < 1e-9);
+            CHECK(kernel.AccumulatePlane(points[i], target, normal, planeA, planeB) == squared);
+
+            expectedA += numeric.transpose() * numeric;
+            expectedB += numeric.transpose() * error;
+
+            TransformKernel::Vector6 Jn = numeric.transpose() * normal;
+            expectedPlaneA += Jn * Jn.transpose();
+            expectedPlaneB += Jn * normal.dot(error);
+        }
+
+        CHECK((A - expectedA).norm() < 1e-6 * expectedA.norm());
+        CHECK((B - expectedB).norm() < 1e-6 * expectedB.norm());
+        CHECK((planeA - expectedPlaneA).norm() < 1e-6 * expectedPlaneA.norm());
+        CHECK((planeB - expectedPlaneB).norm() < 1e-6 * expectedPlaneB.norm());
+    }
+}
+
+int main()
+{
+    KnownTransforms();
+    Reflection();
+    AnglesRoundTrip();
+    JacobianMatchesDifferences();
+
+    return TEST_RESULT;
+}
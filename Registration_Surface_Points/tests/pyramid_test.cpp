@@ -0,0 +1,200 @@
+#include <cmath>
+#include <set>
+#include <tuple>
+#include <vector>
+#include "SourcePyramid.hpp"
+#include "TestCheck.hpp"
+
+using namespace TKA::REGISTRATION;
+
+// A normal that names its point, so a normal taken from another point shows.
+cv::Point3d NormalOf(const cv::Point3d& point)
+{
+    return cv::Point3d(point.x + 1000.0, point.y - 1000.0, point.z * 3.0);
+}
+
+// nx * ny * nz points spacing apart, off the cell boundaries. With spacing 1 and nz = 2 the cells of size 2, 4 and 8
+// hold 8, 32 and 128 points.
+void MakeLattice(int nx, int ny, int nz, double spacing, std::vector<cv::Point3d>& points, std::vector<cv::Point3d>& normals)
+{
+    points.clear();
+    normals.clear();
+
+    for (int i = 0; i < nx; i++)
+    {
+        for (int j = 0; j < ny; j++)
+        {
+            for (int k = 0; k < nz; k++)
+            {
+                cv::Point3d point((i + 0.5) * spacing, (j + 0.5) * spacing, (k + 0.5) * spacing);
+                points.push_back(point);
+                normals.push_back(NormalOf(point));
+            }
+        }
+    }
+}
+
+// Position of every point of subset in points, -1 when missing.
+std::vector<int> Positions(const std::vector<cv::Point3d>& subset, const std::vector<cv::Point3d>& points)
+{
+    std::vector<int> positions;
+
+    for (size_t s = 0; s < subset.size(); s++)
+    {
+        int found = -1;
+
+        for (size_t i = 0; i < points.size() && found < 0; i++)
+        {
+            if (points[i] == subset[s])
+            {
+                found = int(i);
+            }
+        }
+
+        positions.push_back(found);
+    }
+
+    return positions;
+}
+
+int OccupiedCells(const std::vector<cv::Point3d>& points, double cellSize)
+{
+    std::set<std::tuple<long, long, long>> cells;
+
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        cells.insert(std::make_tuple(long(std::floor(points[i].x / cellSize)), long(std::floor(points[i].y / cellSize)), long(std::floor(points[i].z / cellSize))));
+    }
+
+    return int(cells.size());
+}
+
+// Coarsest level first, each one a subset of the one above it in the same order, one point per cell of its size,
+// and every normal still the one of its point.
+void LevelsAreOrderedSubsets()
+{
+    std::vector<cv::Point3d> points, normals;
+    MakeLattice(40, 40, 2, 1.0, points, normals);
+
+    SourcePyramid pyramid;
+    pyramid.Build(points, normals, 2.0, 5, 10);
+
+    int expected[] = { 25, 100, 400 };
+    CHECK(pyramid.GetNumberOfLevels() == 3);
+
+    for (int level = 0; level < pyramid.GetNumberOfLevels() && level < 3; level++)
+    {
+        const std::vector<cv::Point3d>& levelPoints = pyramid.GetPoints(level);
+        const std::vector<cv::Point3d>& levelNormals = pyramid.GetNormals(level);
+        const std::vector<cv::Point3d>& finer = (level + 1 < pyramid.GetNumberOfLevels()) ? pyramid.GetPoints(level + 1) : points;
+        double cellSize = 2.0 * std::pow(2.0, pyramid.GetNumberOfLevels() - 1 - level);
+
+        CHECK(int(levelPoints.size()) == expected[level]);
+        CHECK(OccupiedCells(levelPoints, cellSize) == int(levelPoints.size()));
+        CHECK(levelNormals.size() == levelPoints.size());
+
+        for (size_t i = 0; i < levelPoints.size() && i < levelNormals.size(); i++)
+        {
+            CHECK(levelNormals[i] == NormalOf(levelPoints[i]));
+        }
+
+        std::vector<int> positions = Positions(levelPoints, finer);
+
+        for (size_t i = 0; i < positions.size(); i++)
+        {
+            CHECK(positions[i] >= 0);
+            CHECK(i == 0 || positions[i] > positions[i - 1]);
+        }
+    }
+
+    // Without normals the levels are the same and carry none.
+    SourcePyramid bare;
+    bare.Build(points, std::vector<cv::Point3d>(), 2.0, 5, 10);
+    CHECK(bare.GetNumberOfLevels() == pyramid.GetNumberOfLevels());
+
+    for (int level = 0; level < bare.GetNumberOfLevels() && level < pyramid.GetNumberOfLevels(); level++)
+    {
+        CHECK(bare.GetPoints(level) == pyramid.GetPoints(level));
+        CHECK(bare.GetNormals(level).empty() == true);
+    }
+}
+
+// Levels stop at the requested count, at minPoints, and when a level would barely shrink.
+void CoarseningStops()
+{
+    std::vector<cv::Point3d> points, normals;
+    MakeLattice(40, 40, 2, 1.0, points, normals);
+
+    SourcePyramid pyramid;
+    pyramid.Build(points, normals, 2.0, 3, 10);
+    CHECK(pyramid.GetNumberOfLevels() == 2);
+    CHECK(pyramid.GetNumberOfLevels() == 2 && pyramid.GetPoints(0).size() == 100);
+
+    pyramid.Build(points, normals, 2.0, 5, 100);
+    CHECK(pyramid.GetNumberOfLevels() == 2);
+    CHECK(pyramid.GetNumberOfLevels() == 2 && pyramid.GetPoints(0).size() == 100);
+
+    pyramid.Build(points, normals, 2.0, 5, 101);
+    CHECK(pyramid.GetNumberOfLevels() == 1);
+
+    pyramid.Build(points, normals, 2.0, 5, 401);
+    CHECK(pyramid.GetNumberOfLevels() == 0);
+
+    pyramid.Build(points, normals, 2.0, 1, 10);
+    CHECK(pyramid.GetNumberOfLevels() == 0);
+
+    // Points 3 apart fill a cell of 2 each, so the first level would keep all of them.
+    std::vector<cv::Point3d> sparse, sparseNormals;
+    MakeLattice(10, 10, 10, 3.0, sparse, sparseNormals);
+
+    pyramid.Build(sparse, sparseNormals, 2.0, 5, 10);
+    CHECK(pyramid.GetNumberOfLevels() == 0);
+
+    // One point in eleven moved into the cell of its neighbor is a reduction below a tenth, one in nine above it.
+    for (int every = 9; every <= 11; every += 2)
+    {
+        std::vector<cv::Point3d> merged = sparse;
+
+        for (size_t i = 0; i < merged.size(); i += every)
+        {
+            merged[i] = sparse[i ^ 1] + cv::Point3d(0, 0, 0.1);
+        }
+
+        pyramid.Build(merged, std::vector<cv::Point3d>(), 2.0, 2, 10);
+        int expected = (every == 9) ? 1 : 0;
+        CHECK(pyramid.GetNumberOfLevels() == expected);
+    }
+}
+
+// No cell size, no coarse levels; Downsample hands the points through.
+void NoVoxelSize()
+{
+    std::vector<cv::Point3d> points, normals;
+    MakeLattice(10, 10, 2, 1.0, points, normals);
+
+    SourcePyramid pyramid;
+    pyramid.Build(points, normals, 2.0, 3, 10);
+    CHECK(pyramid.GetNumberOfLevels() > 0);
+
+    for (int size = 0; size < 2; size++)
+    {
+        double voxelSize = (size == 0) ? 0.0 : -2.0;
+
+        pyramid.Build(points, normals, voxelSize, 3, 10);
+        CHECK(pyramid.GetNumberOfLevels() == 0);
+
+        std::vector<cv::Point3d> outPoints, outNormals;
+        SourcePyramid::Downsample(points, normals, voxelSize, outPoints, outNormals);
+        CHECK(outPoints == points);
+        CHECK(outNormals == normals);
+    }
+}
+
+int main()
+{
+    LevelsAreOrderedSubsets();
+    CoarseningStops();
+    NoVoxelSize();
+
+    return TEST_RESULT;
+}
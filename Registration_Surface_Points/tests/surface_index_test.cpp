@@ -0,0 +1,344 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vtkNew.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+#include <vtkSphereSource.h>
+#include "LeastSquaresICP.hpp"
+#include "SurfaceIndex.hpp"
+#include "TestCheck.hpp"
+
+using namespace TKA::REGISTRATION;
+
+// Version 1 layout, see FileHeader in SurfaceIndex.cpp: the brick counts of the volume, then the offset and the
+// element count of every section.
+const size_t BRICKS_POSITION = 108;
+const size_t OFFSETS_POSITION = 120;
+const size_t COUNTS_POSITION = 176;
+
+enum Section
+{
+    SECTION_VERTICES,
+    SECTION_TRIANGLES,
+    SECTION_CELL_IDS,
+    SECTION_NODES,
+    SECTION_PACKETS,
+    SECTION_BRICKS,
+    SECTION_SAMPLES
+};
+
+const char* INDEX_PATH = "surface_index_test.idx";
+const char* CORRUPT_PATH = "surface_index_test_corrupt.idx";
+
+template<typename T>
+T Read(const std::string& bytes, size_t position)
+{
+    T value;
+    std::memcpy(&value, bytes.data() + position, sizeof(T));
+    return value;
+}
+
+template<typename T>
+void Write(std::string& bytes, size_t position, T value)
+{
+    std::memcpy(&bytes[position], &value, sizeof(T));
+}
+
+size_t SectionOffset(const std::string& bytes, Section section)
+{
+    return size_t(Read<uint64_t>(bytes, OFFSETS_POSITION + sizeof(uint64_t) * section));
+}
+
+size_t SectionCount(const std::string& bytes, Section section)
+{
+    return size_t(Read<uint64_t>(bytes, COUNTS_POSITION + sizeof(uint64_t) * section));
+}
+
+std::string ReadFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+void WriteFile(const std::string& path, const std::string& bytes)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), std::streamsize(bytes.size()));
+}
+
+SurfaceIndex BuildSphereIndex()
+{
+    vtkNew<vtkSphereSource> sphere;
+    sphere->SetRadius(40);
+    sphere->SetThetaResolution(48);
+    sphere->SetPhiResolution(48);
+    sphere->Update();
+
+    SurfaceIndex index;
+    index.Build(sphere->GetOutput());
+    index.BuildVolume(1.0, 3.0);
+    return index;
+}
+
+bool SameHit(const SurfaceHit& a, const SurfaceHit& b)
+{
+    return a.triangle == b.triangle && a.index == b.index && a.squaredDistance == b.squaredDistance &&
+        a.point.x == b.point.x && a.point.y == b.point.y && a.point.z == b.point.z;
+}
+
+// Both indexes answer every query with the same bits.
+bool SameAnswers(const SurfaceIndex& a, const SurfaceIndex& b)
+{
+    std::mt19937 random(4);
+    std::uniform_real_distribution<double> coordinate(-50.0, 50.0);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        cv::Point3d point(coordinate(random), coordinate(random), coordinate(random));
+
+        if (SameHit(a.GetBVH()->ClosestPoint(point), b.GetBVH()->ClosestPoint(point)) == false)
+        {
+            return false;
+        }
+
+        cv::Point3d closestA, closestB;
+        bool inBandA = a.GetVolume()->ClosestPoint(point, closestA);
+        bool inBandB = b.GetVolume()->ClosestPoint(point, closestB);
+
+        if (inBandA != inBandB || (inBandA == true && (closestA.x != closestB.x || closestA.y != closestB.y || closestA.z != closestB.z)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Load throws and keeps what the index held before.
+void ExpectRejected(SurfaceIndex& index, const std::string& bytes)
+{
+    WriteFile(CORRUPT_PATH, bytes);
+
+    const SurfaceBVH* before = index.GetBVH();
+    bool thrown = false;
+
+    try
+    {
+        index.Load(CORRUPT_PATH);
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+
+    CHECK(thrown == true);
+    CHECK(index.GetBVH() == before);
+}
+
+void SaveAndLoad()
+{
+    SurfaceIndex built = BuildSphereIndex();
+    CHECK(built.Empty() == false);
+    CHECK(built.GetVolume() != NULL && built.GetVolume()->Empty() == false);
+
+    built.Save(INDEX_PATH);
+
+    SurfaceIndex loaded;
+    loaded.Load(INDEX_PATH);
+
+    CHECK(loaded.Empty() == false);
+    CHECK(loaded.GetVolume() != NULL);
+
+    if (loaded.Empty() == true || loaded.GetVolume() == NULL)
+    {
+        return;
+    }
+
+    CHECK(loaded.GetBVH()->GetNumberOfTriangles() == built.GetBVH()->GetNumberOfTriangles());
+    CHECK(loaded.GetBVH()->GetNumberOfNodes() == built.GetBVH()->GetNumberOfNodes());
+    CHECK(loaded.GetVolume()->GetNumberOfBricks() == built.GetVolume()->GetNumberOfBricks());
+    CHECK(SameAnswers(loaded, built));
+
+    // Saving a loaded index writes the same file.
+    loaded.Save(CORRUPT_PATH);
+    CHECK(ReadFile(CORRUPT_PATH) == ReadFile(INDEX_PATH));
+
+    bool thrown = false;
+
+    try
+    {
+        SurfaceIndex().Save(CORRUPT_PATH);
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+
+    CHECK(thrown == true);
+}
+
+// Every index stored in the file is checked before a query can follow it.
+void CorruptFiles()
+{
+    SurfaceIndex index = BuildSphereIndex();
+    index.Save(INDEX_PATH);
+
+    const std::string file = ReadFile(INDEX_PATH);
+    const int vertexCount = int(SectionCount(file, SECTION_VERTICES));
+    const int triangleCount = int(SectionCount(file, SECTION_TRIANGLES));
+    const int nodeCount = int(SectionCount(file, SECTION_NODES));
+    const int sampleCount = int(SectionCount(file, SECTION_SAMPLES));
+
+    SurfaceIndex loaded;
+    loaded.Load(INDEX_PATH);
+
+    std::string bytes = file.substr(0, file.size() / 2);
+    ExpectRejected(loaded, bytes);
+
+    bytes = file;
+    bytes[0] = 'X';
+    ExpectRejected(loaded, bytes);
+
+    // A triangle vertex past the vertices, and a negative one.
+    size_t triangles = SectionOffset(file, SECTION_TRIANGLES);
+    bytes = file;
+    Write<int>(bytes, triangles + sizeof(int), vertexCount);
+    ExpectRejected(loaded, bytes);
+
+    bytes = file;
+    Write<int>(bytes, triangles + 2 * sizeof(int), -1);
+    ExpectRejected(loaded, bytes);
+
+    // Fewer cell ids than triangles.
+    bytes = file;
+    Write<uint64_t>(bytes, COUNTS_POSITION + sizeof(uint64_t) * SECTION_CELL_IDS, uint64_t(triangleCount - 1));
+    ExpectRejected(loaded, bytes);
+
+    // The root is the parent of itself, then of nodes past the end.
+    size_t nodes = SectionOffset(file, SECTION_NODES);
+    size_t rootFirst = nodes + offsetof(SurfaceBVH::Node, first);
+    CHECK(Read<int>(file, nodes + offsetof(SurfaceBVH::Node, count)) == 0);
+
+    bytes = file;
+    Write<int>(bytes, rootFirst, 0);
+    ExpectRejected(loaded, bytes);
+
+    bytes = file;
+    Write<int>(bytes, rootFirst, nodeCount - 1);
+    ExpectRejected(loaded, bytes);
+
+    // A leaf with more triangles than a packet holds.
+    for (int i = 0; i < nodeCount; i++)
+    {
+        size_t count = nodes + i * sizeof(SurfaceBVH::Node) + offsetof(SurfaceBVH::Node, count);
+
+        if (Read<int>(file, count) > 0)
+        {
+            bytes = file;
+            Write<int>(bytes, count, 5);
+            ExpectRejected(loaded, bytes);
+            break;
+        }
+    }
+
+    // A packet lane naming a triangle past the end.
+    bytes = file;
+    Write<int>(bytes, SectionOffset(file, SECTION_PACKETS) + offsetof(SurfaceBVH::TrianglePacket, index), triangleCount);
+    ExpectRejected(loaded, bytes);
+
+    // A brick table that does not match the grid, and a brick past the samples.
+    bytes = file;
+    Write<int32_t>(bytes, BRICKS_POSITION, Read<int32_t>(file, BRICKS_POSITION) + 1);
+    ExpectRejected(loaded, bytes);
+
+    size_t bricks = SectionOffset(file, SECTION_BRICKS);
+
+    for (size_t b = 0; b < SectionCount(file, SECTION_BRICKS); b++)
+    {
+        if (Read<int>(file, bricks + b * sizeof(int)) >= 0)
+        {
+            bytes = file;
+            Write<int>(bytes, bricks + b * sizeof(int), sampleCount);
+            ExpectRejected(loaded, bytes);
+            break;
+        }
+    }
+
+    // The file itself still loads.
+    CHECK(SameAnswers(loaded, index));
+}
+
+// Registrations given an index without a tree throw and leave data as it was.
+void EmptyIndexRejected()
+{
+    std::vector<cv::Point3d> points;
+
+    for (int i = 0; i < 100; i++)
+    {
+        points.push_back(cv::Point3d(i, 2 * i, 3 * i));
+    }
+
+    SurfaceIndex built;
+    built.Build(vtkSmartPointer<vtkPolyData>::New());
+    CHECK(built.Empty() == true);
+
+    SurfaceIndex indexes[2] = { SurfaceIndex(), built };
+
+    for (int i = 0; i < 2; i++)
+    {
+        for (int method = 0; method < 4; method++)
+        {
+            LeastSquaresICP icp(points);
+            cv::Mat data = cv::Mat::zeros(7, 1, CV_64F);
+            data.at<double>(6, 0) = 1.0;
+            bool thrown = false;
+
+            try
+            {
+                switch (method)
+                {
+                case 0:
+                    icp.LeastSquares(indexes[i], data);
+                    break;
+                case 1:
+                    icp.LeastSquaresScale(indexes[i], data);
+                    break;
+                case 2:
+                    icp.LeastSquaresRandomInit(indexes[i], data);
+                    break;
+                default:
+                    icp.LeastSquaresScaleRandomInit(indexes[i], data);
+                    break;
+                }
+            }
+            catch (const std::runtime_error&)
+            {
+                thrown = true;
+            }
+
+            CHECK(thrown == true);
+            CHECK(data.at<double>(0, 0) == 0 && data.at<double>(3, 0) == 0 && data.at<double>(6, 0) == 1.0);
+        }
+    }
+}
+
+int main()
+{
+    SaveAndLoad();
+    CorruptFiles();
+    EmptyIndexRejected();
+
+    std::remove(CORRUPT_PATH);
+    std::remove(INDEX_PATH);
+
+    return TEST_RESULT;
+}
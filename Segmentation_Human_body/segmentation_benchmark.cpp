@@ -0,0 +1,163 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include "segmentation_dnn/SegmentationScheduler.hpp"
+#include "segmentation_dnn/SegmentationException.hpp"
+
+// Synthetic model: a fixed cost per call plus a smaller cost per image, so batching pays off.
+std::vector<SegmentationResult> syntheticBatch(const std::vector<cv::Mat>& pImgs)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(8 + 2 * int(pImgs.size())));
+
+    std::vector<SegmentationResult> results(pImgs.size());
+
+    for (size_t i = 0; i < pImgs.size(); i++)
+    {
+        results[i].mask = cv::Mat::zeros(pImgs[i].size(), CV_8U);
+        results[i].parts = cv::Mat::zeros(pImgs[i].size(), CV_8U);
+    }
+
+    return results;
+}
+
+void schedulerBenchmark(int pClients, int pRequestsPerClient, const SchedulerOptions& pOptions)
+{
+    SegmentationScheduler scheduler(syntheticBatch, pOptions);
+
+    std::vector<cv::Mat> images = { cv::Mat::zeros(480, 640, CV_8UC3), cv::Mat::zeros(720, 1280, CV_8UC3) };
+
+    std::vector<std::thread> clients;
+
+    for (int c = 0; c < pClients; c++)
+    {
+        clients.push_back(std::thread([&scheduler, &images, c, pRequestsPerClient]()
+        {
+            for (int i = 0; i < pRequestsPerClient; i++)
+            {
+                std::future<SegmentationResult> result = scheduler.submit(images[(c + i) % images.size()]);
+                result.get();
+            }
+        }));
+    }
+
+    for (size_t c = 0; c < clients.size(); c++)
+    {
+        clients[c].join();
+    }
+
+    SchedulerStats stats = scheduler.getStats();
+
+    std::cout << "batch " << pOptions.maxBatchSize << ", latency budget " << pOptions.maxLatencyMs << " ms: "
+        << stats.completed << " requests, mean batch " << stats.meanBatchSize
+        << ", p50 " << stats.p50LatencyMs << " ms, p99 " << stats.p99LatencyMs << " ms, "
+        << stats.throughput << " images/s" << std::endl;
+}
+
+// Fraction of the pixels where both label images agree, and IoU of the two masks.
+void compareResults(const cv::Mat& pMask, const cv::Mat& pParts, const cv::Mat& pRefMask, const cv::Mat& pRefParts, double& pIoU, double& pAgreement)
+{
+    cv::Mat intersection = (pMask > 0) & (pRefMask > 0);
+    cv::Mat both = (pMask > 0) | (pRefMask > 0);
+    int unionArea = cv::countNonZero(both);
+
+    pIoU = (unionArea == 0) ? 1.0 : double(cv::countNonZero(intersection)) / double(unionArea);
+
+    cv::Mat different;
+    cv::compare(pParts, pRefParts, different, cv::CMP_NE);
+    pAgreement = 1.0 - double(cv::countNonZero(different)) / double(pParts.total());
+}
+
+void backendBenchmark(const std::string& pModel, const std::string& pLiteModel, const cv::Mat& pImage, int pRuns)
+{
+    const BackendType backends[] = { BACKEND_TENSORFLOW, BACKEND_OPENCV_DNN, BACKEND_TFLITE };
+
+    cv::Mat refMask, refParts;
+
+    for (BackendType backend : backends)
+    {
+        try
+        {
+            SegmentationDNN model(backend == BACKEND_TFLITE ? pLiteModel : pModel, backend);
+
+            model.Execute(pImage);
+            model.resetAllocationCount();
+
+            auto start = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < pRuns; i++)
+            {
+                model.Execute(pImage);
+            }
+
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+            std::cout << model.getBackendName() << ": " << elapsed.count() / pRuns << " ms per image, "
+                << model.getAllocationCount() << " image buffer reallocations after warm-up";
+
+            if (backend == BACKEND_TENSORFLOW)
+            {
+                refMask = model.getBodyMask().clone();
+                refParts = model.getBodyParts().clone();
+            }
+            else if (!refMask.empty())
+            {
+                double iou, agreement;
+                compareResults(model.getBodyMask(), model.getBodyParts(), refMask, refParts, iou, agreement);
+                std::cout << ", mask IoU " << iou << ", part agreement " << agreement << " against TensorFlow";
+            }
+
+            // The same image with the part head pruned from the graph.
+            model.setOutputs(OUTPUT_MASK);
+            model.Execute(pImage);
+
+            start = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < pRuns; i++)
+            {
+                model.Execute(pImage);
+            }
+
+            elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << ", mask only " << elapsed.count() / pRuns << " ms per image";
+
+            std::cout << std::endl;
+        }
+        catch (const SegmentationException& e)
+        {
+            std::cout << "backend " << int(backend) << " skipped: " << e.what() << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // segmentation_benchmark [model.pb image [model.tflite]] also compares the inference backends.
+    if (argc >= 3)
+    {
+        cv::Mat image = cv::imread(argv[2], cv::IMREAD_COLOR);
+
+        if (image.empty())
+        {
+            std::cerr << "Could not read the image " << argv[2] << "." << std::endl;
+            std::cerr << "usage: segmentation_benchmark [model.pb image [model.tflite]]" << std::endl;
+            return 1;
+        }
+
+        std::string liteModel = (argc >= 4) ? argv[3] : "pix_model.tflite";
+
+        backendBenchmark(argv[1], liteModel, image, 20);
+    }
+
+    SchedulerOptions options;
+
+    options.maxBatchSize = 1;
+    options.maxLatencyMs = 0;
+    schedulerBenchmark(16, 50, options);
+
+    options.maxBatchSize = 8;
+    options.maxLatencyMs = 10;
+    schedulerBenchmark(16, 50, options);
+
+    return 0;
+}
@@ -0,0 +1,611 @@
+#include "ArgMaxKernel.hpp"
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ARGMAX_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ARGMAX_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ARGMAX_TARGET(isa)
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    typedef void (*ArgMaxRow)(const float* pHeat, int pCols, int pChannels, uchar* pOutput);
+
+    inline int first_bit(unsigned int pMask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, pMask);
+        return int(index);
+#else
+        return __builtin_ctz(pMask);
+#endif
+    }
+
+    // First index of the maximum, like the original strict '>' scan. C = 0 means the count is only known at runtime.
+    template <int C>
+    inline int arg_max_scalar(const float* pPixel, int)
+    {
+        int pos = 0;
+        for (int k = 1; k < C; k++)
+        {
+            if (pPixel[k] > pPixel[pos])
+            {
+                pos = k;
+            }
+        }
+        return pos;
+    }
+
+    template <>
+    inline int arg_max_scalar<0>(const float* pPixel, int pChannels)
+    {
+        int pos = 0;
+        for (int k = 1; k < pChannels; k++)
+        {
+            if (pPixel[k] > pPixel[pos])
+            {
+                pos = k;
+            }
+        }
+        return pos;
+    }
+
+    template <int C>
+    void arg_max_row_scalar(const float* pHeat, int pCols, int pChannels, uchar* pOutput)
+    {
+        int stride = (C == 0) ? pChannels : C;
+
+        for (int j = 0; j < pCols; j++, pHeat += stride)
+        {
+            pOutput[j] = uchar(arg_max_scalar<C>(pHeat, pChannels));
+        }
+    }
+
+#ifdef ARGMAX_X86
+    // Each SIMD variant takes the maximum of the 24 channels, broadcasts it and returns the first lane equal
+    // to it, which keeps the tie-breaking of the scalar scan. The max instructions return their second operand
+    // when either is NaN, so they drop a NaN or keep it depending on its lane; a pixel with any NaN channel
+    // takes the scalar scan instead.
+
+    ARGMAX_TARGET("sse2")
+    void arg_max_row_24_sse(const float* pHeat, int pCols, int, uchar* pOutput)
+    {
+        for (int j = 0; j < pCols; j++, pHeat += 24)
+        {
+            __m128 v0 = _mm_loadu_ps(pHeat);
+            __m128 v1 = _mm_loadu_ps(pHeat + 4);
+            __m128 v2 = _mm_loadu_ps(pHeat + 8);
+            __m128 v3 = _mm_loadu_ps(pHeat + 12);
+            __m128 v4 = _mm_loadu_ps(pHeat + 16);
+            __m128 v5 = _mm_loadu_ps(pHeat + 20);
+
+            __m128 unordered = _mm_or_ps(_mm_or_ps(_mm_cmpunord_ps(v0, v1), _mm_cmpunord_ps(v2, v3)), _mm_cmpunord_ps(v4, v5));
+
+            if (_mm_movemask_ps(unordered) != 0)
+            {
+                pOutput[j] = uchar(arg_max_scalar<24>(pHeat, 24));
+                continue;
+            }
+
+            __m128 m = _mm_max_ps(_mm_max_ps(_mm_max_ps(v0, v1), _mm_max_ps(v2, v3)), _mm_max_ps(v4, v5));
+            m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+            m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+
+            const __m128 values[6] = { v0, v1, v2, v3, v4, v5 };
+            int pos = -1;
+
+            for (int k = 0; k < 6 && pos < 0; k++)
+            {
+                int bits = _mm_movemask_ps(_mm_cmpeq_ps(values[k], m));
+                if (bits != 0)
+                {
+                    pos = 4 * k + first_bit(bits);
+                }
+            }
+
+            pOutput[j] = uchar(pos < 0 ? arg_max_scalar<24>(pHeat, 24) : pos);
+        }
+    }
+
+    ARGMAX_TARGET("avx2")
+    void arg_max_row_24_avx2(const float* pHeat, int pCols, int, uchar* pOutput)
+    {
+        for (int j = 0; j < pCols; j++, pHeat += 24)
+        {
+            __m256 v0 = _mm256_loadu_ps(pHeat);
+            __m256 v1 = _mm256_loadu_ps(pHeat + 8);
+            __m256 v2 = _mm256_loadu_ps(pHeat + 16);
+
+            __m256 unordered = _mm256_or_ps(_mm256_cmp_ps(v0, v1, _CMP_UNORD_Q), _mm256_cmp_ps(v2, v2, _CMP_UNORD_Q));
+
+            if (_mm256_movemask_ps(unordered) != 0)
+            {
+                pOutput[j] = uchar(arg_max_scalar<24>(pHeat, 24));
+                continue;
+            }
+
+            __m256 m = _mm256_max_ps(_mm256_max_ps(v0, v1), v2);
+            m = _mm256_max_ps(m, _mm256_permute2f128_ps(m, m, 1));
+            m = _mm256_max_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+            m = _mm256_max_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+
+            int bits0 = _mm256_movemask_ps(_mm256_cmp_ps(v0, m, _CMP_EQ_OQ));
+            int bits1 = _mm256_movemask_ps(_mm256_cmp_ps(v1, m, _CMP_EQ_OQ));
+            int bits2 = _mm256_movemask_ps(_mm256_cmp_ps(v2, m, _CMP_EQ_OQ));
+
+            int pos;
+            if (bits0 != 0)
+            {
+                pos = first_bit(bits0);
+            }
+            else if (bits1 != 0)
+            {
+                pos = 8 + first_bit(bits1);
+            }
+            else if (bits2 != 0)
+            {
+                pos = 16 + first_bit(bits2);
+            }
+            else
+            {
+                pos = arg_max_scalar<24>(pHeat, 24);
+            }
+
+            pOutput[j] = uchar(pos);
+        }
+    }
+
+    ARGMAX_TARGET("avx512f")
+    void arg_max_row_24_avx512(const float* pHeat, int pCols, int, uchar* pOutput)
+    {
+        const __m512 lowest = _mm512_set1_ps(-std::numeric_limits<float>::infinity());
+
+        for (int j = 0; j < pCols; j++, pHeat += 24)
+        {
+            __m512 v0 = _mm512_loadu_ps(pHeat);
+            __m512 v1 = _mm512_mask_loadu_ps(lowest, 0x00FF, pHeat + 16);
+
+            if (_mm512_cmp_ps_mask(v0, v1, _CMP_UNORD_Q) != 0)
+            {
+                pOutput[j] = uchar(arg_max_scalar<24>(pHeat, 24));
+                continue;
+            }
+
+            __m512 m = _mm512_set1_ps(_mm512_reduce_max_ps(_mm512_max_ps(v0, v1)));
+
+            unsigned int bits0 = _mm512_cmp_ps_mask(v0, m, _CMP_EQ_OQ);
+            unsigned int bits1 = _mm512_cmp_ps_mask(v1, m, _CMP_EQ_OQ) & 0x00FF;
+
+            int pos;
+            if (bits0 != 0)
+            {
+                pos = first_bit(bits0);
+            }
+            else if (bits1 != 0)
+            {
+                pos = 16 + first_bit(bits1);
+            }
+            else
+            {
+                pos = arg_max_scalar<24>(pHeat, 24);
+            }
+
+            pOutput[j] = uchar(pos);
+        }
+    }
+#endif
+
+    typedef ArgMaxKernel::Isa ArgMaxIsa;
+
+    const ArgMaxIsa ISA_SCALAR = ArgMaxKernel::ISA_SCALAR;
+    const ArgMaxIsa ISA_SSE = ArgMaxKernel::ISA_SSE;
+    const ArgMaxIsa ISA_AVX2 = ArgMaxKernel::ISA_AVX2;
+    const ArgMaxIsa ISA_AVX512 = ArgMaxKernel::ISA_AVX512;
+
+    ArgMaxIsa detect_isa()
+    {
+#ifdef ARGMAX_X86
+        if (cv::checkHardwareSupport(CV_CPU_AVX_512F))
+        {
+            return ISA_AVX512;
+        }
+        if (cv::checkHardwareSupport(CV_CPU_AVX2))
+        {
+            return ISA_AVX2;
+        }
+        if (cv::checkHardwareSupport(CV_CPU_SSE2))
+        {
+            return ISA_SSE;
+        }
+#endif
+        return ISA_SCALAR;
+    }
+
+    std::atomic<int>& isa_choice()
+    {
+        static std::atomic<int> isa{ int(detect_isa()) };
+        return isa;
+    }
+
+    ArgMaxIsa selected_isa()
+    {
+        return ArgMaxIsa(isa_choice().load());
+    }
+
+    ArgMaxRow select_row_function(int pChannels)
+    {
+        if (pChannels != 24)
+        {
+            return arg_max_row_scalar<0>;
+        }
+
+#ifdef ARGMAX_X86
+        switch (selected_isa())
+        {
+        case ISA_AVX512:
+            return arg_max_row_24_avx512;
+        case ISA_AVX2:
+            return arg_max_row_24_avx2;
+        case ISA_SSE:
+            return arg_max_row_24_sse;
+        default:
+            break;
+        }
+#endif
+        return arg_max_row_scalar<24>;
+    }
+
+    struct LabelAccumulator
+    {
+        uint64 count = 0;
+        int minX = std::numeric_limits<int>::max();
+        int minY = std::numeric_limits<int>::max();
+        int maxX = -1;
+        int maxY = -1;
+        double sumX = 0;
+        double sumY = 0;
+        double sumConfidence = 0;
+
+        inline void add(int pX, int pY, float pValue, bool pLogit)
+        {
+            count++;
+            minX = std::min(minX, pX);
+            maxX = std::max(maxX, pX);
+            minY = std::min(minY, pY);
+            maxY = std::max(maxY, pY);
+            sumX += pX;
+            sumY += pY;
+            sumConfidence += (pLogit == true) ? 1.0 / (1.0 + std::exp(-double(pValue))) : double(pValue);
+        }
+
+        void merge(const LabelAccumulator& pOther)
+        {
+            count += pOther.count;
+            minX = std::min(minX, pOther.minX);
+            maxX = std::max(maxX, pOther.maxX);
+            minY = std::min(minY, pOther.minY);
+            maxY = std::max(maxY, pOther.maxY);
+            sumX += pOther.sumX;
+            sumY += pOther.sumY;
+            sumConfidence += pOther.sumConfidence;
+        }
+
+        void from_statistics(const PartStatistics& pStats)
+        {
+            if (pStats.area == 0)
+            {
+                return;
+            }
+
+            count = uint64(pStats.area);
+            minX = pStats.box.x;
+            minY = pStats.box.y;
+            maxX = pStats.box.x + pStats.box.width - 1;
+            maxY = pStats.box.y + pStats.box.height - 1;
+            sumX = double(pStats.centroid.x) * count;
+            sumY = double(pStats.centroid.y) * count;
+            sumConfidence = double(pStats.confidence) * count;
+        }
+
+        PartStatistics to_statistics() const
+        {
+            PartStatistics stats;
+
+            if (count > 0)
+            {
+                stats.area = int(count);
+                stats.box = cv::Rect(minX, minY, maxX - minX + 1, maxY - minY + 1);
+                stats.centroid = cv::Point2f(float(sumX / count), float(sumY / count));
+                stats.confidence = float(sumConfidence / count);
+            }
+
+            return stats;
+        }
+    };
+
+    class MaskBody : public cv::ParallelLoopBody
+    {
+    public:
+        MaskBody(const cv::Mat& pValues, double pThreshold, bool pLogits, cv::Mat& pOutput, const cv::Point& pOffset,
+            LabelAccumulator& pTotal, std::mutex& pMutex)
+            : mValues(pValues), mThreshold(pThreshold), mLogits(pLogits), mOutput(&pOutput), mOffset(pOffset),
+            mTotal(&pTotal), mTotalMutex(&pMutex)
+        {
+        }
+
+        virtual void operator()(const cv::Range& pRange) const override
+        {
+            LabelAccumulator stripe;
+            int cols = mValues.cols;
+
+            for (int i = pRange.start; i < pRange.end; i++)
+            {
+                uchar* output = mOutput->ptr(i);
+                int y = i + mOffset.y;
+
+                if (mValues.depth() == CV_8U)
+                {
+                    const uchar* values = mValues.ptr(i);
+
+                    for (int j = 0; j < cols; j++)
+                    {
+                        // Read before writing, pOutput may be pValues.
+                        uchar value = values[j];
+                        output[j] = (value > mThreshold) ? 255 : 0;
+
+                        if (value > mThreshold)
+                        {
+                            stripe.add(j + mOffset.x, y, value / 255.0f, false);
+                        }
+                    }
+                }
+                else
+                {
+                    const float* values = mValues.ptr<float>(i);
+
+                    for (int j = 0; j < cols; j++)
+                    {
+                        float value = values[j];
+                        output[j] = (value > mThreshold) ? 255 : 0;
+
+                        if (value > mThreshold)
+                        {
+                            stripe.add(j + mOffset.x, y, value, mLogits);
+                        }
+                    }
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(*mTotalMutex);
+            mTotal->merge(stripe);
+        }
+
+    private:
+        const cv::Mat& mValues;
+        double mThreshold;
+        bool mLogits;
+        cv::Mat* mOutput;
+        cv::Point mOffset;
+        LabelAccumulator* mTotal;
+        std::mutex* mTotalMutex;
+    };
+
+    class ArgMaxBody : public cv::ParallelLoopBody
+    {
+    public:
+        ArgMaxBody(const cv::Mat& pHeatmap, const cv::Mat& pMask, cv::Mat& pOutput)
+            : mHeatmap(pHeatmap), mMask(pMask), mOutput(&pOutput)
+        {
+            mChannels = pHeatmap.channels();
+            mScale = 255 / mChannels;
+            mRow = select_row_function(mChannels);
+            mBody = NULL;
+            mBodyThreshold = 0;
+            mLogits = false;
+            mTotals = NULL;
+            mTotalsMutex = NULL;
+        }
+
+        void setStatistics(const cv::Mat* pBody, float pBodyThreshold, bool pLogits, std::vector<LabelAccumulator>* pTotals, std::mutex* pMutex)
+        {
+            mBody = pBody;
+            mBodyThreshold = pBodyThreshold;
+            mLogits = pLogits;
+            mTotals = pTotals;
+            mTotalsMutex = pMutex;
+        }
+
+        virtual void operator()(const cv::Range& pRange) const override
+        {
+            if (mTotals == NULL)
+            {
+                for (int i = pRange.start; i < pRange.end; i++)
+                {
+                    label_row(i, NULL);
+                }
+
+                return;
+            }
+
+            // At most 256 channels and the body, on the stack so that stripes do not allocate.
+            LabelAccumulator stripe[257];
+
+            for (int i = pRange.start; i < pRange.end; i++)
+            {
+                label_row(i, stripe);
+            }
+
+            std::lock_guard<std::mutex> lock(*mTotalsMutex);
+
+            for (int k = 0; k <= mChannels; k++)
+            {
+                (*mTotals)[k].merge(stripe[k]);
+            }
+        }
+
+    private:
+        const cv::Mat& mHeatmap;
+        const cv::Mat& mMask;
+        cv::Mat* mOutput;
+        int mChannels, mScale;
+        ArgMaxRow mRow;
+        const cv::Mat* mBody;
+        float mBodyThreshold;
+        bool mLogits;
+        std::vector<LabelAccumulator>* mTotals;
+        std::mutex* mTotalsMutex;
+
+        void label_row(int i, LabelAccumulator* pStripe) const
+        {
+            int cols = mHeatmap.cols;
+            uchar* output = mOutput->ptr(i);
+            const float* heat = mHeatmap.ptr<float>(i);
+            mRow(heat, cols, mChannels, output);
+
+            if (pStripe != NULL)
+            {
+                // The raw argmax is still in the row, the labels are scaled below.
+                const float* body = mBody->ptr<float>(i);
+
+                for (int j = 0; j < cols; j++)
+                {
+                    if (body[j] > mBodyThreshold)
+                    {
+                        pStripe[0].add(j, i, body[j], mLogits);
+                        pStripe[output[j] + 1].add(j, i, heat[j * mChannels + output[j]], mLogits);
+                    }
+                }
+            }
+
+            const uchar* mask = mMask.empty() ? NULL : mMask.ptr(i);
+
+            for (int j = 0; j < cols; j++)
+            {
+                bool inside = (mask == NULL || mask[j] >= 128);
+                output[j] = inside ? uchar((output[j] + 1) * mScale) : 0;
+            }
+        }
+    };
+}
+
+void ArgMaxKernel::get_labels(const cv::Mat& pHeatmap, const cv::Mat& pMask, cv::Mat& pOutput)
+{
+    CV_Assert(pHeatmap.depth() == CV_32F && pHeatmap.channels() <= 256);
+    CV_Assert(pMask.empty() || (pMask.type() == CV_8U && pMask.size() == pHeatmap.size()));
+
+    pOutput.create(pHeatmap.rows, pHeatmap.cols, CV_8U);
+
+    ArgMaxBody body(pHeatmap, pMask, pOutput);
+    cv::parallel_for_(cv::Range(0, pHeatmap.rows), body);
+}
+
+void ArgMaxKernel::get_labels(const cv::Mat& pHeatmap, const cv::Mat& pMask, cv::Mat& pOutput,
+    const cv::Mat& pBody, float pBodyThreshold, bool pLogits, std::vector<PartStatistics>& pStats)
+{
+    CV_Assert(pHeatmap.depth() == CV_32F && pHeatmap.channels() <= 256);
+    CV_Assert(pMask.empty() || (pMask.type() == CV_8U && pMask.size() == pHeatmap.size()));
+    CV_Assert(pBody.type() == CV_32F && pBody.size() == pHeatmap.size());
+
+    pOutput.create(pHeatmap.rows, pHeatmap.cols, CV_8U);
+
+    std::vector<LabelAccumulator> totals(pHeatmap.channels() + 1);
+    std::mutex totalsMutex;
+
+    ArgMaxBody body(pHeatmap, pMask, pOutput);
+    body.setStatistics(&pBody, pBodyThreshold, pLogits, &totals, &totalsMutex);
+
+    // A few stripes per thread rather than one per row, each stripe merges its totals under the lock.
+    cv::parallel_for_(cv::Range(0, pHeatmap.rows), body, 4.0 * std::max(1, cv::getNumThreads()));
+
+    pStats.resize(totals.size());
+
+    for (size_t k = 0; k < totals.size(); k++)
+    {
+        pStats[k] = totals[k].to_statistics();
+    }
+}
+
+void ArgMaxKernel::get_mask(const cv::Mat& pValues, double pThreshold, bool pLogits, cv::Mat& pOutput, PartStatistics& pStats,
+    const cv::Point& pOffset)
+{
+    CV_Assert((pValues.type() == CV_32F) || (pValues.type() == CV_8U && pLogits == false));
+
+    pOutput.create(pValues.rows, pValues.cols, CV_8U);
+
+    LabelAccumulator total;
+    total.from_statistics(pStats);
+    std::mutex totalMutex;
+
+    MaskBody body(pValues, pThreshold, pLogits, pOutput, pOffset, total, totalMutex);
+    cv::parallel_for_(cv::Range(0, pValues.rows), body, 4.0 * std::max(1, cv::getNumThreads()));
+
+    pStats = total.to_statistics();
+}
+
+void ArgMaxKernel::map_statistics(std::vector<PartStatistics>& pStats, double pScaleX, double pScaleY, const cv::Point2d& pOffset, const cv::Size& pBounds)
+{
+    cv::Rect bounds(0, 0, pBounds.width, pBounds.height);
+
+    for (size_t k = 0; k < pStats.size(); k++)
+    {
+        PartStatistics& stats = pStats[k];
+
+        if (stats.area == 0)
+        {
+            continue;
+        }
+
+        int x1 = int(floor(stats.box.x * pScaleX + pOffset.x));
+        int y1 = int(floor(stats.box.y * pScaleY + pOffset.y));
+        int x2 = int(ceil((stats.box.x + stats.box.width) * pScaleX + pOffset.x));
+        int y2 = int(ceil((stats.box.y + stats.box.height) * pScaleY + pOffset.y));
+
+        stats.box = cv::Rect(x1, y1, x2 - x1, y2 - y1) & bounds;
+        stats.centroid = cv::Point2f(float(stats.centroid.x * pScaleX + pOffset.x), float(stats.centroid.y * pScaleY + pOffset.y));
+        stats.area = int(round(stats.area * pScaleX * pScaleY));
+    }
+}
+
+bool ArgMaxKernel::is_isa_supported(Isa pIsa)
+{
+    return pIsa <= detect_isa();
+}
+
+bool ArgMaxKernel::set_isa(Isa pIsa)
+{
+    if (is_isa_supported(pIsa) == false)
+    {
+        return false;
+    }
+
+    isa_choice() = int(pIsa);
+    return true;
+}
+
+const char* ArgMaxKernel::get_isa_name()
+{
+    switch (selected_isa())
+    {
+    case ISA_AVX512:
+        return "AVX-512";
+    case ISA_AVX2:
+        return "AVX2";
+    case ISA_SSE:
+        return "SSE2";
+    default:
+        return "scalar";
+    }
+}
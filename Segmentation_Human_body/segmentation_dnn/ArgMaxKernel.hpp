@@ -0,0 +1,53 @@
+#ifndef ARG_MAX_KERNEL_H
+#define ARG_MAX_KERNEL_H
+
+#include <opencv2/opencv.hpp>
+#include "PartStatistics.hpp"
+
+class ArgMaxKernel
+{
+public:
+    // Instruction sets of the C = 24 argmax, each one implying the previous ones.
+    enum Isa
+    {
+        ISA_SCALAR,
+        ISA_SSE,
+        ISA_AVX2,
+        ISA_AVX512
+    };
+
+    // Body part labels from a C-channel CV_32F heatmap, fusing the argmax with the label scaling:
+    // pOutput = (argmax + 1) * (255 / C) where pMask >= 128 (or pMask is empty) and 0 elsewhere.
+    // pOutput is only reallocated when its size or type differ. Rows run in parallel, and for C = 24
+    // the per-pixel argmax uses SSE2, AVX2 or AVX-512 depending on the CPU.
+    static void get_labels(const cv::Mat& pHeatmap, const cv::Mat& pMask, cv::Mat& pOutput);
+
+    // Same labels, plus statistics gathered in the same pass over the pixels where pBody > pBodyThreshold.
+    // pStats[0] is the body (confidence from pBody), pStats[k] the part with argmax k - 1 (confidence from its
+    // heatmap value). pLogits tells whether pBody and pHeatmap hold logits or probabilities. Coordinates are
+    // heatmap pixels. Each stripe accumulates on its own and the totals are merged at the end.
+    static void get_labels(const cv::Mat& pHeatmap, const cv::Mat& pMask, cv::Mat& pOutput,
+        const cv::Mat& pBody, float pBodyThreshold, bool pLogits, std::vector<PartStatistics>& pStats);
+
+    // Body mask from a CV_32F or CV_8U image: pOutput = 255 where pValues > pThreshold and 0 elsewhere, as
+    // cv::compare with CMP_GT does, and pOutput may be pValues when both are CV_8U. The mask pixels are added
+    // to pStats in the same pass, at pOffset plus their position, so consecutive strips of one image can be
+    // accumulated. The confidence is the sigmoid of pValues with pLogits, pValues itself for CV_32F
+    // probabilities and pValues / 255 for CV_8U.
+    static void get_mask(const cv::Mat& pValues, double pThreshold, bool pLogits, cv::Mat& pOutput, PartStatistics& pStats,
+        const cv::Point& pOffset = cv::Point());
+
+    // Moves statistics measured on a resized or cropped image to the full image: x' = x * scale + offset.
+    static void map_statistics(std::vector<PartStatistics>& pStats, double pScaleX, double pScaleY, const cv::Point2d& pOffset, const cv::Size& pBounds);
+
+    // Name of the instruction set selected at runtime, for logging.
+    static const char* get_isa_name();
+
+    static bool is_isa_supported(Isa pIsa);
+
+    // Replaces the instruction set detected at startup for every later call, for tests and benchmarks.
+    // Returns false, and changes nothing, when the CPU does not support pIsa.
+    static bool set_isa(Isa pIsa);
+};
+
+#endif
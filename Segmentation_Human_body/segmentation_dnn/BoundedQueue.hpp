@@ -0,0 +1,115 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+template <typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(size_t pCapacity) : mCapacity(pCapacity == 0 ? 1 : pCapacity), mClosed(false)
+    {
+    }
+
+    // Blocks while the queue is full. Returns false if the queue was closed.
+    bool push(T pItem)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotFull.wait(lock, [this] { return mClosed || mItems.size() < mCapacity; });
+
+        if (mClosed == true)
+        {
+            return false;
+        }
+
+        mItems.push_back(std::move(pItem));
+        mNotEmpty.notify_one();
+        return true;
+    }
+
+    // Never blocks. Returns false if the queue is full or closed.
+    bool tryPush(T& pItem)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if (mClosed == true || mItems.size() >= mCapacity)
+        {
+            return false;
+        }
+
+        mItems.push_back(std::move(pItem));
+        mNotEmpty.notify_one();
+        return true;
+    }
+
+    // Blocks until an item is available. Returns false once the queue is closed and drained.
+    bool pop(T& pItem)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotEmpty.wait(lock, [this] { return mClosed || !mItems.empty(); });
+
+        if (mItems.empty())
+        {
+            return false;
+        }
+
+        pItem = std::move(mItems.front());
+        mItems.pop_front();
+        mNotFull.notify_one();
+        return true;
+    }
+
+    // Waits until the deadline for an item. Returns false on timeout or when closed and drained.
+    bool popUntil(T& pItem, const std::chrono::steady_clock::time_point& pDeadline)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotEmpty.wait_until(lock, pDeadline, [this] { return mClosed || !mItems.empty(); });
+
+        if (mItems.empty())
+        {
+            return false;
+        }
+
+        pItem = std::move(mItems.front());
+        mItems.pop_front();
+        mNotFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mClosed = true;
+        mNotEmpty.notify_all();
+        mNotFull.notify_all();
+    }
+
+    bool isClosed() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mClosed;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mItems.size();
+    }
+
+    size_t capacity() const
+    {
+        return mCapacity;
+    }
+
+private:
+    size_t mCapacity;
+    bool mClosed;
+    std::deque<T> mItems;
+    mutable std::mutex mMutex;
+    std::condition_variable mNotEmpty, mNotFull;
+};
+
+#endif
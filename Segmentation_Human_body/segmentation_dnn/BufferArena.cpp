@@ -0,0 +1,51 @@
+#include "BufferArena.hpp"
+
+BufferArena::BufferArena()
+{
+    mAllocations = 0;
+}
+
+cv::Mat& BufferArena::get(int pSlot, int pRows, int pCols, int pType)
+{
+    cv::Mat& buffer = mBuffers[pSlot];
+
+    if (buffer.rows != pRows || buffer.cols != pCols || buffer.type() != pType || buffer.dims > 2)
+    {
+        buffer.create(pRows, pCols, pType);
+        mAllocations++;
+    }
+
+    return buffer;
+}
+
+void BufferArena::track(int pSlot, const cv::Mat& pBuffer)
+{
+    if (mBuffers[pSlot].data != pBuffer.data)
+    {
+        mBuffers[pSlot] = pBuffer;
+        mAllocations++;
+    }
+}
+
+cv::Mat& BufferArena::slot(int pSlot)
+{
+    return mBuffers[pSlot];
+}
+
+uint64_t BufferArena::getAllocationCount() const
+{
+    return mAllocations;
+}
+
+void BufferArena::resetAllocationCount()
+{
+    mAllocations = 0;
+}
+
+void BufferArena::release()
+{
+    for (int i = 0; i < SLOT_COUNT; i++)
+    {
+        mBuffers[i].release();
+    }
+}
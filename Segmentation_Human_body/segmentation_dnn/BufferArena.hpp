@@ -0,0 +1,62 @@
+#ifndef BUFFER_ARENA_H
+#define BUFFER_ARENA_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+
+// Intermediate images of the preprocessing, inference and decoding stages.
+enum ArenaSlot
+{
+    SLOT_CONVERTED,
+    SLOT_PADDED,
+    SLOT_RESIZED,
+    SLOT_INPUT,
+    SLOT_BATCH,
+    SLOT_OUTPUT_MASK,
+    SLOT_OUTPUT_PART,
+    SLOT_MASK_MODEL,
+    SLOT_MASK_VALUES,
+    SLOT_PART_MODEL,
+    SLOT_PART_CROP,
+    SLOT_HEATMAP,
+    SLOT_HEATMAP_8U,
+    SLOT_LABELS,
+    SLOT_UPSAMPLED,
+    SLOT_MASK,
+    SLOT_PARTS,
+    SLOT_PROBABILITY,
+    SLOT_STRIP_MASK,
+    SLOT_STRIP_PARTS,
+    SLOT_COUNT
+};
+
+// Keeps one buffer per slot from one frame to the next, so a stream of same-sized images only allocates its
+// image buffers on the first frame. Mats handed out share the slot buffer and are overwritten by the next frame.
+class BufferArena
+{
+public:
+    BufferArena();
+
+    // Buffer of the slot with the given shape, reallocated (and counted) only when the shape changed.
+    cv::Mat& get(int pSlot, int pRows, int pCols, int pType);
+
+    // Records a buffer the slot was handed to and filled by someone else, counting it if it was reallocated.
+    void track(int pSlot, const cv::Mat& pBuffer);
+
+    cv::Mat& slot(int pSlot);
+
+    uint64_t getAllocationCount() const;
+
+    void resetAllocationCount();
+
+    void release();
+
+private:
+    cv::Mat mBuffers[SLOT_COUNT];
+    uint64_t mAllocations;
+
+    BufferArena(const BufferArena&);
+    BufferArena& operator=(const BufferArena&);
+};
+
+#endif
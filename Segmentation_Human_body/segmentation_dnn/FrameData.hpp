@@ -0,0 +1,28 @@
+#ifndef FRAME_DATA_H
+#define FRAME_DATA_H
+
+#include <opencv2/opencv.hpp>
+#include "segmentationDNN.hpp"
+#include "ImageSize.hpp"
+#include "Padding.hpp"
+#include "BufferArena.hpp"
+
+// Everything one image carries through the Preprocess, Infer and Postprocess stages of SegmentationDNN.
+// Objects can be reused across frames: every intermediate image, the model outputs and the result live in
+// the frame's arena and keep their buffers while the sizes do not change.
+struct FrameData
+{
+    cv::Mat image;
+    ImageSize originalSize;
+    ImageSize modelInputSize;
+    Padding padding;
+    int outputs = OUTPUT_ALL;
+    int encodings = 0;
+    cv::Mat input;
+    cv::Mat outputMask;
+    cv::Mat outputPart;
+    SegmentationResult result;
+    BufferArena buffers;
+};
+
+#endif
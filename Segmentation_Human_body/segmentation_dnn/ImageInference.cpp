@@ -1,85 +1,332 @@
 #include "ImageInference.hpp"
 #include "ImageSize.hpp"
 #include "Padding.hpp"
+#include "ArgMaxKernel.hpp"
+#include "SegmentationException.hpp"
+#include <algorithm>
 
-const int labels = 24;
-
-ImageInferenceProcess::ImageInferenceProcess(const cv::Mat& pBodyFullSegment, const cv::Mat& pBodyPartSegment, const ImageSize& pImageSize, const ImageSize& pModelInput, const Padding& pPadding)
+ImageInferenceProcess::ImageInferenceProcess(const cv::Mat& pBodyFullSegment, const cv::Mat& pBodyPartSegment, const ImageSize& pImageSize, const ImageSize& pModelInput, const Padding& pPadding, BufferArena* pArena)
+    : mImageSize(pImageSize), mModelInput(pModelInput), mPadding(pPadding)
 {
     mBody_full_segment = pBodyFullSegment;
     mBody_part_segment = pBodyPartSegment;
-    mImageSize = new ImageSize(pImageSize);
-    mModelInput = new ImageSize(pModelInput);
-    mPadding = new Padding(pPadding);
+    mArena = (pArena != NULL) ? pArena : &mLocalArena;
+    mLogitDomain = false;
+}
+
+void ImageInferenceProcess::set_logit_domain(bool pEnable)
+{
+    if (pEnable != mLogitDomain)
+    {
+        mLogitDomain = pEnable;
+        mMaskValues = cv::Mat();
+    }
 }
 
-cv::Mat ImageInferenceProcess::get_Mask(float threshold)
+cv::Mat ImageInferenceProcess::get_Mask(PartStatistics* pBody, float threshold)
 {
-    cv::Mat inference = scale_and_crop_to_input_tensor_shape(mBody_full_segment, true);
-    cv::Mat result = (inference > threshold);
+    cv::Mat inference = get_Mask_values();
+    cv::Mat& result = mArena->get(SLOT_MASK, inference.rows, inference.cols, CV_8U);
+
+    if (pBody != NULL)
+    {
+        *pBody = PartStatistics();
+        ArgMaxKernel::get_mask(inference, get_mask_threshold(threshold), mLogitDomain, result, *pBody);
+    }
+    else
+    {
+        cv::compare(inference, get_mask_threshold(threshold), result, cv::CMP_GT);
+    }
+
     return result;
 }
 
-cv::Mat ImageInferenceProcess::get_Parts_segmentation(const cv::Mat& mask)
+cv::Mat ImageInferenceProcess::get_Mask_probability()
+{
+    cv::Mat values = get_Mask_values();
+    cv::Mat& probability = mArena->get(SLOT_PROBABILITY, values.rows, values.cols, values.type());
+    values.copyTo(probability);
+
+    if (mLogitDomain == true)
+    {
+        get_sigmoid(probability);
+    }
+
+    return probability;
+}
+
+cv::Mat ImageInferenceProcess::get_Mask_values()
+{
+    if (mMaskValues.empty())
+    {
+        mMaskValues = scale_and_crop_to_input_tensor_shape(mBody_full_segment, SLOT_MASK_MODEL, SLOT_MASK_VALUES, !mLogitDomain);
+    }
+
+    return mMaskValues;
+}
+
+float ImageInferenceProcess::get_mask_threshold(float pThreshold)
+{
+    // sigmoid(x) > t  <=>  x > log(t / (1 - t)).
+    return (mLogitDomain == true) ? float(log(pThreshold / (1.0 - pThreshold))) : pThreshold;
+}
+
+cv::Mat ImageInferenceProcess::get_Parts_segmentation(const cv::Mat& mask, std::vector<PartStatistics>* pStatistics, float threshold)
 {
-    cv::Mat inference = scale_and_crop_to_input_tensor_shape(mBody_part_segment, true);
+    // In the logit domain the sigmoid is only needed for a single-channel output. It is monotonic, so the argmax
+    // at model input size is the same, but the crop resize then interpolates logits instead of probabilities.
+    cv::Mat& inference = scale_and_crop_to_input_tensor_shape(mBody_part_segment, SLOT_PART_MODEL, SLOT_PART_CROP, !mLogitDomain);
     
     int channel = inference.channels();
 
     if (channel == 1)
     {
+        if (mLogitDomain == true)
+        {
+            get_sigmoid(inference);
+        }
+
         return inference;
     }
 
-    cv::Mat rightImage = get_arg_max_last(inference);
+    cv::Mat& part_segmentation = mArena->get(SLOT_PARTS, inference.rows, inference.cols, CV_8U);
 
-    rightImage += 1;
-    cv::Mat tempMat = mask / 255;
-
-    cv::Mat part_segmentation = (rightImage.mul(tempMat)) * (255 / labels);
+    if (pStatistics != NULL)
+    {
+        ArgMaxKernel::get_labels(inference, mask, part_segmentation, get_Mask_values(), get_mask_threshold(threshold), mLogitDomain, *pStatistics);
+    }
+    else
+    {
+        ArgMaxKernel::get_labels(inference, mask, part_segmentation);
+    }
 
     return part_segmentation;
 }
 
-cv::Mat ImageInferenceProcess::get_arg_max_last(const cv::Mat& pImage)
+cv::Mat ImageInferenceProcess::get_Mask_low_resolution(PartStatistics* pBody, float threshold)
 {
-    int rows = pImage.rows;
-    int cols = pImage.cols;
-    int channel = pImage.channels();
-    int64_t tSize = rows * cols;
+    cv::Rect region;
+    cv::Matx23d transform = get_heatmap_transform(get_image_size(mBody_full_segment), region);
 
-    float *input = (float*)(pImage.data);
-    uchar* arrayTemp = new uchar[tSize];
+    cv::Mat& logits = mArena->get(SLOT_HEATMAP, region.height, region.width, CV_32F);
+    mBody_full_segment(region).convertTo(logits, CV_32F);
+    get_sigmoid(logits);
 
-    int64_t cont = 0;
-    
-    if (channel > 1)
+    cv::Mat& probability = mArena->get(SLOT_HEATMAP_8U, region.height, region.width, CV_8U);
+    logits.convertTo(probability, CV_8U, 255.0);
+
+    cv::Mat& upsampled = mArena->get(SLOT_UPSAMPLED, mImageSize.mHeight, mImageSize.mWidth, CV_8U);
+    cv::warpAffine(probability, upsampled, transform, cv::Size(mImageSize.mWidth, mImageSize.mHeight),
+        cv::INTER_LINEAR | cv::WARP_INVERSE_MAP, cv::BORDER_REPLICATE);
+
+    cv::Mat& result = mArena->get(SLOT_MASK, mImageSize.mHeight, mImageSize.mWidth, CV_8U);
+
+    if (pBody != NULL)
+    {
+        *pBody = PartStatistics();
+        ArgMaxKernel::get_mask(upsampled, threshold * 255.0, false, result, *pBody);
+    }
+    else
+    {
+        cv::compare(upsampled, threshold * 255.0, result, cv::CMP_GT);
+    }
+
+    return result;
+}
+
+cv::Mat ImageInferenceProcess::get_Parts_segmentation_low_resolution(const cv::Mat& mask, std::vector<PartStatistics>* pStatistics, float threshold)
+{
+    if (mBody_part_segment.channels() == 1)
+    {
+        return get_Parts_segmentation(mask, pStatistics, threshold);
+    }
+
+    cv::Rect region;
+    cv::Matx23d transform = get_heatmap_transform(get_image_size(mBody_part_segment), region);
+
+    cv::Mat& labelImage = get_low_resolution_labels(region, transform, pStatistics, threshold);
+
+    cv::Mat& upsampled = mArena->get(SLOT_PARTS, mImageSize.mHeight, mImageSize.mWidth, CV_8U);
+    cv::warpAffine(labelImage, upsampled, transform, cv::Size(mImageSize.mWidth, mImageSize.mHeight),
+        cv::INTER_NEAREST | cv::WARP_INVERSE_MAP, cv::BORDER_REPLICATE);
+
+    // The mask upsampling buffer is free again once the mask is thresholded.
+    cv::Mat& background = mArena->get(SLOT_UPSAMPLED, mImageSize.mHeight, mImageSize.mWidth, CV_8U);
+    cv::compare(mask, 128, background, cv::CMP_LT);
+    upsampled.setTo(cv::Scalar(0), background);
+
+    return upsampled;
+}
+
+void ImageInferenceProcess::get_encodings_low_resolution(int pEncodings, MaskEncodings& pOutput, std::vector<PartStatistics>* pStatistics,
+    PartStatistics* pBody, float threshold)
+{
+    cv::Rect region;
+    cv::Matx23d transform = get_heatmap_transform(get_image_size(mBody_full_segment), region);
+
+    cv::Mat& logits = mArena->get(SLOT_HEATMAP, region.height, region.width, CV_32F);
+    mBody_full_segment(region).convertTo(logits, CV_32F);
+    get_sigmoid(logits);
+
+    cv::Mat& probability = mArena->get(SLOT_HEATMAP_8U, region.height, region.width, CV_8U);
+    logits.convertTo(probability, CV_8U, 255.0);
+
+    int partCount = 0;
+    cv::Rect partRegion;
+    cv::Matx23d partTransform;
+    cv::Mat labelImage;
+
+    if ((pEncodings & ENCODING_PARTS_RLE) != 0 && !mBody_part_segment.empty() && mBody_part_segment.channels() > 1)
+    {
+        partCount = mBody_part_segment.channels();
+        partTransform = get_heatmap_transform(get_image_size(mBody_part_segment), partRegion);
+        labelImage = get_low_resolution_labels(partRegion, partTransform, pStatistics, threshold);
+    }
+    else
+    {
+        pEncodings &= ~ENCODING_PARTS_RLE;
+    }
+
+    if (pBody != NULL)
+    {
+        *pBody = PartStatistics();
+    }
+
+    const int stripWidth = 32;
+    int height = mImageSize.mHeight;
+    int width = mImageSize.mWidth;
+
+    MaskEncoder encoder(height, width, pEncodings, partCount, partCount > 0 ? 255 / partCount : 1);
+
+    cv::Mat& maskStrip = mArena->get(SLOT_STRIP_MASK, height, stripWidth, CV_8U);
+    cv::Mat& partStrip = mArena->get(SLOT_STRIP_PARTS, height, stripWidth, CV_8U);
+
+    cv::Matx23d stripTransform = transform;
+    cv::Matx23d partStripTransform = partTransform;
+
+    for (int x = 0; x < width; x += stripWidth)
+    {
+        int columns = std::min(stripWidth, width - x);
+
+        // Column x of the image is column 0 of the strip.
+        stripTransform(0, 2) = transform(0, 2) + transform(0, 0) * x;
+
+        cv::Mat mask = maskStrip.colRange(0, columns);
+        cv::warpAffine(probability, mask, stripTransform, cv::Size(columns, height),
+            cv::INTER_LINEAR | cv::WARP_INVERSE_MAP, cv::BORDER_REPLICATE);
+
+        if (pBody != NULL)
+        {
+            ArgMaxKernel::get_mask(mask, threshold * 255.0, false, mask, *pBody, cv::Point(x, 0));
+        }
+        else
+        {
+            cv::compare(mask, threshold * 255.0, mask, cv::CMP_GT);
+        }
+
+        cv::Mat parts;
+
+        if (partCount > 0)
+        {
+            partStripTransform(0, 2) = partTransform(0, 2) + partTransform(0, 0) * x;
+
+            parts = partStrip.colRange(0, columns);
+            cv::warpAffine(labelImage, parts, partStripTransform, cv::Size(columns, height),
+                cv::INTER_NEAREST | cv::WARP_INVERSE_MAP, cv::BORDER_REPLICATE);
+        }
+
+        encoder.add_strip(mask, parts, x);
+    }
+
+    encoder.finish(pOutput);
+}
+
+cv::Mat& ImageInferenceProcess::get_low_resolution_labels(const cv::Rect& pRegion, const cv::Matx23d& pTransform, std::vector<PartStatistics>* pStatistics, float threshold)
+{
+    // The sigmoid is monotonic, so the argmax of the raw heatmap is the same.
+    cv::Mat& labelImage = mArena->get(SLOT_LABELS, pRegion.height, pRegion.width, CV_8U);
+
+    if (pStatistics != NULL)
     {
-        for (int i = 0; i < rows; i++)
+        // The part statistics are gathered where the body heatmap is above the threshold, pixel for pixel.
+        if (mBody_full_segment.size() != mBody_part_segment.size())
         {
-            for (int j = 0; j < cols; j++)
-            {
-                uchar pos = 0;
-                cv::Vec<float, labels> elem = pImage.at<cv::Vec<float, labels>>(i, j);
-                for (uchar k = 1; k < labels; k++)
-                {
-                    if (elem[k] > elem[pos])
-                    {
-                        pos = k;
-                    }
-                }
-
-                arrayTemp[cont++] = pos;
-            }
+            throw SegmentationException("The mask and part heatmaps differ in size, the part statistics cannot be gathered.");
         }
 
-        return cv::Mat(rows, cols, CV_8U, arrayTemp);
+        ArgMaxKernel::get_labels(mBody_part_segment(pRegion), cv::Mat(), labelImage, mBody_full_segment(pRegion),
+            log(threshold / (1.0 - threshold)), true, *pStatistics);
+        heatmap_to_image_statistics(pTransform, *pStatistics);
     }
     else
     {
-        return pImage;
+        ArgMaxKernel::get_labels(mBody_part_segment(pRegion), cv::Mat(), labelImage);
+    }
+
+    return labelImage;
+}
+
+cv::Matx23d ImageInferenceProcess::get_heatmap_transform(const ImageSize& pHeatmapSize, cv::Rect& pRegion)
+{
+    // Composes the crop_and_resize_batch step with the heatmap to model input resize, giving the affine
+    // map from an original image pixel to a heatmap coordinate (OpenCV pixel-center convention).
+    cv::Vec4f box = get_padding_box(mImageSize.mHeight, mImageSize.mWidth, mPadding);
+
+    int image_y1 = box[0] * (float(mModelInput.mHeight) - 1.);
+    int image_x1 = box[1] * (float(mModelInput.mWidth) - 1.);
+    int image_y2 = box[2] * (float(mModelInput.mHeight) - 1.);
+    int image_x2 = box[3] * (float(mModelInput.mWidth) - 1.);
+
+    double heatmapScaleY = double(pHeatmapSize.mHeight) / double(mModelInput.mHeight);
+    double heatmapScaleX = double(pHeatmapSize.mWidth) / double(mModelInput.mWidth);
+    double cropScaleY = double(image_y2 - image_y1 + 1) / double(mImageSize.mHeight);
+    double cropScaleX = double(image_x2 - image_x1 + 1) / double(mImageSize.mWidth);
+
+    double scaleY = cropScaleY * heatmapScaleY;
+    double offsetY = (0.5 * cropScaleY + image_y1) * heatmapScaleY - 0.5;
+    double scaleX = cropScaleX * heatmapScaleX;
+    double offsetX = (0.5 * cropScaleX + image_x1) * heatmapScaleX - 0.5;
+
+    int y1 = std::max(0, int(floor(offsetY)));
+    int x1 = std::max(0, int(floor(offsetX)));
+    int y2 = std::min(pHeatmapSize.mHeight - 1, int(ceil(scaleY * (mImageSize.mHeight - 1) + offsetY)) + 1);
+    int x2 = std::min(pHeatmapSize.mWidth - 1, int(ceil(scaleX * (mImageSize.mWidth - 1) + offsetX)) + 1);
+
+    pRegion = cv::Rect(x1, y1, std::max(1, x2 - x1 + 1), std::max(1, y2 - y1 + 1));
+
+    return cv::Matx23d(scaleX, 0, offsetX - x1,
+        0, scaleY, offsetY - y1);
+}
+
+void ImageInferenceProcess::heatmap_to_image_statistics(const cv::Matx23d& pTransform, std::vector<PartStatistics>& pStatistics)
+{
+    // pTransform maps an image pixel to the heatmap, h = scale * x + offset, so x = (h - offset) / scale.
+    double scaleX = pTransform(0, 0);
+    double offsetX = pTransform(0, 2);
+    double scaleY = pTransform(1, 1);
+    double offsetY = pTransform(1, 2);
+
+    cv::Rect image(0, 0, mImageSize.mWidth, mImageSize.mHeight);
+
+    for (size_t k = 0; k < pStatistics.size(); k++)
+    {
+        PartStatistics& stats = pStatistics[k];
+
+        if (stats.area == 0)
+        {
+            continue;
+        }
+
+        // Every heatmap pixel covers [h - 0.5, h + 0.5] of the image.
+        int x1 = int(ceil((stats.box.x - 0.5 - offsetX) / scaleX));
+        int y1 = int(ceil((stats.box.y - 0.5 - offsetY) / scaleY));
+        int x2 = int(floor((stats.box.x + stats.box.width - 0.5 - offsetX) / scaleX));
+        int y2 = int(floor((stats.box.y + stats.box.height - 0.5 - offsetY) / scaleY));
+
+        stats.box = cv::Rect(x1, y1, std::max(1, x2 - x1 + 1), std::max(1, y2 - y1 + 1)) & image;
+        stats.centroid = cv::Point2f(float((stats.centroid.x - offsetX) / scaleX), float((stats.centroid.y - offsetY) / scaleY));
+        stats.area = int(round(stats.area / (scaleX * scaleY)));
     }
-    
 }
 
 ImageSize ImageInferenceProcess::get_image_size(const cv::Mat& pImage)
@@ -89,56 +336,61 @@ ImageSize ImageInferenceProcess::get_image_size(const cv::Mat& pImage)
     return ImageSize(height, width);
 }
 
-cv::Mat ImageInferenceProcess::resize_image_to(const cv::Mat& pImage, const ImageSize& pImageSize)
+void ImageInferenceProcess::resize_image_to(const cv::Mat& pImage, const ImageSize& pImageSize, cv::Mat& pOutput)
 {
-    cv::Mat rightImage;
-    pImage.convertTo(rightImage, CV_32F);
+    // The model outputs are already CV_32F, other depths are converted first.
+    cv::Mat rightImage = pImage;
+
+    if (pImage.depth() != CV_32F)
+    {
+        pImage.convertTo(rightImage, CV_32F);
+    }
 
     if (get_image_size(pImage) == pImageSize)
     {
-        return rightImage;
+        rightImage.copyTo(pOutput);
+        return;
     }
 
-    cv::Mat output;
-    cv::resize(rightImage, output, cv::Size(pImageSize.mWidth, pImageSize.mHeight));
-    return output;
+    cv::resize(rightImage, pOutput, cv::Size(pImageSize.mWidth, pImageSize.mHeight));
 }
 
 void ImageInferenceProcess::get_sigmoid(cv::Mat& pImage)
 {
-    float *input = (float*)(pImage.data);
-    int64_t tSize = pImage.cols * pImage.rows * pImage.channels();
+    // cv::exp and cv::divide run on the SIMD paths of OpenCV, every step works in place.
+    pImage.convertTo(pImage, -1, -1.0);
+    cv::exp(pImage, pImage);
+    pImage += cv::Scalar::all(1.0);
+    cv::divide(1.0, pImage, pImage);
+}
 
-    for (int64_t i = 0; i < tSize; i++)
-    {
-        float val = 1. / (1. + exp(-(input[i])));
-        input[i] = val;
-    } 
+cv::Vec4f ImageInferenceProcess::get_padding_box(int original_height, int original_width, const Padding& padding)
+{
+    cv::Vec4f box;
+    box[0] = float(padding.mTop / (original_height + padding.mTop + padding.mBottom - 1.0));
+    box[1] = float(padding.mLeft / (original_width + padding.mLeft + padding.mRight - 1.0));
+    box[2] = float((padding.mTop + original_height - 1.0) / (original_height + padding.mTop + padding.mBottom - 1.0));
+    box[3] = float((padding.mLeft + original_width - 1.0) / (original_width + padding.mLeft + padding.mRight - 1.0));
+    return box;
 }
 
-cv::Mat ImageInferenceProcess::remove_padding_and_resize_back(const cv::Mat& pImage, int original_height, int original_width, const Padding& padding)
+void ImageInferenceProcess::remove_padding_and_resize_back(const cv::Mat& pImage, int original_height, int original_width, const Padding& padding, cv::Mat& pOutput)
 {
-    std::vector<float> box;
-    box.push_back(padding.mTop / (original_height + padding.mTop + padding.mBottom - 1.0));
-    box.push_back(padding.mLeft / (original_width + padding.mLeft + padding.mRight - 1.0));
-    box.push_back((padding.mTop + original_height - 1.0) / (original_height + padding.mTop + padding.mBottom - 1.0));
-    box.push_back((padding.mLeft + original_width - 1.0) / (original_width + padding.mLeft + padding.mRight - 1.0));
+    cv::Vec4f box = get_padding_box(original_height, original_width, padding);
 
-    return crop_and_resize_batch(pImage, box, ImageSize(original_height, original_width));
+    crop_and_resize_batch(pImage, box, ImageSize(original_height, original_width), pOutput);
 }
 
-cv::Mat ImageInferenceProcess::crop_and_resize_batch(const cv::Mat& pImage, std::vector<float>& pBox, const ImageSize& crop_size)
+void ImageInferenceProcess::crop_and_resize_batch(const cv::Mat& pImage, const cv::Vec4f& pBox, const ImageSize& crop_size, cv::Mat& pOutput)
 {
-    assert(pBox.size() == 4);
-
     float y1, x1, y2, x2;
     y1 = pBox[0];
     x1 = pBox[1];
     y2 = pBox[2];
     x2 = pBox[3];
 
-    assert(std::max(pBox) <= 1);
-    assert(std::min(pBox) >= 0);
+    assert(*std::max_element(pBox.val, pBox.val + 4) <= 1);
+    assert(*std::min_element(pBox.val, pBox.val + 4) >= 0);
     assert(y1 <= y2);
     assert(x1 <= x2);
 
@@ -150,19 +402,21 @@ cv::Mat ImageInferenceProcess::crop_and_resize_batch(const cv::Mat& pImage, std:
 
     cv::Mat cropped_image = pImage(cv::Range(image_y1, 1 + image_y2), cv::Range(image_x1, 1 + image_x2));
 
-    cv::Mat resized_cropped_image = resize_image_to(cropped_image, ImageSize(crop_size.mHeight, crop_size.mWidth));
-
-    return resized_cropped_image;
+    resize_image_to(cropped_image, ImageSize(crop_size.mHeight, crop_size.mWidth), pOutput);
 }
 
-cv::Mat ImageInferenceProcess::scale_and_crop_to_input_tensor_shape(cv::Mat& pImage, bool apply_sigmoid_activation)
+cv::Mat& ImageInferenceProcess::scale_and_crop_to_input_tensor_shape(const cv::Mat& pImage, int pModelSlot, int pOutputSlot, bool apply_sigmoid_activation)
 {
-    cv::Mat resized_image = resize_image_to(pImage, *mModelInput);
+    cv::Mat& resized_image = mArena->get(pModelSlot, mModelInput.mHeight, mModelInput.mWidth, CV_32FC(pImage.channels()));
+    resize_image_to(pImage, mModelInput, resized_image);
 
     if (apply_sigmoid_activation == true)
     {
         get_sigmoid(resized_image);
     }
 
-    return remove_padding_and_resize_back(resized_image, mImageSize->mHeight, mImageSize->mWidth, *mPadding);
-}
\ No newline at end of file
+    cv::Mat& output = mArena->get(pOutputSlot, mImageSize.mHeight, mImageSize.mWidth, CV_32FC(pImage.channels()));
+    remove_padding_and_resize_back(resized_image, mImageSize.mHeight, mImageSize.mWidth, mPadding, output);
+
+    return output;
+}
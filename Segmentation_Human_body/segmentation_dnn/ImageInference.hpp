@@ -2,38 +2,87 @@
 #define IMAGE_INFERENCE_H
 
 #include <opencv2/opencv.hpp>
-
-class ImageSize;
-class Padding;
+#include "ImageSize.hpp"
+#include "Padding.hpp"
+#include "BufferArena.hpp"
+#include "MaskEncoding.hpp"
+#include "PartStatistics.hpp"
 
 class ImageInferenceProcess
 {
 public:
-    ImageInferenceProcess(const cv::Mat& pBodyFullSegment, const cv::Mat& pBodyPartSegment, const ImageSize& pImageSize, const ImageSize& pModelInput, const Padding& pPadding);
-    cv::Mat get_Mask(float threshold = 0.75);
-    cv::Mat get_Parts_segmentation(const cv::Mat& mask);
+    // With pArena every intermediate and returned image lives in its slots, so decoding same-sized frames does
+    // not reallocate image buffers. The returned Mats are then overwritten by the next decoding with the same arena.
+    ImageInferenceProcess(const cv::Mat& pBodyFullSegment, const cv::Mat& pBodyPartSegment, const ImageSize& pImageSize, const ImageSize& pModelInput, const Padding& pPadding, BufferArena* pArena = NULL);
+
+    // By default the full resolution heads go through the sigmoid at model input size and the probabilities
+    // are resized to the image, as they always were. With pEnable the raw logits are resized instead and the
+    // mask is thresholded at log(t / (1 - t)), which skips the sigmoid of every part channel but is not
+    // bit-identical: interpolating logits and interpolating probabilities differ near the edges.
+    void set_logit_domain(bool pEnable);
+
+    // With pBody, also fills the statistics of the mask pixels while thresholding (index 0 of the statistics).
+    cv::Mat get_Mask(PartStatistics* pBody = NULL, float threshold = 0.75);
+
+    // Soft sigmoid probabilities in [0, 1] at the original image size.
+    cv::Mat get_Mask_probability();
+    // With pStatistics, also fills the per-part statistics of the pixels above the mask threshold (see ArgMaxKernel).
+    cv::Mat get_Parts_segmentation(const cv::Mat& mask, std::vector<PartStatistics>* pStatistics = NULL, float threshold = 0.75);
+
+    // Same outputs, but thresholding and argmax run at heatmap resolution on the region that maps to the
+    // original image, and only the resulting 8-bit images are upsampled.
+    cv::Mat get_Mask_low_resolution(PartStatistics* pBody = NULL, float threshold = 0.75);
+    cv::Mat get_Parts_segmentation_low_resolution(const cv::Mat& mask, std::vector<PartStatistics>* pStatistics = NULL, float threshold = 0.75);
+
+    // The pEncodings (MaskEncodingType flags) of the low resolution mask and parts, upsampled a few columns at a
+    // time and fed to a MaskEncoder, so the full-size 8-bit images are never built. pStatistics and pBody are
+    // filled as in get_Parts_segmentation_low_resolution and get_Mask_low_resolution.
+    void get_encodings_low_resolution(int pEncodings, MaskEncodings& pOutput, std::vector<PartStatistics>* pStatistics = NULL,
+        PartStatistics* pBody = NULL, float threshold = 0.75);
 private:
     cv::Mat mBody_full_segment, mBody_part_segment;
 
-    ImageSize* mImageSize;
+    cv::Mat mMaskValues;
+
+    bool mLogitDomain;
+
+    ImageSize mImageSize;
+
+    ImageSize mModelInput;
 
-    ImageSize* mModelInput;
+    Padding mPadding;
 
-    Padding* mPadding;
+    BufferArena mLocalArena;
+
+    BufferArena* mArena;
 
     ImageSize get_image_size(const cv::Mat& pImage);
     
-    cv::Mat resize_image_to(const cv::Mat& pImage, const ImageSize& pImageSize);
+    void resize_image_to(const cv::Mat& pImage, const ImageSize& pImageSize, cv::Mat& pOutput);
     
     void get_sigmoid(cv::Mat& pImage);
+
+    // The mask head at the image size, logits or probabilities depending on the domain, computed once.
+    cv::Mat get_Mask_values();
+
+    // pThreshold on a probability, expressed in the domain of get_Mask_values.
+    float get_mask_threshold(float pThreshold);
     
-    cv::Mat remove_padding_and_resize_back(const cv::Mat& pImage, int original_height, int original_width, const Padding& padding);
+    cv::Vec4f get_padding_box(int original_height, int original_width, const Padding& padding);
+
+    cv::Matx23d get_heatmap_transform(const ImageSize& pHeatmapSize, cv::Rect& pRegion);
+
+    // Argmax labels of the part heatmap region in SLOT_LABELS.
+    cv::Mat& get_low_resolution_labels(const cv::Rect& pRegion, const cv::Matx23d& pTransform, std::vector<PartStatistics>* pStatistics, float threshold);
+
+    void heatmap_to_image_statistics(const cv::Matx23d& pTransform, std::vector<PartStatistics>& pStatistics);
+
+    void remove_padding_and_resize_back(const cv::Mat& pImage, int original_height, int original_width, const Padding& padding, cv::Mat& pOutput);
     
-    cv::Mat crop_and_resize_batch(const cv::Mat& pImage, std::vector<float>& pBox, const ImageSize& crop_size);
+    void crop_and_resize_batch(const cv::Mat& pImage, const cv::Vec4f& pBox, const ImageSize& crop_size, cv::Mat& pOutput);
     
-    cv::Mat scale_and_crop_to_input_tensor_shape(cv::Mat& pImage, bool apply_sigmoid_activation = false);
-
-    cv::Mat get_arg_max_last(const cv::Mat& pImage);
+    // Resized to the model input in pModelSlot, then cropped and resized back to the image in pOutputSlot.
+    cv::Mat& scale_and_crop_to_input_tensor_shape(const cv::Mat& pImage, int pModelSlot, int pOutputSlot, bool apply_sigmoid_activation = false);
 };
 
 #endif
@@ -10,21 +10,136 @@ ImageProcessing::ImageProcessing()
 {
 }
 
-std::pair<cv::Mat, Padding> ImageProcessing::get_processed_image(const cv::Mat& pImage, ImageSize& modelInputSize)
+std::pair<cv::Mat, Padding> ImageProcessing::get_processed_image(const cv::Mat& pImage, ImageSize& modelInputSize, BufferArena* pArena)
 {
-    cv::Mat rightImage;
+    int height = pImage.rows;
+    int width = pImage.cols;
+
+    {
+        std::lock_guard<std::mutex> lock(mBucketMutex);
+
+        // Selected once under the lock, so the bucket counted is the bucket used even if the buckets change meanwhile.
+        if (mBuckets.empty())
+        {
+            modelInputSize = get_input_resolution_height_and_width(MOVILNET_RESOLUTION, MOVILNET_STRIDE, height, width);
+        }
+        else
+        {
+            int bucket = select_bucket(height, width);
+            mBucketHits[bucket]++;
+            modelInputSize = mBuckets[bucket];
+        }
+    }
+
+    return get_processed_image_at(pImage, modelInputSize, pArena);
+}
+
+std::pair<cv::Mat, Padding> ImageProcessing::get_processed_image_at(const cv::Mat& pImage, const ImageSize& pModelInputSize, BufferArena* pArena)
+{
+    BufferArena local;
+    BufferArena& arena = (pArena != NULL) ? *pArena : local;
+
+    cv::Mat& rightImage = arena.get(SLOT_CONVERTED, pImage.rows, pImage.cols, CV_32FC(pImage.channels()));
     pImage.convertTo(rightImage, CV_32F);
 
-    int height = rightImage.rows;
-    int width = rightImage.cols;
+    Padding padding = pad_and_resize_to(rightImage, pModelInputSize.mHeight, pModelInputSize.mWidth, arena);
+
+    const cv::Mat& resized = arena.slot(SLOT_RESIZED);
+    cv::Mat& processed = arena.get(SLOT_INPUT, resized.rows, resized.cols, resized.type());
+    get_mobileNet_processed_image(resized, processed);
+
+    return std::make_pair(processed, padding);
+}
+
+ImageSize ImageProcessing::get_bounded_input_size(int pHeight, int pWidth, int pMaxSide)
+{
+    float resolution = std::min(MOVILNET_RESOLUTION, float(pMaxSide) / float(std::max(pHeight, pWidth)));
+
+    ImageSize size = get_input_resolution_height_and_width(resolution, MOVILNET_STRIDE, pHeight, pWidth);
+
+    size.mHeight = std::max(size.mHeight, MOVILNET_STRIDE + 1);
+    size.mWidth = std::max(size.mWidth, MOVILNET_STRIDE + 1);
+
+    return size;
+}
+
+ImageSize ImageProcessing::get_model_input_size(int pHeight, int pWidth)
+{
+    std::lock_guard<std::mutex> lock(mBucketMutex);
+
+    if (mBuckets.empty())
+    {
+        return get_input_resolution_height_and_width(MOVILNET_RESOLUTION, MOVILNET_STRIDE, pHeight, pWidth);
+    }
+
+    return mBuckets[select_bucket(pHeight, pWidth)];
+}
+
+void ImageProcessing::set_input_buckets(const std::vector<ImageSize>& pBuckets)
+{
+    std::lock_guard<std::mutex> lock(mBucketMutex);
+
+    mBuckets.clear();
+
+    for (size_t i = 0; i < pBuckets.size(); i++)
+    {
+        int height = to_valid_input_resolution(float(pBuckets[i].mHeight), MOVILNET_STRIDE);
+        int width = to_valid_input_resolution(float(pBuckets[i].mWidth), MOVILNET_STRIDE);
 
-    modelInputSize = get_input_resolution_height_and_width(MOVILNET_RESOLUTION, MOVILNET_STRIDE, height, width);
+        if (height > 0 && width > 0)
+        {
+            mBuckets.push_back(ImageSize(height, width));
+        }
+    }
 
-    std::pair<cv::Mat, Padding> info = pad_and_resize_to(rightImage, modelInputSize.mHeight, modelInputSize.mWidth);
+    mBucketHits.assign(mBuckets.size(), 0);
+}
 
-    cv::Mat processed = get_mobileNet_processed_image(info.first);
+std::vector<ImageSize> ImageProcessing::get_input_buckets() const
+{
+    std::lock_guard<std::mutex> lock(mBucketMutex);
+    return mBuckets;
+}
 
-    return std::make_pair(processed, info.second);
+std::vector<uint64_t> ImageProcessing::get_bucket_hits() const
+{
+    std::lock_guard<std::mutex> lock(mBucketMutex);
+    return mBucketHits;
+}
+
+void ImageProcessing::reset_bucket_hits()
+{
+    std::lock_guard<std::mutex> lock(mBucketMutex);
+    mBucketHits.assign(mBuckets.size(), 0);
+}
+
+int ImageProcessing::select_bucket(int pHeight, int pWidth)
+{
+    // Cost = share of the bucket lost to padding + distance in scale to the size the image would get on its own.
+    ImageSize natural = get_input_resolution_height_and_width(MOVILNET_RESOLUTION, MOVILNET_STRIDE, pHeight, pWidth);
+    float aspect = float(pWidth) / float(pHeight);
+    float naturalArea = float(natural.mHeight) * float(natural.mWidth);
+
+    int best = 0;
+    float bestCost = -1;
+
+    for (size_t i = 0; i < mBuckets.size(); i++)
+    {
+        float bucketAspect = float(mBuckets[i].mWidth) / float(mBuckets[i].mHeight);
+        float bucketArea = float(mBuckets[i].mHeight) * float(mBuckets[i].mWidth);
+
+        float padding = 1.0 - std::min(aspect, bucketAspect) / std::max(aspect, bucketAspect);
+        float scale = fabs(log(bucketArea / naturalArea));
+        float cost = padding + scale;
+
+        if (bestCost < 0 || cost < bestCost)
+        {
+            bestCost = cost;
+            best = int(i);
+        }
+    }
+
+    return best;
 }
 
 bool ImageProcessing::is_valid_input_resolution(float pResolution, int pOutputStride)
@@ -49,7 +164,7 @@ ImageSize ImageProcessing::get_input_resolution_height_and_width(float pInternal
     return ImageSize(height, width);
 }
 
-std::pair<cv::Mat, Padding> ImageProcessing::pad_and_resize_to(const cv::Mat& pImage, int pTarget_height, int pTarget_width)
+Padding ImageProcessing::pad_and_resize_to(const cv::Mat& pImage, int pTarget_height, int pTarget_width, BufferArena& pArena)
 {
     int input_height = pImage.rows;
     int input_width = pImage.cols;
@@ -57,32 +172,31 @@ std::pair<cv::Mat, Padding> ImageProcessing::pad_and_resize_to(const cv::Mat& pI
     float aspect = float(input_width) / float(input_height);
     Padding padding;
 
+    // The missing rows or columns are split evenly between both sides.
     if (aspect < target_aspect)
     {
-        padding = Padding(0, 0, round(MOVILNET_RESOLUTION * (target_aspect * input_height - input_width)),
-            round(MOVILNET_RESOLUTION * (target_aspect * input_height - input_width)));
+        padding = Padding(0, 0, round(0.5 * (target_aspect * input_height - input_width)),
+            round(0.5 * (target_aspect * input_height - input_width)));
     }
     else
     {
-        padding = Padding(round(MOVILNET_RESOLUTION * ((1.0 / target_aspect) * input_width - input_height)),
-                          round(MOVILNET_RESOLUTION * ((1.0 / target_aspect) * input_width - input_height)),
+        padding = Padding(round(0.5 * ((1.0 / target_aspect) * input_width - input_height)),
+                          round(0.5 * ((1.0 / target_aspect) * input_width - input_height)),
                           0, 0);
     }
 
-    cv::Mat paddedTemp, resized;
-    cv::copyMakeBorder(pImage, paddedTemp, padding.mTop, padding.mBottom, padding.mLeft, padding.mRight, cv::BORDER_CONSTANT);
-
-    cv::Mat padded;
-    paddedTemp.convertTo(padded, CV_32F);
+    // pImage is already CV_32F, so the padded image is resized directly.
+    cv::Mat& padded = pArena.get(SLOT_PADDED, pImage.rows + padding.mTop + padding.mBottom, pImage.cols + padding.mLeft + padding.mRight, pImage.type());
+    cv::copyMakeBorder(pImage, padded, padding.mTop, padding.mBottom, padding.mLeft, padding.mRight, cv::BORDER_CONSTANT);
 
+    cv::Mat& resized = pArena.get(SLOT_RESIZED, pTarget_height, pTarget_width, pImage.type());
     cv::resize(padded, resized, cv::Size(pTarget_width, pTarget_height));
 
-    return std::make_pair(resized, padding);
+    return padding;
 }
 
-cv::Mat ImageProcessing::get_mobileNet_processed_image(const cv::Mat& pImage)
+void ImageProcessing::get_mobileNet_processed_image(const cv::Mat& pImage, cv::Mat& pOutput)
 {
-    cv::Mat result = pImage / MOVILNET_SCALE;
-    result -= cv::Scalar(1, 1, 1);
-    return result;
+    // x / scale - 1 in a single pass.
+    pImage.convertTo(pOutput, CV_32F, 1.0 / MOVILNET_SCALE, -1.0);
 }
\ No newline at end of file
@@ -2,26 +2,55 @@
 #define IMAGE_PROCESSING_H
 
 #include <opencv2/opencv.hpp>
+#include <mutex>
+#include <vector>
 #include "ImageSize.hpp"
 #include "Padding.hpp"
+#include "BufferArena.hpp"
 
 class ImageProcessing
 {
 public:
     ImageProcessing();
 
-    std::pair<cv::Mat, Padding> get_processed_image(const cv::Mat& pImage, ImageSize& modelInputSize);
+    // With pArena the intermediate images and the returned input live in its slots and are reused.
+    std::pair<cv::Mat, Padding> get_processed_image(const cv::Mat& pImage, ImageSize& modelInputSize, BufferArena* pArena = NULL);
+
+    // Same, for a model input size chosen by the caller. Buckets are not used or counted.
+    std::pair<cv::Mat, Padding> get_processed_image_at(const cv::Mat& pImage, const ImageSize& pModelInputSize, BufferArena* pArena = NULL);
+
+    ImageSize get_model_input_size(int pHeight, int pWidth);
+
+    // Model input size at the usual resolution, reduced so that its longer side is at most pMaxSide.
+    ImageSize get_bounded_input_size(int pHeight, int pWidth, int pMaxSide);
+
+    // Canonical model input sizes. When set, every image is mapped to one of them instead of its own size.
+    void set_input_buckets(const std::vector<ImageSize>& pBuckets);
+
+    std::vector<ImageSize> get_input_buckets() const;
+
+    std::vector<uint64_t> get_bucket_hits() const;
+
+    void reset_bucket_hits();
 
 private:
+    std::vector<ImageSize> mBuckets;
+
+    std::vector<uint64_t> mBucketHits;
+
+    mutable std::mutex mBucketMutex;
+
+    int select_bucket(int pHeight, int pWidth);
+
     bool is_valid_input_resolution(float pResolution, int pOutputStride);
 
     int to_valid_input_resolution(float pResolution, int pOutputStride);
 
     ImageSize get_input_resolution_height_and_width(float pInternal_resolution, int pOutput_stride, int pInput_height, int pInput_width);
     
-    std::pair<cv::Mat, Padding> pad_and_resize_to(const cv::Mat& pImage, int pTarget_height, int pTarget_width);
+    Padding pad_and_resize_to(const cv::Mat& pImage, int pTarget_height, int pTarget_width, BufferArena& pArena);
     
-    cv::Mat get_mobileNet_processed_image(const cv::Mat& pImage);
+    void get_mobileNet_processed_image(const cv::Mat& pImage, cv::Mat& pOutput);
 };
 
 #endif
\ No newline at end of file
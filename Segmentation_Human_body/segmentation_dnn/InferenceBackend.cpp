@@ -0,0 +1,24 @@
+#include "InferenceBackend.hpp"
+#include "TensorFlowBackend.hpp"
+#include "OpenCVBackend.hpp"
+#include "TFLiteBackend.hpp"
+#include "SegmentationException.hpp"
+
+InferenceBackend* InferenceBackend::create(BackendType pType)
+{
+    switch (pType)
+    {
+    case BACKEND_TENSORFLOW:
+        return new TensorFlowBackend();
+    case BACKEND_OPENCV_DNN:
+        return new OpenCVBackend();
+    case BACKEND_TFLITE:
+#ifdef SEGMENTATION_WITH_TFLITE
+        return new TFLiteBackend();
+#else
+        throw SegmentationException("The TensorFlow Lite backend is not available, build with SEGMENTATION_WITH_TFLITE.");
+#endif
+    default:
+        throw SegmentationException("Unknown inference backend.");
+    }
+}
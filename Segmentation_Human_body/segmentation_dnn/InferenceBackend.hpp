@@ -0,0 +1,38 @@
+#ifndef INFERENCE_BACKEND_H
+#define INFERENCE_BACKEND_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "segmentationDNN.hpp"
+
+// Runs the segmentation graph for SegmentationDNN. Inputs and outputs are NHWC float tensors whatever
+// the layout the runtime uses internally.
+class InferenceBackend
+{
+public:
+    virtual ~InferenceBackend() {}
+
+    virtual bool init(const std::string& pModel) = 0;
+
+    // pData holds pInput_dims = { batch, height, width, channels } floats. Fills pOutputs[layer][batch entry]
+    // with CV_32FC(n) images. Mats that already have the output shape are written in place. Throws
+    // BatchSizeException when only the batch dimension was rejected, SegmentationException otherwise.
+    virtual void run(const std::string& pInputLayer, const std::vector<std::string>& pOutputLayers,
+        const std::vector<std::int64_t>& pInput_dims, const float* pData, size_t pSize, std::vector<std::vector<cv::Mat>>& pOutputs) = 0;
+
+    // Batch dimension the input layer is fixed to in the model, 0 when any batch is accepted or unknown.
+    virtual int getFixedBatchSize(const std::string& pInputLayer) const { return 0; }
+
+    // Buffers the backend allocated itself, beyond what the runtime allocates internally.
+    virtual uint64_t getAllocationCount() const { return 0; }
+
+    virtual void resetAllocationCount() {}
+
+    virtual const char* getName() const = 0;
+
+    // Throws SegmentationException when the backend was not compiled in.
+    static InferenceBackend* create(BackendType pType);
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+    mData = NULL;
+    mSize = 0;
+
+#ifdef _WIN32
+    mFile = INVALID_HANDLE_VALUE;
+    mMapping = NULL;
+#else
+    mFile = -1;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& pPath)
+{
+    close();
+
+    mFile = CreateFileA(pPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (mFile == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(mFile, &size) || size.QuadPart <= 0)
+    {
+        close();
+        return false;
+    }
+
+    mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (mMapping == NULL)
+    {
+        close();
+        return false;
+    }
+
+    mData = static_cast<const char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+
+    if (mData == NULL)
+    {
+        close();
+        return false;
+    }
+
+    mSize = size_t(size.QuadPart);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (mData != NULL)
+    {
+        UnmapViewOfFile(mData);
+        mData = NULL;
+    }
+
+    if (mMapping != NULL)
+    {
+        CloseHandle(mMapping);
+        mMapping = NULL;
+    }
+
+    if (mFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(mFile);
+        mFile = INVALID_HANDLE_VALUE;
+    }
+
+    mSize = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string& pPath)
+{
+    close();
+
+    mFile = ::open(pPath.c_str(), O_RDONLY);
+
+    if (mFile < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+
+    if (fstat(mFile, &info) != 0 || info.st_size <= 0)
+    {
+        close();
+        return false;
+    }
+
+    void* data = mmap(NULL, size_t(info.st_size), PROT_READ, MAP_PRIVATE, mFile, 0);
+
+    if (data == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+
+    mData = static_cast<const char*>(data);
+    mSize = size_t(info.st_size);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (mData != NULL)
+    {
+        munmap(const_cast<char*>(mData), mSize);
+        mData = NULL;
+    }
+
+    if (mFile >= 0)
+    {
+        ::close(mFile);
+        mFile = -1;
+    }
+
+    mSize = 0;
+}
+
+#endif
+
+const char* MappedFile::data() const
+{
+    return mData;
+}
+
+size_t MappedFile::size() const
+{
+    return mSize;
+}
@@ -0,0 +1,39 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. Pages are loaded on demand and shared with the page cache,
+// instead of being copied into a heap buffer.
+class MappedFile
+{
+public:
+    MappedFile();
+
+    ~MappedFile();
+
+    bool open(const std::string& pPath);
+
+    void close();
+
+    const char* data() const;
+
+    size_t size() const;
+
+private:
+    const char* mData;
+    size_t mSize;
+
+#ifdef _WIN32
+    void* mFile;
+    void* mMapping;
+#else
+    int mFile;
+#endif
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+#endif
@@ -0,0 +1,289 @@
+#include "MaskEncoding.hpp"
+
+MaskEncoder::MaskEncoder(int pRows, int pCols, int pEncodings, int pParts, int pLabelScale)
+{
+    mRows = pRows;
+    mCols = pCols;
+    mEncodings = pEncodings;
+    mLabelScale = std::max(1, pLabelScale);
+    mPosition = 0;
+
+    if ((mEncodings & ENCODING_PACKED_MASK) != 0)
+    {
+        mPacked.rows = pRows;
+        mPacked.cols = pCols;
+        mPacked.stride = (pCols + 7) / 8;
+        mPacked.bits.assign(size_t(mPacked.stride) * pRows, 0);
+    }
+
+    mMaskRle.rows = pRows;
+    mMaskRle.cols = pCols;
+    mMaskLast = 0;
+    mMaskState = false;
+
+    if ((mEncodings & ENCODING_PARTS_RLE) != 0)
+    {
+        mPartsRle.resize(pParts);
+
+        for (int k = 0; k < pParts; k++)
+        {
+            mPartsRle[k].rows = pRows;
+            mPartsRle[k].cols = pCols;
+        }
+
+        mPartsLast.assign(pParts, 0);
+    }
+
+    mCurrentPart = 0;
+}
+
+void MaskEncoder::add_strip(const cv::Mat& pMask, const cv::Mat& pLabels, int pX)
+{
+    CV_Assert(pMask.type() == CV_8U && pMask.rows == mRows && pX + pMask.cols <= mCols);
+
+    bool packed = (mEncodings & ENCODING_PACKED_MASK) != 0;
+    bool maskRle = (mEncodings & ENCODING_MASK_RLE) != 0;
+    bool partsRle = (mEncodings & ENCODING_PARTS_RLE) != 0 && !pLabels.empty();
+    int parts = int(mPartsRle.size());
+
+    for (int c = 0; c < pMask.cols; c++)
+    {
+        int x = pX + c;
+        uint8_t bit = uint8_t(0x80 >> (x & 7));
+        uint8_t* packedColumn = packed ? &mPacked.bits[x >> 3] : NULL;
+
+        for (int y = 0; y < mRows; y++, mPosition++)
+        {
+            bool body = pMask.ptr(y)[c] != 0;
+
+            if (packed && body)
+            {
+                packedColumn[size_t(y) * mPacked.stride] |= bit;
+            }
+
+            if (maskRle && body != mMaskState)
+            {
+                mMaskRle.counts.push_back(uint32_t(mPosition - mMaskLast));
+                mMaskLast = mPosition;
+                mMaskState = body;
+            }
+
+            if (partsRle)
+            {
+                int part = body ? pLabels.ptr(y)[c] / mLabelScale : 0;
+                part = (part > parts) ? 0 : part;
+
+                if (part != mCurrentPart)
+                {
+                    // The previous part closes its run of 1, the new one closes its run of 0.
+                    if (mCurrentPart > 0)
+                    {
+                        mPartsRle[mCurrentPart - 1].counts.push_back(uint32_t(mPosition - mPartsLast[mCurrentPart - 1]));
+                        mPartsLast[mCurrentPart - 1] = mPosition;
+                    }
+
+                    if (part > 0)
+                    {
+                        mPartsRle[part - 1].counts.push_back(uint32_t(mPosition - mPartsLast[part - 1]));
+                        mPartsLast[part - 1] = mPosition;
+                    }
+
+                    mCurrentPart = part;
+                }
+            }
+        }
+    }
+}
+
+void MaskEncoder::finish(MaskEncodings& pEncodings)
+{
+    uint64_t total = uint64_t(mRows) * mCols;
+
+    if ((mEncodings & ENCODING_PACKED_MASK) != 0)
+    {
+        pEncodings.packedMask = mPacked;
+    }
+
+    if ((mEncodings & ENCODING_MASK_RLE) != 0)
+    {
+        pEncodings.maskRle = mMaskRle;
+        pEncodings.maskRle.counts.push_back(uint32_t(total - mMaskLast));
+    }
+
+    if ((mEncodings & ENCODING_PARTS_RLE) != 0)
+    {
+        pEncodings.partsRle = mPartsRle;
+
+        for (size_t k = 0; k < pEncodings.partsRle.size(); k++)
+        {
+            pEncodings.partsRle[k].counts.push_back(uint32_t(total - mPartsLast[k]));
+        }
+    }
+}
+
+MaskEncodings MaskEncoding::encode(const cv::Mat& pMask, const cv::Mat& pParts, int pPartCount, int pEncodings)
+{
+    // A single-channel part output is a probability image, not labels.
+    if (pParts.empty() || pParts.type() != CV_8U || pPartCount <= 0)
+    {
+        pEncodings &= ~ENCODING_PARTS_RLE;
+        pPartCount = 0;
+    }
+
+    MaskEncoder encoder(pMask.rows, pMask.cols, pEncodings, pPartCount, pPartCount > 0 ? 255 / pPartCount : 1);
+    encoder.add_strip(pMask, pParts, 0);
+
+    MaskEncodings encodings;
+    encoder.finish(encodings);
+    return encodings;
+}
+
+PackedMask MaskEncoding::pack(const cv::Mat& pMask)
+{
+    return encode(pMask, cv::Mat(), 0, ENCODING_PACKED_MASK).packedMask;
+}
+
+RunLengthMask MaskEncoding::encode_rle(const cv::Mat& pMask)
+{
+    return encode(pMask, cv::Mat(), 0, ENCODING_MASK_RLE).maskRle;
+}
+
+cv::Mat MaskEncoding::unpack(const PackedMask& pPacked)
+{
+    cv::Mat mask(pPacked.rows, pPacked.cols, CV_8U);
+
+    for (int y = 0; y < pPacked.rows; y++)
+    {
+        const uint8_t* bits = &pPacked.bits[size_t(y) * pPacked.stride];
+        uchar* row = mask.ptr(y);
+
+        for (int x = 0; x < pPacked.cols; x++)
+        {
+            row[x] = (bits[x >> 3] & (0x80 >> (x & 7))) ? 255 : 0;
+        }
+    }
+
+    return mask;
+}
+
+namespace
+{
+    // Writes pValue over the runs of 1 of pRle, walking the image column by column.
+    void fill_runs(const RunLengthMask& pRle, uchar pValue, cv::Mat& pImage)
+    {
+        uint64_t position = 0;
+        uint64_t total = uint64_t(pRle.rows) * pRle.cols;
+
+        for (size_t i = 0; i < pRle.counts.size() && position < total; i++)
+        {
+            uint64_t end = std::min(total, position + pRle.counts[i]);
+
+            if ((i & 1) == 1)
+            {
+                for (uint64_t p = position; p < end; p++)
+                {
+                    pImage.ptr(int(p % pRle.rows))[p / pRle.rows] = pValue;
+                }
+            }
+
+            position = end;
+        }
+    }
+}
+
+cv::Mat MaskEncoding::decode_rle(const RunLengthMask& pRle)
+{
+    cv::Mat mask = cv::Mat::zeros(pRle.rows, pRle.cols, CV_8U);
+    fill_runs(pRle, 255, mask);
+    return mask;
+}
+
+cv::Mat MaskEncoding::decode_parts_rle(const std::vector<RunLengthMask>& pParts)
+{
+    if (pParts.empty())
+    {
+        return cv::Mat();
+    }
+
+    cv::Mat labels = cv::Mat::zeros(pParts[0].rows, pParts[0].cols, CV_8U);
+    int scale = 255 / int(pParts.size());
+
+    for (size_t k = 0; k < pParts.size(); k++)
+    {
+        fill_runs(pParts[k], uchar((k + 1) * scale), labels);
+    }
+
+    return labels;
+}
+
+std::string MaskEncoding::to_coco_string(const RunLengthMask& pRle)
+{
+    std::string result;
+
+    for (size_t i = 0; i < pRle.counts.size(); i++)
+    {
+        int64_t x = int64_t(pRle.counts[i]);
+
+        if (i > 2)
+        {
+            x -= int64_t(pRle.counts[i - 2]);
+        }
+
+        bool more = true;
+
+        while (more)
+        {
+            char c = char(x & 0x1f);
+            x >>= 5;
+            more = (c & 0x10) ? (x != -1) : (x != 0);
+
+            if (more)
+            {
+                c |= 0x20;
+            }
+
+            result.push_back(char(c + 48));
+        }
+    }
+
+    return result;
+}
+
+RunLengthMask MaskEncoding::from_coco_string(const std::string& pCounts, int pRows, int pCols)
+{
+    RunLengthMask rle;
+    rle.rows = pRows;
+    rle.cols = pCols;
+
+    size_t p = 0;
+
+    while (p < pCounts.size())
+    {
+        int64_t x = 0;
+        int k = 0;
+        bool more = true;
+
+        while (more && p < pCounts.size())
+        {
+            int c = pCounts[p] - 48;
+            x |= int64_t(c & 0x1f) << (5 * k);
+            more = (c & 0x20) != 0;
+            p++;
+            k++;
+
+            if (!more && (c & 0x10))
+            {
+                x |= -(int64_t(1) << (5 * k));
+            }
+        }
+
+        if (rle.counts.size() > 2)
+        {
+            x += int64_t(rle.counts[rle.counts.size() - 2]);
+        }
+
+        rle.counts.push_back(uint32_t(x));
+    }
+
+    return rle;
+}
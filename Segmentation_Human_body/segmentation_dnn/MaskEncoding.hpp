@@ -0,0 +1,97 @@
+#ifndef MASK_ENCODING_H
+#define MASK_ENCODING_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum MaskEncodingType
+{
+    ENCODING_PACKED_MASK = 1,
+    ENCODING_MASK_RLE = 2,
+    ENCODING_PARTS_RLE = 4
+};
+
+// One bit per pixel, row-major, most significant bit first. Every row starts on a new byte.
+struct PackedMask
+{
+    int rows = 0;
+    int cols = 0;
+    int stride = 0;
+    std::vector<uint8_t> bits;
+};
+
+// COCO run-length encoding: the image is read column by column and counts alternate between runs of 0
+// and runs of 1, starting with 0 (possibly an empty run).
+struct RunLengthMask
+{
+    int rows = 0;
+    int cols = 0;
+    std::vector<uint32_t> counts;
+};
+
+// Compact outputs selected with SegmentationDNN::setEncodings(). partsRle[k] is the part labelled (k + 1) * (255 / parts).
+struct MaskEncodings
+{
+    PackedMask packedMask;
+    RunLengthMask maskRle;
+    std::vector<RunLengthMask> partsRle;
+};
+
+// Builds the encodings from vertical strips of the mask and of the part labels given left to right, so the
+// decoder can hand over small strips instead of materializing full-resolution images.
+class MaskEncoder
+{
+public:
+    // pLabelScale is the step between part labels (255 / parts), label k * pLabelScale is part k.
+    MaskEncoder(int pRows, int pCols, int pEncodings, int pParts, int pLabelScale);
+
+    // pMask and pLabels are CV_8U strips of pRows rows covering columns [pX, pX + cols). A pixel is body when
+    // pMask is non-zero, pLabels is only read there and may be empty when parts are not encoded.
+    void add_strip(const cv::Mat& pMask, const cv::Mat& pLabels, int pX);
+
+    // Closes the last runs. Only the selected encodings are written to pEncodings.
+    void finish(MaskEncodings& pEncodings);
+
+private:
+    int mRows, mCols, mEncodings, mLabelScale;
+    uint64_t mPosition;
+
+    PackedMask mPacked;
+
+    RunLengthMask mMaskRle;
+    uint64_t mMaskLast;
+    bool mMaskState;
+
+    std::vector<RunLengthMask> mPartsRle;
+    std::vector<uint64_t> mPartsLast;
+    int mCurrentPart;
+};
+
+class MaskEncoding
+{
+public:
+    // Encodings of decoded images. pParts holds CV_8U labels k * (255 / pPartCount), parts are not encoded
+    // when it is empty or of another type.
+    static MaskEncodings encode(const cv::Mat& pMask, const cv::Mat& pParts, int pPartCount, int pEncodings);
+
+    static PackedMask pack(const cv::Mat& pMask);
+
+    static RunLengthMask encode_rle(const cv::Mat& pMask);
+
+    // CV_8U images with 0 and 255.
+    static cv::Mat unpack(const PackedMask& pPacked);
+
+    static cv::Mat decode_rle(const RunLengthMask& pRle);
+
+    // Label image with part k set to k * (255 / number of parts), as returned by getBodyParts().
+    static cv::Mat decode_parts_rle(const std::vector<RunLengthMask>& pParts);
+
+    // The compressed string form used by pycocotools (delta-coded counts, 5 bits per character).
+    static std::string to_coco_string(const RunLengthMask& pRle);
+
+    static RunLengthMask from_coco_string(const std::string& pCounts, int pRows, int pCols);
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include "OpenCVBackend.hpp"
+#include "SegmentationException.hpp"
+#include "MappedFile.hpp"
+
+bool OpenCVBackend::init(const std::string& pModel)
+{
+    MappedFile file;
+
+    if (!file.open(pModel))
+    {
+        return false;
+    }
+
+    try
+    {
+        mNet = cv::dnn::readNetFromTensorflow(file.data(), file.size());
+    }
+    catch (const cv::Exception&)
+    {
+        return false;
+    }
+
+    if (mNet.empty())
+    {
+        return false;
+    }
+
+    mNet.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    mNet.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+
+    return true;
+}
+
+void OpenCVBackend::run(const std::string& pInputLayer, const std::vector<std::string>& pOutputLayers,
+    const std::vector<std::int64_t>& pInput_dims, const float* pData, size_t pSize, std::vector<std::vector<cv::Mat>>& pOutputs)
+{
+    int batch = int(pInput_dims[0]);
+    int height = int(pInput_dims[1]);
+    int width = int(pInput_dims[2]);
+    int channel = int(pInput_dims[3]);
+    size_t imageLenght = size_t(height) * width * channel;
+
+    if (pSize < sizeof(float) * imageLenght * batch)
+    {
+        throw SegmentationException("The input buffer is smaller than the input dimensions.");
+    }
+
+    std::vector<cv::Mat>& images = mImages;
+    images.resize(batch);
+
+    for (int i = 0; i < batch; i++)
+    {
+        images[i] = cv::Mat(height, width, CV_32FC(channel), (void*)(pData + i * imageLenght));
+    }
+
+    // The importer replaces the graph inputs, so the blob is fed to the network input rather than to pInputLayer.
+    cv::dnn::blobFromImages(images, mInput, 1.0, cv::Size(), cv::Scalar(), false, false, CV_32F);
+    mNet.setInput(mInput);
+
+    std::vector<cv::Mat>& blobs = mBlobs;
+
+    try
+    {
+        mNet.forward(blobs, pOutputLayers);
+    }
+    catch (const cv::Exception&)
+    {
+        throw SegmentationException("Failed cv::dnn::Net::forward.");
+    }
+
+    pOutputs.resize(blobs.size());
+
+    for (size_t k = 0; k < blobs.size(); k++)
+    {
+        const cv::Mat& blob = blobs[k];
+
+        if (blob.dims != 4)
+        {
+            throw SegmentationException("Unexpected cv::dnn output shape.");
+        }
+
+        // NCHW blob to one interleaved HxW image per batch entry.
+        pOutputs[k].resize(blob.size[0]);
+
+        for (int i = 0; i < blob.size[0]; i++)
+        {
+            std::vector<cv::Mat>& planes = mPlanes;
+            planes.resize(blob.size[1]);
+
+            for (int c = 0; c < blob.size[1]; c++)
+            {
+                planes[c] = cv::Mat(blob.size[2], blob.size[3], CV_32F, (void*)blob.ptr<float>(i, c));
+            }
+
+            cv::merge(planes, pOutputs[k][i]);
+        }
+    }
+
+    // The wrappers point into the caller's input and the network blobs, they must not outlive the run.
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        images[i].release();
+    }
+
+    for (size_t c = 0; c < mPlanes.size(); c++)
+    {
+        mPlanes[c].release();
+    }
+}
+
+const char* OpenCVBackend::getName() const
+{
+    return "OpenCV DNN";
+}
@@ -0,0 +1,26 @@
+#ifndef OPENCV_BACKEND_H
+#define OPENCV_BACKEND_H
+
+#include "InferenceBackend.hpp"
+
+// Frozen graph imported with cv::dnn::readNetFromTensorflow. OpenCV works in NCHW, so inputs and
+// outputs are transposed at the boundary.
+class OpenCVBackend : public InferenceBackend
+{
+public:
+    bool init(const std::string& pModel) override;
+
+    void run(const std::string& pInputLayer, const std::vector<std::string>& pOutputLayers,
+        const std::vector<std::int64_t>& pInput_dims, const float* pData, size_t pSize, std::vector<std::vector<cv::Mat>>& pOutputs) override;
+
+    const char* getName() const override;
+
+private:
+    cv::dnn::Net mNet;
+
+    // Kept from one run to the next so that the wrappers and the input blob are not reallocated.
+    std::vector<cv::Mat> mImages, mBlobs, mPlanes;
+    cv::Mat mInput;
+};
+
+#endif
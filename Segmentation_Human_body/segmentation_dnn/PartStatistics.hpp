@@ -0,0 +1,15 @@
+#ifndef PART_STATISTICS_H
+#define PART_STATISTICS_H
+
+#include <opencv2/opencv.hpp>
+
+// Pixels of one label in image coordinates. confidence is the mean sigmoid of the winning logit.
+struct PartStatistics
+{
+    int area = 0;
+    cv::Rect box;
+    cv::Point2f centroid;
+    float confidence = 0;
+};
+
+#endif
@@ -5,43 +5,14 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include "MappedFile.hpp"
 
-static void DeallocateBuffer(void* data, size_t) {
-    std::free(data);
-}
-
-static TF_Buffer* ReadBufferFromFile(const char* file) {
-    std::ifstream f(file, std::ios::binary);
-    //SCOPE_EXIT{ f.close(); };
-    if (f.fail() || !f.is_open()) {
-        return nullptr;
-    }
-
-    if (f.seekg(0, std::ios::end).fail()) {
-        return nullptr;
-    }
-    auto fsize = f.tellg();
-    if (f.seekg(0, std::ios::beg).fail()) {
-        return nullptr;
-    }
-
-    if (fsize <= 0) {
-        return nullptr;
-    }
-
-    auto data = static_cast<char*>(std::malloc(fsize));
-    if (f.read(data, fsize).fail()) {
-        return nullptr;
-    }
-
-    f.close();
-
-    auto buf = TF_NewBuffer();
-    buf->data = data;
-    buf->length = fsize;
-    buf->data_deallocator = DeallocateBuffer;
-
-    return buf;
+namespace
+{
+    std::mutex gGraphCacheMutex;
+    std::map<std::string, std::weak_ptr<TF_Graph>> gGraphCache;
 }
 
 PrivateData::PrivateData()
@@ -52,18 +23,14 @@ PrivateData::PrivateData()
 
 PrivateData::~PrivateData()
 {
-    TF_DeleteGraph(mGraph);
     DeleteSession(mSession);
+    mSharedGraph.reset();
 }
 
 bool PrivateData::init(const std::string& pModel)
 {
-    if (mGraph != nullptr)
-    {
-        TF_DeleteGraph(mGraph);
-    }
-
     DeleteSession(mSession);
+    mSession = nullptr;
 
     TF_Status* status = TF_NewStatus();
     LoadGraph(pModel.c_str(), status);
@@ -123,20 +90,10 @@ TF_Tensor* PrivateData::CreateTensor(TF_DataType data_type, const std::int64_t*
 
 void PrivateData::LoadGraph(const char* graph_path, TF_Status* status)
 {
-    if (graph_path == nullptr) {
-        if (mGraph != nullptr)
-        {
-            TF_DeleteGraph(mGraph);
-        }
-        return;
-    }
+    mSharedGraph.reset();
+    mGraph = nullptr;
 
-    auto buffer = ReadBufferFromFile(graph_path);
-    if (buffer == nullptr) {
-        if (mGraph != nullptr)
-        {
-            TF_DeleteGraph(mGraph);
-        }
+    if (graph_path == nullptr) {
         return;
     }
 
@@ -144,19 +101,39 @@ void PrivateData::LoadGraph(const char* graph_path, TF_Status* status)
         status = TF_NewStatus();
     }
 
-    mGraph = TF_NewGraph();
-    auto opts = TF_NewImportGraphDefOptions();
+    std::lock_guard<std::mutex> lock(gGraphCacheMutex);
 
-    TF_GraphImportGraphDef(mGraph, buffer, opts, status);
-    TF_DeleteImportGraphDefOptions(opts);
-    TF_DeleteBuffer(buffer);
+    std::shared_ptr<TF_Graph> graph = gGraphCache[graph_path].lock();
 
-    if (TF_GetCode(status) != TF_OK) {
-        if (mGraph != nullptr) {
-            TF_DeleteGraph(mGraph);
+    if (graph == nullptr) {
+        // The file is mapped rather than read, the import parses it straight from the page cache.
+        MappedFile file;
+        if (!file.open(graph_path)) {
+            TF_SetStatus(status, TF_NOT_FOUND, "Could not open the model file.");
+            return;
         }
-        return;
+
+        auto buffer = TF_NewBuffer();
+        buffer->data = file.data();
+        buffer->length = file.size();
+        buffer->data_deallocator = nullptr;
+
+        graph = std::shared_ptr<TF_Graph>(TF_NewGraph(), TF_DeleteGraph);
+        auto opts = TF_NewImportGraphDefOptions();
+
+        TF_GraphImportGraphDef(graph.get(), buffer, opts, status);
+        TF_DeleteImportGraphDefOptions(opts);
+        TF_DeleteBuffer(buffer);
+
+        if (TF_GetCode(status) != TF_OK) {
+            return;
+        }
+
+        gGraphCache[graph_path] = graph;
     }
+
+    mSharedGraph = graph;
+    mGraph = graph.get();
 }
 
 void PrivateData::CreateSession(TF_Graph* graph, TF_Status* status)
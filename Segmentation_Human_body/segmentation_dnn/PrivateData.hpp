@@ -2,6 +2,8 @@
 #define PRIVATE_DATA_H
 
 #include "tensorflow/c/c_api.h"
+#include <memory>
+#include <string>
 #include <vector>
 
 class PrivateData
@@ -16,11 +18,14 @@ private:
         const TF_Output* outputs, TF_Tensor** output_tensors, std::size_t noutputs,
         TF_Status* status = nullptr);
 
+    // Graphs are imported once per model path and shared by every PrivateData of the process, each one
+    // only owns its session.
     void LoadGraph(const char* graph_path, TF_Status* status = nullptr);
 
     void CreateSession(TF_Graph* graph, TF_Status* status = nullptr);
 
     TF_Graph* mGraph;
+    std::shared_ptr<TF_Graph> mSharedGraph;
     TF_Session* mSession;
 public:
     PrivateData();
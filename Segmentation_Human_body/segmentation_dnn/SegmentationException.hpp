@@ -16,4 +16,11 @@ public:
     }
 };
 
+// The runtime rejected the batch dimension of the input. The same images can still run one at a time.
+class BatchSizeException : public SegmentationException
+{
+public:
+    BatchSizeException(const std::string& msg) : SegmentationException(msg) {}
+};
+
 #endif
\ No newline at end of file
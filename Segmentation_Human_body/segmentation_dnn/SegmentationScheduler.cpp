@@ -0,0 +1,287 @@
+#include "SegmentationScheduler.hpp"
+#include "SegmentationException.hpp"
+#include <algorithm>
+
+const size_t MAX_LATENCY_SAMPLES = 10000;
+
+SegmentationScheduler::SegmentationScheduler(SegmentationDNN& pModel, const SchedulerOptions& pOptions)
+    : mOptions(pOptions), mQueue(size_t(std::max(1, pOptions.maxQueueSize)))
+{
+    SegmentationDNN* model = &pModel;
+
+    mBatchFunction = [model](const std::vector<cv::Mat>& pImgs)
+    {
+        return model->ExecuteBatch(pImgs);
+    };
+
+    mShapeFunction = [model](const cv::Mat& pImg)
+    {
+        return model->getModelInputSize(pImg);
+    };
+
+    start();
+}
+
+SegmentationScheduler::SegmentationScheduler(const BatchFunction& pBatchFunction, const SchedulerOptions& pOptions, const ShapeFunction& pShapeFunction)
+    : mOptions(pOptions), mBatchFunction(pBatchFunction), mShapeFunction(pShapeFunction), mQueue(size_t(std::max(1, pOptions.maxQueueSize)))
+{
+    if (!mShapeFunction)
+    {
+        mShapeFunction = [](const cv::Mat& pImg)
+        {
+            return pImg.size();
+        };
+    }
+
+    start();
+}
+
+SegmentationScheduler::~SegmentationScheduler()
+{
+    stop();
+}
+
+void SegmentationScheduler::start()
+{
+    if (mOptions.maxBatchSize < 1)
+    {
+        mOptions.maxBatchSize = 1;
+    }
+
+    mLatencyPos = 0;
+    mHasArrival = false;
+    mStopped = false;
+    mWorker = std::thread(&SegmentationScheduler::run, this);
+}
+
+void SegmentationScheduler::stop()
+{
+    if (mStopped.exchange(true) == true)
+    {
+        return;
+    }
+
+    mQueue.close();
+
+    if (mWorker.joinable())
+    {
+        mWorker.join();
+    }
+}
+
+SegmentationScheduler::Request SegmentationScheduler::makeRequest(const cv::Mat& pImg)
+{
+    Request request;
+    request.image = pImg;
+    request.shape = mShapeFunction(pImg);
+    request.arrival = Clock::now();
+    return request;
+}
+
+void SegmentationScheduler::recordArrival(const Clock::time_point& pArrival)
+{
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+
+    // Concurrent submitters can enqueue out of arrival order, the earliest accepted request counts.
+    if (mHasArrival == false || pArrival < mFirstArrival)
+    {
+        mFirstArrival = pArrival;
+        mHasArrival = true;
+    }
+}
+
+std::future<SegmentationResult> SegmentationScheduler::submit(const cv::Mat& pImg)
+{
+    Request request = makeRequest(pImg);
+    Clock::time_point arrival = request.arrival;
+    std::future<SegmentationResult> result = request.promise.get_future();
+
+    if (mQueue.push(std::move(request)) == false)
+    {
+        throw SegmentationException("The scheduler is stopped.");
+    }
+
+    recordArrival(arrival);
+    return result;
+}
+
+bool SegmentationScheduler::trySubmit(const cv::Mat& pImg, std::future<SegmentationResult>& pResult)
+{
+    Request request = makeRequest(pImg);
+    Clock::time_point arrival = request.arrival;
+    std::future<SegmentationResult> result = request.promise.get_future();
+
+    if (mQueue.tryPush(request) == false)
+    {
+        std::lock_guard<std::mutex> lock(mStatsMutex);
+        mStats.rejected++;
+        return false;
+    }
+
+    recordArrival(arrival);
+    pResult = std::move(result);
+    return true;
+}
+
+void SegmentationScheduler::run()
+{
+    std::map<cv::Size, Group, ShapeLess> pending;
+    Clock::duration maxLatency = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(mOptions.maxLatencyMs));
+
+    while (true)
+    {
+        auto oldest = pending.end();
+
+        for (auto it = pending.begin(); it != pending.end(); ++it)
+        {
+            if (oldest == pending.end() || it->second.front().arrival < oldest->second.front().arrival)
+            {
+                oldest = it;
+            }
+        }
+
+        if (oldest != pending.end() && Clock::now() >= oldest->second.front().arrival + maxLatency)
+        {
+            dispatch(oldest->second);
+            pending.erase(oldest);
+            continue;
+        }
+
+        Request request;
+        bool received;
+
+        if (oldest == pending.end())
+        {
+            received = mQueue.pop(request);
+        }
+        else
+        {
+            received = mQueue.popUntil(request, oldest->second.front().arrival + maxLatency);
+        }
+
+        if (received == true)
+        {
+            cv::Size shape = request.shape;
+            Group& group = pending[shape];
+            group.push_back(std::move(request));
+
+            if (int(group.size()) >= mOptions.maxBatchSize)
+            {
+                dispatch(group);
+                pending.erase(shape);
+            }
+            continue;
+        }
+
+        if (oldest == pending.end())
+        {
+            // Closed and drained.
+            break;
+        }
+
+        // The latency budget of the oldest group is spent, or the queue was closed.
+        dispatch(oldest->second);
+        pending.erase(oldest);
+    }
+}
+
+void SegmentationScheduler::dispatch(Group& pGroup)
+{
+    std::vector<cv::Mat> images;
+
+    for (size_t i = 0; i < pGroup.size(); i++)
+    {
+        images.push_back(pGroup[i].image);
+    }
+
+    try
+    {
+        std::vector<SegmentationResult> results = mBatchFunction(images);
+
+        if (results.size() != pGroup.size())
+        {
+            throw SegmentationException("The batch function returned a wrong number of results.");
+        }
+
+        for (size_t i = 0; i < pGroup.size(); i++)
+        {
+            pGroup[i].promise.set_value(results[i]);
+        }
+    }
+    catch (...)
+    {
+        for (size_t i = 0; i < pGroup.size(); i++)
+        {
+            pGroup[i].promise.set_exception(std::current_exception());
+        }
+    }
+
+    Clock::time_point now = Clock::now();
+
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+
+    for (size_t i = 0; i < pGroup.size(); i++)
+    {
+        double latency = std::chrono::duration<double, std::milli>(now - pGroup[i].arrival).count();
+
+        if (mLatencies.size() < MAX_LATENCY_SAMPLES)
+        {
+            mLatencies.push_back(latency);
+        }
+        else
+        {
+            mLatencies[mLatencyPos] = latency;
+            mLatencyPos = (mLatencyPos + 1) % MAX_LATENCY_SAMPLES;
+        }
+    }
+
+    mStats.completed += pGroup.size();
+    mStats.batches++;
+    mLastCompletion = now;
+}
+
+SchedulerStats SegmentationScheduler::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+
+    SchedulerStats stats = mStats;
+
+    if (stats.batches > 0)
+    {
+        stats.meanBatchSize = double(stats.completed) / double(stats.batches);
+    }
+
+    if (!mLatencies.empty())
+    {
+        std::vector<double> sorted = mLatencies;
+
+        size_t p50 = (sorted.size() - 1) / 2;
+        std::nth_element(sorted.begin(), sorted.begin() + p50, sorted.end());
+        stats.p50LatencyMs = sorted[p50];
+
+        size_t p99 = size_t(0.99 * (sorted.size() - 1));
+        std::nth_element(sorted.begin(), sorted.begin() + p99, sorted.end());
+        stats.p99LatencyMs = sorted[p99];
+    }
+
+    if (mHasArrival == true && stats.completed > 0)
+    {
+        double seconds = std::chrono::duration<double>(mLastCompletion - mFirstArrival).count();
+
+        if (seconds > 0)
+        {
+            stats.throughput = double(stats.completed) / seconds;
+        }
+    }
+
+    return stats;
+}
+
+void SegmentationScheduler::resetStats()
+{
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    mStats = SchedulerStats();
+    mLatencies.clear();
+    mLatencyPos = 0;
+    mHasArrival = false;
+}
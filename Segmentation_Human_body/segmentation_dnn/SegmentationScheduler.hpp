@@ -0,0 +1,113 @@
+#ifndef SEGMENTATION_SCHEDULER_H
+#define SEGMENTATION_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "segmentationDNN.hpp"
+#include "BoundedQueue.hpp"
+
+struct SchedulerOptions
+{
+    int maxBatchSize = 4;
+    double maxLatencyMs = 10.0;
+    int maxQueueSize = 64;
+};
+
+struct SchedulerStats
+{
+    uint64_t completed = 0;
+    uint64_t rejected = 0;
+    uint64_t batches = 0;
+    double meanBatchSize = 0;
+    double p50LatencyMs = 0;
+    double p99LatencyMs = 0;
+    double throughput = 0;
+};
+
+/*
+* Asynchronous front end that coalesces single-image requests into batches.
+* Requests are grouped by a shape key (the model input size by default) and a group is
+* run when it reaches maxBatchSize or when its oldest request has waited maxLatencyMs.
+* submit() blocks while maxQueueSize requests are waiting to be grouped, trySubmit() rejects instead.
+* Images are not copied, the caller must not write into them until the future is ready.
+*/
+class SegmentationScheduler
+{
+public:
+    using BatchFunction = std::function<std::vector<SegmentationResult>(const std::vector<cv::Mat>&)>;
+
+    using ShapeFunction = std::function<cv::Size(const cv::Mat&)>;
+
+    SegmentationScheduler(SegmentationDNN& pModel, const SchedulerOptions& pOptions = SchedulerOptions());
+
+    // Runs any batch function, grouping by image size unless a shape function is given. Useful for synthetic load.
+    SegmentationScheduler(const BatchFunction& pBatchFunction, const SchedulerOptions& pOptions = SchedulerOptions(), const ShapeFunction& pShapeFunction = ShapeFunction());
+
+    ~SegmentationScheduler();
+
+    std::future<SegmentationResult> submit(const cv::Mat& pImg);
+
+    bool trySubmit(const cv::Mat& pImg, std::future<SegmentationResult>& pResult);
+
+    void stop();
+
+    SchedulerStats getStats() const;
+
+    void resetStats();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request
+    {
+        cv::Mat image;
+        cv::Size shape;
+        Clock::time_point arrival;
+        std::promise<SegmentationResult> promise;
+    };
+
+    struct ShapeLess
+    {
+        bool operator()(const cv::Size& a, const cv::Size& b) const
+        {
+            return (a.height < b.height) || (a.height == b.height && a.width < b.width);
+        }
+    };
+
+    using Group = std::vector<Request>;
+
+    SchedulerOptions mOptions;
+    BatchFunction mBatchFunction;
+    ShapeFunction mShapeFunction;
+
+    BoundedQueue<Request> mQueue;
+    std::thread mWorker;
+    std::atomic<bool> mStopped;
+
+    mutable std::mutex mStatsMutex;
+    std::vector<double> mLatencies;
+    size_t mLatencyPos;
+    SchedulerStats mStats;
+    Clock::time_point mFirstArrival, mLastCompletion;
+    bool mHasArrival;
+
+    void start();
+
+    void run();
+
+    Request makeRequest(const cv::Mat& pImg);
+
+    // Starts the throughput clock, only for requests that made it into the queue.
+    void recordArrival(const Clock::time_point& pArrival);
+
+    void dispatch(Group& pGroup);
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifdef SEGMENTATION_WITH_TFLITE
+
+#include "TFLiteBackend.hpp"
+#include "SegmentationException.hpp"
+#include "tensorflow/lite/c/c_api.h"
+#include "tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+TFLiteBackend::TFLiteBackend()
+{
+    mModel = NULL;
+    mOptions = NULL;
+    mDelegate = NULL;
+    mInterpreter = NULL;
+    mAllocations = 0;
+}
+
+TFLiteBackend::~TFLiteBackend()
+{
+    release();
+}
+
+void TFLiteBackend::release()
+{
+    // The interpreter has to go before the delegate it runs on.
+    if (mInterpreter != NULL)
+    {
+        TfLiteInterpreterDelete(mInterpreter);
+        mInterpreter = NULL;
+    }
+
+    if (mDelegate != NULL)
+    {
+        TfLiteXNNPackDelegateDelete(mDelegate);
+        mDelegate = NULL;
+    }
+
+    if (mOptions != NULL)
+    {
+        TfLiteInterpreterOptionsDelete(mOptions);
+        mOptions = NULL;
+    }
+
+    if (mModel != NULL)
+    {
+        TfLiteModelDelete(mModel);
+        mModel = NULL;
+    }
+
+    mInputDims.clear();
+}
+
+bool TFLiteBackend::init(const std::string& pModel)
+{
+    release();
+
+    mModel = TfLiteModelCreateFromFile(pModel.c_str());
+
+    if (mModel == NULL)
+    {
+        return false;
+    }
+
+    int threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+    TfLiteXNNPackDelegateOptions delegateOptions = TfLiteXNNPackDelegateOptionsDefault();
+    delegateOptions.num_threads = threads;
+    mDelegate = TfLiteXNNPackDelegateCreate(&delegateOptions);
+
+    mOptions = TfLiteInterpreterOptionsCreate();
+    TfLiteInterpreterOptionsSetNumThreads(mOptions, threads);
+    TfLiteInterpreterOptionsAddDelegate(mOptions, mDelegate);
+
+    mInterpreter = TfLiteInterpreterCreate(mModel, mOptions);
+
+    if (mInterpreter == NULL)
+    {
+        release();
+        return false;
+    }
+
+    return true;
+}
+
+void TFLiteBackend::run(const std::string& pInputLayer, const std::vector<std::string>& pOutputLayers,
+    const std::vector<std::int64_t>& pInput_dims, const float* pData, size_t pSize, std::vector<std::vector<cv::Mat>>& pOutputs)
+{
+    if (mInterpreter == NULL)
+    {
+        throw SegmentationException("The TensorFlow Lite model is not loaded.");
+    }
+
+    bool sameDims = (pInput_dims.size() == mInputDims.size()) && std::equal(pInput_dims.begin(), pInput_dims.end(), mInputDims.begin());
+
+    if (sameDims == false)
+    {
+        std::vector<int> dims(pInput_dims.begin(), pInput_dims.end());
+
+        if (TfLiteInterpreterResizeInputTensor(mInterpreter, 0, dims.data(), int32_t(dims.size())) != kTfLiteOk ||
+            TfLiteInterpreterAllocateTensors(mInterpreter) != kTfLiteOk)
+        {
+            mInputDims.clear();
+
+            if (dims.empty() == false && dims[0] > 1)
+            {
+                throw BatchSizeException("Failed TfLiteInterpreterResizeInputTensor, the model does not accept this batch size.");
+            }
+
+            throw SegmentationException("Failed TfLiteInterpreterAllocateTensors.");
+        }
+
+        mInputDims = dims;
+        mAllocations++;
+    }
+
+    TfLiteTensor* input = TfLiteInterpreterGetInputTensor(mInterpreter, 0);
+
+    if (input == NULL || TfLiteTensorCopyFromBuffer(input, pData, pSize) != kTfLiteOk)
+    {
+        throw SegmentationException("Failed TfLiteTensorCopyFromBuffer.");
+    }
+
+    if (TfLiteInterpreterInvoke(mInterpreter) != kTfLiteOk)
+    {
+        throw SegmentationException("Failed TfLiteInterpreterInvoke.");
+    }
+
+    pOutputs.resize(pOutputLayers.size());
+    int32_t count = TfLiteInterpreterGetOutputTensorCount(mInterpreter);
+
+    for (size_t k = 0; k < pOutputLayers.size(); k++)
+    {
+        // The converter keeps the graph node names, possibly with a suffix.
+        const TfLiteTensor* tensor = NULL;
+
+        for (int32_t t = 0; t < count && tensor == NULL; t++)
+        {
+            const TfLiteTensor* candidate = TfLiteInterpreterGetOutputTensor(mInterpreter, t);
+            const char* name = TfLiteTensorName(candidate);
+
+            if (name != NULL && std::strstr(name, pOutputLayers[k].c_str()) != NULL)
+            {
+                tensor = candidate;
+            }
+        }
+
+        if (tensor == NULL || TfLiteTensorNumDims(tensor) != 4)
+        {
+            throw SegmentationException("TensorFlow Lite output not found: " + pOutputLayers[k]);
+        }
+
+        int batch = TfLiteTensorDim(tensor, 0);
+        int dim1 = TfLiteTensorDim(tensor, 1);
+        int dim2 = TfLiteTensorDim(tensor, 2);
+        int dim3 = TfLiteTensorDim(tensor, 3);
+        size_t imageLenght = size_t(dim1) * dim2 * dim3;
+
+        const float* rawData = static_cast<const float*>(TfLiteTensorData(tensor));
+
+        // The buffers belong to the interpreter and are overwritten by the next run.
+        pOutputs[k].resize(batch);
+
+        for (int i = 0; i < batch; i++)
+        {
+            cv::Mat& outputMatrix = pOutputs[k][i];
+            outputMatrix.create(dim1, dim2, CV_32FC(dim3));
+            std::memcpy(outputMatrix.data, rawData + i * imageLenght, sizeof(float) * imageLenght);
+        }
+    }
+}
+
+uint64_t TFLiteBackend::getAllocationCount() const
+{
+    return mAllocations;
+}
+
+void TFLiteBackend::resetAllocationCount()
+{
+    mAllocations = 0;
+}
+
+const char* TFLiteBackend::getName() const
+{
+    return "TensorFlow Lite (XNNPACK)";
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef TFLITE_BACKEND_H
+#define TFLITE_BACKEND_H
+
+#ifdef SEGMENTATION_WITH_TFLITE
+
+#include "InferenceBackend.hpp"
+
+struct TfLiteModel;
+struct TfLiteInterpreter;
+struct TfLiteInterpreterOptions;
+struct TfLiteDelegate;
+
+// .tflite conversion of the model run with the XNNPACK CPU delegate. The input tensor is only resized
+// and reallocated when its shape changes.
+class TFLiteBackend : public InferenceBackend
+{
+public:
+    TFLiteBackend();
+
+    ~TFLiteBackend();
+
+    bool init(const std::string& pModel) override;
+
+    void run(const std::string& pInputLayer, const std::vector<std::string>& pOutputLayers,
+        const std::vector<std::int64_t>& pInput_dims, const float* pData, size_t pSize, std::vector<std::vector<cv::Mat>>& pOutputs) override;
+
+    const char* getName() const override;
+
+    uint64_t getAllocationCount() const override;
+
+    void resetAllocationCount() override;
+
+private:
+    TfLiteModel* mModel;
+    TfLiteInterpreterOptions* mOptions;
+    TfLiteDelegate* mDelegate;
+    TfLiteInterpreter* mInterpreter;
+    std::vector<int> mInputDims;
+    uint64_t mAllocations;
+
+    void release();
+};
+
+#endif
+
+#endif
@@ -0,0 +1,188 @@
+#include "TensorFlowBackend.hpp"
+#include "PrivateData.hpp"
+#include "SegmentationException.hpp"
+#include "tensorflow/c/c_api.h"
+#include <algorithm>
+#include <cstring>
+
+TensorFlowBackend::TensorFlowBackend()
+{
+    mData = new PrivateData();
+    mInput = NULL;
+    mAllocations = 0;
+}
+
+TensorFlowBackend::~TensorFlowBackend()
+{
+    if (mInput != NULL)
+    {
+        TF_DeleteTensor(mInput);
+        mInput = NULL;
+    }
+
+    delete mData;
+    mData = NULL;
+}
+
+uint64_t TensorFlowBackend::getAllocationCount() const
+{
+    return mAllocations;
+}
+
+void TensorFlowBackend::resetAllocationCount()
+{
+    mAllocations = 0;
+}
+
+bool TensorFlowBackend::init(const std::string& pModel)
+{
+    return mData->init(pModel);
+}
+
+const char* TensorFlowBackend::getName() const
+{
+    return "TensorFlow";
+}
+
+int TensorFlowBackend::getFixedBatchSize(const std::string& pInputLayer) const
+{
+    TF_Output input = { TF_GraphOperationByName(mData->getGraph(), pInputLayer.c_str()), 0 };
+
+    if (input.oper == NULL)
+    {
+        return 0;
+    }
+
+    TF_Status* status = TF_NewStatus();
+    int batch = 0;
+    int dims = TF_GraphGetTensorNumDims(mData->getGraph(), input, status);
+
+    // Unknown ranks and -1 dimensions accept any batch.
+    if (TF_GetCode(status) == TF_OK && dims > 0)
+    {
+        std::vector<int64_t> shape(dims);
+        TF_GraphGetTensorShape(mData->getGraph(), input, shape.data(), dims, status);
+
+        if (TF_GetCode(status) == TF_OK && shape[0] > 0)
+        {
+            batch = int(shape[0]);
+        }
+    }
+
+    TF_DeleteStatus(status);
+    return batch;
+}
+
+void TensorFlowBackend::run(const std::string& pInputLayer, const std::vector<std::string>& pOutputLayers,
+    const std::vector<std::int64_t>& pInput_dims, const float* pData, size_t pSize, std::vector<std::vector<cv::Mat>>& pOutputs)
+{
+    // The graph operations are only looked up again when the layers change.
+    if (mInputOps.empty() || mInputLayer != pInputLayer || mOutputLayers != pOutputLayers)
+    {
+        mInputOps.clear();
+        mOutputOps.clear();
+
+        TF_Output t0 = { TF_GraphOperationByName(mData->getGraph(), pInputLayer.c_str()), 0 };
+
+        if (t0.oper == NULL)
+        {
+            throw SegmentationException("Failed TF_GraphOperationByName Input.");
+        }
+
+        for (size_t k = 0; k < pOutputLayers.size(); k++)
+        {
+            TF_Output t1 = { TF_GraphOperationByName(mData->getGraph(), pOutputLayers[k].c_str()), 0 };
+
+            if (t1.oper == NULL)
+            {
+                mOutputOps.clear();
+                throw SegmentationException("Failed TF_GraphOperationByName Output.");
+            }
+
+            mOutputOps.push_back(t1);
+        }
+
+        mInputOps.push_back(t0);
+        mInputLayer = pInputLayer;
+        mOutputLayers = pOutputLayers;
+    }
+
+    if (mInput == NULL || mInputDims != pInput_dims)
+    {
+        if (mInput != NULL)
+        {
+            TF_DeleteTensor(mInput);
+        }
+
+        mInput = mData->CreateTensor(TF_FLOAT, pInput_dims, pData, pSize);
+        mInputDims = pInput_dims;
+        mAllocations++;
+
+        if (mInput == NULL)
+        {
+            mInputDims.clear();
+            throw SegmentationException("Failed to allocate the input tensor.");
+        }
+    }
+    else
+    {
+        std::memcpy(TF_TensorData(mInput), pData, std::min(pSize, TF_TensorByteSize(mInput)));
+    }
+
+    mInputTensors.assign(1, mInput);
+    mOutputTensors.assign(mOutputOps.size(), nullptr);
+
+    std::vector<TF_Tensor*>& output_tensors = mOutputTensors;
+
+    auto code = mData->Execute(mInputOps, mInputTensors, mOutputOps, output_tensors);
+
+    bool complete = (code == TF_OK);
+
+    for (size_t k = 0; k < output_tensors.size(); k++)
+    {
+        complete = complete && (output_tensors[k] != nullptr);
+    }
+
+    pOutputs.resize(output_tensors.size());
+
+    for (size_t k = 0; k < output_tensors.size() && complete; k++)
+    {
+        int64_t batch = TF_Dim(output_tensors[k], 0);
+        int64_t dim1 = TF_Dim(output_tensors[k], 1);
+        int64_t dim2 = TF_Dim(output_tensors[k], 2);
+        int64_t dim3 = TF_Dim(output_tensors[k], 3);
+        int64_t imageLenght = dim1 * dim2 * dim3;
+
+        const float* rawData = static_cast<const float*>(TF_TensorData(output_tensors[k]));
+
+        // The tensor is NHWC, so every batch entry is already an interleaved multi-channel image.
+        pOutputs[k].resize(size_t(batch));
+
+        for (int64_t i = 0; i < batch; i++)
+        {
+            cv::Mat& outputMatrix = pOutputs[k][i];
+            outputMatrix.create(int(dim1), int(dim2), CV_32FC(int(dim3)));
+            std::memcpy(outputMatrix.data, rawData + i * imageLenght, sizeof(float) * imageLenght);
+        }
+    }
+
+    for (size_t k = 0; k < output_tensors.size(); k++)
+    {
+        if (output_tensors[k] != nullptr)
+        {
+            TF_DeleteTensor(output_tensors[k]);
+            output_tensors[k] = nullptr;
+        }
+    }
+
+    if (complete == false)
+    {
+        // A placeholder with a fixed batch rejects the feed as an invalid argument.
+        if (code == TF_INVALID_ARGUMENT && pInput_dims.empty() == false && pInput_dims[0] > 1)
+        {
+            throw BatchSizeException("Failed TF_SessionRun, the graph does not accept this batch size.");
+        }
+
+        throw SegmentationException("Failed TF_SessionRun.");
+    }
+}
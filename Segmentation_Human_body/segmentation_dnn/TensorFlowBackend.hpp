@@ -0,0 +1,46 @@
+#ifndef TENSORFLOW_BACKEND_H
+#define TENSORFLOW_BACKEND_H
+
+#include "InferenceBackend.hpp"
+#include "tensorflow/c/c_api.h"
+
+class PrivateData;
+
+// Frozen graph run through the TensorFlow C API. Only the requested outputs are fetched, so the rest of
+// the graph is pruned.
+class TensorFlowBackend : public InferenceBackend
+{
+public:
+    TensorFlowBackend();
+
+    ~TensorFlowBackend();
+
+    bool init(const std::string& pModel) override;
+
+    void run(const std::string& pInputLayer, const std::vector<std::string>& pOutputLayers,
+        const std::vector<std::int64_t>& pInput_dims, const float* pData, size_t pSize, std::vector<std::vector<cv::Mat>>& pOutputs) override;
+
+    const char* getName() const override;
+
+    int getFixedBatchSize(const std::string& pInputLayer) const override;
+
+    uint64_t getAllocationCount() const override;
+
+    void resetAllocationCount() override;
+
+private:
+    PrivateData* mData;
+
+    // Input tensor kept while the input shape does not change, only its contents are rewritten.
+    TF_Tensor* mInput;
+    std::vector<std::int64_t> mInputDims;
+    uint64_t mAllocations;
+
+    // Graph operations of the last layers that were run, and the tensor lists handed to the session.
+    std::string mInputLayer;
+    std::vector<std::string> mOutputLayers;
+    std::vector<TF_Output> mInputOps, mOutputOps;
+    std::vector<TF_Tensor*> mInputTensors, mOutputTensors;
+};
+
+#endif
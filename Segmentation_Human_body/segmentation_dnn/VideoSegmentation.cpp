@@ -0,0 +1,479 @@
+#include "VideoSegmentation.hpp"
+#include "FrameData.hpp"
+#include "BoundedQueue.hpp"
+#include "SegmentationException.hpp"
+#include "ArgMaxKernel.hpp"
+#include <chrono>
+#include <exception>
+#include <thread>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct PipelineFrame
+    {
+        FrameData data;
+        int64_t index;
+        bool reuse;
+        cv::Point2d shift;
+        cv::Rect crop;
+    };
+
+    // Person box shared by the post-processing stage, which updates it, and the preprocessing stage.
+    struct TrackState
+    {
+        std::mutex mutex;
+        cv::Rect box;
+        bool valid = false;
+    };
+
+    cv::Rect get_tracking_box(const cv::Mat& pMask, const TrackingOptions& pOptions)
+    {
+        if (pMask.empty() || cv::countNonZero(pMask) < pOptions.minArea)
+        {
+            return cv::Rect();
+        }
+
+        cv::Rect box = cv::boundingRect(pMask);
+        int margin = int(std::ceil(pOptions.margin * std::max(box.width, box.height)));
+
+        box.x -= margin;
+        box.y -= margin;
+        box.width += 2 * margin;
+        box.height += 2 * margin;
+
+        box &= cv::Rect(0, 0, pMask.cols, pMask.rows);
+
+        if (box.area() > pOptions.maxCropFraction * pMask.cols * pMask.rows)
+        {
+            return cv::Rect();
+        }
+
+        return box;
+    }
+
+    cv::Mat paste(const cv::Mat& pCrop, const cv::Rect& pBox, const cv::Size& pSize)
+    {
+        if (pCrop.empty())
+        {
+            return pCrop;
+        }
+
+        cv::Mat result = cv::Mat::zeros(pSize, pCrop.type());
+        pCrop.copyTo(result(pBox));
+        return result;
+    }
+
+    cv::Mat get_motion_image(const cv::Mat& pFrame, int pWidth)
+    {
+        cv::Mat gray, small, result;
+
+        if (pFrame.channels() == 3)
+        {
+            cv::cvtColor(pFrame, gray, cv::COLOR_BGR2GRAY);
+        }
+        else
+        {
+            gray = pFrame;
+        }
+
+        int width = std::max(8, std::min(pWidth, gray.cols));
+        int height = std::max(8, int(std::round(double(gray.rows) * width / gray.cols)));
+
+        cv::resize(gray, small, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+        small.convertTo(result, CV_32F);
+        return result;
+    }
+
+    cv::Mat translate(const cv::Mat& pImage, const cv::Point2d& pShift, int pInterpolation)
+    {
+        if (pImage.empty() || (pShift.x == 0 && pShift.y == 0))
+        {
+            return pImage.clone();
+        }
+
+        cv::Mat transform = cv::Mat::zeros(2, 3, CV_64F);
+        transform.at<double>(0, 0) = 1;
+        transform.at<double>(1, 1) = 1;
+        transform.at<double>(0, 2) = pShift.x;
+        transform.at<double>(1, 2) = pShift.y;
+
+        cv::Mat result;
+        cv::warpAffine(pImage, result, transform, pImage.size(), pInterpolation, cv::BORDER_CONSTANT, cv::Scalar(0));
+        return result;
+    }
+
+    // Warped and pasted results no longer match the encodings of the decoded crop or keyframe.
+    void encode(SegmentationResult& pResult, int pEncodings, int pPartCount)
+    {
+        if (pEncodings != 0)
+        {
+            pResult.encodings = MaskEncoding::encode(pResult.mask, pResult.parts, pPartCount, pEncodings);
+        }
+    }
+
+    double elapsed_seconds(const Clock::time_point& pStart)
+    {
+        return std::chrono::duration<double>(Clock::now() - pStart).count();
+    }
+}
+
+VideoSegmentation::VideoSegmentation(SegmentationDNN& pModel, int pQueueSize) : mModel(pModel)
+{
+    mQueueSize = (pQueueSize < 1) ? 1 : pQueueSize;
+    mStop = false;
+}
+
+void VideoSegmentation::stop()
+{
+    mStop = true;
+}
+
+void VideoSegmentation::setTemporalOptions(const TemporalOptions& pOptions)
+{
+    mTemporal = pOptions;
+
+    if (mTemporal.keyframeInterval < 1)
+    {
+        mTemporal.keyframeInterval = 1;
+    }
+}
+
+TemporalOptions VideoSegmentation::getTemporalOptions() const
+{
+    return mTemporal;
+}
+
+void VideoSegmentation::setTrackingOptions(const TrackingOptions& pOptions)
+{
+    mTracking = pOptions;
+
+    if (mTracking.refreshInterval < 1)
+    {
+        mTracking.refreshInterval = 1;
+    }
+}
+
+TrackingOptions VideoSegmentation::getTrackingOptions() const
+{
+    return mTracking;
+}
+
+VideoStats VideoSegmentation::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    return mStats;
+}
+
+VideoStats VideoSegmentation::run(cv::VideoCapture& pCapture, const ResultCallback& pCallback)
+{
+    if (!pCapture.isOpened())
+    {
+        throw SegmentationException("Error opening video stream or file.");
+    }
+
+    FrameSource source = [&pCapture](cv::Mat& pFrame)
+    {
+        return pCapture.read(pFrame);
+    };
+
+    return run(source, pCallback);
+}
+
+VideoStats VideoSegmentation::run(const FrameSource& pSource, const ResultCallback& pCallback)
+{
+    if ((mTemporal.enabled == true || mTracking.enabled == true) && mModel.getDenseImages() == false)
+    {
+        throw SegmentationException("Temporal and tracking modes need the dense mask, see SegmentationDNN::setEncodings.");
+    }
+
+    mStop = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mStatsMutex);
+        mStats = VideoStats();
+    }
+
+    // One frame per stage plus full queues on both sides of the network.
+    size_t poolSize = 2 * size_t(mQueueSize) + 3;
+    std::vector<PipelineFrame> pool(poolSize);
+
+    BoundedQueue<PipelineFrame*> freeFrames(poolSize);
+    BoundedQueue<PipelineFrame*> toInfer(mQueueSize);
+    BoundedQueue<PipelineFrame*> toPostprocess(mQueueSize);
+
+    for (size_t i = 0; i < pool.size(); i++)
+    {
+        freeFrames.push(&pool[i]);
+    }
+
+    double busy[3] = { 0, 0, 0 };
+    std::exception_ptr errors[3];
+
+    auto fail = [&](int pStage)
+    {
+        errors[pStage] = std::current_exception();
+        mStop = true;
+        freeFrames.close();
+        toInfer.close();
+        toPostprocess.close();
+    };
+
+    Clock::time_point start = Clock::now();
+
+    const TemporalOptions temporal = mTemporal;
+    const TrackingOptions tracking = mTracking;
+    TrackState track;
+
+    std::thread preprocessThread([&]()
+    {
+        try
+        {
+            int64_t index = 0;
+            int sinceKeyframe = 0;
+            int sinceFullFrame = 0;
+            cv::Mat keyframeMotion;
+            PipelineFrame* frame;
+
+            while (mStop == false && freeFrames.pop(frame))
+            {
+                Clock::time_point begin = Clock::now();
+
+                if (pSource(frame->data.image) == false || frame->data.image.empty())
+                {
+                    break;
+                }
+
+                frame->index = index++;
+                frame->reuse = false;
+                frame->shift = cv::Point2d(0, 0);
+                frame->crop = cv::Rect();
+
+                if (temporal.enabled == true)
+                {
+                    cv::Mat motion = get_motion_image(frame->data.image, temporal.analysisWidth);
+
+                    if (!keyframeMotion.empty() && motion.size() == keyframeMotion.size() && sinceKeyframe < temporal.keyframeInterval)
+                    {
+                        cv::Mat difference;
+                        cv::absdiff(motion, keyframeMotion, difference);
+
+                        if (cv::mean(difference)[0] < temporal.motionThreshold)
+                        {
+                            frame->reuse = true;
+                            sinceKeyframe++;
+
+                            if (temporal.warp == true)
+                            {
+                                cv::Point2d shift = cv::phaseCorrelate(keyframeMotion, motion);
+                                double scale = double(frame->data.image.cols) / double(motion.cols);
+                                frame->shift = cv::Point2d(shift.x * scale, shift.y * scale);
+                            }
+                        }
+                    }
+
+                    if (frame->reuse == false)
+                    {
+                        keyframeMotion = motion;
+                        sinceKeyframe = 0;
+                    }
+                }
+
+                if (frame->reuse == false && tracking.enabled == true)
+                {
+                    std::lock_guard<std::mutex> lock(track.mutex);
+
+                    if (track.valid == true && sinceFullFrame < tracking.refreshInterval &&
+                        (track.box & cv::Rect(0, 0, frame->data.image.cols, frame->data.image.rows)) == track.box)
+                    {
+                        frame->crop = track.box;
+                        sinceFullFrame++;
+                    }
+                    else
+                    {
+                        sinceFullFrame = 0;
+                    }
+                }
+
+                if (frame->reuse == false)
+                {
+                    if (frame->crop.area() > 0)
+                    {
+                        mModel.Preprocess(frame->data.image(frame->crop), frame->data);
+                    }
+                    else
+                    {
+                        mModel.Preprocess(frame->data.image, frame->data);
+                    }
+                }
+
+                busy[0] += elapsed_seconds(begin);
+
+                if (toInfer.push(frame) == false)
+                {
+                    break;
+                }
+            }
+        }
+        catch (...)
+        {
+            fail(0);
+        }
+
+        toInfer.close();
+    });
+
+    std::thread inferenceThread([&]()
+    {
+        try
+        {
+            PipelineFrame* frame;
+
+            while (toInfer.pop(frame))
+            {
+                Clock::time_point begin = Clock::now();
+
+                if (frame->reuse == false)
+                {
+                    mModel.Infer(frame->data);
+                }
+
+                busy[1] += elapsed_seconds(begin);
+
+                if (toPostprocess.push(frame) == false)
+                {
+                    break;
+                }
+            }
+        }
+        catch (...)
+        {
+            fail(1);
+        }
+
+        toPostprocess.close();
+    });
+
+    try
+    {
+        PipelineFrame* frame;
+        SegmentationResult keyframeResult;
+        const int encodings = mModel.getEncodings();
+        int partCount = 0;
+
+        while (toPostprocess.pop(frame))
+        {
+            Clock::time_point begin = Clock::now();
+
+            if (frame->reuse == true)
+            {
+                frame->data.result.mask = translate(keyframeResult.mask, frame->shift, cv::INTER_NEAREST);
+                frame->data.result.parts = translate(keyframeResult.parts, frame->shift, cv::INTER_NEAREST);
+                frame->data.result.maskProbability = translate(keyframeResult.maskProbability, frame->shift, cv::INTER_LINEAR);
+                frame->data.result.statistics = keyframeResult.statistics;
+                ArgMaxKernel::map_statistics(frame->data.result.statistics, 1, 1, frame->shift, frame->data.image.size());
+                encode(frame->data.result, encodings, partCount);
+            }
+            else
+            {
+                mModel.Postprocess(frame->data);
+                partCount = frame->data.outputPart.channels();
+
+                if (frame->crop.area() > 0)
+                {
+                    cv::Size size = frame->data.image.size();
+                    frame->data.result.mask = paste(frame->data.result.mask, frame->crop, size);
+                    frame->data.result.parts = paste(frame->data.result.parts, frame->crop, size);
+                    frame->data.result.maskProbability = paste(frame->data.result.maskProbability, frame->crop, size);
+                    ArgMaxKernel::map_statistics(frame->data.result.statistics, 1, 1, cv::Point2d(frame->crop.x, frame->crop.y), size);
+                    encode(frame->data.result, encodings, partCount);
+                }
+
+                if (tracking.enabled == true)
+                {
+                    cv::Rect box = get_tracking_box(frame->data.result.mask, tracking);
+                    std::lock_guard<std::mutex> lock(track.mutex);
+
+                    if (box.area() == 0 && track.valid == true && frame->crop.area() > 0)
+                    {
+                        std::lock_guard<std::mutex> statsLock(mStatsMutex);
+                        mStats.trackingLost++;
+                    }
+
+                    track.box = box;
+                    track.valid = (box.area() > 0);
+                }
+
+                if (temporal.enabled == true)
+                {
+                    keyframeResult.mask = frame->data.result.mask.clone();
+                    keyframeResult.parts = frame->data.result.parts.clone();
+                    keyframeResult.maskProbability = frame->data.result.maskProbability.clone();
+                    keyframeResult.statistics = frame->data.result.statistics;
+                }
+            }
+
+            pCallback(frame->index, frame->data.image, frame->data.result);
+
+            busy[2] += elapsed_seconds(begin);
+
+            {
+                std::lock_guard<std::mutex> lock(mStatsMutex);
+                mStats.frames++;
+                if (frame->reuse == true)
+                {
+                    mStats.reusedFrames++;
+                }
+                else
+                {
+                    mStats.inferredFrames++;
+                }
+                if (frame->crop.area() > 0)
+                {
+                    mStats.trackedFrames++;
+                }
+                mStats.inferredFraction = double(mStats.inferredFrames) / double(mStats.frames);
+                mStats.seconds = elapsed_seconds(start);
+                mStats.fps = double(mStats.frames) / mStats.seconds;
+            }
+
+            freeFrames.push(frame);
+        }
+    }
+    catch (...)
+    {
+        fail(2);
+    }
+
+    freeFrames.close();
+    preprocessThread.join();
+    inferenceThread.join();
+
+    VideoStats stats;
+
+    {
+        std::lock_guard<std::mutex> lock(mStatsMutex);
+        mStats.seconds = elapsed_seconds(start);
+
+        if (mStats.seconds > 0)
+        {
+            mStats.fps = double(mStats.frames) / mStats.seconds;
+            mStats.preprocessOccupancy = busy[0] / mStats.seconds;
+            mStats.inferenceOccupancy = busy[1] / mStats.seconds;
+            mStats.postprocessOccupancy = busy[2] / mStats.seconds;
+        }
+
+        stats = mStats;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (errors[i])
+        {
+            std::rethrow_exception(errors[i]);
+        }
+    }
+
+    return stats;
+}
@@ -0,0 +1,103 @@
+#ifndef VIDEO_SEGMENTATION_H
+#define VIDEO_SEGMENTATION_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include "segmentationDNN.hpp"
+
+struct VideoStats
+{
+    uint64_t frames = 0;
+    double seconds = 0;
+    double fps = 0;
+    // Fraction of the wall time each stage spent working rather than waiting on its queues.
+    double preprocessOccupancy = 0;
+    double inferenceOccupancy = 0;
+    double postprocessOccupancy = 0;
+    // Temporal mode: frames that ran the network and frames that reused the last keyframe result.
+    uint64_t inferredFrames = 0;
+    uint64_t reusedFrames = 0;
+    double inferredFraction = 0;
+    // Tracking mode: frames run on a person crop and number of times the person was lost.
+    uint64_t trackedFrames = 0;
+    uint64_t trackingLost = 0;
+};
+
+struct TemporalOptions
+{
+    bool enabled = false;
+    // Mean absolute gray-level difference to the last keyframe, measured at analysisWidth, below which
+    // the keyframe result is reused.
+    double motionThreshold = 2.0;
+    // A full inference is forced after this many reused frames.
+    int keyframeInterval = 10;
+    int analysisWidth = 64;
+    // Shift the reused mask and parts by the translation estimated between the keyframe and the frame.
+    bool warp = true;
+};
+
+struct TrackingOptions
+{
+    bool enabled = false;
+    // Added on every side of the mask bounding box, as a fraction of its larger side.
+    double margin = 0.25;
+    // Below this many mask pixels the person is considered lost and the next frames run on the full frame.
+    int minArea = 400;
+    // Crops larger than this fraction of the frame run on the full frame instead.
+    double maxCropFraction = 0.7;
+    // A full-frame pass every this many frames picks up people entering the scene.
+    int refreshInterval = 30;
+};
+
+/*
+* Segments a stream of frames with a three-stage pipeline: while frame t is in the network, frame t+1
+* is read and preprocessed and frame t-1 is post-processed and handed to the callback. Stages are
+* connected by bounded queues and frames come from a fixed pool that is recycled, so memory stays
+* constant however long the stream is.
+*/
+class VideoSegmentation
+{
+public:
+    // Fills the frame and returns true, or returns false at the end of the stream.
+    using FrameSource = std::function<bool(cv::Mat&)>;
+
+    // Called in frame order. The frame and its result are recycled afterwards, clone them to keep them.
+    using ResultCallback = std::function<void(int64_t pIndex, const cv::Mat& pFrame, const SegmentationResult& pResult)>;
+
+    VideoSegmentation(SegmentationDNN& pModel, int pQueueSize = 2);
+
+    VideoStats run(cv::VideoCapture& pCapture, const ResultCallback& pCallback);
+
+    VideoStats run(const FrameSource& pSource, const ResultCallback& pCallback);
+
+    // Can be called from the callback or another thread, run() returns after the frames in flight.
+    void stop();
+
+    // Skips the network on frames that barely changed since the last keyframe.
+    void setTemporalOptions(const TemporalOptions& pOptions);
+
+    TemporalOptions getTemporalOptions() const;
+
+    // Runs the network on a crop around the person found in the previous results. The crop follows the
+    // latest post-processed mask, which is a few frames behind in the pipeline, hence the margin.
+    // Input buckets keep the crop-sized model inputs to a few shapes.
+    void setTrackingOptions(const TrackingOptions& pOptions);
+
+    TrackingOptions getTrackingOptions() const;
+
+    VideoStats getStats() const;
+
+private:
+    SegmentationDNN& mModel;
+    int mQueueSize;
+    std::atomic<bool> mStop;
+    TemporalOptions mTemporal;
+    TrackingOptions mTracking;
+
+    mutable std::mutex mStatsMutex;
+    VideoStats mStats;
+};
+
+#endif
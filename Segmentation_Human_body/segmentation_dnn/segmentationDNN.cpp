@@ -1,5 +1,5 @@
 #include "segmentationDNN.hpp"
-#include "PrivateData.hpp"
+#include "InferenceBackend.hpp"
 #include "tensorflow/c/c_api.h"
 #include <stdio.h>
 #include <functional> 
@@ -8,30 +8,72 @@
 #include "ImageInference.hpp"
 #include <fstream>
 #include "SegmentationException.hpp"
+#include "FrameData.hpp"
+#include "ArgMaxKernel.hpp"
 
 std::string LAYER_INPUT = "sub_2";
 std::string LAYER_OUTPUT_MASK = "float_segments";
 std::string LAYER_OUTPUT_PART = "float_part_heatmaps";
 
 
-SegmentationDNN::SegmentationDNN(const std::string& pModelPB)
+SegmentationDNN::SegmentationDNN(const std::string& pModelPB, BackendType pBackend)
 {
-    mData = new PrivateData();
+    mBackend = InferenceBackend::create(pBackend);
+    Initialize();
 
-    bool result = mData->init(pModelPB);
+    bool result = mBackend->init(pModelPB);
 
     if (result == false)
     {
+        delete mBackend;
+        delete mProcess;
+        delete mArena;
+        delete mFrame;
         throw SegmentationException("Could not load or read model parameters.");
     }
+
+    mFixedBatchSize = mBackend->getFixedBatchSize(LAYER_INPUT);
+}
+
+SegmentationDNN::SegmentationDNN(InferenceBackend* pBackend)
+{
+    if (pBackend == NULL)
+    {
+        throw SegmentationException("No inference backend given.");
+    }
+
+    mBackend = pBackend;
+    Initialize();
+    mFixedBatchSize = mBackend->getFixedBatchSize(LAYER_INPUT);
+}
+
+void SegmentationDNN::Initialize()
+{
+    mProcess = new ImageProcessing();
+    mArena = new BufferArena();
+    mFrame = new FrameData();
+    mDecodingMode = DECODING_FULL_RESOLUTION;
+    mLogitDecoding = false;
+    mMaskProbability = false;
+    mStatistics = false;
+    mOutputs = OUTPUT_ALL;
+    mEncodings = 0;
+    mDenseImages = true;
 }
 
 SegmentationDNN::~SegmentationDNN()
 {
-    mData->~PrivateData();
+    delete mBackend;
+    mBackend = NULL;
+
+    delete mProcess;
+    mProcess = NULL;
 
-    mData = NULL;
-    delete mData;
+    delete mArena;
+    mArena = NULL;
+
+    delete mFrame;
+    mFrame = NULL;
 }
 
 
@@ -45,90 +87,588 @@ cv::Mat SegmentationDNN::getBodyParts()
     return mParts;
 }
 
+cv::Mat SegmentationDNN::getBodyMaskProbability()
+{
+    return mProbability;
+}
+
+void SegmentationDNN::setMaskProbability(bool pEnable)
+{
+    mMaskProbability = pEnable;
+}
+
+std::vector<PartStatistics> SegmentationDNN::getStatistics()
+{
+    return mPartStatistics;
+}
+
+void SegmentationDNN::setStatistics(bool pEnable)
+{
+    mStatistics = pEnable;
+}
+
+void SegmentationDNN::setOutputs(int pOutputs)
+{
+    if ((pOutputs & OUTPUT_ALL) == 0)
+    {
+        throw SegmentationException("At least one output must be selected.");
+    }
+
+    mOutputs = pOutputs & OUTPUT_ALL;
+}
+
+int SegmentationDNN::getOutputs() const
+{
+    return mOutputs;
+}
+
+void SegmentationDNN::setEncodings(int pEncodings, bool pDenseImages)
+{
+    int all = ENCODING_PACKED_MASK | ENCODING_MASK_RLE | ENCODING_PARTS_RLE;
+
+    if ((pEncodings & ~all) != 0)
+    {
+        throw SegmentationException("Unknown mask encoding.");
+    }
+
+    if (pEncodings == 0 && pDenseImages == false)
+    {
+        throw SegmentationException("Dense images can only be disabled when an encoding is selected.");
+    }
+
+    mEncodings = pEncodings;
+    mDenseImages = pDenseImages;
+}
+
+int SegmentationDNN::getEncodings() const
+{
+    return mEncodings;
+}
+
+bool SegmentationDNN::getDenseImages() const
+{
+    return mDenseImages;
+}
+
+MaskEncodings SegmentationDNN::getMaskEncodings()
+{
+    return mMaskEncodings;
+}
+
 bool SegmentationDNN::Execute(const cv::Mat& pImg)
 {
-    ImageSize originalSize(pImg.rows, pImg.cols);
-    ImageSize modelInputSize;
+    Preprocess(pImg, *mFrame);
+
+    Infer(*mFrame);
+
+    Postprocess(*mFrame);
 
-    ImageProcessing process;
-    std::pair<cv::Mat, Padding> result = process.get_processed_image(pImg, modelInputSize);
+    mMask = mFrame->result.mask;
 
-    int height = result.first.rows;
-    int width = result.first.cols;
-    int channel = result.first.channels();
+    mParts = mFrame->result.parts;
 
-    const std::vector<std::int64_t> input_dims = { 1, height, width, channel };
+    mProbability = mFrame->result.maskProbability;
 
-    float* buffer = (float*)result.first.data;
-    int64 tSize = height * width * channel;
+    mPartStatistics = mFrame->result.statistics;
+
+    mMaskEncodings = mFrame->result.encodings;
+
+    return true;
+}
 
-    cv::Mat outputMask = GetPrediction(LAYER_INPUT, LAYER_OUTPUT_MASK, input_dims, buffer, sizeof(float) * tSize);
+uint64_t SegmentationDNN::getAllocationCount() const
+{
+    return mArena->getAllocationCount() + mFrame->buffers.getAllocationCount() + mBackend->getAllocationCount();
+}
 
-    cv::Mat outputPart = GetPrediction(LAYER_INPUT, LAYER_OUTPUT_PART, input_dims, buffer, sizeof(float) * tSize);
+void SegmentationDNN::resetAllocationCount()
+{
+    mArena->resetAllocationCount();
+    mFrame->buffers.resetAllocationCount();
+    mBackend->resetAllocationCount();
+}
 
-    ImageInferenceProcess inference(outputMask, outputPart, originalSize, modelInputSize, result.second);
+bool SegmentationDNN::ExecuteCoarseToFine(const cv::Mat& pImg, int pCoarseSide, int pFineSide)
+{
+    if (pImg.empty())
+    {
+        throw SegmentationException("Empty image.");
+    }
 
-    mMask = inference.get_Mask();
+    FrameData coarse;
+    PreprocessBounded(pImg, pCoarseSide, coarse);
+    coarse.outputs = OUTPUT_MASK;
+    coarse.encodings = 0;
+    Infer(coarse);
+    DecodeFrame(coarse, DECODING_LOW_RESOLUTION);
 
-    mParts = inference.get_Parts_segmentation(mMask);
+    // Person box in the coarse mask, with a margin for the parts the coarse pass missed, in image pixels.
+    cv::Rect box(0, 0, pImg.cols, pImg.rows);
+    const cv::Mat& coarseMask = coarse.result.mask;
+
+    if (cv::countNonZero(coarseMask) > 0)
+    {
+        cv::Rect found = cv::boundingRect(coarseMask);
+        double scaleX = double(pImg.cols) / double(coarseMask.cols);
+        double scaleY = double(pImg.rows) / double(coarseMask.rows);
+        double margin = 0.1 * std::max(found.width, found.height);
+
+        int x1 = int(floor((found.x - margin) * scaleX));
+        int y1 = int(floor((found.y - margin) * scaleY));
+        int x2 = int(ceil((found.x + found.width + margin) * scaleX));
+        int y2 = int(ceil((found.y + found.height + margin) * scaleY));
+
+        box &= cv::Rect(x1, y1, x2 - x1, y2 - y1);
+
+        if (box.area() == 0)
+        {
+            box = cv::Rect(0, 0, pImg.cols, pImg.rows);
+        }
+    }
+
+    FrameData fine;
+    PreprocessBounded(pImg(box), pFineSide, fine);
+    fine.encodings = 0;
+    Infer(fine);
+    DecodeFrame(fine, DECODING_LOW_RESOLUTION);
+
+    cv::Size cropSize = box.size();
+    cv::Mat mask, parts, probability;
+
+    cv::resize(fine.result.mask, mask, cropSize, 0, 0, cv::INTER_LINEAR);
+    cv::threshold(mask, mask, 127, 255, cv::THRESH_BINARY);
+
+    mMask = cv::Mat::zeros(pImg.rows, pImg.cols, CV_8U);
+    mask.copyTo(mMask(box));
+
+    mParts = cv::Mat();
+
+    if (!fine.result.parts.empty())
+    {
+        cv::resize(fine.result.parts, parts, cropSize, 0, 0, cv::INTER_NEAREST);
+        mParts = cv::Mat::zeros(pImg.rows, pImg.cols, parts.type());
+        parts.copyTo(mParts(box));
+    }
+
+    mProbability = cv::Mat();
+
+    if (mMaskProbability == true)
+    {
+        cv::resize(fine.result.maskProbability, probability, cropSize, 0, 0, cv::INTER_LINEAR);
+        mProbability = cv::Mat::zeros(pImg.rows, pImg.cols, CV_32F);
+        probability.copyTo(mProbability(box));
+    }
+
+    mPartStatistics = fine.result.statistics;
+    ArgMaxKernel::map_statistics(mPartStatistics, double(cropSize.width) / fine.result.mask.cols, double(cropSize.height) / fine.result.mask.rows,
+        cv::Point2d(box.x, box.y), pImg.size());
+
+    // Only the crop is decoded, so the encodings are taken from the pasted full-size images.
+    mMaskEncodings = MaskEncodings();
+
+    if (mEncodings != 0)
+    {
+        mMaskEncodings = MaskEncoding::encode(mMask, mParts, fine.outputPart.channels(), mEncodings);
+
+        if (mDenseImages == false)
+        {
+            mMask = cv::Mat();
+            mParts = cv::Mat();
+        }
+    }
 
     return true;
 }
 
-cv::Mat SegmentationDNN::GetPrediction(const std::string& pInputLayer, const std::string& pOutputLayer, const std::vector<std::int64_t>& pInput_dims, const float* pData, size_t pSize)
+std::vector<SegmentationResult> SegmentationDNN::ExecuteBatch(const std::vector<cv::Mat>& pImgs)
 {
+    std::vector<SegmentationResult> results;
+
+    if (pImgs.empty())
+    {
+        return results;
+    }
 
-    TF_Output t0 = { TF_GraphOperationByName(mData->getGraph(), pInputLayer.c_str()), 0 };
-    TF_Output t1 = { TF_GraphOperationByName(mData->getGraph(), pOutputLayer.c_str()), 0 };
+    std::vector<FrameData> frames(pImgs.size());
+    std::vector<FrameData*> framePointers;
 
-    if (t0.oper == NULL)
+    for (size_t i = 0; i < pImgs.size(); i++)
     {
-        throw SegmentationException("Failed TF_GraphOperationByName Input.");
+        Preprocess(pImgs[i], frames[i]);
+
+        if (!(frames[i].modelInputSize == frames[0].modelInputSize))
+        {
+            throw SegmentationException("All images of a batch must have the same model input size.");
+        }
+
+        framePointers.push_back(&frames[i]);
+    }
+
+    // A model fixed to a batch of one runs the images one by one without trying the batch first.
+    bool batched = (frames.size() > 1 && mFixedBatchSize != 1);
+
+    if (batched == true)
+    {
+        try
+        {
+            InferFrames(framePointers);
+        }
+        catch (const BatchSizeException&)
+        {
+            // Rejected by the runtime although the model did not fix it, the next batches skip it too.
+            mFixedBatchSize = 1;
+            batched = false;
+        }
+    }
+
+    if (batched == false)
+    {
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            Infer(frames[i]);
+        }
     }
 
-    if (t1.oper == NULL)
+    for (size_t i = 0; i < frames.size(); i++)
     {
-        throw SegmentationException("Failed TF_GraphOperationByName Output.");
+        Postprocess(frames[i]);
+        results.push_back(frames[i].result);
     }
 
-    const std::vector<TF_Output> input_ops = { t0 };
-    const std::vector<TF_Tensor*> input_tensors = { mData->CreateTensor(TF_FLOAT, pInput_dims, pData, pSize) };
+    return results;
+}
 
-    const std::vector<TF_Output> out_ops = { t1 };
-    std::vector<TF_Tensor*> output_tensors = { nullptr };
+void SegmentationDNN::Preprocess(const cv::Mat& pImg, FrameData& pFrame)
+{
+    pFrame.originalSize = ImageSize(pImg.rows, pImg.cols);
+    pFrame.outputs = mOutputs;
+    pFrame.encodings = mEncodings;
 
-    auto code = mData->Execute(input_ops, input_tensors, out_ops, output_tensors);
+    std::pair<cv::Mat, Padding> processed = mProcess->get_processed_image(pImg, pFrame.modelInputSize, &pFrame.buffers);
 
-    int64_t dim1 = TF_Dim(output_tensors[0], 1);
-    int64_t dim2 = TF_Dim(output_tensors[0], 2);
-    int64_t dim3 = TF_Dim(output_tensors[0], 3);
-    int64_t totalLenght = dim1 * dim2 * dim3;
+    pFrame.input = processed.first;
+    pFrame.padding = processed.second;
+}
 
-    auto result = mData->GetTensorData<float>(output_tensors[0]);
-    float * rawData = result.data();
+void SegmentationDNN::PreprocessBounded(const cv::Mat& pImg, int pMaxSide, FrameData& pFrame)
+{
+    pFrame.modelInputSize = mProcess->get_bounded_input_size(pImg.rows, pImg.cols, pMaxSide);
 
-    cv::Mat outputMatrix;
+    // Shrink to the scale the image will have inside the model input, keeping its aspect ratio.
+    double scale = std::min(double(pFrame.modelInputSize.mWidth) / double(pImg.cols), double(pFrame.modelInputSize.mHeight) / double(pImg.rows));
 
-    std::vector<cv::Mat> channelsList;
-    int cont = 0;
-    int64_t tSize = dim1 * dim2;
+    cv::Mat image = pImg;
 
-    for (int64_t i = 0; i < dim3; i++)
+    if (scale < 1.0)
     {
-        float* arrayTemp = new float[tSize];
-        cont = 0;
+        cv::Size size(std::max(1, int(round(pImg.cols * scale))), std::max(1, int(round(pImg.rows * scale))));
+        cv::resize(pImg, image, size, 0, 0, cv::INTER_AREA);
+    }
+
+    pFrame.originalSize = ImageSize(image.rows, image.cols);
+    pFrame.outputs = mOutputs;
+    pFrame.encodings = mEncodings;
+
+    std::pair<cv::Mat, Padding> processed = mProcess->get_processed_image_at(image, pFrame.modelInputSize, &pFrame.buffers);
+
+    pFrame.input = processed.first;
+    pFrame.padding = processed.second;
+}
+
+void SegmentationDNN::Infer(FrameData& pFrame)
+{
+    mInferFrames.assign(1, &pFrame);
+    InferFrames(mInferFrames);
+}
+
+void SegmentationDNN::InferFrames(const std::vector<FrameData*>& pFrames)
+{
+    int batch = int(pFrames.size());
+    int height = pFrames[0]->input.rows;
+    int width = pFrames[0]->input.cols;
+    int channel = pFrames[0]->input.channels();
 
-        for (int64_t j = i; j < totalLenght; j += dim3)
+    mInputDims.resize(4);
+    mInputDims[0] = batch;
+    mInputDims[1] = height;
+    mInputDims[2] = width;
+    mInputDims[3] = channel;
+
+    int64 tSize = int64(height) * width * channel;
+
+    cv::Mat batchBuffer;
+
+    if (batch == 1)
+    {
+        batchBuffer = pFrames[0]->input;
+    }
+    else
+    {
+        batchBuffer = mArena->get(SLOT_BATCH, batch, int(tSize), CV_32F);
+
+        for (int i = 0; i < batch; i++)
+        {
+            pFrames[i]->input.reshape(1, 1).copyTo(batchBuffer.row(i));
+        }
+    }
+
+    float* buffer = (float*)batchBuffer.data;
+
+    int outputs = 0;
+
+    for (int i = 0; i < batch; i++)
+    {
+        outputs |= pFrames[i]->outputs;
+    }
+
+    mLayers.resize(((outputs & OUTPUT_PARTS) != 0) ? 2 : 1);
+    mLayers[0] = LAYER_OUTPUT_MASK;
+
+    if (mLayers.size() > 1)
+    {
+        mLayers[1] = LAYER_OUTPUT_PART;
+    }
+
+    // The backend writes into the output buffers of the frames when the shapes match.
+    std::vector<std::vector<cv::Mat>>& prediction = mPrediction;
+    prediction.resize(mLayers.size());
+
+    for (size_t k = 0; k < prediction.size(); k++)
+    {
+        prediction[k].resize(batch);
+    }
+
+    for (int i = 0; i < batch; i++)
+    {
+        prediction[0][i] = pFrames[i]->buffers.slot(SLOT_OUTPUT_MASK);
+
+        if (mLayers.size() > 1)
+        {
+            prediction[1][i] = pFrames[i]->buffers.slot(SLOT_OUTPUT_PART);
+        }
+    }
+
+    mBackend->run(LAYER_INPUT, mLayers, mInputDims, buffer, sizeof(float) * tSize * batch, prediction);
+
+    for (size_t k = 0; k < prediction.size(); k++)
+    {
+        if (int(prediction[k].size()) != batch)
+        {
+            throw SegmentationException("The model output does not match the batch size.");
+        }
+    }
+
+    for (int i = 0; i < batch; i++)
+    {
+        pFrames[i]->buffers.track(SLOT_OUTPUT_MASK, prediction[0][i]);
+        pFrames[i]->outputMask = prediction[0][i];
+
+        if (prediction.size() > 1)
+        {
+            pFrames[i]->buffers.track(SLOT_OUTPUT_PART, prediction[1][i]);
+            pFrames[i]->outputPart = prediction[1][i];
+        }
+        else
+        {
+            pFrames[i]->outputPart = cv::Mat();
+        }
+    }
+
+    // Only the frames hold on to their outputs, the scratch keeps no buffer alive.
+    for (size_t k = 0; k < prediction.size(); k++)
+    {
+        for (size_t i = 0; i < prediction[k].size(); i++)
+        {
+            prediction[k][i].release();
+        }
+    }
+}
+
+void SegmentationDNN::Postprocess(FrameData& pFrame)
+{
+    DecodeFrame(pFrame, mDecodingMode);
+}
+
+void SegmentationDNN::DecodeFrame(FrameData& pFrame, DecodingMode pMode)
+{
+    ImageInferenceProcess inference(pFrame.outputMask, pFrame.outputPart, pFrame.originalSize, pFrame.modelInputSize, pFrame.padding, &pFrame.buffers);
+    inference.set_logit_domain(mLogitDecoding);
+
+    SegmentationResult result;
+
+    bool parts = ((pFrame.outputs & OUTPUT_PARTS) != 0 && !pFrame.outputPart.empty());
+    std::vector<PartStatistics>* statistics = (mStatistics == true) ? &result.statistics : NULL;
+
+    // The body comes from the mask pass, so it is there without parts or with a single-channel part output.
+    PartStatistics body;
+    PartStatistics* bodyStatistics = (mStatistics == true) ? &body : NULL;
+
+    bool dense = (mDenseImages == true || pFrame.encodings == 0);
+
+    if (pMode == DECODING_LOW_RESOLUTION)
+    {
+        if (dense == true)
+        {
+            result.mask = inference.get_Mask_low_resolution(bodyStatistics);
+
+            if (parts == true)
+            {
+                result.parts = inference.get_Parts_segmentation_low_resolution(result.mask, statistics);
+            }
+        }
+
+        if (pFrame.encodings != 0)
+        {
+            int encodings = (parts == true) ? pFrame.encodings : (pFrame.encodings & ~ENCODING_PARTS_RLE);
+
+            // The streaming encoder only pays off when the full-size images are not built anyway.
+            if (dense == true)
+            {
+                result.encodings = MaskEncoding::encode(result.mask, result.parts, pFrame.outputPart.channels(), encodings);
+            }
+            else
+            {
+                inference.get_encodings_low_resolution(encodings, result.encodings, statistics, bodyStatistics);
+            }
+        }
+    }
+    else
+    {
+        result.mask = inference.get_Mask(bodyStatistics);
+
+        if (parts == true)
         {
-            arrayTemp[cont] = rawData[j];
-            cont++;
+            result.parts = inference.get_Parts_segmentation(result.mask, statistics);
         }
-        channelsList.push_back(cv::Mat(dim1, dim2, CV_32F, arrayTemp));
+
+        if (pFrame.encodings != 0)
+        {
+            result.encodings = MaskEncoding::encode(result.mask, result.parts, pFrame.outputPart.channels(), pFrame.encodings);
+        }
+
+        if (dense == false)
+        {
+            result.mask = cv::Mat();
+            result.parts = cv::Mat();
+        }
+    }
+
+    if (mMaskProbability == true)
+    {
+        result.maskProbability = inference.get_Mask_probability();
     }
 
-    cv::merge(channelsList, outputMatrix);
+    if (mStatistics == true)
+    {
+        result.statistics.resize(std::max<size_t>(1, result.statistics.size()));
+        result.statistics[0] = body;
+    }
+
+    pFrame.result = result;
+}
+
+void SegmentationDNN::warmUp(const std::vector<cv::Size>& pImageSizes)
+{
+    std::vector<cv::Size> sizes = pImageSizes.empty() ? getInputBuckets() : pImageSizes;
+
+    // Without buckets the model input size follows each image, there is no size to guess.
+    if (sizes.empty())
+    {
+        throw SegmentationException("Nothing to warm up, give image sizes or set input buckets.");
+    }
+
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+        cv::Mat blank = cv::Mat::zeros(sizes[i].height, sizes[i].width, CV_8UC3);
+
+        // Not counted in the bucket statistics.
+        FrameData frame;
+        frame.originalSize = ImageSize(blank.rows, blank.cols);
+        frame.modelInputSize = mProcess->get_model_input_size(blank.rows, blank.cols);
+        frame.outputs = mOutputs;
+
+        std::pair<cv::Mat, Padding> processed = mProcess->get_processed_image_at(blank, frame.modelInputSize, &frame.buffers);
+        frame.input = processed.first;
+        frame.padding = processed.second;
+
+        Infer(frame);
+        Postprocess(frame);
+    }
+}
+
+cv::Size SegmentationDNN::getModelInputSize(const cv::Mat& pImg) const
+{
+    ImageSize modelInputSize = mProcess->get_model_input_size(pImg.rows, pImg.cols);
+    return cv::Size(modelInputSize.mWidth, modelInputSize.mHeight);
+}
+
+void SegmentationDNN::setInputBuckets(const std::vector<cv::Size>& pBuckets)
+{
+    std::vector<ImageSize> buckets;
+
+    for (size_t i = 0; i < pBuckets.size(); i++)
+    {
+        buckets.push_back(ImageSize(pBuckets[i].height, pBuckets[i].width));
+    }
 
-    return outputMatrix;
+    mProcess->set_input_buckets(buckets);
+}
+
+std::vector<cv::Size> SegmentationDNN::getInputBuckets() const
+{
+    std::vector<ImageSize> buckets = mProcess->get_input_buckets();
+    std::vector<cv::Size> result;
+
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        result.push_back(cv::Size(buckets[i].mWidth, buckets[i].mHeight));
+    }
+
+    return result;
+}
+
+std::vector<std::pair<cv::Size, uint64_t>> SegmentationDNN::getBucketHits() const
+{
+    std::vector<cv::Size> buckets = getInputBuckets();
+    std::vector<uint64_t> hits = mProcess->get_bucket_hits();
+    std::vector<std::pair<cv::Size, uint64_t>> result;
+
+    for (size_t i = 0; i < buckets.size() && i < hits.size(); i++)
+    {
+        result.push_back(std::make_pair(buckets[i], hits[i]));
+    }
+
+    return result;
+}
+
+void SegmentationDNN::resetBucketHits()
+{
+    mProcess->reset_bucket_hits();
+}
+
+void SegmentationDNN::setDecodingMode(DecodingMode pMode)
+{
+    mDecodingMode = pMode;
+}
+
+DecodingMode SegmentationDNN::getDecodingMode() const
+{
+    return mDecodingMode;
+}
+
+void SegmentationDNN::setLogitDecoding(bool pEnable)
+{
+    mLogitDecoding = pEnable;
+}
+
+bool SegmentationDNN::getLogitDecoding() const
+{
+    return mLogitDecoding;
+}
+
+const char* SegmentationDNN::getBackendName() const
+{
+    return mBackend->getName();
 }
 
 void SegmentationDNN::getVersion()
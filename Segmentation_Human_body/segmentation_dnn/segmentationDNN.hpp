@@ -2,29 +2,192 @@
 #define SEGMENTATION_H
 
 #include <string>
+#include <vector>
 #include<opencv2/opencv.hpp>
+#include "MaskEncoding.hpp"
+#include "PartStatistics.hpp"
 
-class PrivateData;
+class InferenceBackend;
+class ImageProcessing;
+class BufferArena;
+struct FrameData;
+
+struct SegmentationResult
+{
+    cv::Mat mask;
+    cv::Mat parts;
+    cv::Mat maskProbability;
+    // Index 0 is the whole body, index k the part labelled k * (255 / parts). Only filled with setStatistics(true).
+    std::vector<PartStatistics> statistics;
+    // Only filled with setEncodings().
+    MaskEncodings encodings;
+};
+
+enum DecodingMode
+{
+    DECODING_FULL_RESOLUTION,
+    DECODING_LOW_RESOLUTION
+};
+
+// Runtime the graph runs on. BACKEND_TFLITE expects a .tflite conversion of the model and is only available
+// when built with SEGMENTATION_WITH_TFLITE.
+enum BackendType
+{
+    BACKEND_TENSORFLOW,
+    BACKEND_OPENCV_DNN,
+    BACKEND_TFLITE
+};
+
+// Model heads to evaluate. The part labels are masked with the body mask, so OUTPUT_PARTS also runs the mask head.
+enum SegmentationOutput
+{
+    OUTPUT_MASK = 1,
+    OUTPUT_PARTS = 2,
+    OUTPUT_ALL = OUTPUT_MASK | OUTPUT_PARTS
+};
 
 class SegmentationDNN
 {
 public:
-    SegmentationDNN(const std::string& pModelPB);
-    
+    SegmentationDNN(const std::string& pModelPB, BackendType pBackend = BACKEND_TENSORFLOW);
+
+    // Runs the graph on a backend that is already initialized, for runtimes not wrapped here and for tests.
+    // Takes ownership of pBackend.
+    explicit SegmentationDNN(InferenceBackend* pBackend);
+
     ~SegmentationDNN();
 
+    // Intermediate images and results are kept between calls, so the Mats returned by getBodyMask(),
+    // getBodyParts() and getBodyMaskProbability() are overwritten by the next Execute. Clone them to keep them.
     bool Execute(const cv::Mat& pImg);
 
+    // Two passes for very large images: a mask pass with the longer model input side at most pCoarseSide
+    // finds the person, then a second pass runs on the person crop with the longer side at most
+    // pFineSide. Only the crop is upsampled, so memory and latency do not grow with the image size.
+    bool ExecuteCoarseToFine(const cv::Mat& pImg, int pCoarseSide = 257, int pFineSide = 513);
+
+    // All images must map to the same model input size (see getModelInputSize). They run as one batch, or
+    // one at a time when the model input has a fixed batch of one or the runtime rejected a batch before.
+    std::vector<SegmentationResult> ExecuteBatch(const std::vector<cv::Mat>& pImgs);
+
+    cv::Size getModelInputSize(const cv::Mat& pImg) const;
+
+    // Runs a blank image of every size through the whole pipeline so that graph optimization and buffer
+    // allocation happen before the first real request. With no sizes, warms up every input bucket, and
+    // throws SegmentationException when there are no buckets either.
+    void warmUp(const std::vector<cv::Size>& pImageSizes = std::vector<cv::Size>());
+
+    // The three stages of Execute, for callers that overlap consecutive frames. Each stage only writes
+    // into pFrame, so different frames can be in different stages on different threads. Infer reuses the
+    // segmenter's scratch vectors and the backend, so only one thread may be in it at a time.
+    void Preprocess(const cv::Mat& pImg, FrameData& pFrame);
+
+    void Infer(FrameData& pFrame);
+
+    void Postprocess(FrameData& pFrame);
+
+    // Maps every image to the closest of these model input sizes (snapped to the network stride) so that
+    // mixed-size workloads only produce a few distinct graph shapes. An empty list restores per-image sizes.
+    void setInputBuckets(const std::vector<cv::Size>& pBuckets);
+
+    // Number of images that were processed with each bucket, in the same order as getInputBuckets().
+    std::vector<std::pair<cv::Size, uint64_t>> getBucketHits() const;
+
+    std::vector<cv::Size> getInputBuckets() const;
+
+    void resetBucketHits();
+
+    // DECODING_LOW_RESOLUTION thresholds and takes the part argmax at heatmap resolution and only
+    // upsamples the final 8-bit images, instead of resizing every float channel to full size.
+    void setDecodingMode(DecodingMode pMode);
+
+    DecodingMode getDecodingMode() const;
+
+    // DECODING_FULL_RESOLUTION resizes the sigmoid probabilities by default. With pEnable it resizes the raw
+    // logits and thresholds them in the logit domain, skipping the sigmoid of the part channels. Faster, but
+    // pixels near the mask and part edges can differ from the default.
+    void setLogitDecoding(bool pEnable);
+
+    bool getLogitDecoding() const;
+
+    // Only the selected heads are fetched from the session, so TensorFlow prunes the rest of the graph, and
+    // only their post-processing runs. getBodyParts() is empty when OUTPUT_PARTS is not selected.
+    void setOutputs(int pOutputs);
+
+    int getOutputs() const;
+
     cv::Mat getBodyMask();
 
     cv::Mat getBodyParts();
 
+    // Soft CV_32F mask in [0, 1]. Only filled when setMaskProbability(true) was called before Execute.
+    cv::Mat getBodyMaskProbability();
+
+    void setMaskProbability(bool pEnable);
+
+    // Area, bounding box, centroid and mean confidence of the body and of every part. The body is accumulated
+    // while the mask is thresholded, so it is also filled with OUTPUT_MASK alone, and the parts while their
+    // labels are decoded. In DECODING_LOW_RESOLUTION the parts are measured on the heatmap and scaled.
+    std::vector<PartStatistics> getStatistics();
+
+    void setStatistics(bool pEnable);
+
+    // Compact outputs, MaskEncodingType flags (0 disables them). With pDenseImages false getBodyMask() and
+    // getBodyParts() stay empty, and in DECODING_LOW_RESOLUTION the full-size 8-bit images are never built:
+    // the heatmaps are upsampled a few columns at a time straight into the encoders.
+    void setEncodings(int pEncodings, bool pDenseImages = true);
+
+    int getEncodings() const;
+
+    bool getDenseImages() const;
+
+    MaskEncodings getMaskEncodings();
+
+    const char* getBackendName() const;
+
+    // Image and tensor buffers allocated by Execute and the backend since the last reset. Stays constant for
+    // a stream of same-sized images once the first one is processed. Heap use inside OpenCV, the runtime and
+    // the results (statistics, encodings) is not counted.
+    uint64_t getAllocationCount() const;
+
+    void resetAllocationCount();
+
     static void getVersion();
 
 private:
-    PrivateData* mData;
-    cv::Mat mMask, mParts;
-    cv::Mat GetPrediction(const std::string& pInputLayer, const std::string& pOutputLayer, const std::vector<std::int64_t>& pInput_dims, const float* pData, size_t pSize);
+    InferenceBackend* mBackend;
+    ImageProcessing* mProcess;
+    BufferArena* mArena;
+    FrameData* mFrame;
+    DecodingMode mDecodingMode;
+    bool mLogitDecoding;
+    bool mMaskProbability;
+    bool mStatistics;
+    int mOutputs;
+    int mEncodings;
+    bool mDenseImages;
+    // Batch the model input is fixed to, read at load; 0 when free. Set to 1 once a batch is rejected.
+    int mFixedBatchSize;
+    cv::Mat mMask, mParts, mProbability;
+    std::vector<PartStatistics> mPartStatistics;
+    MaskEncodings mMaskEncodings;
+
+    // Scratch of InferFrames, kept from one frame to the next instead of being rebuilt.
+    std::vector<FrameData*> mInferFrames;
+    std::vector<std::string> mLayers;
+    std::vector<std::int64_t> mInputDims;
+    std::vector<std::vector<cv::Mat>> mPrediction;
+
+    // Everything the constructors share but the backend.
+    void Initialize();
+
+    void InferFrames(const std::vector<FrameData*>& pFrames);
+
+    void DecodeFrame(FrameData& pFrame, DecodingMode pMode);
+
+    // Downscales pImg to the input size bounded by pMaxSide before preprocessing, so the full image is never
+    // converted to float. Results are at the size of the downscaled image.
+    void PreprocessBounded(const cv::Mat& pImg, int pMaxSide, FrameData& pFrame);
 };
 
 #endif
@@ -0,0 +1,111 @@
+#ifndef SYNTHETIC_BACKEND_H
+#define SYNTHETIC_BACKEND_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "InferenceBackend.hpp"
+
+const int SYNTHETIC_STRIDE = 16;
+const int SYNTHETIC_PARTS = 24;
+const char* const SYNTHETIC_PART_LAYER = "float_part_heatmaps";
+
+// Stand-in for the network: a pixel is the person when it is brighter than mid gray. The mask logit of every
+// output cell is taken from the input pixel at its corner, and the parts put all of the person in part 0.
+// Records what SegmentationDNN asks of it.
+class SyntheticBackend : public InferenceBackend
+{
+public:
+    struct Call
+    {
+        std::vector<std::string> layers;
+        std::vector<std::int64_t> inputDims;
+    };
+
+    explicit SyntheticBackend(int pDelayMs = 0) : mDelayMs(pDelayMs) {}
+
+    bool init(const std::string&) override
+    {
+        return true;
+    }
+
+    void run(const std::string&, const std::vector<std::string>& pOutputLayers, const std::vector<std::int64_t>& pInput_dims,
+        const float* pData, size_t, std::vector<std::vector<cv::Mat>>& pOutputs) override
+    {
+        int batch = int(pInput_dims[0]);
+        int height = int(pInput_dims[1]);
+        int width = int(pInput_dims[2]);
+        int channels = int(pInput_dims[3]);
+        int rows = (height - 1) / SYNTHETIC_STRIDE + 1;
+        int cols = (width - 1) / SYNTHETIC_STRIDE + 1;
+
+        pOutputs.resize(pOutputLayers.size());
+
+        for (size_t k = 0; k < pOutputLayers.size(); k++)
+        {
+            bool parts = pOutputLayers[k] == SYNTHETIC_PART_LAYER;
+            int outputChannels = parts ? SYNTHETIC_PARTS : 1;
+            pOutputs[k].resize(batch);
+
+            for (int b = 0; b < batch; b++)
+            {
+                cv::Mat& output = pOutputs[k][b];
+                output.create(rows, cols, CV_32FC(outputChannels));
+
+                for (int i = 0; i < rows; i++)
+                {
+                    float* row = output.ptr<float>(i);
+
+                    for (int j = 0; j < cols; j++)
+                    {
+                        const float* pixel = pData + ((int64_t(b) * height + std::min(i * SYNTHETIC_STRIDE, height - 1)) * width + std::min(j * SYNTHETIC_STRIDE, width - 1)) * channels;
+                        float logit = (pixel[0] > 0) ? 8.0f : -8.0f;
+
+                        for (int c = 0; c < outputChannels; c++)
+                        {
+                            row[j * outputChannels + c] = (c == 0) ? logit : -8.0f;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (mDelayMs > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(mDelayMs));
+        }
+
+        Call call;
+        call.layers = pOutputLayers;
+        call.inputDims = pInput_dims;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCalls.push_back(call);
+    }
+
+    const char* getName() const override
+    {
+        return "Synthetic";
+    }
+
+    std::vector<Call> getCalls() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mCalls;
+    }
+
+    void clearCalls()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCalls.clear();
+    }
+
+private:
+    int mDelayMs;
+    mutable std::mutex mMutex;
+    std::vector<Call> mCalls;
+};
+
+#endif
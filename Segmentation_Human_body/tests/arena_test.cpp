@@ -0,0 +1,124 @@
+#include <random>
+#include <vector>
+#include "BufferArena.hpp"
+#include "ImageInference.hpp"
+#include "ImageProcessing.hpp"
+#include "MaskEncoding.hpp"
+#include "TestCheck.hpp"
+
+const int PART_COUNT = 24;
+const int OUTPUT_STRIDE = 16;
+
+enum DecodingPath
+{
+    PATH_FULL_RESOLUTION,
+    PATH_LOW_RESOLUTION,
+    PATH_ENCODINGS
+};
+
+void fillRandom(cv::Mat& pImage, std::mt19937& pRandom)
+{
+    std::uniform_real_distribution<float> value(-4.0f, 4.0f);
+
+    for (int i = 0; i < pImage.rows; i++)
+    {
+        float* row = pImage.ptr<float>(i);
+
+        for (int j = 0; j < pImage.cols * pImage.channels(); j++)
+        {
+            row[j] = value(pRandom);
+        }
+    }
+}
+
+// Preprocesses and decodes one frame the way SegmentationDNN does, with the heatmaps written into the output
+// slots as a backend writes its outputs.
+void decodeFrame(ImageProcessing& pProcess, BufferArena& pArena, const cv::Mat& pImage, DecodingPath pPath, std::mt19937& pRandom)
+{
+    ImageSize modelInput;
+    std::pair<cv::Mat, Padding> processed = pProcess.get_processed_image(pImage, modelInput, &pArena);
+
+    int rows = (modelInput.mHeight - 1) / OUTPUT_STRIDE + 1;
+    int cols = (modelInput.mWidth - 1) / OUTPUT_STRIDE + 1;
+    cv::Mat& mask = pArena.get(SLOT_OUTPUT_MASK, rows, cols, CV_32FC1);
+    cv::Mat& parts = pArena.get(SLOT_OUTPUT_PART, rows, cols, CV_32FC(PART_COUNT));
+    fillRandom(mask, pRandom);
+    fillRandom(parts, pRandom);
+
+    ImageInferenceProcess inference(mask, parts, ImageSize(pImage.rows, pImage.cols), modelInput, processed.second, &pArena);
+    PartStatistics body;
+    std::vector<PartStatistics> statistics;
+
+    if (pPath == PATH_FULL_RESOLUTION)
+    {
+        cv::Mat result = inference.get_Mask(&body);
+        inference.get_Parts_segmentation(result, &statistics);
+        inference.get_Mask_probability();
+    }
+    else if (pPath == PATH_LOW_RESOLUTION)
+    {
+        cv::Mat result = inference.get_Mask_low_resolution(&body);
+        inference.get_Parts_segmentation_low_resolution(result, &statistics);
+    }
+    else
+    {
+        MaskEncodings encodings;
+        inference.get_encodings_low_resolution(ENCODING_PACKED_MASK | ENCODING_MASK_RLE | ENCODING_PARTS_RLE, encodings, &statistics, &body);
+    }
+}
+
+// After the first frame of a same-sized stream every image buffer comes from the arena.
+void sameSizedFramesAllocateOnce()
+{
+    for (int path = PATH_FULL_RESOLUTION; path <= PATH_ENCODINGS; path++)
+    {
+        ImageProcessing process;
+        BufferArena arena;
+        std::mt19937 random(path);
+        cv::Mat image(480, 640, CV_8UC3);
+
+        image.setTo(cv::Scalar(40, 90, 200));
+        decodeFrame(process, arena, image, DecodingPath(path), random);
+
+        uint64_t firstFrame = arena.getAllocationCount();
+        CHECK(firstFrame > 0);
+
+        for (int frame = 1; frame < 6; frame++)
+        {
+            image.setTo(cv::Scalar(frame * 30, 255 - frame * 20, frame * 10));
+            decodeFrame(process, arena, image, DecodingPath(path), random);
+            CHECK(arena.getAllocationCount() == firstFrame);
+        }
+    }
+}
+
+// A frame of another size reallocates, going back reallocates again.
+void sizeChangeReallocates()
+{
+    ImageProcessing process;
+    BufferArena arena;
+    std::mt19937 random(7);
+    cv::Mat landscape = cv::Mat::zeros(480, 640, CV_8UC3);
+    cv::Mat portrait = cv::Mat::zeros(640, 480, CV_8UC3);
+
+    decodeFrame(process, arena, landscape, PATH_FULL_RESOLUTION, random);
+    uint64_t firstFrame = arena.getAllocationCount();
+
+    decodeFrame(process, arena, portrait, PATH_FULL_RESOLUTION, random);
+    uint64_t secondFrame = arena.getAllocationCount();
+    CHECK(secondFrame > firstFrame);
+
+    decodeFrame(process, arena, portrait, PATH_FULL_RESOLUTION, random);
+    CHECK(arena.getAllocationCount() == secondFrame);
+
+    arena.resetAllocationCount();
+    CHECK(arena.getAllocationCount() == 0);
+}
+
+int main()
+{
+    sameSizedFramesAllocateOnce();
+    sizeChangeReallocates();
+
+    return TEST_RESULT;
+}
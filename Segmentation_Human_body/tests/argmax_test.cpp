@@ -0,0 +1,295 @@
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+#include "ArgMaxKernel.hpp"
+#include "TestCheck.hpp"
+
+// Heatmap with values drawn from a few levels, so most pixels have ties for the maximum.
+cv::Mat randomHeatmap(int pRows, int pCols, int pChannels, std::mt19937& pRandom)
+{
+    std::uniform_int_distribution<int> level(-4, 4);
+    cv::Mat heatmap(pRows, pCols, CV_32FC(pChannels));
+
+    for (int i = 0; i < pRows; i++)
+    {
+        float* row = heatmap.ptr<float>(i);
+
+        for (int j = 0; j < pCols * pChannels; j++)
+        {
+            row[j] = 0.5f * float(level(pRandom));
+        }
+    }
+
+    return heatmap;
+}
+
+cv::Mat randomMask(int pRows, int pCols, std::mt19937& pRandom)
+{
+    std::uniform_int_distribution<int> bit(0, 1);
+    cv::Mat mask(pRows, pCols, CV_8U);
+
+    for (int i = 0; i < pRows; i++)
+    {
+        for (int j = 0; j < pCols; j++)
+        {
+            mask.at<uchar>(i, j) = uchar(255 * bit(pRandom));
+        }
+    }
+
+    return mask;
+}
+
+// Reference labels with the strict '>' scan of the original decoder.
+cv::Mat referenceLabels(const cv::Mat& pHeatmap, const cv::Mat& pMask)
+{
+    int channels = pHeatmap.channels();
+    cv::Mat labels(pHeatmap.rows, pHeatmap.cols, CV_8U);
+
+    for (int i = 0; i < pHeatmap.rows; i++)
+    {
+        const float* row = pHeatmap.ptr<float>(i);
+
+        for (int j = 0; j < pHeatmap.cols; j++)
+        {
+            const float* pixel = row + j * channels;
+            int pos = 0;
+
+            for (int k = 1; k < channels; k++)
+            {
+                if (pixel[k] > pixel[pos])
+                {
+                    pos = k;
+                }
+            }
+
+            bool inside = pMask.empty() || pMask.at<uchar>(i, j) >= 128;
+            labels.at<uchar>(i, j) = inside ? uchar((pos + 1) * (255 / channels)) : 0;
+        }
+    }
+
+    return labels;
+}
+
+bool sameLabels(const cv::Mat& a, const cv::Mat& b)
+{
+    if (a.rows != b.rows || a.cols != b.cols || a.type() != b.type())
+    {
+        return false;
+    }
+
+    for (int i = 0; i < a.rows; i++)
+    {
+        for (int j = 0; j < a.cols; j++)
+        {
+            if (a.at<uchar>(i, j) != b.at<uchar>(i, j))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool sameStatistics(const std::vector<PartStatistics>& a, const std::vector<PartStatistics>& b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+
+    for (size_t k = 0; k < a.size(); k++)
+    {
+        // The stripes are merged in any order, so the sums may differ in the last bits.
+        if (a[k].area != b[k].area || !(a[k].box == b[k].box) || std::abs(a[k].centroid.x - b[k].centroid.x) > 1e-4f ||
+            std::abs(a[k].centroid.y - b[k].centroid.y) > 1e-4f || std::abs(a[k].confidence - b[k].confidence) > 1e-5f)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Every instruction set the CPU supports must match the scalar scan bit for bit, ties included. The
+// AVX-512 kernel reads the last 8 of the 24 channels with a masked load, narrower than its 16 lanes, and
+// single-column and odd-width rows exercise the row loops.
+void simdMatchesScalar()
+{
+    const ArgMaxKernel::Isa isas[] = { ArgMaxKernel::ISA_SCALAR, ArgMaxKernel::ISA_SSE, ArgMaxKernel::ISA_AVX2, ArgMaxKernel::ISA_AVX512 };
+    const int widths[] = { 1, 2, 7, 17, 33 };
+
+    std::mt19937 random(7);
+
+    for (int channels : { 24, 7 })
+    {
+        for (int width : widths)
+        {
+            cv::Mat heatmap = randomHeatmap(9, width, channels, random);
+            cv::Mat mask = randomMask(9, width, random);
+            cv::Mat body = randomHeatmap(9, width, 1, random);
+
+            cv::Mat expected = referenceLabels(heatmap, cv::Mat());
+            cv::Mat expectedMasked = referenceLabels(heatmap, mask);
+
+            ArgMaxKernel::set_isa(ArgMaxKernel::ISA_SCALAR);
+            cv::Mat scalarLabels;
+            std::vector<PartStatistics> scalarStats;
+            ArgMaxKernel::get_labels(heatmap, mask, scalarLabels, body, 0.0f, true, scalarStats);
+
+            for (ArgMaxKernel::Isa isa : isas)
+            {
+                if (ArgMaxKernel::set_isa(isa) == false)
+                {
+                    continue;
+                }
+
+                cv::Mat labels, maskedLabels, statisticsLabels;
+                std::vector<PartStatistics> stats;
+
+                ArgMaxKernel::get_labels(heatmap, cv::Mat(), labels);
+                ArgMaxKernel::get_labels(heatmap, mask, maskedLabels);
+                ArgMaxKernel::get_labels(heatmap, mask, statisticsLabels, body, 0.0f, true, stats);
+
+                CHECK(sameLabels(labels, expected));
+                CHECK(sameLabels(maskedLabels, expectedMasked));
+                CHECK(sameLabels(statisticsLabels, scalarLabels));
+                CHECK(sameStatistics(stats, scalarStats));
+            }
+        }
+    }
+}
+
+// A heatmap that is a region of a larger one has a row stride wider than its pixels.
+void simdMatchesScalarOnRegions()
+{
+    std::mt19937 random(11);
+    cv::Mat full = randomHeatmap(12, 40, 24, random);
+    cv::Mat region = full(cv::Rect(3, 2, 29, 9));
+    cv::Mat expected = referenceLabels(region, cv::Mat());
+
+    for (int isa = ArgMaxKernel::ISA_SCALAR; isa <= ArgMaxKernel::ISA_AVX512; isa++)
+    {
+        if (ArgMaxKernel::set_isa(ArgMaxKernel::Isa(isa)) == false)
+        {
+            continue;
+        }
+
+        cv::Mat labels;
+        ArgMaxKernel::get_labels(region, cv::Mat(), labels);
+        CHECK(sameLabels(labels, expected));
+    }
+}
+
+// A NaN channel compares false both ways, so the scalar scan skips it, or keeps channel 0 when that is the NaN.
+// The SIMD kernels give the same labels wherever the NaN is.
+void nanMatchesScalar()
+{
+    std::mt19937 random(13);
+    cv::Mat heatmap = randomHeatmap(4, 24, 24, random);
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+
+    // Column j has a NaN in channel j, the last row NaNs in two channels or all of them.
+    for (int j = 0; j < heatmap.cols; j++)
+    {
+        heatmap.ptr<float>(0)[j * 24 + j] = nan;
+        heatmap.ptr<float>(1)[j * 24 + (23 - j)] = nan;
+        heatmap.ptr<float>(3)[j * 24 + j] = nan;
+        heatmap.ptr<float>(3)[j * 24 + (j + 7) % 24] = nan;
+    }
+
+    for (int k = 0; k < 24; k++)
+    {
+        heatmap.ptr<float>(2)[5 * 24 + k] = nan;
+    }
+
+    cv::Mat expected = referenceLabels(heatmap, cv::Mat());
+
+    for (int isa = ArgMaxKernel::ISA_SCALAR; isa <= ArgMaxKernel::ISA_AVX512; isa++)
+    {
+        if (ArgMaxKernel::set_isa(ArgMaxKernel::Isa(isa)) == false)
+        {
+            continue;
+        }
+
+        cv::Mat labels;
+        ArgMaxKernel::get_labels(heatmap, cv::Mat(), labels);
+        CHECK(sameLabels(labels, expected));
+    }
+}
+
+// The fused mask kernel thresholds like cv::compare, and strips of one image add up to the whole image.
+void maskStatisticsInOnePass()
+{
+    std::mt19937 random(5);
+    cv::Mat values = randomHeatmap(11, 45, 1, random);
+    cv::Mat bytes;
+    values.convertTo(bytes, CV_8U, 20.0, 128.0);
+
+    cv::Mat expected, mask;
+    cv::compare(values, 0.5, expected, cv::CMP_GT);
+
+    PartStatistics body;
+    ArgMaxKernel::get_mask(values, 0.5, false, mask, body);
+    CHECK(sameLabels(mask, expected));
+
+    // Brute force statistics of the same pixels.
+    int area = 0;
+    double sumX = 0, sumY = 0, sumConfidence = 0;
+    cv::Rect box;
+
+    for (int i = 0; i < values.rows; i++)
+    {
+        for (int j = 0; j < values.cols; j++)
+        {
+            float value = values.at<float>(i, j);
+
+            if (value > 0.5f)
+            {
+                box = (area == 0) ? cv::Rect(j, i, 1, 1) : (box | cv::Rect(j, i, 1, 1));
+                area++;
+                sumX += j;
+                sumY += i;
+                sumConfidence += value;
+            }
+        }
+    }
+
+    std::vector<PartStatistics> expectedStats(1);
+    expectedStats[0].area = area;
+    expectedStats[0].box = box;
+    expectedStats[0].centroid = cv::Point2f(float(sumX / area), float(sumY / area));
+    expectedStats[0].confidence = float(sumConfidence / area);
+    CHECK(area > 0 && sameStatistics(std::vector<PartStatistics>(1, body), expectedStats));
+
+    // Strips of 8 columns in place, as the streaming encoder runs it.
+    cv::Mat expectedBytes, wholeMask;
+    PartStatistics whole, strips;
+    cv::compare(bytes, 140.0, expectedBytes, cv::CMP_GT);
+    ArgMaxKernel::get_mask(bytes, 140.0, false, wholeMask, whole);
+    CHECK(whole.area > 0 && sameLabels(wholeMask, expectedBytes));
+
+    cv::Mat stripped = bytes.clone();
+
+    for (int x = 0; x < stripped.cols; x += 8)
+    {
+        cv::Mat strip = stripped.colRange(x, std::min(x + 8, stripped.cols));
+        ArgMaxKernel::get_mask(strip, 140.0, false, strip, strips, cv::Point(x, 0));
+    }
+
+    CHECK(sameLabels(stripped, expectedBytes));
+    CHECK(sameStatistics(std::vector<PartStatistics>(1, strips), std::vector<PartStatistics>(1, whole)));
+}
+
+int main()
+{
+    std::cout << "argmax instruction sets up to " << ArgMaxKernel::get_isa_name() << std::endl;
+
+    simdMatchesScalar();
+    simdMatchesScalarOnRegions();
+    nanMatchesScalar();
+    maskStatisticsInOnePass();
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <vector>
+#include "ImageProcessing.hpp"
+#include "SyntheticBackend.hpp"
+#include "TestCheck.hpp"
+
+void sizesWithoutBuckets()
+{
+    ImageProcessing process;
+
+    // Half resolution, snapped to a multiple of the output stride plus one.
+    CHECK(process.get_model_input_size(480, 640) == ImageSize(241, 321));
+    CHECK(process.get_model_input_size(257, 257) == ImageSize(129, 129));
+    CHECK(process.get_model_input_size(500, 500) == ImageSize(241, 241));
+    CHECK(process.get_bucket_hits().empty());
+}
+
+void bucketsAreSnappedToTheStride()
+{
+    ImageProcessing process;
+    process.set_input_buckets({ ImageSize(256, 256), ImageSize(241, 321) });
+
+    std::vector<ImageSize> buckets = process.get_input_buckets();
+    CHECK(buckets.size() == 2);
+    CHECK(buckets[0] == ImageSize(257, 257));
+    CHECK(buckets[1] == ImageSize(241, 321));
+    CHECK(process.get_bucket_hits() == std::vector<uint64_t>(2, 0));
+}
+
+void imagesGoToTheClosestBucket()
+{
+    ImageProcessing process;
+    process.set_input_buckets({ ImageSize(257, 257), ImageSize(241, 321), ImageSize(321, 241) });
+
+    CHECK(process.get_model_input_size(480, 640) == ImageSize(241, 321));
+    CHECK(process.get_model_input_size(640, 480) == ImageSize(321, 241));
+    CHECK(process.get_model_input_size(500, 500) == ImageSize(257, 257));
+
+    // Only preprocessing counts.
+    CHECK(process.get_bucket_hits() == std::vector<uint64_t>(3, 0));
+}
+
+void preprocessingCountsTheBucketItUses()
+{
+    ImageProcessing process;
+    process.set_input_buckets({ ImageSize(257, 257), ImageSize(241, 321) });
+
+    cv::Mat landscape = cv::Mat::zeros(480, 640, CV_8UC3);
+    cv::Mat square = cv::Mat::zeros(500, 500, CV_8UC3);
+
+    ImageSize size;
+    std::pair<cv::Mat, Padding> processed = process.get_processed_image(landscape, size);
+    CHECK(size == ImageSize(241, 321));
+    CHECK(processed.first.rows == 241 && processed.first.cols == 321);
+
+    process.get_processed_image(landscape, size);
+    process.get_processed_image(square, size);
+    CHECK(size == ImageSize(257, 257));
+
+    std::vector<uint64_t> hits = process.get_bucket_hits();
+    CHECK(hits.size() == 2 && hits[0] == 1 && hits[1] == 2);
+
+    // A size chosen by the caller is neither replaced nor counted.
+    processed = process.get_processed_image_at(square, ImageSize(129, 129));
+    CHECK(processed.first.rows == 129 && processed.first.cols == 129);
+    CHECK(process.get_bucket_hits() == hits);
+
+    process.reset_bucket_hits();
+    CHECK(process.get_bucket_hits() == std::vector<uint64_t>(2, 0));
+}
+
+// The person found by the coarse pass is cropped from the full image, run again and pasted back where it was. The
+// model inputs of both passes stay within their bounds however large the image is. The edges of the synthetic
+// mask are off by up to two output cells of the fine pass, pTolerance in image pixels; a crop pasted at the wrong
+// place would be off by its offset.
+void coarseToFineCropsThePerson(int pRows, int pCols, const cv::Rect& pPerson, int pTolerance)
+{
+    SyntheticBackend* backend = new SyntheticBackend();
+    SegmentationDNN model(backend);
+
+    cv::Mat image = cv::Mat::zeros(pRows, pCols, CV_8UC3);
+    image(pPerson).setTo(cv::Scalar(255, 255, 255));
+
+    CHECK(model.ExecuteCoarseToFine(image, 257, 513) == true);
+
+    std::vector<SyntheticBackend::Call> calls = backend->getCalls();
+    CHECK(calls.size() == 2);
+
+    if (calls.size() != 2)
+    {
+        return;
+    }
+
+    // The coarse pass only needs the mask head.
+    CHECK(calls[0].layers.size() == 1);
+    CHECK(std::max(calls[0].inputDims[1], calls[0].inputDims[2]) <= 257);
+    CHECK(calls[1].layers.size() == 2);
+    CHECK(std::max(calls[1].inputDims[1], calls[1].inputDims[2]) <= 513);
+
+    cv::Mat mask = model.getBodyMask();
+    CHECK(mask.rows == pRows && mask.cols == pCols);
+
+    if (mask.rows != pRows || mask.cols != pCols)
+    {
+        return;
+    }
+
+    cv::Rect found = cv::boundingRect(mask);
+    CHECK(std::abs(found.x - pPerson.x) <= pTolerance && std::abs(found.y - pPerson.y) <= pTolerance);
+    CHECK(std::abs(found.x + found.width - pPerson.x - pPerson.width) <= pTolerance);
+    CHECK(std::abs(found.y + found.height - pPerson.y - pPerson.height) <= pTolerance);
+
+    cv::Mat parts = model.getBodyParts();
+    CHECK(parts.rows == pRows && parts.cols == pCols);
+    CHECK(parts.empty() == false && parts.at<uchar>(pPerson.y + pPerson.height / 2, pPerson.x + pPerson.width / 2) != 0);
+    CHECK(parts.empty() == false && parts.at<uchar>(0, 0) == 0);
+}
+
+int main()
+{
+    sizesWithoutBuckets();
+    bucketsAreSnappedToTheStride();
+    imagesGoToTheClosestBucket();
+    preprocessingCountsTheBucketItUses();
+
+    // A crop small enough to run at the default half resolution, cells of 32 pixels, and one bounded to 513,
+    // cells of about 80.
+    coarseToFineCropsThePerson(1200, 1600, cv::Rect(900, 500, 300, 400), 64);
+    coarseToFineCropsThePerson(3000, 4000, cv::Rect(1000, 300, 2000, 2400), 160);
+
+    return TEST_RESULT;
+}
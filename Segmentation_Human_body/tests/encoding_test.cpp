@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "MaskEncoding.hpp"
+#include "TestCheck.hpp"
+
+const int PART_COUNT = 24;
+const int LABEL_SCALE = 255 / PART_COUNT;
+
+bool sameImage(const cv::Mat& a, const cv::Mat& b)
+{
+    if (a.rows != b.rows || a.cols != b.cols || a.type() != b.type())
+    {
+        return false;
+    }
+
+    for (int i = 0; i < a.rows; i++)
+    {
+        for (int j = 0; j < a.cols; j++)
+        {
+            if (a.at<uchar>(i, j) != b.at<uchar>(i, j))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool sameRle(const RunLengthMask& a, const RunLengthMask& b)
+{
+    return a.rows == b.rows && a.cols == b.cols && a.counts == b.counts;
+}
+
+// A body mask and part labels inside it. Every few images only a few parts are used, so most part runs are empty.
+void randomMaskAndParts(int pRows, int pCols, int pPartsUsed, std::mt19937& pRandom, cv::Mat& pMask, cv::Mat& pParts)
+{
+    std::uniform_int_distribution<int> body(0, 2);
+    std::uniform_int_distribution<int> part(1, pPartsUsed);
+
+    pMask = cv::Mat(pRows, pCols, CV_8U);
+    pParts = cv::Mat(pRows, pCols, CV_8U);
+
+    for (int i = 0; i < pRows; i++)
+    {
+        for (int j = 0; j < pCols; j++)
+        {
+            bool inside = (body(pRandom) != 0);
+            pMask.at<uchar>(i, j) = inside ? 255 : 0;
+            pParts.at<uchar>(i, j) = inside ? uchar(part(pRandom) * LABEL_SCALE) : 0;
+        }
+    }
+}
+
+void encodingsRoundTrip()
+{
+    std::mt19937 random(3);
+    std::uniform_int_distribution<int> side(1, 21);
+
+    for (int n = 0; n < 100; n++)
+    {
+        int rows = side(random);
+        int cols = side(random);
+
+        cv::Mat mask, parts;
+        randomMaskAndParts(rows, cols, (n % 4 == 0) ? 3 : PART_COUNT, random, mask, parts);
+
+        MaskEncodings encodings = MaskEncoding::encode(mask, parts, PART_COUNT,
+            ENCODING_PACKED_MASK | ENCODING_MASK_RLE | ENCODING_PARTS_RLE);
+
+        CHECK(encodings.packedMask.stride == (cols + 7) / 8);
+        CHECK(sameImage(MaskEncoding::unpack(encodings.packedMask), mask));
+        CHECK(sameImage(MaskEncoding::decode_rle(encodings.maskRle), mask));
+        CHECK(encodings.partsRle.size() == size_t(PART_COUNT));
+        CHECK(sameImage(MaskEncoding::decode_parts_rle(encodings.partsRle), parts));
+
+        uint64_t total = 0;
+
+        for (size_t k = 0; k < encodings.maskRle.counts.size(); k++)
+        {
+            total += encodings.maskRle.counts[k];
+        }
+
+        CHECK(total == uint64_t(rows) * cols);
+
+        // The standalone encoders give the same result.
+        CHECK(sameRle(MaskEncoding::encode_rle(mask), encodings.maskRle));
+        CHECK(MaskEncoding::pack(mask).bits == encodings.packedMask.bits);
+
+        std::string coco = MaskEncoding::to_coco_string(encodings.maskRle);
+        CHECK(sameRle(MaskEncoding::from_coco_string(coco, rows, cols), encodings.maskRle));
+
+        for (int k = 0; k < PART_COUNT; k++)
+        {
+            coco = MaskEncoding::to_coco_string(encodings.partsRle[k]);
+            CHECK(sameRle(MaskEncoding::from_coco_string(coco, rows, cols), encodings.partsRle[k]));
+        }
+    }
+}
+
+// The streaming encoder fed a few columns at a time, as the low resolution decoder does, matches the
+// encoder fed the whole images.
+void stripsMatchWholeImages()
+{
+    std::mt19937 random(9);
+    const int encodingTypes = ENCODING_PACKED_MASK | ENCODING_MASK_RLE | ENCODING_PARTS_RLE;
+
+    for (int stripWidth : { 1, 3, 8, 32 })
+    {
+        cv::Mat mask, parts;
+        randomMaskAndParts(13, 45, PART_COUNT, random, mask, parts);
+
+        MaskEncodings whole = MaskEncoding::encode(mask, parts, PART_COUNT, encodingTypes);
+
+        MaskEncoder encoder(mask.rows, mask.cols, encodingTypes, PART_COUNT, LABEL_SCALE);
+
+        for (int x = 0; x < mask.cols; x += stripWidth)
+        {
+            int columns = std::min(stripWidth, mask.cols - x);
+            encoder.add_strip(mask.colRange(x, x + columns), parts.colRange(x, x + columns), x);
+        }
+
+        MaskEncodings strips;
+        encoder.finish(strips);
+
+        CHECK(strips.packedMask.bits == whole.packedMask.bits);
+        CHECK(sameRle(strips.maskRle, whole.maskRle));
+        CHECK(strips.partsRle.size() == whole.partsRle.size());
+
+        for (size_t k = 0; k < strips.partsRle.size() && k < whole.partsRle.size(); k++)
+        {
+            CHECK(sameRle(strips.partsRle[k], whole.partsRle[k]));
+        }
+    }
+}
+
+void uniformMasks()
+{
+    cv::Mat empty = cv::Mat::zeros(4, 5, CV_8U);
+    cv::Mat full(4, 5, CV_8U, cv::Scalar(255));
+
+    // Counts start with a run of 0, empty when the first pixel is set.
+    CHECK(MaskEncoding::encode_rle(empty).counts == std::vector<uint32_t>(1, 20));
+    CHECK(MaskEncoding::encode_rle(full).counts == std::vector<uint32_t>({ 0, 20 }));
+
+    // Labels of another type than CV_8U, such as a single-channel part probability, are not encoded.
+    MaskEncodings encodings = MaskEncoding::encode(full, cv::Mat(4, 5, CV_32F, cv::Scalar(0.5)), 1, ENCODING_MASK_RLE | ENCODING_PARTS_RLE);
+    CHECK(encodings.partsRle.empty());
+    CHECK(encodings.maskRle.counts == std::vector<uint32_t>({ 0, 20 }));
+}
+
+// Strings worked out by hand with the pycocotools algorithm: counts from the third on are stored as the
+// difference with the count two places before, 5 bits per character with a continuation bit.
+void cocoStrings()
+{
+    RunLengthMask simple;
+    simple.rows = 2;
+    simple.cols = 3;
+    simple.counts = { 2, 3, 1 };
+    CHECK(MaskEncoding::to_coco_string(simple) == "231");
+
+    RunLengthMask deltas;
+    deltas.rows = 2;
+    deltas.cols = 23;
+    deltas.counts = { 1, 40, 3, 2 };
+    CHECK(MaskEncoding::to_coco_string(deltas) == "1X13jN");
+    CHECK(sameRle(MaskEncoding::from_coco_string("1X13jN", 2, 23), deltas));
+}
+
+int main()
+{
+    encodingsRoundTrip();
+    stripsMatchWholeImages();
+    uniformMasks();
+    cocoStrings();
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,95 @@
+#include <string>
+#include <vector>
+#include "segmentationDNN.hpp"
+#include "SegmentationException.hpp"
+#include "SyntheticBackend.hpp"
+#include "TestCheck.hpp"
+
+const char* const MASK_LAYER = "float_segments";
+
+cv::Mat personImage()
+{
+    cv::Mat image = cv::Mat::zeros(240, 320, CV_8UC3);
+    image(cv::Rect(100, 40, 100, 160)).setTo(cv::Scalar(255, 255, 255));
+    return image;
+}
+
+// Mask-only runs fetch the mask head alone and skip the part decoding. The parts also need the mask head.
+void maskOnlyFetchesTheMaskHead()
+{
+    const int selections[] = { OUTPUT_MASK, OUTPUT_PARTS, OUTPUT_ALL };
+
+    for (int outputs : selections)
+    {
+        for (int mode = DECODING_FULL_RESOLUTION; mode <= DECODING_LOW_RESOLUTION; mode++)
+        {
+            SyntheticBackend* backend = new SyntheticBackend();
+            SegmentationDNN model(backend);
+            model.setOutputs(outputs);
+            model.setDecodingMode(DecodingMode(mode));
+            model.setStatistics(true);
+            CHECK(model.getOutputs() == outputs);
+
+            CHECK(model.Execute(personImage()) == true);
+
+            std::vector<SyntheticBackend::Call> calls = backend->getCalls();
+            std::vector<std::string> expected(1, MASK_LAYER);
+
+            if (outputs != OUTPUT_MASK)
+            {
+                expected.push_back(SYNTHETIC_PART_LAYER);
+            }
+
+            CHECK(calls.size() == 1 && calls[0].layers == expected);
+
+            CHECK(model.getBodyMask().empty() == false && model.getBodyMask().at<uchar>(120, 150) != 0);
+            CHECK(model.getBodyParts().empty() == (outputs == OUTPUT_MASK));
+
+            // The body is measured on the mask, the parts only when they are decoded.
+            std::vector<PartStatistics> statistics = model.getStatistics();
+            CHECK(statistics.empty() == false && statistics[0].area > 0);
+            CHECK((statistics.size() == 1) == (outputs == OUTPUT_MASK));
+
+            // A batch asks for the same heads.
+            backend->clearCalls();
+            std::vector<cv::Mat> images(2, personImage());
+            std::vector<SegmentationResult> results = model.ExecuteBatch(images);
+
+            calls = backend->getCalls();
+            CHECK(calls.size() == 1 && calls[0].layers == expected && calls[0].inputDims[0] == 2);
+            CHECK(results.size() == 2);
+
+            for (size_t i = 0; i < results.size(); i++)
+            {
+                CHECK(results[i].mask.empty() == false);
+                CHECK(results[i].parts.empty() == (outputs == OUTPUT_MASK));
+            }
+        }
+    }
+}
+
+void noOutputRejected()
+{
+    SegmentationDNN model(new SyntheticBackend());
+    bool thrown = false;
+
+    try
+    {
+        model.setOutputs(0);
+    }
+    catch (const SegmentationException&)
+    {
+        thrown = true;
+    }
+
+    CHECK(thrown == true);
+    CHECK(model.getOutputs() == OUTPUT_ALL);
+}
+
+int main()
+{
+    maskOnlyFetchesTheMaskHead();
+    noOutputRejected();
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,218 @@
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <vector>
+#include "SegmentationScheduler.hpp"
+#include "SegmentationException.hpp"
+#include "TestCheck.hpp"
+
+// Batch function that records every batch it sees and returns each image as its own mask, so a result
+// can be matched to its request.
+struct RecordingBatch
+{
+    std::mutex mutex;
+    std::vector<std::vector<cv::Size>> batches;
+
+    std::vector<SegmentationResult> run(const std::vector<cv::Mat>& pImgs)
+    {
+        std::vector<cv::Size> sizes;
+        std::vector<SegmentationResult> results(pImgs.size());
+
+        for (size_t i = 0; i < pImgs.size(); i++)
+        {
+            sizes.push_back(pImgs[i].size());
+            results[i].mask = pImgs[i];
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        batches.push_back(sizes);
+        return results;
+    }
+};
+
+cv::Mat taggedImage(int pRows, int pCols, int pTag)
+{
+    cv::Mat image(pRows, pCols, CV_8U, cv::Scalar(pTag));
+    return image;
+}
+
+void fullBatchIsRunAtOnce()
+{
+    RecordingBatch recorder;
+    SchedulerOptions options;
+    options.maxBatchSize = 4;
+    options.maxLatencyMs = 10000.0;
+
+    SegmentationScheduler scheduler([&recorder](const std::vector<cv::Mat>& pImgs) { return recorder.run(pImgs); }, options);
+
+    std::vector<std::future<SegmentationResult>> results;
+
+    for (int i = 0; i < 4; i++)
+    {
+        results.push_back(scheduler.submit(taggedImage(8, 8, i)));
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        CHECK(results[i].wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+        CHECK(results[i].get().mask.at<uchar>(0, 0) == i);
+    }
+
+    // The statistics are updated after the promises are set, stopping waits for them.
+    scheduler.stop();
+
+    SchedulerStats stats = scheduler.getStats();
+    CHECK(stats.completed == 4);
+    CHECK(stats.batches == 1);
+    CHECK(stats.meanBatchSize == 4.0);
+    CHECK(recorder.batches.size() == 1 && recorder.batches[0].size() == 4);
+}
+
+void batchesHoldOneShape()
+{
+    RecordingBatch recorder;
+    SchedulerOptions options;
+    options.maxBatchSize = 3;
+    options.maxLatencyMs = 20.0;
+
+    SegmentationScheduler scheduler([&recorder](const std::vector<cv::Mat>& pImgs) { return recorder.run(pImgs); }, options);
+
+    std::vector<std::future<SegmentationResult>> results;
+
+    for (int i = 0; i < 9; i++)
+    {
+        results.push_back(scheduler.submit((i % 2 == 0) ? taggedImage(8, 8, i) : taggedImage(4, 6, i)));
+    }
+
+    for (int i = 0; i < 9; i++)
+    {
+        CHECK(results[i].wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+        CHECK(results[i].get().mask.at<uchar>(0, 0) == i);
+    }
+
+    size_t total = 0;
+
+    for (size_t b = 0; b < recorder.batches.size(); b++)
+    {
+        CHECK(int(recorder.batches[b].size()) <= options.maxBatchSize);
+
+        for (size_t i = 0; i < recorder.batches[b].size(); i++)
+        {
+            CHECK(recorder.batches[b][i] == recorder.batches[b][0]);
+        }
+
+        total += recorder.batches[b].size();
+    }
+
+    CHECK(total == 9);
+}
+
+void partialBatchRunsAfterLatencyBudget()
+{
+    RecordingBatch recorder;
+    SchedulerOptions options;
+    options.maxBatchSize = 8;
+    options.maxLatencyMs = 5.0;
+
+    SegmentationScheduler scheduler([&recorder](const std::vector<cv::Mat>& pImgs) { return recorder.run(pImgs); }, options);
+
+    std::future<SegmentationResult> result = scheduler.submit(taggedImage(8, 8, 1));
+
+    CHECK(result.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    CHECK(recorder.batches.size() == 1 && recorder.batches[0].size() == 1);
+}
+
+void fullQueueRejects()
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool entered = false;
+    bool release = false;
+
+    // Holds the worker inside the first batch, so the queue behind it fills up.
+    auto blocking = [&](const std::vector<cv::Mat>& pImgs)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        entered = true;
+        changed.notify_all();
+        changed.wait(lock, [&] { return release; });
+        return std::vector<SegmentationResult>(pImgs.size());
+    };
+
+    SchedulerOptions options;
+    options.maxBatchSize = 1;
+    options.maxQueueSize = 1;
+
+    SegmentationScheduler scheduler(blocking, options);
+
+    std::future<SegmentationResult> first = scheduler.submit(taggedImage(8, 8, 0));
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return entered; });
+    }
+
+    std::future<SegmentationResult> second, third;
+    CHECK(scheduler.trySubmit(taggedImage(8, 8, 1), second) == true);
+    CHECK(scheduler.trySubmit(taggedImage(8, 8, 2), third) == false);
+    CHECK(third.valid() == false);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+        changed.notify_all();
+    }
+
+    CHECK(first.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    CHECK(second.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+
+    scheduler.stop();
+
+    SchedulerStats stats = scheduler.getStats();
+    CHECK(stats.completed == 2);
+    CHECK(stats.rejected == 1);
+}
+
+void batchErrorsReachEveryRequest()
+{
+    SchedulerOptions options;
+    options.maxBatchSize = 2;
+    options.maxLatencyMs = 10000.0;
+
+    SegmentationScheduler scheduler([](const std::vector<cv::Mat>& pImgs)
+    {
+        // One result short.
+        return std::vector<SegmentationResult>(pImgs.size() - 1);
+    }, options);
+
+    std::future<SegmentationResult> a = scheduler.submit(taggedImage(8, 8, 0));
+    std::future<SegmentationResult> b = scheduler.submit(taggedImage(8, 8, 1));
+
+    int failed = 0;
+
+    for (std::future<SegmentationResult>* result : { &a, &b })
+    {
+        try
+        {
+            result->get();
+        }
+        catch (const SegmentationException&)
+        {
+            failed++;
+        }
+    }
+
+    CHECK(failed == 2);
+}
+
+int main()
+{
+    fullBatchIsRunAtOnce();
+    batchesHoldOneShape();
+    partialBatchRunsAfterLatencyBudget();
+    fullQueueRejects();
+    batchErrorsReachEveryRequest();
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <vector>
+#include "VideoSegmentation.hpp"
+#include "SyntheticBackend.hpp"
+#include "TestCheck.hpp"
+
+const int FRAME_WIDTH = 320;
+const int FRAME_HEIGHT = 240;
+
+// Black frame with a white person box at pBox. The first pixel carries the frame index, dark enough to stay
+// background, so a result can be matched to its frame.
+cv::Mat syntheticFrame(int64_t pIndex, const cv::Rect& pBox)
+{
+    cv::Mat frame = cv::Mat::zeros(FRAME_HEIGHT, FRAME_WIDTH, CV_8UC3);
+    frame(pBox).setTo(cv::Scalar(255, 255, 255));
+    frame.ptr<uchar>(0)[0] = uchar(pIndex % 100);
+    return frame;
+}
+
+// Frames reach the callback in order, each with its own result, while at most a pool of frames is in flight:
+// the source is never asked for more frames than have been handed back plus the pool.
+void framesArriveInOrder()
+{
+    SyntheticBackend* backend = new SyntheticBackend(2);
+    SegmentationDNN model(backend);
+
+    const int queueSize = 2;
+    const int poolSize = 2 * queueSize + 3;
+    const int frameCount = 40;
+    VideoSegmentation video(model, queueSize);
+
+    int64_t produced = 0;
+    int64_t delivered = 0;
+    int64_t maxInFlight = 0;
+    std::set<const uchar*> buffers;
+
+    VideoSegmentation::FrameSource source = [&](cv::Mat& pFrame)
+    {
+        if (produced == frameCount)
+        {
+            return false;
+        }
+
+        maxInFlight = std::max(maxInFlight, produced - delivered + 1);
+        syntheticFrame(produced, cv::Rect(40 + int(produced), 60, 80, 120)).copyTo(pFrame);
+        produced++;
+        return true;
+    };
+
+    VideoStats stats = video.run(source, [&](int64_t pIndex, const cv::Mat& pFrame, const SegmentationResult& pResult)
+    {
+        CHECK(pIndex == delivered);
+        CHECK(pFrame.ptr<uchar>(0)[0] == uchar(pIndex % 100));
+        CHECK(pResult.mask.rows == FRAME_HEIGHT && pResult.mask.cols == FRAME_WIDTH);
+        CHECK(pResult.mask.empty() == false && pResult.mask.at<uchar>(120, 80 + int(pIndex)) != 0);
+        CHECK(pResult.mask.empty() == false && pResult.mask.at<uchar>(200, 280) == 0);
+
+        buffers.insert(pFrame.data);
+        delivered++;
+    });
+
+    CHECK(delivered == frameCount);
+    CHECK(maxInFlight <= poolSize);
+    CHECK(int(buffers.size()) <= poolSize);
+    CHECK(int(backend->getCalls().size()) == frameCount);
+
+    CHECK(stats.frames == uint64_t(frameCount));
+    CHECK(stats.seconds > 0);
+    CHECK(std::abs(stats.fps - stats.frames / stats.seconds) <= 1e-9 * stats.fps);
+    CHECK(stats.inferredFrames == uint64_t(frameCount) && stats.reusedFrames == 0 && stats.inferredFraction == 1.0);
+
+    // The network sleeps 2 ms a frame, so its stage is busy for at least that share of the run.
+    CHECK(stats.inferenceOccupancy >= 0.002 * frameCount / stats.seconds * 0.99 && stats.inferenceOccupancy <= 1.0);
+    CHECK(stats.preprocessOccupancy > 0 && stats.preprocessOccupancy <= 1.0);
+    CHECK(stats.postprocessOccupancy > 0 && stats.postprocessOccupancy <= 1.0);
+
+    VideoStats reported = video.getStats();
+    CHECK(reported.frames == stats.frames && reported.fps == stats.fps);
+}
+
+// Stopping from the callback ends the run after the frames already in flight, which still arrive in order.
+void stopDrainsInOrder()
+{
+    SegmentationDNN model(new SyntheticBackend());
+    VideoSegmentation video(model, 2);
+
+    int64_t produced = 0;
+    int64_t delivered = 0;
+
+    VideoStats stats = video.run([&](cv::Mat& pFrame)
+    {
+        syntheticFrame(produced++, cv::Rect(40, 60, 80, 120)).copyTo(pFrame);
+        return true;
+    }, [&](int64_t pIndex, const cv::Mat&, const SegmentationResult&)
+    {
+        CHECK(pIndex == delivered);
+        delivered++;
+
+        if (pIndex == 5)
+        {
+            video.stop();
+        }
+    });
+
+    CHECK(delivered >= 6 && delivered <= produced);
+    CHECK(stats.frames == uint64_t(delivered));
+}
+
+// Runs a box moving pStep pixels a frame with the temporal options. pCalls is the number of network runs.
+VideoStats runTemporal(const TemporalOptions& pOptions, int pFrameCount, int pStep, int& pCalls)
+{
+    SyntheticBackend* backend = new SyntheticBackend();
+    SegmentationDNN model(backend);
+    VideoSegmentation video(model, 2);
+    video.setTemporalOptions(pOptions);
+
+    int64_t produced = 0;
+
+    VideoStats stats = video.run([&](cv::Mat& pFrame)
+    {
+        if (produced == pFrameCount)
+        {
+            return false;
+        }
+
+        syntheticFrame(0, cv::Rect(20 + pStep * int(produced), 60, 80, 120)).copyTo(pFrame);
+        produced++;
+        return true;
+    }, [&](int64_t pIndex, const cv::Mat&, const SegmentationResult& pResult)
+    {
+        // Reused results are the keyframe ones, still on the box when it does not move.
+        CHECK(pResult.mask.empty() == false && pResult.mask.at<uchar>(120, 60 + pStep * int(pIndex)) != 0);
+    });
+
+    pCalls = int(backend->getCalls().size());
+    return stats;
+}
+
+// A still scene runs the network on a keyframe and reuses it for the next keyframeInterval frames, so one frame
+// in keyframeInterval + 1 is inferred. A moving one runs it on every frame.
+void temporalReuse()
+{
+    TemporalOptions options;
+    options.enabled = true;
+    options.keyframeInterval = 4;
+    options.warp = false;
+
+    int calls = 0;
+
+    VideoStats still = runTemporal(options, 20, 0, calls);
+    CHECK(still.frames == 20);
+    CHECK(still.inferredFrames == 4 && still.reusedFrames == 16);
+    CHECK(still.inferredFraction == 0.2);
+    CHECK(calls == 4);
+
+    options.keyframeInterval = 1;
+    still = runTemporal(options, 20, 0, calls);
+    CHECK(still.inferredFrames == 10 && still.reusedFrames == 10 && calls == 10);
+    CHECK(still.inferredFraction == 0.5);
+
+    // 20 pixels a frame changes far more than the threshold.
+    options.keyframeInterval = 4;
+    VideoStats moving = runTemporal(options, 10, 20, calls);
+    CHECK(moving.frames == 10);
+    CHECK(moving.inferredFrames == 10 && moving.reusedFrames == 0);
+    CHECK(moving.inferredFraction == 1.0);
+    CHECK(calls == 10);
+
+    // Without the temporal mode every frame runs.
+    options.enabled = false;
+    VideoStats disabled = runTemporal(options, 10, 0, calls);
+    CHECK(disabled.inferredFrames == 10 && disabled.reusedFrames == 0 && calls == 10);
+}
+
+// The box of the person in frame pIndex of the tracking stream, empty while the person is away.
+cv::Rect trackedBox(int64_t pIndex)
+{
+    if (pIndex < 30)
+    {
+        return cv::Rect(40 + 2 * int(pIndex), 60, 60, 90);
+    }
+
+    if (pIndex < 40)
+    {
+        return cv::Rect();
+    }
+
+    return cv::Rect(180, 100, 60, 90);
+}
+
+// Frames after the first run on a crop around the person, with the results put back at full-frame coordinates.
+// When the person leaves, the empty crop counts as lost and the next frames run on the full frame until the person
+// is found again.
+void trackingCrops()
+{
+    SyntheticBackend* backend = new SyntheticBackend();
+    SegmentationDNN model(backend);
+    VideoSegmentation video(model, 2);
+
+    // The synthetic mask is off by up to a cell of 32 pixels, the margin keeps the person inside the crop.
+    TrackingOptions options;
+    options.enabled = true;
+    options.margin = 0.6;
+    video.setTrackingOptions(options);
+
+    const int frameCount = 60;
+    int64_t produced = 0;
+
+    VideoStats stats = video.run([&](cv::Mat& pFrame)
+    {
+        if (produced == frameCount)
+        {
+            return false;
+        }
+
+        syntheticFrame(produced, trackedBox(produced)).copyTo(pFrame);
+        produced++;
+        return true;
+    }, [&](int64_t pIndex, const cv::Mat&, const SegmentationResult& pResult)
+    {
+        cv::Rect box = trackedBox(pIndex);
+        CHECK(pResult.mask.rows == FRAME_HEIGHT && pResult.mask.cols == FRAME_WIDTH);
+
+        if (pResult.mask.empty() == true)
+        {
+            return;
+        }
+
+        cv::Rect found = cv::boundingRect(pResult.mask);
+
+        if (box.area() == 0)
+        {
+            CHECK(found.area() == 0);
+            return;
+        }
+
+        // The mask is decoded from cells of 32 pixels of the frame, in the crop as in the full frame.
+        cv::Rect near(box.x - 32, box.y - 32, box.width + 64, box.height + 64);
+        CHECK(pResult.mask.at<uchar>(box.y + box.height / 2, box.x + box.width / 2) != 0);
+        CHECK(found.area() > 0 && (found & near) == found);
+    });
+
+    // Without temporal reuse the network runs once per frame, in frame order.
+    std::vector<SyntheticBackend::Call> calls = backend->getCalls();
+    CHECK(int(calls.size()) == frameCount);
+
+    if (int(calls.size()) != frameCount)
+    {
+        return;
+    }
+
+    std::vector<bool> cropped(frameCount);
+    int croppedCount = 0;
+
+    for (int i = 0; i < frameCount; i++)
+    {
+        cropped[i] = calls[i].inputDims[2] < calls[0].inputDims[2];
+        croppedCount += cropped[i] ? 1 : 0;
+    }
+
+    CHECK(cropped[0] == false);
+    CHECK(std::count(cropped.begin() + 1, cropped.begin() + 30, true) >= 20);
+    CHECK(cropped[37] == false && cropped[38] == false && cropped[39] == false);
+    CHECK(std::count(cropped.begin() + 40, cropped.end(), true) >= 10);
+
+    CHECK(stats.trackedFrames == uint64_t(croppedCount));
+    CHECK(stats.trackingLost == 1);
+}
+
+int main()
+{
+    framesArriveInOrder();
+    stopDrainsInOrder();
+    temporalReuse();
+    trackingCrops();
+
+    return TEST_RESULT;
+}